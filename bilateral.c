@@ -0,0 +1,293 @@
+#include "pgm.h"
+#include <omp.h>
+
+// Empty cells around the grid so the 5 tap blur never reads outside of it
+#define GRID_PAD 2
+
+// Most grid cells per image pixel, smaller sigmas make a grid that costs more than filtering every pixel directly
+#define GRID_MAX_CELLS 32
+
+// Bilateral grid, each cell holds the sum of the splatted values and their count
+// The grid is never held whole: a plane is one grid row, width x depth cells, and every thread streams the planes
+// of its band of output rows through a ring
+
+typedef struct
+{
+    int width;
+    int height;
+    int depth;
+} bilateral_grid;
+
+#define GRID_PLANE_FLOATS(grid) (2 * (size_t)(grid)->width * (grid)->depth)
+#define GRID_CELL(grid, plane, x, z) ((plane) + 2 * ((ptrdiff_t)(x) * (grid)->depth + (z)))
+
+/**
+ * @brief Blur the grid with the binomial kernel [1 4 6 4 1] / 16 along one axis
+ *        The kernel has variance 1, so one cell of the grid stays one sigma of the filter
+ *        step is the distance between neighbour cells along the axis in floats, count the number of cells on it
+ *        line is scratch of 2 * count floats
+ * 
+ * @param data 
+ * @param step 
+ * @param count 
+ * @param line 
+ */
+static void grid_blur_line(float *data, ptrdiff_t step, int count, float *line)
+{
+    for (int n = 0; n < count; n++)
+    {
+        line[2 * n] = data[n * step];
+        line[2 * n + 1] = data[n * step + 1];
+    }
+
+    for (int n = 2; n < count - 2; n++)
+    {
+        const float *c = line + 2 * n;
+        data[n * step] = (c[-4] + 4 * c[-2] + 6 * c[0] + 4 * c[2] + c[4]) * (1.0f / 16);
+        data[n * step + 1] = (c[-3] + 4 * c[-1] + 6 * c[1] + 4 * c[3] + c[5]) * (1.0f / 16);
+    }
+}
+
+/**
+ * @brief Blur count contiguous rows of length floats with [1 4 6 4 1] / 16 across the rows, in place
+ *        Every output row is one vector pass over 5 rows, the 2 rows above it that are already overwritten
+ *          are kept in history, 2 * length floats
+ *        The first and last 2 rows are left as they are, like the ends of grid_blur_line()
+ * 
+ * @param data 
+ * @param length 
+ * @param count 
+ * @param history 
+ */
+static void grid_blur_rows(float *data, int length, int count, float *history)
+{
+    if (count < 5)
+    {
+        return;
+    }
+
+    memcpy(history, data, 2 * length * sizeof(float));
+    for (int n = 2; n < count - 2; n++)
+    {
+        // Row n - 2 is in history slot n % 2, row n - 1 in the other
+        float *older = history + (n % 2) * length, *old = history + ((n + 1) % 2) * length;
+        float *row = data + (ptrdiff_t)n * length;
+        const float *next = row + length, *last = row + 2 * length;
+
+#pragma omp simd
+        for (int e = 0; e < length; e++)
+        {
+            float center = row[e];
+
+            row[e] = (older[e] + 4 * old[e] + 6 * center + 4 * next[e] + last[e]) * (1.0f / 16);
+            older[e] = center;
+        }
+    }
+}
+
+/**
+ * @brief Splat the pixels of grid row gy into plane and blur the plane along x and the range axis
+ *        Pixel row i lands in grid row (int)(i * spatial + 0.5), so grid rows never share pixel rows
+ *        The padding rows of the grid stay empty
+ * 
+ * @param src 
+ * @param grid 
+ * @param gy 
+ * @param sigma_spatial 
+ * @param spatial 1 / sigma_spatial
+ * @param range 1 / sigma_range
+ * @param plane 
+ * @param scratch 4 * depth floats
+ */
+static void grid_splat_row(const PGM_view *src, const bilateral_grid *grid, int gy, double sigma_spatial, float spatial, float range,
+                           float *plane, float *scratch)
+{
+    int first = (int)ceil((gy - GRID_PAD - 0.5) * sigma_spatial);
+    int last = (int)ceil((gy - GRID_PAD + 0.5) * sigma_spatial);
+
+    memset(plane, 0, GRID_PLANE_FLOATS(grid) * sizeof(float));
+    if (gy < GRID_PAD || gy >= grid->height - GRID_PAD)
+    {
+        return;
+    }
+
+    for (int i = first < 1 ? 0 : first - 1; i <= last && i < src->height; i++)
+    {
+        const unsigned char *row = PGM_VIEW_ROW(src, unsigned char, i);
+        if ((int)(i * spatial + 0.5f) + GRID_PAD != gy)
+        {
+            continue;
+        }
+
+        for (int j = 0; j < src->width; j++)
+        {
+            float *cell = GRID_CELL(grid, plane, (int)(j * spatial + 0.5f) + GRID_PAD, (int)(row[j] * range + 0.5f) + GRID_PAD);
+            cell[0] += row[j];
+            cell[1] += 1;
+        }
+    }
+
+    for (int x = 0; x < grid->width; x++)
+    {
+        grid_blur_line(GRID_CELL(grid, plane, x, 0), 2, grid->depth, scratch);
+    }
+    grid_blur_rows(plane, 2 * grid->depth, grid->width, scratch);
+}
+
+/**
+ * @brief Apply bilateral filter to the image and return the filtered image
+ *        See filter_bilateral_view()
+ * 
+ * @param img 
+ * @param sigma_spatial 
+ * @param sigma_range 
+ * @param padding 
+ * @return PGM* 
+ */
+PGM *filter_bilateral(PGM *img, double sigma_spatial, double sigma_range, char *padding)
+{
+    int size = gaussian_filter_size(sigma_spatial);
+    PGM *filtered = filter_create_output(img, size, size, padding);
+    PGM_view src = pgm_view_of(img);
+    PGM_view dst = pgm_view_of(filtered);
+
+    filter_bilateral_view(&src, &dst, sigma_spatial, sigma_range, padding);
+    return filtered;
+}
+
+/**
+ * @brief Apply edge preserving bilateral filter to src and write the result to dst
+ *        Bilateral grid approximation (Paris and Durand 2006, Chen, Paris and Durand 2007):
+ *          every pixel is added to the cell (x / sigma_spatial, y / sigma_spatial, value / sigma_range)
+ *          of a coarse 3D grid, the grid is blurred with a Gaussian of one cell, and the output is the
+ *          trilinear interpolation of the blurred sums divided by the blurred counts at the same place
+ *        Splat and slice are linear in the number of pixels, the grid gets smaller as the sigmas grow
+ *          so the cost does not go up with sigma_spatial
+ *        The grid is streamed one row of cells at a time: every thread splats, blurs and slices the grid rows
+ *          of its band of output rows through a ring of 7 planes, so memory is 7 planes per thread whatever the
+ *          image height, and the blur along y is a vector pass over whole planes
+ *        Grids of more than GRID_MAX_CELLS cells per pixel are refused, sigmas that small are cheaper filtered
+ *          directly
+ *        Output size follows the rules of filter_gaussian_view(), with padding "yes" the border is filtered too
+ * 
+ * @param src 
+ * @param dst 
+ * @param sigma_spatial in pixels, at least 1
+ * @param sigma_range in gray levels, at least 1
+ * @param padding 
+ */
+void filter_bilateral_view(const PGM_view *src, const PGM_view *dst, double sigma_spatial, double sigma_range, char *padding)
+{
+    int size = gaussian_filter_size(sigma_spatial);
+    int offset = strcmp(padding, "yes") == 0 ? 0 : size / 2;
+    float spatial = (float)(1 / sigma_spatial);
+    float range = (float)(1 / sigma_range);
+    bilateral_grid grid;
+
+    if (!(sigma_spatial >= 1) || !(sigma_range >= 1))
+    {
+        fprintf(stderr, "Error: filter_bilateral() sigmas must be at least 1\n");
+        exit(EXIT_FAILURE);
+    }
+
+    filter_prepare_output(src, dst, size, padding, "filter_bilateral");
+
+    grid.width = (int)((src->width - 1) * spatial + 0.5f) + 1 + 2 * GRID_PAD;
+    grid.height = (int)((src->height - 1) * spatial + 0.5f) + 1 + 2 * GRID_PAD;
+    grid.depth = (int)(255 * range + 0.5f) + 1 + 2 * GRID_PAD;
+    if ((double)grid.width * grid.height * grid.depth > (double)GRID_MAX_CELLS * src->width * src->height + 4096)
+    {
+        fprintf(stderr, "Error: filter_bilateral() grid of %dx%dx%d cells is too large for the image, use larger sigmas\n",
+                grid.width, grid.height, grid.depth);
+        exit(EXIT_FAILURE);
+    }
+
+    // Every thread slices a band of output rows from the grid rows y0 .. y1 its rows fall between,
+    // those are blurred from the splatted rows y0 - 2 .. y1 + 2, so neighbour bands splat 4 rows twice
+#pragma omp parallel
+    {
+        int t = omp_get_thread_num(), teams = omp_get_num_threads();
+        int i0 = (int)((long long)dst->height * t / teams), i1 = (int)((long long)dst->height * (t + 1) / teams);
+        size_t plane_size = GRID_PLANE_FLOATS(&grid);
+        // 5 splatted planes around the grid row being blurred along y, then the 2 blurred planes a pixel row slices
+        float *planes = (float *)malloc(7 * plane_size * sizeof(float));
+        float *scratch = (float *)malloc(4 * (size_t)grid.depth * sizeof(float));
+        if (planes == NULL || scratch == NULL)
+        {
+            fprintf(stderr, "Error: filter_bilateral() failed to allocate memory for the grid\n");
+            exit(EXIT_FAILURE);
+        }
+
+        if (i0 < i1)
+        {
+            int y0 = (int)((i0 + offset) * spatial + GRID_PAD), y1 = (int)((i1 - 1 + offset) * spatial + GRID_PAD) + 1;
+            int splatted = y0 - 3, i = i0;
+
+            for (int gy = y0; gy <= y1; gy++)
+            {
+                float *blurred = planes + (5 + gy % 2) * plane_size;
+                const float *splat[5];
+
+                for (; splatted < gy + 2; splatted++)
+                {
+                    if (splatted + 1 >= 0 && splatted + 1 < grid.height)
+                    {
+                        grid_splat_row(src, &grid, splatted + 1, sigma_spatial, spatial, range, planes + (splatted + 1) % 5 * plane_size,
+                                       scratch);
+                    }
+                }
+
+                if (gy < 2 || gy >= grid.height - 2)
+                {
+                    // Padding rows are left unblurred like the ends of every other axis, and they are empty
+                    memset(blurred, 0, plane_size * sizeof(float));
+                }
+                else
+                {
+                    for (int k = 0; k < 5; k++)
+                    {
+                        splat[k] = planes + (gy - 2 + k) % 5 * plane_size;
+                    }
+#pragma omp simd
+                    for (size_t e = 0; e < plane_size; e++)
+                    {
+                        blurred[e] = (splat[0][e] + 4 * splat[1][e] + 6 * splat[2][e] + 4 * splat[3][e] + splat[4][e]) * (1.0f / 16);
+                    }
+                }
+
+                // Pixel rows between this grid row and the one above are sliced now that both are blurred
+                for (; i < i1 && (int)((i + offset) * spatial + GRID_PAD) == gy - 1; i++)
+                {
+                    const unsigned char *row = PGM_VIEW_ROW(src, unsigned char, i + offset);
+                    unsigned char *out = PGM_VIEW_ROW(dst, unsigned char, i);
+                    const float *above = planes + (5 + (gy - 1) % 2) * plane_size;
+                    float fy = (i + offset) * spatial + GRID_PAD - (gy - 1);
+
+                    for (int j = 0; j < dst->width; j++)
+                    {
+                        float gx = (j + offset) * spatial + GRID_PAD;
+                        float gz = row[j + offset] * range + GRID_PAD;
+                        int x0 = (int)gx, z0 = (int)gz;
+                        float fx = gx - x0, fz = gz - z0;
+                        float sum = 0, weight = 0;
+
+                        for (int c = 0; c < 8; c++)
+                        {
+                            int dx = c & 1, dy = (c >> 1) & 1, dz = c >> 2;
+                            float w = (dx ? fx : 1 - fx) * (dy ? fy : 1 - fy) * (dz ? fz : 1 - fz);
+                            const float *cell = GRID_CELL(&grid, dy ? blurred : above, x0 + dx, z0 + dz);
+                            sum += w * cell[0];
+                            weight += w * cell[1];
+                        }
+
+                        float value = weight > 0 ? sum / weight + 0.5f : row[j + offset];
+                        out[j] = value >= 255 ? 255 : (unsigned char)value;
+                    }
+                }
+            }
+        }
+
+        free(planes);
+        free(scratch);
+    }
+}
@@ -0,0 +1,409 @@
+#include "pgm.h"
+
+// Rows per tile of the gradient pass and per band of the hysteresis
+#define CANNY_BAND 64
+
+// Classes of the edge map, EDGE marks pixels reached by the hysteresis
+#define CANNY_NONE 0
+#define CANNY_WEAK 1
+#define CANNY_STRONG 2
+#define CANNY_EDGE 255
+
+// Growable stack of pixel offsets for the hysteresis flood fill
+
+typedef struct
+{
+    ptrdiff_t *items;
+    size_t size;
+    size_t capacity;
+} canny_stack;
+
+/**
+ * @brief Push a pixel offset on the stack, growing it if needed
+ * 
+ * @param stack 
+ * @param item 
+ */
+static void canny_push(canny_stack *stack, ptrdiff_t item)
+{
+    if (stack->size == stack->capacity)
+    {
+        stack->capacity = stack->capacity ? 2 * stack->capacity : 1024;
+        stack->items = (ptrdiff_t *)realloc(stack->items, stack->capacity * sizeof(ptrdiff_t));
+        if (stack->items == NULL)
+        {
+            fprintf(stderr, "Error: filter_canny() failed to allocate memory for the hysteresis\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    stack->items[stack->size++] = item;
+}
+
+/**
+ * @brief Sobel gradients and squared magnitude of one image row
+ *        Row y of the image, columns 1 .. width - 2, the first and last column get 0
+ * 
+ * @param image 
+ * @param stride 
+ * @param width 
+ * @param y 
+ * @param gx may be NULL if only the magnitude is needed
+ * @param gy may be NULL if only the magnitude is needed
+ * @param magnitude 
+ */
+static void canny_gradient_row(const unsigned char *image, ptrdiff_t stride, int width, int y,
+                               int *gx, int *gy, int *magnitude)
+{
+    const unsigned char *r0 = image + (y - 1) * stride;
+    const unsigned char *r1 = image + y * stride;
+    const unsigned char *r2 = image + (y + 1) * stride;
+
+    magnitude[0] = 0;
+    magnitude[width - 1] = 0;
+
+#pragma omp simd
+    for (int x = 1; x < width - 1; x++)
+    {
+        int dx = (r0[x + 1] - r0[x - 1]) + 2 * (r1[x + 1] - r1[x - 1]) + (r2[x + 1] - r2[x - 1]);
+        int dy = (r2[x - 1] + 2 * r2[x] + r2[x + 1]) - (r0[x - 1] + 2 * r0[x] + r0[x + 1]);
+        magnitude[x] = dx * dx + dy * dy;
+        if (gx != NULL)
+        {
+            gx[x] = dx;
+            gy[x] = dy;
+        }
+    }
+}
+
+/**
+ * @brief Gradient, non-maximum suppression and double threshold for rows y0 .. y1 - 1 of the interior
+ *        Magnitudes are kept for the tile and one row above and below it only, so no full size
+ *          gradient image is ever stored
+ *        The gradient direction is quantized to 0, 45, 90 or 135 degrees with tan(22.5) and tan(67.5)
+ *          in 15 bit fixed point, a pixel is kept if it is larger than the neighbour on one side
+ *          and not smaller than the one on the other side along that direction
+ * 
+ * @param image smoothed input
+ * @param stride 
+ * @param width 
+ * @param height 
+ * @param y0 
+ * @param y1 
+ * @param low2 squared low threshold
+ * @param high2 squared high threshold
+ * @param edges edge map, rows are width bytes apart whatever the stride of image
+ * @param buffer scratch of 5 * width ints
+ * @param rows scratch of (CANNY_BAND + 2) * width ints
+ */
+static void canny_tile(const unsigned char *image, ptrdiff_t stride, int width, int height, int y0, int y1,
+                       long low2, long high2, unsigned char *edges, int *buffer, int *rows)
+{
+    const int tg22 = 13573, tg67 = 79109;
+    int *gx = buffer, *gy = buffer + width;
+
+    for (int y = y0 - 1; y <= y1; y++)
+    {
+        int *magnitude = rows + (ptrdiff_t)(y - y0 + 1) * width;
+        if (y < 1 || y > height - 2)
+        {
+            memset(magnitude, 0, width * sizeof(int));
+        }
+        else
+        {
+            canny_gradient_row(image, stride, width, y, NULL, NULL, magnitude);
+        }
+    }
+
+    for (int y = y0; y < y1; y++)
+    {
+        const int *above = rows + (ptrdiff_t)(y - y0) * width;
+        const int *current = above + width;
+        const int *below = current + width;
+        unsigned char *out = edges + (ptrdiff_t)y * width;
+
+        canny_gradient_row(image, stride, width, y, gx, gy, buffer + 2 * width);
+
+        out[0] = CANNY_NONE;
+        out[width - 1] = CANNY_NONE;
+        for (int x = 1; x < width - 1; x++)
+        {
+            int m = current[x];
+            long ax = gx[x] < 0 ? -gx[x] : gx[x];
+            long ay = gy[x] < 0 ? -gy[x] : gy[x];
+            long tg22x = ax * tg22;
+            int keep;
+
+            out[x] = CANNY_NONE;
+            if (m <= low2)
+            {
+                continue;
+            }
+
+            ay <<= 15;
+            if (ay < tg22x)
+            {
+                keep = m > current[x - 1] && m >= current[x + 1];
+            }
+            else if (ay > ax * tg67)
+            {
+                keep = m > above[x] && m >= below[x];
+            }
+            else
+            {
+                int s = (gx[x] ^ gy[x]) < 0 ? -1 : 1;
+                keep = m > above[x - s] && m >= below[x + s];
+            }
+
+            if (keep)
+            {
+                out[x] = m > high2 ? CANNY_STRONG : CANNY_WEAK;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Flood fill from the pixels on the stack to the weak and strong pixels around them
+ *        Only rows y0 .. y1 - 1 are written so bands can be filled in parallel
+ * 
+ * @param edges rows are width bytes apart
+ * @param width 
+ * @param y0 
+ * @param y1 
+ * @param stack 
+ */
+static void canny_flood(unsigned char *edges, int width, int y0, int y1, canny_stack *stack)
+{
+    while (stack->size > 0)
+    {
+        ptrdiff_t p = stack->items[--stack->size];
+        int y = (int)(p / width);
+        int x = (int)(p % width);
+
+        for (int dy = -1; dy <= 1; dy++)
+        {
+            if (y + dy < y0 || y + dy >= y1)
+            {
+                continue;
+            }
+            for (int dx = -1; dx <= 1; dx++)
+            {
+                ptrdiff_t q = p + (ptrdiff_t)dy * width + dx;
+                if (x + dx < 0 || x + dx >= width || edges[q] == CANNY_NONE || edges[q] == CANNY_EDGE)
+                {
+                    continue;
+                }
+                edges[q] = CANNY_EDGE;
+                canny_push(stack, q);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Apply Canny edge detector to the image and return the binary edge image
+ *        See filter_canny_view()
+ * 
+ * @param img 
+ * @param sigma 
+ * @param low 
+ * @param high 
+ * @param padding 
+ * @return PGM* 
+ */
+PGM *filter_canny(PGM *img, double sigma, int low, int high, char *padding)
+{
+    PGM *filtered = filter_create_output(img, 3, 3, padding);
+    PGM_view src = pgm_view_of(img);
+    PGM_view dst = pgm_view_of(filtered);
+
+    filter_canny_view(&src, &dst, sigma, low, high, padding);
+    return filtered;
+}
+
+/**
+ * @brief Apply Canny edge detector to src and write edges as 255 and the rest as 0 to dst
+ *        1. Gaussian blur with sigma, see filter_gaussian_view(), sigma 0 skips it, otherwise it must be at least 1
+ *        2. Sobel gradient, non-maximum suppression and double threshold fused in tiles of CANNY_BAND rows
+ *        3. Hysteresis: every band flood fills from its strong pixels, then the weak pixels on band
+ *             borders that touch an edge of the next band seed another round, until no band changes
+ *        The Gaussian stays a full frame pass of its own: it is the recursive filter of filter_gaussian_view(),
+ *          which runs down every whole column, so a tile cannot make its smoothed rows from a halo of a few rows.
+ *          Doing it in the tiles would take a sampled kernel, 2 * (6 sigma + 1) taps per pixel against about 16
+ *          multiply-adds, and a different result
+ *        low and high are thresholds on the Sobel gradient magnitude sqrt(gx^2 + gy^2), 0 .. 1442
+ *        Output size follows the padding rules of filter_sobel_view()
+ * 
+ * @param src 
+ * @param dst 
+ * @param sigma 
+ * @param low 
+ * @param high 
+ * @param padding 
+ */
+void filter_canny_view(const PGM_view *src, const PGM_view *dst, double sigma, int low, int high, char *padding)
+{
+    int width = src->width, height = src->height;
+    int bands = (height + CANNY_BAND - 1) / CANNY_BAND;
+    int k, changed;
+    unsigned char *smoothed = NULL, *edges;
+    const unsigned char *image = (const unsigned char *)src->data;
+    ptrdiff_t stride = width;
+    canny_stack *stacks;
+
+    if (low < 0 || high < low)
+    {
+        fprintf(stderr, "Error: filter_canny() thresholds must be 0 <= low <= high\n");
+        exit(EXIT_FAILURE);
+    }
+    if (!(sigma == 0 || sigma >= 1))
+    {
+        fprintf(stderr, "Error: filter_canny() sigma must be 0 or at least 1\n");
+        exit(EXIT_FAILURE);
+    }
+
+    k = filter_prepare_output(src, dst, 3, padding, "filter_canny");
+
+    if (sigma > 0)
+    {
+        PGM_view blurred;
+        smoothed = (unsigned char *)malloc((size_t)width * height);
+        if (smoothed == NULL)
+        {
+            fprintf(stderr, "Error: filter_canny() failed to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+        blurred = pgm_view_wrap(smoothed, width, height, width, PGM_DEPTH_8U);
+        filter_gaussian_view(src, &blurred, sigma, "yes");
+        image = smoothed;
+    }
+    else
+    {
+        stride = src->stride;
+    }
+
+    // Edge map rows are width bytes apart, the stride of the image can be padded or negative
+    edges = (unsigned char *)malloc((size_t)width * height);
+    stacks = (canny_stack *)calloc(bands, sizeof(canny_stack));
+    if (edges == NULL || stacks == NULL)
+    {
+        fprintf(stderr, "Error: filter_canny() failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(edges, CANNY_NONE, width);
+    memset(edges + (ptrdiff_t)(height - 1) * width, CANNY_NONE, width);
+
+#pragma omp parallel
+    {
+        int *buffer = (int *)malloc(5 * (size_t)width * sizeof(int));
+        int *rows = (int *)malloc((CANNY_BAND + 2) * (size_t)width * sizeof(int));
+        if (buffer == NULL || rows == NULL)
+        {
+            fprintf(stderr, "Error: filter_canny() failed to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+
+#pragma omp for schedule(static)
+        for (int b = 0; b < bands; b++)
+        {
+            int y0 = b * CANNY_BAND < 1 ? 1 : b * CANNY_BAND;
+            int y1 = (b + 1) * CANNY_BAND < height - 1 ? (b + 1) * CANNY_BAND : height - 1;
+            if (y0 < y1)
+            {
+                canny_tile(image, stride, width, height, y0, y1, (long)low * low, (long)high * high, edges, buffer, rows);
+            }
+        }
+
+#pragma omp for schedule(static)
+        for (int b = 0; b < bands; b++)
+        {
+            int y0 = b * CANNY_BAND;
+            int y1 = y0 + CANNY_BAND < height ? y0 + CANNY_BAND : height;
+            for (int y = y0; y < y1; y++)
+            {
+                for (int x = 0; x < width; x++)
+                {
+                    ptrdiff_t p = (ptrdiff_t)y * width + x;
+                    if (edges[p] == CANNY_STRONG)
+                    {
+                        edges[p] = CANNY_EDGE;
+                        canny_push(&stacks[b], p);
+                    }
+                }
+            }
+            canny_flood(edges, width, y0, y1, &stacks[b]);
+        }
+
+        free(buffer);
+        free(rows);
+    }
+
+    // Edges that cross band borders, seeds are collected read-only and flooded in a second step
+    do
+    {
+        changed = 0;
+
+#pragma omp parallel for schedule(static) reduction(| : changed)
+        for (int b = 0; b < bands; b++)
+        {
+            int y0 = b * CANNY_BAND;
+            int y1 = y0 + CANNY_BAND < height ? y0 + CANNY_BAND : height;
+            int border[2] = {y0, y1 - 1};
+            int other[2] = {y0 - 1, y1};
+
+            for (int e = 0; e < 2; e++)
+            {
+                if (other[e] < 0 || other[e] >= height)
+                {
+                    continue;
+                }
+                const unsigned char *row = edges + (ptrdiff_t)border[e] * width;
+                const unsigned char *next = edges + (ptrdiff_t)other[e] * width;
+                for (int x = 0; x < width; x++)
+                {
+                    if (row[x] != CANNY_WEAK)
+                    {
+                        continue;
+                    }
+                    if (next[x] == CANNY_EDGE || (x > 0 && next[x - 1] == CANNY_EDGE) ||
+                        (x < width - 1 && next[x + 1] == CANNY_EDGE))
+                    {
+                        canny_push(&stacks[b], (ptrdiff_t)border[e] * width + x);
+                        changed = 1;
+                    }
+                }
+            }
+        }
+
+#pragma omp parallel for schedule(static)
+        for (int b = 0; b < bands; b++)
+        {
+            int y0 = b * CANNY_BAND;
+            int y1 = y0 + CANNY_BAND < height ? y0 + CANNY_BAND : height;
+            for (size_t s = 0; s < stacks[b].size; s++)
+            {
+                edges[stacks[b].items[s]] = CANNY_EDGE;
+            }
+            canny_flood(edges, width, y0, y1, &stacks[b]);
+        }
+    } while (changed);
+
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < height - 2; i++)
+    {
+        const unsigned char *row = edges + (ptrdiff_t)(i + 1) * width + 1;
+        unsigned char *out = PGM_VIEW_ROW(dst, unsigned char, i + k) + k;
+        for (int j = 0; j < width - 2; j++)
+        {
+            out[j] = row[j] == CANNY_EDGE ? 255 : 0;
+        }
+    }
+
+    for (int b = 0; b < bands; b++)
+    {
+        free(stacks[b].items);
+    }
+    free(stacks);
+    free(edges);
+    free(smoothed);
+}
@@ -0,0 +1,385 @@
+#include "pgm.h"
+
+// Rows per band, bands are labeled independently and merged along their first rows
+#define LABEL_BAND 128
+
+/**
+ * @brief Find the root of a pixel in the union-find forest with path halving
+ *        Only called on pixels of the band the calling thread owns
+ * 
+ * @param parent 
+ * @param p 
+ * @return unsigned int 
+ */
+static unsigned int label_find(unsigned int *parent, unsigned int p)
+{
+    while (parent[p] != p)
+    {
+        parent[p] = parent[parent[p]];
+        p = parent[p];
+    }
+    return p;
+}
+
+/**
+ * @brief Find the root of a pixel without changing the forest, safe while other threads read it
+ * 
+ * @param parent 
+ * @param p 
+ * @return unsigned int 
+ */
+static unsigned int label_root(const unsigned int *parent, unsigned int p)
+{
+    while (parent[p] != p)
+    {
+        p = parent[p];
+    }
+    return p;
+}
+
+/**
+ * @brief Merge the sets of a and b, the smaller index becomes the root
+ *        So the root of every component is its first pixel in raster order
+ * 
+ * @param parent 
+ * @param a 
+ * @param b 
+ */
+static void label_union(unsigned int *parent, unsigned int a, unsigned int b)
+{
+    a = label_find(parent, a);
+    b = label_find(parent, b);
+    if (a < b)
+    {
+        parent[b] = a;
+    }
+    else if (b < a)
+    {
+        parent[a] = b;
+    }
+}
+
+/**
+ * @brief Add pixel (x, y) to the statistics of a component
+ * 
+ * @param component 
+ * @param x 
+ * @param y 
+ */
+static void label_add(PGM_component *component, int x, int y)
+{
+    if (component->area == 0)
+    {
+        component->left = component->right = x;
+        component->top = component->bottom = y;
+    }
+    component->area++;
+    component->left = x < component->left ? x : component->left;
+    component->right = x > component->right ? x : component->right;
+    component->top = y < component->top ? y : component->top;
+    component->bottom = y > component->bottom ? y : component->bottom;
+}
+
+/**
+ * @brief Merge the statistics of part of a component into the whole
+ * 
+ * @param component 
+ * @param part 
+ */
+static void label_merge(PGM_component *component, const PGM_component *part)
+{
+    if (part->area == 0)
+    {
+        return;
+    }
+    if (component->area == 0)
+    {
+        *component = *part;
+        return;
+    }
+    component->area += part->area;
+    component->left = part->left < component->left ? part->left : component->left;
+    component->right = part->right > component->right ? part->right : component->right;
+    component->top = part->top < component->top ? part->top : component->top;
+    component->bottom = part->bottom > component->bottom ? part->bottom : component->bottom;
+}
+
+/**
+ * @brief Label the connected components of a binary image
+ *        Every non zero pixel of src is foreground, labels gets 0 for background and 1 .. n for the components,
+ *          numbered in raster order of their first pixel
+ *        1. Bands of LABEL_BAND rows build their own union-find forests in parallel
+ *        2. Forests are joined along the first row of every band
+ *        3. Roots get their labels (each band knows its first label from a prefix sum of root counts),
+ *             then every pixel takes the label of its root and its component's area and bounding box
+ *             are updated in the same pass
+ *        Statistics of a component rooted in an earlier band go to a small per band table first and are merged
+ *          at the end, such a component always crosses the first row of the band so the table never gets longer than it
+ *        components is set to a malloc'ed array of n entries, entry i is label i + 1, pass NULL to skip it
+ * 
+ * @param src 8-bit binary image
+ * @param labels 32-bit view of the same size
+ * @param connectivity 4 or 8
+ * @param components 
+ * @return int number of components
+ */
+int label_components(const PGM_view *src, const PGM_view *labels, int connectivity, PGM_component **components)
+{
+    int width = src->width, height = src->height;
+    int bands = (height + LABEL_BAND - 1) / LABEL_BAND;
+    unsigned int *parent, *first_label;
+    unsigned int **foreign;
+    PGM_component *stats, **foreign_stats;
+    int *foreign_count;
+    int count = 0;
+
+    if (src->depth != PGM_DEPTH_8U || labels->depth != PGM_DEPTH_32U)
+    {
+        fprintf(stderr, "Error: label_components() needs an 8-bit image and a 32-bit label view\n");
+        exit(EXIT_FAILURE);
+    }
+    if (labels->width != width || labels->height != height)
+    {
+        fprintf(stderr, "Error: label_components() label view is %dx%d, expected %dx%d\n", labels->width, labels->height, width, height);
+        exit(EXIT_FAILURE);
+    }
+    if (connectivity != 4 && connectivity != 8)
+    {
+        fprintf(stderr, "Error: label_components() connectivity must be 4 or 8\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if ((double)width * height >= UINT_MAX)
+    {
+        fprintf(stderr, "Error: label_components() image is too large for 32-bit labels\n");
+        exit(EXIT_FAILURE);
+    }
+
+    parent = (unsigned int *)malloc(((size_t)width * height + 1) * sizeof(unsigned int));
+    first_label = (unsigned int *)calloc(bands + 1, sizeof(unsigned int));
+    foreign = (unsigned int **)calloc(bands, sizeof(unsigned int *));
+    foreign_stats = (PGM_component **)calloc(bands, sizeof(PGM_component *));
+    foreign_count = (int *)calloc(bands, sizeof(int));
+    if (parent == NULL || first_label == NULL || foreign == NULL || foreign_stats == NULL || foreign_count == NULL)
+    {
+        fprintf(stderr, "Error: label_components() failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+#pragma omp parallel for schedule(static)
+    for (int b = 0; b < bands; b++)
+    {
+        int y0 = b * LABEL_BAND;
+        int y1 = y0 + LABEL_BAND < height ? y0 + LABEL_BAND : height;
+        unsigned int roots = 0;
+
+        for (int y = y0; y < y1; y++)
+        {
+            const unsigned char *row = PGM_VIEW_ROW(src, unsigned char, y);
+            const unsigned char *up = y > y0 ? PGM_VIEW_ROW(src, unsigned char, y - 1) : NULL;
+
+            for (int x = 0; x < width; x++)
+            {
+                unsigned int p = (unsigned int)y * width + x;
+                if (row[x] == 0)
+                {
+                    continue;
+                }
+
+                parent[p] = p;
+                if (x > 0 && row[x - 1])
+                {
+                    label_union(parent, p, p - 1);
+                }
+                if (up == NULL)
+                {
+                    continue;
+                }
+                if (up[x])
+                {
+                    label_union(parent, p, p - width);
+                }
+                if (connectivity == 8 && x > 0 && up[x - 1])
+                {
+                    label_union(parent, p, p - width - 1);
+                }
+                if (connectivity == 8 && x < width - 1 && up[x + 1])
+                {
+                    label_union(parent, p, p - width + 1);
+                }
+            }
+        }
+
+        for (int y = y0; y < y1; y++)
+        {
+            const unsigned char *row = PGM_VIEW_ROW(src, unsigned char, y);
+            for (int x = 0; x < width; x++)
+            {
+                unsigned int p = (unsigned int)y * width + x;
+                roots += row[x] && parent[p] == p;
+            }
+        }
+        first_label[b + 1] = roots;
+    }
+
+    // Joining bands touches only their first rows, it is cheap enough to do in order
+    for (int b = 1; b < bands; b++)
+    {
+        int y = b * LABEL_BAND;
+        const unsigned char *row = PGM_VIEW_ROW(src, unsigned char, y);
+        const unsigned char *up = PGM_VIEW_ROW(src, unsigned char, y - 1);
+
+        for (int x = 0; x < width; x++)
+        {
+            unsigned int p = (unsigned int)y * width + x;
+            if (row[x] == 0)
+            {
+                continue;
+            }
+            for (int dx = connectivity == 8 ? -1 : 0; dx <= (connectivity == 8 ? 1 : 0); dx++)
+            {
+                if (x + dx >= 0 && x + dx < width && up[x + dx])
+                {
+                    unsigned int a = label_find(parent, p), c = label_find(parent, p - width + dx);
+                    if (a != c)
+                    {
+                        // The band loses a root for every merge that hangs one of its roots below another
+                        first_label[(a > c ? a : c) / width / LABEL_BAND + 1]--;
+                        label_union(parent, a, c);
+                    }
+                }
+            }
+        }
+    }
+
+    for (int b = 0; b < bands; b++)
+    {
+        first_label[b + 1] += first_label[b];
+    }
+    count = (int)first_label[bands];
+
+    stats = (PGM_component *)calloc(count > 0 ? count : 1, sizeof(PGM_component));
+    if (stats == NULL)
+    {
+        fprintf(stderr, "Error: label_components() failed to allocate memory for the components\n");
+        exit(EXIT_FAILURE);
+    }
+
+#pragma omp parallel for schedule(static)
+    for (int b = 0; b < bands; b++)
+    {
+        int y0 = b * LABEL_BAND;
+        int y1 = y0 + LABEL_BAND < height ? y0 + LABEL_BAND : height;
+        unsigned int next = first_label[b] + 1;
+
+        for (int y = y0; y < y1; y++)
+        {
+            const unsigned char *row = PGM_VIEW_ROW(src, unsigned char, y);
+            unsigned int *out = PGM_VIEW_ROW(labels, unsigned int, y);
+            for (int x = 0; x < width; x++)
+            {
+                unsigned int p = (unsigned int)y * width + x;
+                out[x] = row[x] && parent[p] == p ? next++ : 0;
+            }
+        }
+    }
+
+#pragma omp parallel for schedule(static)
+    for (int b = 0; b < bands; b++)
+    {
+        int y0 = b * LABEL_BAND;
+        int y1 = y0 + LABEL_BAND < height ? y0 + LABEL_BAND : height;
+        unsigned int own = first_label[b];
+        unsigned int *seen = (unsigned int *)malloc((width + 1) * sizeof(unsigned int));
+        PGM_component *seen_stats = (PGM_component *)calloc(width + 1, sizeof(PGM_component));
+        int seen_count = 0;
+
+        if (seen == NULL || seen_stats == NULL)
+        {
+            fprintf(stderr, "Error: label_components() failed to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+
+        for (int y = y0; y < y1; y++)
+        {
+            const unsigned char *row = PGM_VIEW_ROW(src, unsigned char, y);
+            unsigned int *out = PGM_VIEW_ROW(labels, unsigned int, y);
+
+            for (int x = 0; x < width; x++)
+            {
+                unsigned int p = (unsigned int)y * width + x, root, label;
+                int low = 0, high = seen_count;
+                if (row[x] == 0)
+                {
+                    continue;
+                }
+
+                root = label_root(parent, p);
+                label = *(PGM_VIEW_ROW(labels, unsigned int, root / width) + root % width);
+                if (root != p)
+                {
+                    out[x] = label;
+                }
+
+                if (label > own)
+                {
+                    label_add(&stats[label - 1], x, y);
+                    continue;
+                }
+
+                // Sorted table of the labels of earlier bands
+                while (low < high)
+                {
+                    int mid = (low + high) / 2;
+                    if (seen[mid] < label)
+                    {
+                        low = mid + 1;
+                    }
+                    else
+                    {
+                        high = mid;
+                    }
+                }
+                if (low == seen_count || seen[low] != label)
+                {
+                    memmove(seen + low + 1, seen + low, (seen_count - low) * sizeof(unsigned int));
+                    memmove(seen_stats + low + 1, seen_stats + low, (seen_count - low) * sizeof(PGM_component));
+                    seen[low] = label;
+                    memset(&seen_stats[low], 0, sizeof(PGM_component));
+                    seen_count++;
+                }
+                label_add(&seen_stats[low], x, y);
+            }
+        }
+
+        foreign[b] = seen;
+        foreign_stats[b] = seen_stats;
+        foreign_count[b] = seen_count;
+    }
+
+    for (int b = 0; b < bands; b++)
+    {
+        for (int f = 0; f < foreign_count[b]; f++)
+        {
+            label_merge(&stats[foreign[b][f] - 1], &foreign_stats[b][f]);
+        }
+        free(foreign[b]);
+        free(foreign_stats[b]);
+    }
+
+    free(parent);
+    free(first_label);
+    free(foreign);
+    free(foreign_stats);
+    free(foreign_count);
+
+    if (components != NULL)
+    {
+        *components = stats;
+    }
+    else
+    {
+        free(stats);
+    }
+    return count;
+}
@@ -0,0 +1,348 @@
+#include "pgm.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Sub-histograms a tile is counted into, runs of equal pixels then update different counters
+#define HISTOGRAM_COPIES 4
+// Rows counted together by one thread for the global histogram
+#define EQUALIZE_BAND 64
+
+/**
+ * @brief Add the histogram of a rectangle of src to histogram
+ *        Consecutive pixels go to HISTOGRAM_COPIES private sub-histograms that are added at the end,
+ *          so flat areas do not wait on the same counter over and over
+ * 
+ * @param src 
+ * @param x0 
+ * @param y0 
+ * @param width 
+ * @param height 
+ * @param histogram 256 entries
+ */
+static void histogram_count(const PGM_view *src, int x0, int y0, int width, int height, unsigned int *histogram)
+{
+    unsigned int copies[HISTOGRAM_COPIES][256];
+
+    memset(copies, 0, sizeof(copies));
+    for (int i = y0; i < y0 + height; i++)
+    {
+        const unsigned char *row = PGM_VIEW_ROW(src, unsigned char, i) + x0;
+        int j = 0;
+        for (; j + HISTOGRAM_COPIES <= width; j += HISTOGRAM_COPIES)
+        {
+            for (int c = 0; c < HISTOGRAM_COPIES; c++)
+            {
+                copies[c][row[j + c]]++;
+            }
+        }
+        for (; j < width; j++)
+        {
+            copies[0][row[j]]++;
+        }
+    }
+
+    for (int v = 0; v < 256; v++)
+    {
+        unsigned int total = 0;
+        for (int c = 0; c < HISTOGRAM_COPIES; c++)
+        {
+            total += copies[c][v];
+        }
+        histogram[v] += total;
+    }
+}
+
+/**
+ * @brief Check that src and dst are 8-bit views of the same size
+ * 
+ * @param src 
+ * @param dst 
+ * @param caller 
+ */
+static void contrast_check(const PGM_view *src, const PGM_view *dst, const char *caller)
+{
+    if (src->depth != PGM_DEPTH_8U || dst->depth != PGM_DEPTH_8U || dst->width != src->width || dst->height != src->height)
+    {
+        fprintf(stderr, "Error: %s() needs 8-bit views of the same size\n", caller);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Equalize the histogram of the image and return the equalized image
+ *        See filter_equalize_view()
+ * 
+ * @param img 
+ * @return PGM* 
+ */
+PGM *filter_equalize(PGM *img)
+{
+    PGM *equalized = pgm_create(img->width, img->height, img->max_val, img->type);
+    PGM_view src = pgm_view_of(img);
+    PGM_view dst = pgm_view_of(equalized);
+
+    filter_equalize_view(&src, &dst);
+    return equalized;
+}
+
+/**
+ * @brief Spread the gray levels of src over 0..255 so its cumulative histogram becomes a straight line
+ *        Every thread counts its bands of EQUALIZE_BAND rows into its own histogram, they are added once at the end,
+ *          then the look-up table lut[v] = (cdf(v) - cdf(darkest)) * 255 / (pixels - cdf(darkest)) is applied to every pixel
+ * 
+ * @param src 
+ * @param dst view of the same size
+ */
+void filter_equalize_view(const PGM_view *src, const PGM_view *dst)
+{
+    unsigned long long histogram[256] = {0};
+    unsigned char lut[256];
+    unsigned long long cumulative = 0, darkest = 0, pixels = (unsigned long long)src->width * src->height;
+    int bands = (src->height + EQUALIZE_BAND - 1) / EQUALIZE_BAND;
+
+    contrast_check(src, dst, "filter_equalize");
+
+#pragma omp parallel
+    {
+        unsigned int local[256] = {0};
+
+#pragma omp for schedule(static)
+        for (int b = 0; b < bands; b++)
+        {
+            int y0 = b * EQUALIZE_BAND;
+            histogram_count(src, 0, y0, src->width, src->height - y0 < EQUALIZE_BAND ? src->height - y0 : EQUALIZE_BAND, local);
+        }
+
+#pragma omp critical
+        for (int v = 0; v < 256; v++)
+        {
+            histogram[v] += local[v];
+        }
+    }
+
+    for (int v = 0; v < 256; v++)
+    {
+        cumulative += histogram[v];
+        if (darkest == 0)
+        {
+            darkest = cumulative;
+        }
+        lut[v] = pixels == darkest ? (unsigned char)v : (unsigned char)((double)(cumulative - darkest) * 255 / (pixels - darkest) + 0.5);
+    }
+
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < src->height; i++)
+    {
+        const unsigned char *row = PGM_VIEW_ROW(src, unsigned char, i);
+        unsigned char *out = PGM_VIEW_ROW(dst, unsigned char, i);
+        for (int j = 0; j < src->width; j++)
+        {
+            out[j] = lut[row[j]];
+        }
+    }
+}
+
+/**
+ * @brief Apply contrast limited adaptive histogram equalization and return the result
+ *        See filter_clahe_view()
+ * 
+ * @param img 
+ * @param tiles_x 
+ * @param tiles_y 
+ * @param clip_limit 
+ * @return PGM* 
+ */
+PGM *filter_clahe(PGM *img, int tiles_x, int tiles_y, double clip_limit)
+{
+    PGM *equalized = pgm_create(img->width, img->height, img->max_val, img->type);
+    PGM_view src = pgm_view_of(img);
+    PGM_view dst = pgm_view_of(equalized);
+
+    filter_clahe_view(&src, &dst, tiles_x, tiles_y, clip_limit);
+    return equalized;
+}
+
+/**
+ * @brief Contrast limited adaptive histogram equalization (Zuiderveld, Graphics Gems IV, 1994)
+ *        1. src is cut in tiles_x x tiles_y tiles, every tile gets its own histogram, tiles run in parallel
+ *        2. Bins above clip_limit times the mean bin count are cut and the excess is spread over all bins,
+ *             which bounds the contrast gain, clip_limit <= 0 keeps the histograms as they are
+ *        3. Each tile's look-up table equalizes its clipped histogram
+ *        4. Every pixel blends the tables of the 4 tiles whose centers surround it, bilinearly
+ *        Step 4 is one pass over the rows: the two tile rows around a pixel row are first blended into one
+ *          16-bit table per tile column with vector code, and the entries of neighbouring tile columns are paired
+ *          into 32 bits. Each pixel then reads one pair and blends it with weights that depend only on its column,
+ *          4 pixels at a time in float with SSE2, exact since every value stays below 2^24
+ * 
+ * @param src 
+ * @param dst view of the same size
+ * @param tiles_x 
+ * @param tiles_y 
+ * @param clip_limit usually 2 .. 4
+ */
+void filter_clahe_view(const PGM_view *src, const PGM_view *dst, int tiles_x, int tiles_y, double clip_limit)
+{
+    int width = src->width, height = src->height;
+    double tile_width = (double)width / tiles_x, tile_height = (double)height / tiles_y;
+    unsigned char *luts;
+    int *column_tile;
+    float *column_weight;
+
+    contrast_check(src, dst, "filter_clahe");
+    if (tiles_x < 1 || tiles_y < 1 || tiles_x > width || tiles_y > height)
+    {
+        fprintf(stderr, "Error: filter_clahe() needs between 1 and one tile per pixel in each direction\n");
+        exit(EXIT_FAILURE);
+    }
+
+    luts = (unsigned char *)malloc((size_t)tiles_x * tiles_y * 256);
+    column_tile = (int *)malloc(width * sizeof(int));
+    column_weight = (float *)malloc(width * sizeof(float));
+    if (luts == NULL || column_tile == NULL || column_weight == NULL)
+    {
+        fprintf(stderr, "Error: filter_clahe() failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+#pragma omp parallel for collapse(2) schedule(static)
+    for (int ty = 0; ty < tiles_y; ty++)
+    {
+        for (int tx = 0; tx < tiles_x; tx++)
+        {
+            int x0 = (int)(tx * tile_width), x1 = tx == tiles_x - 1 ? width : (int)((tx + 1) * tile_width);
+            int y0 = (int)(ty * tile_height), y1 = ty == tiles_y - 1 ? height : (int)((ty + 1) * tile_height);
+            unsigned int pixels = (unsigned int)(x1 - x0) * (y1 - y0);
+            unsigned int histogram[256] = {0}, cumulative = 0;
+            unsigned char *lut = luts + ((ptrdiff_t)ty * tiles_x + tx) * 256;
+
+            histogram_count(src, x0, y0, x1 - x0, y1 - y0, histogram);
+
+            if (clip_limit > 0)
+            {
+                unsigned int limit = (unsigned int)(clip_limit * pixels / 256);
+                unsigned int excess = 0, batch, residual;
+
+                limit = limit < 1 ? 1 : limit;
+                for (int v = 0; v < 256; v++)
+                {
+                    if (histogram[v] > limit)
+                    {
+                        excess += histogram[v] - limit;
+                        histogram[v] = limit;
+                    }
+                }
+
+                batch = excess / 256;
+                residual = excess % 256;
+                for (int v = 0; v < 256; v++)
+                {
+                    histogram[v] += batch;
+                }
+                for (unsigned int v = 0, step = residual > 0 ? 256 / residual : 0; v < residual; v++)
+                {
+                    histogram[v * step]++;
+                }
+            }
+
+            for (int v = 0; v < 256; v++)
+            {
+                cumulative += histogram[v];
+                lut[v] = (unsigned char)((cumulative * 255.0) / pixels + 0.5);
+            }
+        }
+    }
+
+    // Table offset of the left tile and the weight of the right one, in 1/256, for every column
+    for (int j = 0; j < width; j++)
+    {
+        double position = (j + 0.5) / tile_width - 0.5;
+        int tile = position < 0 ? 0 : (int)position;
+        double weight = position - tile;
+
+        tile = tile > tiles_x - 1 ? tiles_x - 1 : tile;
+        weight = position < 0 || tile == tiles_x - 1 ? 0 : weight;
+        column_tile[j] = tile * 256;
+        column_weight[j] = (float)(int)(weight * 256 + 0.5);
+    }
+
+#pragma omp parallel
+    {
+        // Row tables are one entry wider so the right neighbour of the last tile column can be read
+        unsigned short *blended = (unsigned short *)malloc((size_t)(tiles_x + 1) * 256 * sizeof(unsigned short));
+        // Entry v of a tile column next to the same entry of the column to its right
+        unsigned int *pairs = (unsigned int *)malloc((size_t)tiles_x * 256 * sizeof(unsigned int));
+        if (blended == NULL || pairs == NULL)
+        {
+            fprintf(stderr, "Error: filter_clahe() failed to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+
+#pragma omp for schedule(static)
+        for (int i = 0; i < height; i++)
+        {
+            double position = (i + 0.5) / tile_height - 0.5;
+            int top = position < 0 ? 0 : (int)position;
+            int bottom, weight_bottom, weight_top, j = 0;
+            const unsigned char *upper, *lower;
+            const unsigned char *row = PGM_VIEW_ROW(src, unsigned char, i);
+            unsigned char *out = PGM_VIEW_ROW(dst, unsigned char, i);
+
+            top = top > tiles_y - 1 ? tiles_y - 1 : top;
+            bottom = top + 1 < tiles_y ? top + 1 : top;
+            weight_bottom = position < 0 || bottom == top ? 0 : (int)((position - top) * 256 + 0.5);
+            weight_top = 256 - weight_bottom;
+            upper = luts + (ptrdiff_t)top * tiles_x * 256;
+            lower = luts + (ptrdiff_t)bottom * tiles_x * 256;
+
+#pragma omp simd
+            for (int n = 0; n < tiles_x * 256; n++)
+            {
+                blended[n] = (unsigned short)(upper[n] * weight_top + lower[n] * weight_bottom);
+            }
+            memcpy(blended + tiles_x * 256, blended + (tiles_x - 1) * 256, 256 * sizeof(unsigned short));
+#pragma omp simd
+            for (int n = 0; n < tiles_x * 256; n++)
+            {
+                pairs[n] = blended[n] | (unsigned int)blended[n + 256] << 16;
+            }
+
+#ifdef __SSE2__
+            for (; j + 16 <= width; j += 16)
+            {
+                __m128i quarters[4];
+
+                for (int q = 0; q < 4; q++)
+                {
+                    const int *tile = column_tile + j + 4 * q;
+                    const unsigned char *value = row + j + 4 * q;
+                    __m128i pair = _mm_set_epi32(pairs[tile[3] + value[3]], pairs[tile[2] + value[2]], pairs[tile[1] + value[1]],
+                                                 pairs[tile[0] + value[0]]);
+                    __m128 left = _mm_cvtepi32_ps(_mm_and_si128(pair, _mm_set1_epi32(0xffff)));
+                    __m128 right = _mm_cvtepi32_ps(_mm_srli_epi32(pair, 16));
+                    __m128 weight = _mm_loadu_ps(column_weight + j + 4 * q);
+                    __m128 sum = _mm_add_ps(_mm_mul_ps(left, _mm_sub_ps(_mm_set1_ps(256), weight)), _mm_mul_ps(right, weight));
+
+                    quarters[q] = _mm_srli_epi32(_mm_cvttps_epi32(_mm_add_ps(sum, _mm_set1_ps(32768))), 16);
+                }
+                _mm_storeu_si128((__m128i *)(out + j), _mm_packus_epi16(_mm_packs_epi32(quarters[0], quarters[1]),
+                                                                        _mm_packs_epi32(quarters[2], quarters[3])));
+            }
+#endif
+            for (; j < width; j++)
+            {
+                unsigned int pair = pairs[column_tile[j] + row[j]], w = (unsigned int)column_weight[j];
+                unsigned int value = (pair & 0xffff) * (256 - w) + (pair >> 16) * w;
+                out[j] = (unsigned char)((value + 32768) >> 16);
+            }
+        }
+
+        free(blended);
+        free(pairs);
+    }
+
+    free(luts);
+    free(column_tile);
+    free(column_weight);
+}
@@ -0,0 +1,852 @@
+#include "pgm.h"
+
+// Cost of one FFT element per pass relative to one vectorized multiply-add of the direct path, measured on x86-64
+#define CONVOLVE_FFT_COST 4.0
+// Smallest FFT length worth planning, shorter transforms are all overhead
+#define CONVOLVE_MIN_FFT 16
+// Lanes fft_lanes() takes through all stages at once, so both buffers of a block stay in L2
+#define FFT_LANE_BLOCK 64
+
+// Complex number of the FFT, laid out like two floats so real rows can be read as complex ones
+
+typedef struct
+{
+    float re;
+    float im;
+} fft_complex;
+
+// Mixed radix FFT of one length, factors holds pairs (radix, remaining length)
+
+typedef struct
+{
+    int n;
+    int factors[64];
+    fft_complex *twiddles;
+} fft_plan;
+
+/**
+ * @brief Allocate memory or exit
+ * 
+ * @param size 
+ * @return void* 
+ */
+static void *convolve_alloc(size_t size)
+{
+    void *buffer = malloc(size > 0 ? size : 1);
+    if (buffer == NULL)
+    {
+        fprintf(stderr, "Error: filter_convolve() failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return buffer;
+}
+
+/**
+ * @brief Non zero if n only has the factors 2, 3 and 5 the FFT has butterflies for
+ * 
+ * @param n 
+ * @return int 
+ */
+static int fft_supported(int n)
+{
+    static const int radices[] = {2, 3, 5};
+
+    for (int r = 0; r < 3; r++)
+    {
+        while (n % radices[r] == 0)
+        {
+            n /= radices[r];
+        }
+    }
+    return n == 1;
+}
+
+/**
+ * @brief Work of an FFT of length n per element, the sum over its radices as fft_plan_create() picks them
+ *        Radix 2 and 4 have dedicated butterflies and cost log2 of the radix, radix 3 and 5 go through
+ *          the generic butterfly of p complex multiplies per element and cost p
+ * 
+ * @param n supported by fft_supported()
+ * @return double 
+ */
+static double fft_cost(int n)
+{
+    double cost = 0;
+
+    for (; n % 4 == 0; n /= 4)
+    {
+        cost += 2;
+    }
+    for (; n % 2 == 0; n /= 2)
+    {
+        cost += 1;
+    }
+    for (; n % 3 == 0; n /= 3)
+    {
+        cost += 3;
+    }
+    for (; n % 5 == 0; n /= 5)
+    {
+        cost += 5;
+    }
+    return cost;
+}
+
+/**
+ * @brief Twiddle factors and factorization of an FFT of length n, radix 4 first, then 2, 3 and 5
+ * 
+ * @param n supported by fft_supported()
+ * @return fft_plan 
+ */
+static fft_plan fft_plan_create(int n)
+{
+    fft_plan plan;
+    int remaining = n, radix = 4, count = 0;
+
+    plan.n = n;
+    plan.twiddles = (fft_complex *)convolve_alloc(n * sizeof(fft_complex));
+    for (int k = 0; k < n; k++)
+    {
+        double phase = -2 * M_PI * k / n;
+        plan.twiddles[k].re = (float)cos(phase);
+        plan.twiddles[k].im = (float)sin(phase);
+    }
+
+    while (remaining > 1)
+    {
+        while (remaining % radix != 0)
+        {
+            radix = radix == 4 ? 2 : radix == 2 ? 3 : radix + 2;
+        }
+        remaining /= radix;
+        plan.factors[count++] = radix;
+        plan.factors[count++] = remaining;
+    }
+    if (n == 1)
+    {
+        plan.factors[0] = plan.factors[1] = 1;
+    }
+
+    return plan;
+}
+
+/**
+ * @brief Free the twiddle factors of a plan
+ * 
+ * @param plan 
+ */
+static void fft_plan_free(fft_plan *plan)
+{
+    free(plan->twiddles);
+}
+
+/**
+ * @brief One stage of fft_lanes(), radix p: sub-transforms of length m become p * (m / p) of length m / p
+ *        Output k of butterfly j goes to element s * (p * j + k) + q, times the twiddle w_m^(j * k),
+ *          every butterfly is a vector loop over the lanes of its rows
+ * 
+ * @param plan 
+ * @param p radix
+ * @param m length of the sub-transforms before the stage
+ * @param s number of sub-transforms before the stage
+ * @param direction 1 forward, -1 inverse
+ * @param x_re input
+ * @param x_im 
+ * @param y_re output
+ * @param y_im 
+ * @param stride 
+ * @param lanes 
+ */
+static void fft_lanes_stage(const fft_plan *plan, int p, int m, int s, float direction, const float *x_re, const float *x_im,
+                            float *y_re, float *y_im, ptrdiff_t stride, int lanes)
+{
+    const int n = plan->n, span = m / p;
+
+    for (int j = 0; j < span; j++)
+    {
+        fft_complex w[5], c[5][5];
+
+        // Twiddles of this butterfly, and for radix 3 and 5 the DFT matrix with them folded in
+        for (int k = 0; k < p; k++)
+        {
+            w[k] = plan->twiddles[(size_t)j * k * (n / m)];
+            w[k].im *= direction;
+        }
+        for (int r = 0; r < p && p != 2 && p != 4; r++)
+        {
+            for (int k = 0; k < p; k++)
+            {
+                fft_complex root = plan->twiddles[(r * k % p) * (n / p)];
+
+                root.im *= direction;
+                c[r][k].re = root.re * w[k].re - root.im * w[k].im;
+                c[r][k].im = root.re * w[k].im + root.im * w[k].re;
+            }
+        }
+
+        for (int q = 0; q < s; q++)
+        {
+            const float *a_re[5], *a_im[5];
+            float *b_re[5], *b_im[5];
+
+            for (int r = 0; r < p; r++)
+            {
+                a_re[r] = x_re + (ptrdiff_t)(q + s * (j + r * span)) * stride;
+                a_im[r] = x_im + (ptrdiff_t)(q + s * (j + r * span)) * stride;
+                b_re[r] = y_re + (ptrdiff_t)(q + s * (p * j + r)) * stride;
+                b_im[r] = y_im + (ptrdiff_t)(q + s * (p * j + r)) * stride;
+            }
+
+            if (p == 2)
+            {
+#pragma omp simd
+                for (int l = 0; l < lanes; l++)
+                {
+                    float d_re = a_re[0][l] - a_re[1][l], d_im = a_im[0][l] - a_im[1][l];
+
+                    b_re[0][l] = a_re[0][l] + a_re[1][l];
+                    b_im[0][l] = a_im[0][l] + a_im[1][l];
+                    b_re[1][l] = d_re * w[1].re - d_im * w[1].im;
+                    b_im[1][l] = d_re * w[1].im + d_im * w[1].re;
+                }
+            }
+            else if (p == 4)
+            {
+#pragma omp simd
+                for (int l = 0; l < lanes; l++)
+                {
+                    float s02_re = a_re[0][l] + a_re[2][l], s02_im = a_im[0][l] + a_im[2][l];
+                    float d02_re = a_re[0][l] - a_re[2][l], d02_im = a_im[0][l] - a_im[2][l];
+                    float s13_re = a_re[1][l] + a_re[3][l], s13_im = a_im[1][l] + a_im[3][l];
+                    float d13_re = a_re[1][l] - a_re[3][l], d13_im = a_im[1][l] - a_im[3][l];
+                    // Times -i going forward, +i going back
+                    float t_re = direction * d13_im, t_im = -direction * d13_re;
+                    float v1_re = d02_re + t_re, v1_im = d02_im + t_im;
+                    float v2_re = s02_re - s13_re, v2_im = s02_im - s13_im;
+                    float v3_re = d02_re - t_re, v3_im = d02_im - t_im;
+
+                    b_re[0][l] = s02_re + s13_re;
+                    b_im[0][l] = s02_im + s13_im;
+                    b_re[1][l] = v1_re * w[1].re - v1_im * w[1].im;
+                    b_im[1][l] = v1_re * w[1].im + v1_im * w[1].re;
+                    b_re[2][l] = v2_re * w[2].re - v2_im * w[2].im;
+                    b_im[2][l] = v2_re * w[2].im + v2_im * w[2].re;
+                    b_re[3][l] = v3_re * w[3].re - v3_im * w[3].im;
+                    b_im[3][l] = v3_re * w[3].im + v3_im * w[3].re;
+                }
+            }
+            else
+            {
+                for (int k = 0; k < p; k++)
+                {
+#pragma omp simd
+                    for (int l = 0; l < lanes; l++)
+                    {
+                        float sum_re = 0, sum_im = 0;
+
+                        for (int r = 0; r < p; r++)
+                        {
+                            sum_re += a_re[r][l] * c[r][k].re - a_im[r][l] * c[r][k].im;
+                            sum_im += a_re[r][l] * c[r][k].im + a_im[r][l] * c[r][k].re;
+                        }
+                        b_re[k][l] = sum_re;
+                        b_im[k][l] = sum_im;
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief FFT of plan->n elements of lanes values each, the lanes are independent transforms done all at once
+ *        Element e of lane l is re[e * stride + l] + i im[e * stride + l], real and imaginary parts apart
+ *          so every butterfly is plain vector arithmetic across the lanes
+ *        Stockham autosort: each stage reads one buffer and writes the other in order, no bit reversal,
+ *          the result ends in re and im
+ *        The lanes go through all stages in blocks of FFT_LANE_BLOCK, so long transforms stay in cache
+ * 
+ * @param plan 
+ * @param re 
+ * @param im 
+ * @param stride distance between elements in floats, at least lanes
+ * @param lanes 
+ * @param direction 1 forward, sum x[t] exp(-2 pi i k t / n), -1 for the unnormalized inverse
+ * @param work_re scratch of plan->n * stride floats
+ * @param work_im 
+ */
+static void fft_lanes(const fft_plan *plan, float *re, float *im, ptrdiff_t stride, int lanes, float direction, float *work_re,
+                      float *work_im)
+{
+    for (int first = 0; first < lanes; first += FFT_LANE_BLOCK)
+    {
+        int block = lanes - first < FFT_LANE_BLOCK ? lanes - first : FFT_LANE_BLOCK;
+        float *x_re = re + first, *x_im = im + first, *y_re = work_re + first, *y_im = work_im + first;
+        int m = plan->n, s = 1;
+
+        for (const int *f = plan->factors; m > 1; f += 2)
+        {
+            float *swap;
+
+            fft_lanes_stage(plan, f[0], m, s, direction, x_re, x_im, y_re, y_im, stride, block);
+            m /= f[0];
+            s *= f[0];
+            swap = x_re, x_re = y_re, y_re = swap;
+            swap = x_im, x_im = y_im, y_im = swap;
+        }
+
+        if (x_re != re + first)
+        {
+            for (int e = 0; e < plan->n; e++)
+            {
+                memcpy(re + first + (ptrdiff_t)e * stride, x_re + (ptrdiff_t)e * stride, block * sizeof(float));
+                memcpy(im + first + (ptrdiff_t)e * stride, x_im + (ptrdiff_t)e * stride, block * sizeof(float));
+            }
+        }
+    }
+}
+
+/**
+ * @brief FFT length for one axis of the overlap-add tiles
+ *        Tiles hold n - kernel + 1 input pixels, the length with the least work per output pixel,
+ *          n (fft_cost(n / 2) + 1) / (n - kernel + 1), is picked among the even lengths of the form 2^a 3^b 5^c
+ *          (a real transform of n is a complex one of n / 2 and one pass to split it)
+ *        The tiles must be at least kernel - 1 long, and never longer than the image needs
+ * 
+ * @param kernel 
+ * @param extent 
+ * @return int 
+ */
+static int convolve_fft_length(int kernel, int extent)
+{
+    int best = 0;
+    double best_cost = 0;
+
+    for (int n = 2 * kernel - 2 > CONVOLVE_MIN_FFT ? 2 * kernel - 2 : CONVOLVE_MIN_FFT;; n++)
+    {
+        double cost;
+        if (n % 2 != 0 || !fft_supported(n / 2))
+        {
+            continue;
+        }
+
+        cost = n * (fft_cost(n / 2) + 1) / (n - kernel + 1);
+        if (best == 0 || cost < best_cost)
+        {
+            best = n;
+            best_cost = cost;
+        }
+        if (n >= extent + kernel - 1 || n >= 16 * kernel)
+        {
+            break;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * @brief Direct convolution, every output row sums kernel_width x kernel_height shifted input rows with vector code
+ * 
+ * @param src 
+ * @param out width x height floats, width and height of the output without padding
+ * @param kernel 
+ * @param kernel_width 
+ * @param kernel_height 
+ */
+static void convolve_direct(const PGM_view *src, float *out, const float *kernel, int kernel_width, int kernel_height)
+{
+    int width = src->width - kernel_width + 1, height = src->height - kernel_height + 1;
+
+#pragma omp parallel
+    {
+        float *line = (float *)convolve_alloc(src->width * sizeof(float));
+
+#pragma omp for schedule(static)
+        for (int i = 0; i < height; i++)
+        {
+            float *sum = out + (ptrdiff_t)i * width;
+            memset(sum, 0, width * sizeof(float));
+
+            for (int m = 0; m < kernel_height; m++)
+            {
+                const unsigned char *row = PGM_VIEW_ROW(src, unsigned char, i + m);
+                for (int x = 0; x < src->width; x++)
+                {
+                    line[x] = row[x];
+                }
+
+                for (int n = 0; n < kernel_width; n++)
+                {
+                    const float w = kernel[(kernel_height - 1 - m) * kernel_width + kernel_width - 1 - n];
+                    const float *shifted = line + n;
+                    if (w == 0)
+                    {
+                        continue;
+                    }
+#pragma omp simd
+                    for (int x = 0; x < width; x++)
+                    {
+                        sum[x] += w * shifted[x];
+                    }
+                }
+            }
+        }
+
+        free(line);
+    }
+}
+
+// Transform geometry of the overlap-add tiles and the planes one thread works in
+// A tile of nx x ny is transformed along y first, as a real FFT of ny / 2 complex rows with the columns
+// as lanes, then transposed and transformed along x with the ky = ny / 2 + 1 spectrum rows as lanes
+
+typedef struct
+{
+    int nx;
+    int ny;
+    int half;
+    int ky;
+    fft_plan rows;
+    fft_plan columns;
+    fft_complex *split;
+} convolve_geometry;
+
+typedef struct
+{
+    float *packed_re;
+    float *packed_im;
+    float *rows_re;
+    float *rows_im;
+    float *columns_re;
+    float *columns_im;
+    float *work_re;
+    float *work_im;
+} convolve_planes;
+
+/**
+ * @brief Allocate the planes of one thread, every plane holds nx * ky floats
+ * 
+ * @param planes 
+ * @param geometry 
+ */
+static void convolve_planes_alloc(convolve_planes *planes, const convolve_geometry *geometry)
+{
+    size_t size = (size_t)geometry->nx * geometry->ky * sizeof(float);
+
+    planes->packed_re = (float *)convolve_alloc(size);
+    planes->packed_im = (float *)convolve_alloc(size);
+    planes->rows_re = (float *)convolve_alloc(size);
+    planes->rows_im = (float *)convolve_alloc(size);
+    planes->columns_re = (float *)convolve_alloc(size);
+    planes->columns_im = (float *)convolve_alloc(size);
+    planes->work_re = (float *)convolve_alloc(size);
+    planes->work_im = (float *)convolve_alloc(size);
+}
+
+/**
+ * @brief Free the planes of one thread
+ * 
+ * @param planes 
+ */
+static void convolve_planes_free(convolve_planes *planes)
+{
+    free(planes->packed_re);
+    free(planes->packed_im);
+    free(planes->rows_re);
+    free(planes->rows_im);
+    free(planes->columns_re);
+    free(planes->columns_im);
+    free(planes->work_re);
+    free(planes->work_im);
+}
+
+/**
+ * @brief Transpose one float plane with transpose_tile()
+ * 
+ * @param src 
+ * @param width 
+ * @param height 
+ * @param dst height x width
+ */
+static void convolve_transpose(float *src, int width, int height, float *dst)
+{
+    PGM_view in = pgm_view_wrap(src, width, height, width * sizeof(float), PGM_DEPTH_32F);
+    PGM_view out = pgm_view_wrap(dst, height, width, height * sizeof(float), PGM_DEPTH_32F);
+
+    transpose_tile(&in, &out);
+}
+
+/**
+ * @brief 2D FFT of the tile in packed, which holds row 2j of the tile in packed_re row j and row 2j + 1 in packed_im,
+ *          columns lanes and beyond are 0
+ *        The FFT along y of half rows is split into the ky coefficients of the real rows (even and odd rows are the
+ *          real and imaginary parts of one complex transform), the result is transposed and transformed along x
+ *        Leaves nx rows of ky coefficients in columns_re and columns_im
+ * 
+ * @param geometry 
+ * @param planes 
+ * @param lanes columns of the tile that are not 0
+ */
+static void convolve_forward(const convolve_geometry *geometry, convolve_planes *planes, int lanes)
+{
+    const int nx = geometry->nx, half = geometry->half;
+
+    fft_lanes(&geometry->rows, planes->packed_re, planes->packed_im, nx, lanes, 1, planes->work_re, planes->work_im);
+
+    for (int k = 0; k <= half; k++)
+    {
+        const float *a_re = planes->packed_re + (ptrdiff_t)(k % half) * nx, *a_im = planes->packed_im + (ptrdiff_t)(k % half) * nx;
+        const float *b_re = planes->packed_re + (ptrdiff_t)((half - k) % half) * nx;
+        const float *b_im = planes->packed_im + (ptrdiff_t)((half - k) % half) * nx;
+        float *out_re = planes->rows_re + (ptrdiff_t)k * nx, *out_im = planes->rows_im + (ptrdiff_t)k * nx;
+        const fft_complex twiddle = geometry->split[k];
+
+#pragma omp simd
+        for (int l = 0; l < lanes; l++)
+        {
+            float even_re = 0.5f * (a_re[l] + b_re[l]), even_im = 0.5f * (a_im[l] - b_im[l]);
+            float odd_re = 0.5f * (a_im[l] + b_im[l]), odd_im = -0.5f * (a_re[l] - b_re[l]);
+
+            out_re[l] = even_re + odd_re * twiddle.re - odd_im * twiddle.im;
+            out_im[l] = even_im + odd_re * twiddle.im + odd_im * twiddle.re;
+        }
+        memset(out_re + lanes, 0, (nx - lanes) * sizeof(float));
+        memset(out_im + lanes, 0, (nx - lanes) * sizeof(float));
+    }
+
+    convolve_transpose(planes->rows_re, nx, geometry->ky, planes->columns_re);
+    convolve_transpose(planes->rows_im, nx, geometry->ky, planes->columns_im);
+    fft_lanes(&geometry->columns, planes->columns_re, planes->columns_im, geometry->ky, geometry->ky, 1, planes->work_re,
+              planes->work_im);
+}
+
+/**
+ * @brief Inverse of convolve_forward(), times nx * ny, for the columns first .. last - 1 of the tile only
+ *        Leaves row 2j of the tile in packed_re row j and row 2j + 1 in packed_im
+ * 
+ * @param geometry 
+ * @param planes 
+ * @param first 
+ * @param last 
+ */
+static void convolve_inverse(const convolve_geometry *geometry, convolve_planes *planes, int first, int last)
+{
+    const int nx = geometry->nx, half = geometry->half;
+
+    fft_lanes(&geometry->columns, planes->columns_re, planes->columns_im, geometry->ky, geometry->ky, -1, planes->work_re,
+              planes->work_im);
+    convolve_transpose(planes->columns_re, geometry->ky, nx, planes->rows_re);
+    convolve_transpose(planes->columns_im, geometry->ky, nx, planes->rows_im);
+
+    for (int k = 0; k < half; k++)
+    {
+        const float *a_re = planes->rows_re + (ptrdiff_t)k * nx, *a_im = planes->rows_im + (ptrdiff_t)k * nx;
+        const float *b_re = planes->rows_re + (ptrdiff_t)(half - k) * nx, *b_im = planes->rows_im + (ptrdiff_t)(half - k) * nx;
+        float *out_re = planes->packed_re + (ptrdiff_t)k * nx, *out_im = planes->packed_im + (ptrdiff_t)k * nx;
+        const fft_complex twiddle = geometry->split[k];
+
+#pragma omp simd
+        for (int l = first; l < last; l++)
+        {
+            float even_re = a_re[l] + b_re[l], even_im = a_im[l] - b_im[l];
+            float diff_re = a_re[l] - b_re[l], diff_im = a_im[l] + b_im[l];
+            // Times the conjugate of the split twiddle
+            float odd_re = diff_re * twiddle.re + diff_im * twiddle.im, odd_im = diff_im * twiddle.re - diff_re * twiddle.im;
+
+            out_re[l] = even_re - odd_im;
+            out_im[l] = even_im + odd_re;
+        }
+    }
+
+    fft_lanes(&geometry->rows, planes->packed_re + first, planes->packed_im + first, nx, last - first, -1, planes->work_re,
+              planes->work_im);
+}
+
+/**
+ * @brief Plans, split twiddles and the kernel spectrum for tiles of nx x ny
+ *        The kernel is zero padded to the tile, transformed like a tile and scaled by 1 / (nx * ny),
+ *          so the inverse transforms come back normalized
+ * 
+ * @param geometry 
+ * @param nx 
+ * @param ny 
+ * @param kernel 
+ * @param kernel_width 
+ * @param kernel_height 
+ * @param spectrum_re set to nx rows of ky coefficients, freed by the caller
+ * @param spectrum_im 
+ */
+static void convolve_geometry_create(convolve_geometry *geometry, int nx, int ny, const float *kernel, int kernel_width,
+                                     int kernel_height, float **spectrum_re, float **spectrum_im)
+{
+    const float scale = 1.0f / ((float)nx * ny);
+    convolve_planes planes;
+
+    geometry->nx = nx;
+    geometry->ny = ny;
+    geometry->half = ny / 2;
+    geometry->ky = ny / 2 + 1;
+    geometry->rows = fft_plan_create(geometry->half);
+    geometry->columns = fft_plan_create(nx);
+    geometry->split = (fft_complex *)convolve_alloc(geometry->ky * sizeof(fft_complex));
+    for (int k = 0; k < geometry->ky; k++)
+    {
+        double phase = -2 * M_PI * k / ny;
+        geometry->split[k].re = (float)cos(phase);
+        geometry->split[k].im = (float)sin(phase);
+    }
+
+    convolve_planes_alloc(&planes, geometry);
+    for (int j = 0; j < geometry->half; j++)
+    {
+        float *re = planes.packed_re + (ptrdiff_t)j * nx, *im = planes.packed_im + (ptrdiff_t)j * nx;
+
+        memset(re, 0, nx * sizeof(float));
+        memset(im, 0, nx * sizeof(float));
+        for (int c = 0; c < kernel_width; c++)
+        {
+            re[c] = 2 * j < kernel_height ? kernel[2 * j * kernel_width + c] * scale : 0;
+            im[c] = 2 * j + 1 < kernel_height ? kernel[(2 * j + 1) * kernel_width + c] * scale : 0;
+        }
+    }
+    convolve_forward(geometry, &planes, kernel_width);
+
+    *spectrum_re = planes.columns_re;
+    *spectrum_im = planes.columns_im;
+    planes.columns_re = planes.columns_im = NULL;
+    convolve_planes_free(&planes);
+}
+
+/**
+ * @brief Free the plans and twiddles of a geometry
+ * 
+ * @param geometry 
+ */
+static void convolve_geometry_free(convolve_geometry *geometry)
+{
+    fft_plan_free(&geometry->rows);
+    fft_plan_free(&geometry->columns);
+    free(geometry->split);
+}
+
+/**
+ * @brief FFT convolution with overlap-add
+ *        src is cut in tiles of (nx - kernel_width + 1) x (ny - kernel_height + 1) pixels, each tile is zero padded to
+ *          nx x ny, transformed, multiplied with the spectrum of the kernel and transformed back, and its full
+ *          convolution is added to the output where it lands
+ *        Every transform runs on many lines at once with vector code, see fft_lanes(): the tile is transformed
+ *          along y with its columns as lanes, transposed with transpose_tile() and transformed along x with its
+ *          spectrum rows as lanes. Zero columns of a tile are left out going forward, and columns that do not
+ *          land in the output are left out going back
+ *        A tile only spills into its right and lower neighbours, so the tiles are done in 4 rounds of
+ *          non touching tiles, by parity of their position, and the tiles of a round run in parallel
+ * 
+ * @param src 
+ * @param out width x height floats, width and height of the output without padding
+ * @param kernel 
+ * @param kernel_width 
+ * @param kernel_height 
+ * @param nx 
+ * @param ny 
+ */
+static void convolve_fft(const PGM_view *src, float *out, const float *kernel, int kernel_width, int kernel_height, int nx, int ny)
+{
+    int width = src->width - kernel_width + 1, height = src->height - kernel_height + 1;
+    int block_x = nx - kernel_width + 1, block_y = ny - kernel_height + 1;
+    int tiles_x = (src->width + block_x - 1) / block_x, tiles_y = (src->height + block_y - 1) / block_y;
+    convolve_geometry geometry;
+    float *spectrum_re, *spectrum_im;
+
+    convolve_geometry_create(&geometry, nx, ny, kernel, kernel_width, kernel_height, &spectrum_re, &spectrum_im);
+    memset(out, 0, (size_t)width * height * sizeof(float));
+
+#pragma omp parallel
+    {
+        convolve_planes planes;
+        const size_t cells = (size_t)nx * geometry.ky;
+
+        convolve_planes_alloc(&planes, &geometry);
+
+        for (int round = 0; round < 4; round++)
+        {
+            int count_x = (tiles_x + 1 - (round & 1)) / 2, count_y = (tiles_y + 1 - (round >> 1)) / 2;
+
+#pragma omp for collapse(2) schedule(static)
+            for (int ty = 0; ty < count_y; ty++)
+            {
+                for (int tx = 0; tx < count_x; tx++)
+                {
+                    int x0 = (2 * tx + (round & 1)) * block_x, y0 = (2 * ty + (round >> 1)) * block_y;
+                    int tile_width = src->width - x0 < block_x ? src->width - x0 : block_x;
+                    int tile_height = src->height - y0 < block_y ? src->height - y0 : block_y;
+                    // Full convolution column c is output column x0 + c - (kernel_width - 1), same for rows
+                    int first = x0 - (kernel_width - 1) < 0 ? kernel_width - 1 - x0 : 0;
+                    int last = x0 + nx - (kernel_width - 1) > width ? width - x0 + kernel_width - 1 : nx;
+
+                    for (int j = 0; j < geometry.half; j++)
+                    {
+                        float *re = planes.packed_re + (ptrdiff_t)j * nx, *im = planes.packed_im + (ptrdiff_t)j * nx;
+                        const unsigned char *even = 2 * j < tile_height ? PGM_VIEW_ROW(src, unsigned char, y0 + 2 * j) + x0 : NULL;
+                        const unsigned char *odd = 2 * j + 1 < tile_height ? PGM_VIEW_ROW(src, unsigned char, y0 + 2 * j + 1) + x0 : NULL;
+
+                        for (int c = 0; c < tile_width; c++)
+                        {
+                            re[c] = even != NULL ? even[c] : 0;
+                            im[c] = odd != NULL ? odd[c] : 0;
+                        }
+                    }
+                    convolve_forward(&geometry, &planes, tile_width);
+
+#pragma omp simd
+                    for (size_t c = 0; c < cells; c++)
+                    {
+                        float a_re = planes.columns_re[c], a_im = planes.columns_im[c];
+
+                        planes.columns_re[c] = a_re * spectrum_re[c] - a_im * spectrum_im[c];
+                        planes.columns_im[c] = a_re * spectrum_im[c] + a_im * spectrum_re[c];
+                    }
+
+                    convolve_inverse(&geometry, &planes, first, last);
+
+                    for (int r = 0; r < ny; r++)
+                    {
+                        int i = y0 + r - (kernel_height - 1);
+                        const float *row = (r % 2 == 0 ? planes.packed_re : planes.packed_im) + (ptrdiff_t)(r / 2) * nx;
+                        float *sum;
+                        if (i < 0 || i >= height)
+                        {
+                            continue;
+                        }
+
+                        sum = out + (ptrdiff_t)i * width + x0 - (kernel_width - 1);
+#pragma omp simd
+                        for (int c = first; c < last; c++)
+                        {
+                            sum[c] += row[c];
+                        }
+                    }
+                }
+            }
+        }
+
+        convolve_planes_free(&planes);
+    }
+
+    convolve_geometry_free(&geometry);
+    free(spectrum_re);
+    free(spectrum_im);
+}
+
+/**
+ * @brief Convolve src with a kernel and write the valid part of the result as floats, no padding and no rounding
+ *        out(i, j) = sum kernel(a, b) * src(i + kernel_height - 1 - a, j + kernel_width - 1 - b)
+ *        CONVOLVE_AUTO picks the direct or the FFT path by cost, see filter_convolve_view()
+ * 
+ * @param src 8-bit view at least as large as the kernel
+ * @param out (src->width - kernel_width + 1) x (src->height - kernel_height + 1) floats
+ * @param kernel kernel_height rows of kernel_width weights
+ * @param kernel_width 
+ * @param kernel_height 
+ * @param method 
+ */
+void convolve_valid(const PGM_view *src, float *out, const float *kernel, int kernel_width, int kernel_height, convolve_method method)
+{
+    int width = src->width - kernel_width + 1, height = src->height - kernel_height + 1;
+    int nx = convolve_fft_length(kernel_width, src->width);
+    int ny = convolve_fft_length(kernel_height, src->height);
+
+    // Direct: one multiply-add per weight and one conversion per kernel row for every output pixel
+    // FFT: every tile is transformed forward and back, at fft_cost() per element and axis
+    if (method == CONVOLVE_AUTO)
+    {
+        double tiles = (double)((src->width + nx - kernel_width) / (nx - kernel_width + 1)) * ((src->height + ny - kernel_height) / (ny - kernel_height + 1));
+        double direct = (double)width * height * (kernel_width + 1) * kernel_height;
+        double fft = CONVOLVE_FFT_COST * tiles * nx * ny * (fft_cost(nx / 2) + fft_cost(ny / 2) + 2);
+        method = fft < direct ? CONVOLVE_FFT : CONVOLVE_DIRECT;
+    }
+
+    if (method == CONVOLVE_FFT)
+    {
+        convolve_fft(src, out, kernel, kernel_width, kernel_height, nx, ny);
+    }
+    else
+    {
+        convolve_direct(src, out, kernel, kernel_width, kernel_height);
+    }
+}
+
+/**
+ * @brief Convolve the image with a kernel and return the filtered image
+ *        See filter_convolve_view()
+ * 
+ * @param img 
+ * @param kernel 
+ * @param kernel_width 
+ * @param kernel_height 
+ * @param method 
+ * @param padding 
+ * @return PGM* 
+ */
+PGM *filter_convolve(PGM *img, const float *kernel, int kernel_width, int kernel_height, convolve_method method, char *padding)
+{
+    PGM *filtered = filter_create_output(img, kernel_width, kernel_height, padding);
+    PGM_view src = pgm_view_of(img);
+    PGM_view dst = pgm_view_of(filtered);
+
+    filter_convolve_view(&src, &dst, kernel, kernel_width, kernel_height, method, padding);
+    return filtered;
+}
+
+/**
+ * @brief Convolve src with any kernel_width x kernel_height kernel and write the result to dst
+ *        out(i, j) = sum kernel(a, b) * src(i + kernel_height - 1 - a, j + kernel_width - 1 - b), a true convolution,
+ *          flip the kernel for a correlation, results are rounded and clamped to 0..255
+ *        CONVOLVE_DIRECT costs kernel_width * kernel_height multiply-adds per pixel,
+ *          CONVOLVE_FFT about log2 of the FFT size times a constant whatever the kernel, see convolve_fft(),
+ *          CONVOLVE_AUTO picks the cheaper one from that cost model
+ *        FFT results stay within 1 gray level of the direct path, the difference is float rounding
+ *          that can move a value across a rounding boundary, see the convolve-check mode of main
+ *        Output size follows the padding rules of filter_prepare_output_rect()
+ * 
+ * @param src 
+ * @param dst 
+ * @param kernel kernel_height rows of kernel_width weights
+ * @param kernel_width 
+ * @param kernel_height 
+ * @param method 
+ * @param padding 
+ */
+void filter_convolve_view(const PGM_view *src, const PGM_view *dst, const float *kernel, int kernel_width, int kernel_height,
+                          convolve_method method, char *padding)
+{
+    int kx, ky, width, height;
+    float *out;
+
+    if (kernel_width < 1 || kernel_height < 1)
+    {
+        fprintf(stderr, "Error: filter_convolve() kernel must be at least 1x1\n");
+        exit(EXIT_FAILURE);
+    }
+
+    filter_prepare_output_rect(src, dst, kernel_width, kernel_height, padding, "filter_convolve", &kx, &ky);
+    width = src->width - kernel_width + 1;
+    height = src->height - kernel_height + 1;
+
+    out = (float *)convolve_alloc((size_t)width * height * sizeof(float));
+    convolve_valid(src, out, kernel, kernel_width, kernel_height, method);
+
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < height; i++)
+    {
+        const float *sum = out + (ptrdiff_t)i * width;
+        unsigned char *row = PGM_VIEW_ROW(dst, unsigned char, i + ky) + kx;
+        for (int j = 0; j < width; j++)
+        {
+            float value = sum[j] + 0.5f;
+            row[j] = value <= 0 ? 0 : value >= 255 ? 255 : (unsigned char)value;
+        }
+    }
+
+    free(out);
+}
@@ -0,0 +1,580 @@
+#include "pgm.h"
+
+// Rows of response per band, a band of detect_corners() also computes radius rows above and below it
+#define CORNER_BAND 64
+
+// Scratch of one thread: for the box, the products of a window in every column and their prefix sums along
+// the row, for the Gaussian, the three product planes of a band and its halo
+typedef struct
+{
+    long long *sum_xx;
+    long long *sum_yy;
+    long long *sum_xy;
+    long long *prefix_xx;
+    long long *prefix_yy;
+    long long *prefix_xy;
+    float *products;
+} corner_sums;
+
+/**
+ * @brief Allocate the scratch for bands of at most rows rows of width pixels
+ * 
+ * @param sums 
+ * @param width 
+ * @param shape 
+ * @param window 
+ * @param rows 
+ */
+static void corner_sums_alloc(corner_sums *sums, int width, corner_window shape, int window, int rows)
+{
+    sums->products = NULL;
+    if (shape == CORNER_GAUSSIAN)
+    {
+        // The band and window rows of halo above and below it, 6 sigma, where the Gaussian has died out
+        sums->products = (float *)malloc((size_t)3 * (rows + 2 * window) * width * sizeof(float));
+        if (sums->products == NULL)
+        {
+            fprintf(stderr, "Error: corner_response() failed to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    sums->sum_xx = (long long *)malloc(width * sizeof(long long));
+    sums->sum_yy = (long long *)malloc(width * sizeof(long long));
+    sums->sum_xy = (long long *)malloc(width * sizeof(long long));
+    sums->prefix_xx = (long long *)malloc((width + 1) * sizeof(long long));
+    sums->prefix_yy = (long long *)malloc((width + 1) * sizeof(long long));
+    sums->prefix_xy = (long long *)malloc((width + 1) * sizeof(long long));
+    if (sums->sum_xx == NULL || sums->sum_yy == NULL || sums->sum_xy == NULL || sums->prefix_xx == NULL ||
+        sums->prefix_yy == NULL || sums->prefix_xy == NULL)
+    {
+        fprintf(stderr, "Error: corner_response() failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Free the running sums
+ * 
+ * @param sums 
+ */
+static void corner_sums_free(corner_sums *sums)
+{
+    free(sums->sum_xx);
+    free(sums->sum_yy);
+    free(sums->sum_xy);
+    free(sums->prefix_xx);
+    free(sums->prefix_yy);
+    free(sums->prefix_xy);
+    free(sums->products);
+}
+
+/**
+ * @brief Add or remove the gradient products of image row y to the column sums
+ *        Gradients are the Sobel ones of filter_sobel(), exact integers, and 0 on the image border
+ * 
+ * @param src 
+ * @param y 
+ * @param sums 
+ * @param sign 1 to add, -1 to remove
+ */
+static void corner_add_row(const PGM_view *src, int y, corner_sums *sums, int sign)
+{
+    const unsigned char *top, *middle, *bottom;
+
+    if (y < 1 || y > src->height - 2)
+    {
+        return;
+    }
+    top = PGM_VIEW_ROW(src, unsigned char, y - 1);
+    middle = PGM_VIEW_ROW(src, unsigned char, y);
+    bottom = PGM_VIEW_ROW(src, unsigned char, y + 1);
+
+#pragma omp simd
+    for (int x = 1; x < src->width - 1; x++)
+    {
+        int gx = top[x + 1] - top[x - 1] + 2 * (middle[x + 1] - middle[x - 1]) + bottom[x + 1] - bottom[x - 1];
+        int gy = bottom[x - 1] + 2 * bottom[x] + bottom[x + 1] - top[x - 1] - 2 * top[x] - top[x + 1];
+
+        sums->sum_xx[x] += sign * gx * gx;
+        sums->sum_yy[x] += sign * gy * gy;
+        sums->sum_xy[x] += sign * gx * gy;
+    }
+}
+
+/**
+ * @brief Score of a structure tensor [a b; b c]
+ * 
+ * @param method 
+ * @param a 
+ * @param b 
+ * @param c 
+ * @param k 
+ * @return float 
+ */
+static float corner_score(corner_method method, double a, double b, double c, double k)
+{
+    if (method == CORNER_HARRIS)
+    {
+        return (float)(a * c - b * b - k * (a + c) * (a + c));
+    }
+    return (float)((a + c) / 2 - sqrt((a - c) * (a - c) / 4 + b * b));
+}
+
+/**
+ * @brief Compute the box window corner response of image rows y0 .. y1 - 1 into rows 0 .. y1 - y0 of out
+ *        The window keeps its column sums up to date row by row, adding the products of the row that
+ *          enters it and removing those of the row that leaves, then prefix sums along the row give
+ *          every window sum with two reads, whatever the window size
+ *        Near the border the window is cut to the image and the sums are divided by its area
+ * 
+ * @param src 
+ * @param method 
+ * @param window 
+ * @param k 
+ * @param y0 
+ * @param y1 
+ * @param out 32F view of at least y1 - y0 rows
+ * @param sums scratch of the calling thread
+ */
+static void corner_box_rows(const PGM_view *src, corner_method method, int window, double k, int y0, int y1,
+                            const PGM_view *out, corner_sums *sums)
+{
+    int width = src->width, height = src->height;
+    int radius = window / 2;
+    int top = y0 - radius < 0 ? 0 : y0 - radius;
+    int bottom = y0 + radius + 1 > height ? height : y0 + radius + 1;
+
+    memset(sums->sum_xx, 0, width * sizeof(long long));
+    memset(sums->sum_yy, 0, width * sizeof(long long));
+    memset(sums->sum_xy, 0, width * sizeof(long long));
+    for (int y = top; y < bottom; y++)
+    {
+        corner_add_row(src, y, sums, 1);
+    }
+
+    for (int y = y0; y < y1; y++)
+    {
+        float *row = PGM_VIEW_ROW(out, float, y - y0);
+        int rows;
+
+        if (y > y0 && y + radius < height)
+        {
+            corner_add_row(src, y + radius, sums, 1);
+            bottom++;
+        }
+        if (y > y0 && y - radius - 1 >= 0)
+        {
+            corner_add_row(src, y - radius - 1, sums, -1);
+            top++;
+        }
+        rows = bottom - top;
+
+        sums->prefix_xx[0] = sums->prefix_yy[0] = sums->prefix_xy[0] = 0;
+        for (int x = 0; x < width; x++)
+        {
+            sums->prefix_xx[x + 1] = sums->prefix_xx[x] + sums->sum_xx[x];
+            sums->prefix_yy[x + 1] = sums->prefix_yy[x] + sums->sum_yy[x];
+            sums->prefix_xy[x + 1] = sums->prefix_xy[x] + sums->sum_xy[x];
+        }
+
+        for (int x = 0; x < width; x++)
+        {
+            int left = x - radius < 0 ? 0 : x - radius;
+            int right = x + radius + 1 > width ? width : x + radius + 1;
+            double scale = 1.0 / ((double)(right - left) * rows);
+            double a = (sums->prefix_xx[right] - sums->prefix_xx[left]) * scale;
+            double c = (sums->prefix_yy[right] - sums->prefix_yy[left]) * scale;
+            double b = (sums->prefix_xy[right] - sums->prefix_xy[left]) * scale;
+
+            row[x] = corner_score(method, a, b, c, k);
+        }
+    }
+}
+
+/**
+ * @brief Compute the Gaussian window corner response of image rows y0 .. y1 - 1 into rows 0 .. y1 - y0 of out
+ *        The products of the band and of window rows above and below it go into three float planes,
+ *          exact since gradients stay below 2^11, and gaussian_blur_planes() smooths them together
+ *        The image is extended with its edge products, the halo is cut at the image border
+ * 
+ * @param src 
+ * @param method 
+ * @param window 
+ * @param k 
+ * @param y0 
+ * @param y1 
+ * @param out 32F view of at least y1 - y0 rows
+ * @param sums scratch of the calling thread
+ */
+static void corner_gaussian_rows(const PGM_view *src, corner_method method, int window, double k, int y0, int y1,
+                                 const PGM_view *out, corner_sums *sums)
+{
+    int width = src->width, height = src->height;
+    int top = y0 - window < 0 ? 0 : y0 - window;
+    int bottom = y1 + window > height ? height : y1 + window;
+    size_t plane = (size_t)(bottom - top) * width;
+    float *xx = sums->products, *yy = xx + plane, *xy = yy + plane;
+
+    for (int y = top; y < bottom; y++)
+    {
+        size_t offset = (size_t)(y - top) * width;
+        const unsigned char *above, *middle, *below;
+
+        memset(xx + offset, 0, width * sizeof(float));
+        memset(yy + offset, 0, width * sizeof(float));
+        memset(xy + offset, 0, width * sizeof(float));
+        if (y < 1 || y > height - 2)
+        {
+            continue;
+        }
+        above = PGM_VIEW_ROW(src, unsigned char, y - 1);
+        middle = PGM_VIEW_ROW(src, unsigned char, y);
+        below = PGM_VIEW_ROW(src, unsigned char, y + 1);
+
+#pragma omp simd
+        for (int x = 1; x < width - 1; x++)
+        {
+            int gx = above[x + 1] - above[x - 1] + 2 * (middle[x + 1] - middle[x - 1]) + below[x + 1] - below[x - 1];
+            int gy = below[x - 1] + 2 * below[x] + below[x + 1] - above[x - 1] - 2 * above[x] - above[x + 1];
+
+            xx[offset + x] = (float)(gx * gx);
+            yy[offset + x] = (float)(gy * gy);
+            xy[offset + x] = (float)(gx * gy);
+        }
+    }
+
+    gaussian_blur_planes(xx, width, bottom - top, 3, (window - 1) / 6.0);
+
+    for (int y = y0; y < y1; y++)
+    {
+        float *row = PGM_VIEW_ROW(out, float, y - y0);
+        size_t offset = (size_t)(y - top) * width;
+
+        for (int x = 0; x < width; x++)
+        {
+            row[x] = corner_score(method, xx[offset + x], xy[offset + x], yy[offset + x], k);
+        }
+    }
+}
+
+/**
+ * @brief Compute the corner response of image rows y0 .. y1 - 1 into rows 0 .. y1 - y0 of out with the window of shape
+ * 
+ * @param src 
+ * @param method 
+ * @param shape 
+ * @param window 
+ * @param k 
+ * @param y0 
+ * @param y1 
+ * @param out 
+ * @param sums 
+ */
+static void corner_response_rows(const PGM_view *src, corner_method method, corner_window shape, int window, double k,
+                                 int y0, int y1, const PGM_view *out, corner_sums *sums)
+{
+    if (shape == CORNER_GAUSSIAN)
+    {
+        corner_gaussian_rows(src, method, window, k, y0, y1, out, sums);
+    }
+    else
+    {
+        corner_box_rows(src, method, window, k, y0, y1, out, sums);
+    }
+}
+
+/**
+ * @brief Check the arguments shared by the corner functions
+ * 
+ * @param src 
+ * @param method 
+ * @param shape 
+ * @param window 
+ * @param caller 
+ */
+static void corner_check(const PGM_view *src, corner_method method, corner_window shape, int window, const char *caller)
+{
+    if (src->depth != PGM_DEPTH_8U)
+    {
+        fprintf(stderr, "Error: %s() works on 8-bit views only\n", caller);
+        exit(EXIT_FAILURE);
+    }
+    if (window < 3 || window % 2 == 0)
+    {
+        fprintf(stderr, "Error: %s() window must be odd and at least 3\n", caller);
+        exit(EXIT_FAILURE);
+    }
+    if (method != CORNER_HARRIS && method != CORNER_SHI_TOMASI)
+    {
+        fprintf(stderr, "Error: %s() unknown method\n", caller);
+        exit(EXIT_FAILURE);
+    }
+    if (shape != CORNER_BOX && shape != CORNER_GAUSSIAN)
+    {
+        fprintf(stderr, "Error: %s() unknown window\n", caller);
+        exit(EXIT_FAILURE);
+    }
+    // Sigma of the recursive Gaussian is at least 1, and it needs 3 pixels along both axes
+    if (shape == CORNER_GAUSSIAN && (window < 7 || src->width < 3 || src->height < 3))
+    {
+        fprintf(stderr, "Error: %s() Gaussian window must be at least 7, the image at least 3x3\n", caller);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Write the corner response of every pixel of src to dst
+ *        The structure tensor [gx^2 gx*gy; gx*gy gy^2] is averaged over a window around the pixel
+ *        CORNER_BOX: a window x window box, running sums make its cost independent of the size
+ *        CORNER_GAUSSIAN: Gaussian weights of sigma (window - 1) / 6, the recursive filter of
+ *          filter_gaussian_view() run on the products, also independent of the size
+ *        CORNER_HARRIS: det - k * trace^2, k around 0.04 .. 0.06
+ *        CORNER_SHI_TOMASI: the smaller eigenvalue, k is not used
+ *        Gradients, products, window sums and scores are computed together for bands of rows,
+ *          nothing but dst is as large as the image
+ * 
+ * @param src 
+ * @param dst 32F view of the same size
+ * @param method 
+ * @param shape 
+ * @param window odd, at least 3, at least 7 for CORNER_GAUSSIAN
+ * @param k 
+ */
+void corner_response_view(const PGM_view *src, const PGM_view *dst, corner_method method, corner_window shape, int window,
+                          double k)
+{
+    int bands = (src->height + CORNER_BAND - 1) / CORNER_BAND;
+
+    corner_check(src, method, shape, window, "corner_response");
+    if (dst->depth != PGM_DEPTH_32F || dst->width != src->width || dst->height != src->height)
+    {
+        fprintf(stderr, "Error: corner_response() needs a 32F output of the size of the input\n");
+        exit(EXIT_FAILURE);
+    }
+
+#pragma omp parallel
+    {
+        corner_sums sums;
+
+        corner_sums_alloc(&sums, src->width, shape, window, CORNER_BAND);
+
+#pragma omp for schedule(static)
+        for (int b = 0; b < bands; b++)
+        {
+            int y0 = b * CORNER_BAND, y1 = y0 + CORNER_BAND < src->height ? y0 + CORNER_BAND : src->height;
+            PGM_view out = pgm_view_sub(dst, 0, y0, dst->width, y1 - y0);
+
+            corner_response_rows(src, method, shape, window, k, y0, y1, &out, &sums);
+        }
+
+        corner_sums_free(&sums);
+    }
+}
+
+/**
+ * @brief Largest value of row within radius of every pixel (van Herk / Gil-Werman)
+ *        In blocks of 2 * radius + 1 pixels, the running maximum from the block start and the one
+ *          from the block end give any window maximum with one comparison
+ * 
+ * @param row 
+ * @param width 
+ * @param radius 
+ * @param forward scratch of width + 2 * radius + 1 floats
+ * @param backward scratch of width + 2 * radius + 1 floats
+ * @param out 
+ */
+static void corner_row_max(const float *row, int width, int radius, float *forward, float *backward, float *out)
+{
+    int size = 2 * radius + 1, padded = width + 2 * radius;
+
+    for (int x = 0; x < padded; x++)
+    {
+        float value = x < radius || x >= width + radius ? -FLT_MAX : row[x - radius];
+        forward[x] = x % size == 0 || value > forward[x - 1] ? value : forward[x - 1];
+    }
+    for (int x = padded - 1; x >= 0; x--)
+    {
+        float value = x < radius || x >= width + radius ? -FLT_MAX : row[x - radius];
+        backward[x] = x == padded - 1 || x % size == size - 1 || value > backward[x + 1] ? value : backward[x + 1];
+    }
+    for (int x = 0; x < width; x++)
+    {
+        out[x] = backward[x] > forward[x + 2 * radius] ? backward[x] : forward[x + 2 * radius];
+    }
+}
+
+/**
+ * @brief Order corners by decreasing score, then in raster order
+ * 
+ * @param a 
+ * @param b 
+ * @return int 
+ */
+static int corner_compare(const void *a, const void *b)
+{
+    const PGM_corner *p = (const PGM_corner *)a, *q = (const PGM_corner *)b;
+
+    if (p->score != q->score)
+    {
+        return p->score > q->score ? -1 : 1;
+    }
+    if (p->y != q->y)
+    {
+        return p->y < q->y ? -1 : 1;
+    }
+    return p->x < q->x ? -1 : p->x > q->x;
+}
+
+/**
+ * @brief Find the strongest corners of src
+ *        Every band of rows computes its response with radius extra rows above and below, keeps the
+ *          pixels with a positive response that are the largest within radius (on ties the first in raster
+ *          order wins), and adds them to the list of its thread, so the response of the whole image is never stored
+ *        The suppression first takes the maximum within radius along every row, then a pixel only
+ *          compares with 2 * radius + 1 of those maxima in its column
+ *        The lists are merged and sorted by score, corners weaker than quality times the strongest are dropped
+ *          and at most max_corners are kept
+ * 
+ * @param src 
+ * @param method see corner_response_view()
+ * @param shape 
+ * @param window 
+ * @param k 
+ * @param radius of the non-maximum suppression, the smallest distance between two corners
+ * @param quality 0 .. 1, 0.01 is a common choice
+ * @param max_corners 0 for all of them
+ * @param corners set to an array the caller frees, strongest first
+ * @return int number of corners
+ */
+int detect_corners(const PGM_view *src, corner_method method, corner_window shape, int window, double k, int radius,
+                   double quality, int max_corners, PGM_corner **corners)
+{
+    int width = src->width, height = src->height;
+    int bands = (height + CORNER_BAND - 1) / CORNER_BAND;
+    PGM_corner *found = NULL;
+    int count = 0;
+
+    corner_check(src, method, shape, window, "detect_corners");
+    radius = radius < 1 ? 1 : radius;
+
+#pragma omp parallel
+    {
+        corner_sums sums;
+        float *response = (float *)malloc((size_t)(CORNER_BAND + 2 * radius) * width * sizeof(float));
+        float *row_max = (float *)malloc((size_t)(CORNER_BAND + 2 * radius) * width * sizeof(float));
+        float *forward = (float *)malloc((width + 2 * radius + 1) * sizeof(float));
+        float *backward = (float *)malloc((width + 2 * radius + 1) * sizeof(float));
+        PGM_corner *local = NULL;
+        int local_count = 0, local_capacity = 0;
+
+        if (response == NULL || row_max == NULL || forward == NULL || backward == NULL)
+        {
+            fprintf(stderr, "Error: detect_corners() failed to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+        corner_sums_alloc(&sums, width, shape, window, CORNER_BAND + 2 * radius);
+
+#pragma omp for schedule(static)
+        for (int b = 0; b < bands; b++)
+        {
+            int y0 = b * CORNER_BAND, y1 = y0 + CORNER_BAND < height ? y0 + CORNER_BAND : height;
+            int r0 = y0 - radius < 0 ? 0 : y0 - radius, r1 = y1 + radius > height ? height : y1 + radius;
+            PGM_view out = pgm_view_wrap(response, width, r1 - r0, width * sizeof(float), PGM_DEPTH_32F);
+
+            corner_response_rows(src, method, shape, window, k, r0, r1, &out, &sums);
+            for (int y = r0; y < r1; y++)
+            {
+                corner_row_max(response + (size_t)(y - r0) * width, width, radius, forward, backward,
+                               row_max + (size_t)(y - r0) * width);
+            }
+
+            for (int y = y0; y < y1; y++)
+            {
+                const float *row = response + (size_t)(y - r0) * width;
+                const float *own_max = row_max + (size_t)(y - r0) * width;
+                int first = y - radius < 0 ? 0 : y - radius, last = y + radius >= height ? height - 1 : y + radius;
+
+                for (int x = 0; x < width; x++)
+                {
+                    float value = row[x];
+                    int peak = value > 0 && value >= own_max[x];
+
+                    // Row maxima reject most pixels, the few left check the raster order rule for ties
+                    for (int ny = first; peak && ny <= last; ny++)
+                    {
+                        peak = row_max[(size_t)(ny - r0) * width + x] <= value;
+                    }
+                    for (int ny = first; peak && ny <= y; ny++)
+                    {
+                        const float *near = response + (size_t)(ny - r0) * width;
+                        for (int nx = x - radius < 0 ? 0 : x - radius; nx <= x + radius && nx < width; nx++)
+                        {
+                            if ((ny < y || nx < x) && near[nx] == value)
+                            {
+                                peak = 0;
+                                break;
+                            }
+                        }
+                    }
+
+                    if (peak)
+                    {
+                        if (local_count == local_capacity)
+                        {
+                            local_capacity = local_capacity ? 2 * local_capacity : 256;
+                            local = (PGM_corner *)realloc(local, local_capacity * sizeof(PGM_corner));
+                            if (local == NULL)
+                            {
+                                fprintf(stderr, "Error: detect_corners() failed to allocate memory\n");
+                                exit(EXIT_FAILURE);
+                            }
+                        }
+                        local[local_count].x = x;
+                        local[local_count].y = y;
+                        local[local_count].score = value;
+                        local_count++;
+                    }
+                }
+            }
+        }
+
+#pragma omp critical
+        {
+            found = (PGM_corner *)realloc(found, (count + local_count + 1) * sizeof(PGM_corner));
+            if (found == NULL)
+            {
+                fprintf(stderr, "Error: detect_corners() failed to allocate memory\n");
+                exit(EXIT_FAILURE);
+            }
+            if (local_count > 0)
+            {
+                memcpy(found + count, local, local_count * sizeof(PGM_corner));
+            }
+            count += local_count;
+        }
+
+        free(local);
+        free(response);
+        free(row_max);
+        free(forward);
+        free(backward);
+        corner_sums_free(&sums);
+    }
+
+    qsort(found, count, sizeof(PGM_corner), corner_compare);
+    if (count > 0)
+    {
+        float limit = (float)(quality * found[0].score);
+        int kept = 0;
+
+        while (kept < count && found[kept].score >= limit && (max_corners <= 0 || kept < max_corners))
+        {
+            kept++;
+        }
+        count = kept;
+    }
+
+    *corners = found;
+    return count;
+}
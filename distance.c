@@ -0,0 +1,220 @@
+#include "pgm.h"
+
+// Columns handled by one thread in the column pass
+#define DISTANCE_BAND 256
+
+/**
+ * @brief Floor of a / b for b > 0
+ * 
+ * @param a 
+ * @param b 
+ * @return long long 
+ */
+static long long floor_div(long long a, long long b)
+{
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+/**
+ * @brief Squared distance of every pixel of one row to the nearest feature, from the column distances g
+ *        Meijster, Roerdink and Hesselink, "A general algorithm for computing distance transforms in linear time", 2000
+ *        The row is the lower envelope of the parabolas (x - i)^2 + g(i)^2, built with a stack of
+ *          parabola centers s and the points t where they start to be the lowest one
+ *        Everything is integer, so the result is exact
+ * 
+ * @param g 
+ * @param width 
+ * @param out 
+ * @param s scratch of width ints
+ * @param t scratch of width ints
+ */
+static void distance_row(const int *g, int width, long long *out, int *s, int *t)
+{
+    int q = 0;
+
+    s[0] = 0;
+    t[0] = 0;
+    for (int u = 1; u < width; u++)
+    {
+        long long gu = (long long)g[u] * g[u];
+
+        while (q >= 0)
+        {
+            long long gs = (long long)g[s[q]] * g[s[q]];
+            long long at_s = (long long)(t[q] - s[q]) * (t[q] - s[q]) + gs;
+            long long at_u = (long long)(t[q] - u) * (t[q] - u) + gu;
+            if (at_s <= at_u)
+            {
+                break;
+            }
+            q--;
+        }
+
+        if (q < 0)
+        {
+            q = 0;
+            s[0] = u;
+        }
+        else
+        {
+            long long i = s[q];
+            long long start = 1 + floor_div((long long)u * u - i * i + gu - (long long)g[i] * g[i], 2 * (u - i));
+            if (start < width)
+            {
+                q++;
+                s[q] = u;
+                t[q] = (int)start;
+            }
+        }
+    }
+
+    for (int u = width - 1; u >= 0; u--)
+    {
+        out[u] = (long long)(u - s[q]) * (u - s[q]) + (long long)g[s[q]] * g[s[q]];
+        if (u == t[q])
+        {
+            q--;
+        }
+    }
+}
+
+/**
+ * @brief Exact Euclidean distance from every pixel of src to the nearest non zero pixel of src
+ *        Separable and linear in the number of pixels whatever the number of features:
+ *        1. Distance to the nearest feature in the same column, one pass down and one up,
+ *             bands of DISTANCE_BAND columns are processed as vectors, one band per thread
+ *        2. Every row combines the column distances with distance_row(), rows are spread over the threads
+ *        dst has the size of src, its depth picks the output:
+ *          PGM_DEPTH_32F the distance itself, INFINITY if src has no feature pixel
+ *          PGM_DEPTH_16U and PGM_DEPTH_8U the distance rounded and clamped to 65535 or 255, also the value
+ *            every pixel gets if src has no feature pixel
+ * 
+ * @param src 8-bit binary image
+ * @param dst 
+ */
+void distance_transform(const PGM_view *src, const PGM_view *dst)
+{
+    int width = src->width, height = src->height;
+    int infinity = width + height;
+    // No real distance reaches it, every squared distance at least this large means src has no feature
+    long long empty = (long long)infinity * infinity;
+    int bands = (width + DISTANCE_BAND - 1) / DISTANCE_BAND;
+    int *g;
+
+    if (src->depth != PGM_DEPTH_8U ||
+        (dst->depth != PGM_DEPTH_8U && dst->depth != PGM_DEPTH_16U && dst->depth != PGM_DEPTH_32F))
+    {
+        fprintf(stderr, "Error: distance_transform() needs an 8-bit image and an 8-bit, 16-bit unsigned or float output\n");
+        exit(EXIT_FAILURE);
+    }
+    if (dst->width != width || dst->height != height)
+    {
+        fprintf(stderr, "Error: distance_transform() output is %dx%d, expected %dx%d\n", dst->width, dst->height, width, height);
+        exit(EXIT_FAILURE);
+    }
+
+    g = (int *)malloc(((size_t)width * height + 1) * sizeof(int));
+    if (g == NULL)
+    {
+        fprintf(stderr, "Error: distance_transform() failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+#pragma omp parallel for schedule(static)
+    for (int b = 0; b < bands; b++)
+    {
+        int x0 = b * DISTANCE_BAND;
+        int lanes = width - x0 < DISTANCE_BAND ? width - x0 : DISTANCE_BAND;
+
+        for (int x = 0; x < lanes; x++)
+        {
+            g[x0 + x] = PGM_VIEW_ROW(src, unsigned char, 0)[x0 + x] ? 0 : infinity;
+        }
+
+        for (int y = 1; y < height; y++)
+        {
+            const unsigned char *row = PGM_VIEW_ROW(src, unsigned char, y) + x0;
+            int *current = g + (ptrdiff_t)y * width + x0;
+            const int *above = current - width;
+
+#pragma omp simd
+            for (int x = 0; x < lanes; x++)
+            {
+                int previous = above[x] + 1 < infinity ? above[x] + 1 : infinity;
+                current[x] = row[x] ? 0 : previous;
+            }
+        }
+
+        for (int y = height - 2; y >= 0; y--)
+        {
+            int *current = g + (ptrdiff_t)y * width + x0;
+            const int *below = current + width;
+
+#pragma omp simd
+            for (int x = 0; x < lanes; x++)
+            {
+                current[x] = below[x] + 1 < current[x] ? below[x] + 1 : current[x];
+            }
+        }
+    }
+
+#pragma omp parallel
+    {
+        long long *squared = (long long *)malloc(width * sizeof(long long));
+        int *s = (int *)malloc(width * sizeof(int));
+        int *t = (int *)malloc(width * sizeof(int));
+        if (squared == NULL || s == NULL || t == NULL)
+        {
+            fprintf(stderr, "Error: distance_transform() failed to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+
+#pragma omp for schedule(static)
+        for (int y = 0; y < height; y++)
+        {
+            distance_row(g + (ptrdiff_t)y * width, width, squared, s, t);
+
+            switch (dst->depth)
+            {
+            case PGM_DEPTH_32F:
+            {
+                float *out = PGM_VIEW_ROW(dst, float, y);
+                for (int x = 0; x < width; x++)
+                {
+                    out[x] = squared[x] >= empty ? INFINITY : sqrtf((float)squared[x]);
+                }
+                break;
+            }
+
+            case PGM_DEPTH_16U:
+            {
+                unsigned short *out = PGM_VIEW_ROW(dst, unsigned short, y);
+                for (int x = 0; x < width; x++)
+                {
+                    double distance = squared[x] >= empty ? 65535 : sqrt((double)squared[x]) + 0.5;
+                    out[x] = distance >= 65535 ? 65535 : (unsigned short)distance;
+                }
+                break;
+            }
+
+            // PGM_DEPTH_8U, the only depth left
+            default:
+            {
+                unsigned char *out = PGM_VIEW_ROW(dst, unsigned char, y);
+                for (int x = 0; x < width; x++)
+                {
+                    double distance = squared[x] >= empty ? 255 : sqrt((double)squared[x]) + 0.5;
+                    out[x] = distance >= 255 ? 255 : (unsigned char)distance;
+                }
+                break;
+            }
+            }
+        }
+
+        free(squared);
+        free(s);
+        free(t);
+    }
+
+    free(g);
+}
@@ -0,0 +1,527 @@
+#include "pgm.h"
+#include <omp.h>
+
+// Edge pixels of a binary image in raster order
+typedef struct
+{
+    int *x;
+    int *y;
+    int count;
+} hough_points;
+
+// Accumulator geometry, theta_steps rows of bins rho cells, rho from -rho_max to rho_max
+typedef struct
+{
+    int theta_steps;
+    int rho_max;
+    int bins;
+    float *cos_table;
+    float *sin_table;
+} hough_space;
+
+/**
+ * @brief Check the arguments of detect_lines()
+ * 
+ * @param src 
+ * @param method 
+ * @param theta_steps 
+ * @param fraction 
+ */
+static void hough_check(const PGM_view *src, hough_method method, int theta_steps, double fraction)
+{
+    if (src->depth != PGM_DEPTH_8U)
+    {
+        fprintf(stderr, "Error: detect_lines() works on 8-bit views only\n");
+        exit(EXIT_FAILURE);
+    }
+    if (theta_steps < 1)
+    {
+        fprintf(stderr, "Error: detect_lines() needs at least one angle\n");
+        exit(EXIT_FAILURE);
+    }
+    if (method != HOUGH_STANDARD && method != HOUGH_PROBABILISTIC)
+    {
+        fprintf(stderr, "Error: detect_lines() unknown method\n");
+        exit(EXIT_FAILURE);
+    }
+    if (method == HOUGH_PROBABILISTIC && (fraction <= 0 || fraction > 1))
+    {
+        fprintf(stderr, "Error: detect_lines() fraction must be in (0, 1]\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Set up the sin and cos tables of theta_steps angles in [0, pi) for an image of width x height
+ *        |rho| of a pixel is at most its distance to the origin, below rho_max
+ * 
+ * @param space 
+ * @param theta_steps 
+ * @param width 
+ * @param height 
+ */
+static void hough_space_alloc(hough_space *space, int theta_steps, int width, int height)
+{
+    space->theta_steps = theta_steps;
+    space->rho_max = (int)ceil(sqrt((double)width * width + (double)height * height));
+    space->bins = 2 * space->rho_max + 1;
+    space->cos_table = (float *)malloc(theta_steps * sizeof(float));
+    space->sin_table = (float *)malloc(theta_steps * sizeof(float));
+    if (space->cos_table == NULL || space->sin_table == NULL)
+    {
+        fprintf(stderr, "Error: detect_lines() failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int t = 0; t < theta_steps; t++)
+    {
+        space->cos_table[t] = (float)cos(M_PI * t / theta_steps);
+        space->sin_table[t] = (float)sin(M_PI * t / theta_steps);
+    }
+}
+
+/**
+ * @brief Free the tables of space
+ * 
+ * @param space 
+ */
+static void hough_space_free(hough_space *space)
+{
+    free(space->cos_table);
+    free(space->sin_table);
+}
+
+/**
+ * @brief Rho cell of pixel (x, y) at angle t, x cos + y sin rounded, shifted by rho_max
+ *        The sum is never below -rho_max, so truncation rounds like floor
+ *        The voting loop computes the same expression for all angles at once
+ * 
+ * @param space 
+ * @param x 
+ * @param y 
+ * @param t 
+ * @return int 
+ */
+static int hough_bin(const hough_space *space, int x, int y, int t)
+{
+    return (int)(x * space->cos_table[t] + y * space->sin_table[t] + (space->rho_max + 0.5f));
+}
+
+/**
+ * @brief Collect the non zero pixels of src in raster order
+ *        Rows are counted in parallel first, so every row knows where its points go
+ * 
+ * @param src 
+ * @param points 
+ */
+static void hough_collect(const PGM_view *src, hough_points *points)
+{
+    int *offsets = (int *)malloc((src->height + 1) * sizeof(int));
+
+    if (offsets == NULL)
+    {
+        fprintf(stderr, "Error: detect_lines() failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < src->height; i++)
+    {
+        const unsigned char *row = PGM_VIEW_ROW(src, unsigned char, i);
+        int count = 0;
+
+#pragma omp simd reduction(+ : count)
+        for (int j = 0; j < src->width; j++)
+        {
+            count += row[j] != 0;
+        }
+        offsets[i + 1] = count;
+    }
+
+    offsets[0] = 0;
+    for (int i = 0; i < src->height; i++)
+    {
+        offsets[i + 1] += offsets[i];
+    }
+
+    points->count = offsets[src->height];
+    points->x = (int *)malloc((points->count + 1) * sizeof(int));
+    points->y = (int *)malloc((points->count + 1) * sizeof(int));
+    if (points->x == NULL || points->y == NULL)
+    {
+        fprintf(stderr, "Error: detect_lines() failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < src->height; i++)
+    {
+        const unsigned char *row = PGM_VIEW_ROW(src, unsigned char, i);
+        int p = offsets[i];
+
+        for (int j = 0; j < src->width; j++)
+        {
+            if (row[j] != 0)
+            {
+                points->x[p] = j;
+                points->y[p] = i;
+                p++;
+            }
+        }
+    }
+
+    free(offsets);
+}
+
+/**
+ * @brief Keep about fraction of the points, chosen by a hash of their index
+ *        The same image always keeps the same points, whatever the number of threads
+ * 
+ * @param points 
+ * @param fraction 
+ * @param sample set to the kept points, freed by the caller
+ */
+static void hough_sample(const hough_points *points, double fraction, hough_points *sample)
+{
+    unsigned int limit = (unsigned int)(fraction * 4294967295.0);
+
+    sample->x = (int *)malloc((points->count + 1) * sizeof(int));
+    sample->y = (int *)malloc((points->count + 1) * sizeof(int));
+    if (sample->x == NULL || sample->y == NULL)
+    {
+        fprintf(stderr, "Error: detect_lines() failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    sample->count = 0;
+    for (int p = 0; p < points->count; p++)
+    {
+        unsigned int hash = (unsigned int)p * 2654435761u;
+
+        hash ^= hash >> 16;
+        hash *= 2246822519u;
+        hash ^= hash >> 13;
+        if (hash <= limit)
+        {
+            sample->x[sample->count] = points->x[p];
+            sample->y[sample->count] = points->y[p];
+            sample->count++;
+        }
+    }
+}
+
+/**
+ * @brief Vote with every point for all angles
+ *        Each thread fills an accumulator of its own, no atomics, and the accumulators are summed into
+ *          the one of the first thread cell by cell in parallel
+ *        A point computes the cells of all angles in one vector loop and then increments them
+ * 
+ * @param points 
+ * @param space 
+ * @return unsigned int* theta_steps x bins votes, freed by the caller
+ */
+static unsigned int *hough_accumulate(const hough_points *points, const hough_space *space)
+{
+    size_t cells = (size_t)space->theta_steps * space->bins;
+    int max_threads = omp_get_max_threads(), teams = 1;
+    unsigned int **partial = (unsigned int **)calloc(max_threads, sizeof(unsigned int *));
+    unsigned int *votes;
+
+    if (partial == NULL)
+    {
+        fprintf(stderr, "Error: detect_lines() failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+#pragma omp parallel num_threads(max_threads)
+    {
+        const float *cos_table = space->cos_table, *sin_table = space->sin_table;
+        const float offset = space->rho_max + 0.5f;
+        const int theta_steps = space->theta_steps, bins = space->bins;
+        unsigned int *acc = (unsigned int *)calloc(cells, sizeof(unsigned int));
+        int *index = (int *)malloc(theta_steps * sizeof(int));
+
+        if (acc == NULL || index == NULL)
+        {
+            fprintf(stderr, "Error: detect_lines() failed to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+        partial[omp_get_thread_num()] = acc;
+#pragma omp single
+        teams = omp_get_num_threads();
+
+#pragma omp for schedule(static)
+        for (int p = 0; p < points->count; p++)
+        {
+            const float x = (float)points->x[p], y = (float)points->y[p];
+
+#pragma omp simd
+            for (int t = 0; t < theta_steps; t++)
+            {
+                index[t] = t * bins + (int)(x * cos_table[t] + y * sin_table[t] + offset);
+            }
+            for (int t = 0; t < theta_steps; t++)
+            {
+                acc[index[t]]++;
+            }
+        }
+
+        if (teams > 1)
+        {
+#pragma omp for schedule(static)
+            for (size_t c = 0; c < cells; c++)
+            {
+                unsigned int sum = partial[0][c];
+
+                for (int k = 1; k < teams; k++)
+                {
+                    sum += partial[k][c];
+                }
+                partial[0][c] = sum;
+            }
+        }
+
+        free(index);
+    }
+
+    votes = partial[0];
+    for (int k = 1; k < teams; k++)
+    {
+        free(partial[k]);
+    }
+    free(partial);
+    return votes;
+}
+
+/**
+ * @brief Compare lines by votes, most first, then by angle and rho for a stable order
+ * 
+ * @param a 
+ * @param b 
+ * @return int 
+ */
+static int hough_compare(const void *a, const void *b)
+{
+    const PGM_line *p = (const PGM_line *)a, *q = (const PGM_line *)b;
+
+    if (p->votes != q->votes)
+    {
+        return p->votes > q->votes ? -1 : 1;
+    }
+    if (p->theta != q->theta)
+    {
+        return p->theta < q->theta ? -1 : 1;
+    }
+    return p->rho < q->rho ? -1 : p->rho > q->rho;
+}
+
+/**
+ * @brief Find the cells with at least min_votes that are the largest within radius cells in angle and rho
+ *        On ties the first cell in memory order wins
+ *        Angles wrap around, a line at theta + pi is the one at theta with the opposite rho,
+ *          so lines close to vertical suppress each other across the ends of the accumulator
+ * 
+ * @param votes 
+ * @param space 
+ * @param min_votes 
+ * @param radius 
+ * @param lines set to an array the caller frees, in no particular order
+ * @return int number of lines
+ */
+static int hough_peaks(const unsigned int *votes, const hough_space *space, unsigned int min_votes, int radius,
+                       PGM_line **lines)
+{
+    const int theta_steps = space->theta_steps, bins = space->bins;
+    PGM_line *found = NULL;
+    int count = 0;
+
+#pragma omp parallel
+    {
+        PGM_line *local = NULL;
+        int local_count = 0, local_capacity = 0;
+
+#pragma omp for schedule(dynamic, 4)
+        for (int t = 0; t < theta_steps; t++)
+        {
+            const unsigned int *row = votes + (size_t)t * bins;
+
+            for (int r = 0; r < bins; r++)
+            {
+                unsigned int value = row[r];
+                size_t own = (size_t)t * bins + r;
+                int peak = value >= min_votes;
+
+                for (int dt = -radius; peak && dt <= radius; dt++)
+                {
+                    int nt = t + dt, mirror = 0;
+
+                    if (nt < 0 || nt >= theta_steps)
+                    {
+                        nt = nt < 0 ? nt + theta_steps : nt - theta_steps;
+                        mirror = 1;
+                    }
+                    if (nt < 0 || nt >= theta_steps)
+                    {
+                        continue;
+                    }
+                    for (int dr = -radius; dr <= radius; dr++)
+                    {
+                        int nr = mirror ? bins - 1 - (r + dr) : r + dr;
+                        size_t other = (size_t)nt * bins + nr;
+
+                        if (nr < 0 || nr >= bins || other == own)
+                        {
+                            continue;
+                        }
+                        if (votes[other] > value || (votes[other] == value && other < own))
+                        {
+                            peak = 0;
+                            break;
+                        }
+                    }
+                }
+
+                if (peak)
+                {
+                    if (local_count == local_capacity)
+                    {
+                        local_capacity = local_capacity ? 2 * local_capacity : 64;
+                        local = (PGM_line *)realloc(local, local_capacity * sizeof(PGM_line));
+                        if (local == NULL)
+                        {
+                            fprintf(stderr, "Error: detect_lines() failed to allocate memory\n");
+                            exit(EXIT_FAILURE);
+                        }
+                    }
+                    local[local_count].rho = (float)(r - space->rho_max);
+                    local[local_count].theta = (float)(M_PI * t / theta_steps);
+                    local[local_count].votes = (int)value;
+                    local_count++;
+                }
+            }
+        }
+
+#pragma omp critical
+        {
+            found = (PGM_line *)realloc(found, (count + local_count + 1) * sizeof(PGM_line));
+            if (found == NULL)
+            {
+                fprintf(stderr, "Error: detect_lines() failed to allocate memory\n");
+                exit(EXIT_FAILURE);
+            }
+            if (local_count > 0)
+            {
+                memcpy(found + count, local, local_count * sizeof(PGM_line));
+            }
+            count += local_count;
+        }
+
+        free(local);
+    }
+
+    *lines = found;
+    return count;
+}
+
+/**
+ * @brief Count the votes every line gets from all points, for lines found on a sample
+ *        One pass over the points per line, cheaper than voting for all angles while lines are fewer than angles
+ * 
+ * @param points 
+ * @param space 
+ * @param lines 
+ * @param count 
+ */
+static void hough_recount(const hough_points *points, const hough_space *space, PGM_line *lines, int count)
+{
+#pragma omp parallel for schedule(dynamic)
+    for (int l = 0; l < count; l++)
+    {
+        int t = (int)lrint(lines[l].theta * space->theta_steps / M_PI);
+        int r = (int)lrint(lines[l].rho) + space->rho_max;
+        int votes = 0;
+
+        for (int p = 0; p < points->count; p++)
+        {
+            votes += hough_bin(space, points->x[p], points->y[p], t) == r;
+        }
+        lines[l].votes = votes;
+    }
+}
+
+/**
+ * @brief Find the straight lines through the non zero pixels of a binary image, such as the output of
+ *          filter_threshold() or filter_canny()
+ *        A line is x cos(theta) + y sin(theta) = rho with theta in [0, pi) and the origin at the top left pixel
+ *        HOUGH_STANDARD: every edge pixel votes for theta_steps angles, rho in steps of one pixel
+ *        HOUGH_PROBABILISTIC: only fraction of the edge pixels vote and peaks need fraction * threshold votes,
+ *          then the votes of those peaks are counted again over all edge pixels, so the result reports exact
+ *          votes. On sparse edge maps with long lines, 0.1 .. 0.3 finds the same lines several times faster.
+ *          With max_lines set, only the 2 * max_lines strongest peaks of the sample are counted again
+ *        Peaks are the largest cells within radius steps of angle and rho, lines with fewer than threshold
+ *          votes are dropped and at most max_lines are kept, most votes first
+ * 
+ * @param src 8-bit view, pixels that are not 0 are edges
+ * @param method 
+ * @param theta_steps angles in [0, pi), 180 for steps of one degree
+ * @param fraction of the edge pixels that vote, HOUGH_PROBABILISTIC only
+ * @param threshold smallest number of votes, pixels on the line
+ * @param radius of the non-maximum suppression in cells
+ * @param max_lines 0 for all of them
+ * @param lines set to an array the caller frees, strongest first
+ * @return int number of lines
+ */
+int detect_lines(const PGM_view *src, hough_method method, int theta_steps, double fraction, int threshold, int radius,
+                 int max_lines, PGM_line **lines)
+{
+    hough_points points;
+    hough_space space;
+    unsigned int *votes;
+    int count, kept;
+
+    hough_check(src, method, theta_steps, fraction);
+    radius = radius < 0 ? 0 : radius;
+    threshold = threshold < 1 ? 1 : threshold;
+
+    hough_space_alloc(&space, theta_steps, src->width, src->height);
+    hough_collect(src, &points);
+
+    if (method == HOUGH_PROBABILISTIC && fraction < 1)
+    {
+        hough_points sample;
+        unsigned int min_votes;
+
+        hough_sample(&points, fraction, &sample);
+        min_votes = (unsigned int)floor(threshold * fraction);
+        votes = hough_accumulate(&sample, &space);
+        count = hough_peaks(votes, &space, min_votes < 1 ? 1 : min_votes, radius, lines);
+        free(votes);
+        free(sample.x);
+        free(sample.y);
+
+        qsort(*lines, count, sizeof(PGM_line), hough_compare);
+        if (max_lines > 0 && count > 2 * max_lines)
+        {
+            count = 2 * max_lines;
+        }
+        hough_recount(&points, &space, *lines, count);
+    }
+    else
+    {
+        votes = hough_accumulate(&points, &space);
+        count = hough_peaks(votes, &space, (unsigned int)threshold, radius, lines);
+        free(votes);
+    }
+
+    qsort(*lines, count, sizeof(PGM_line), hough_compare);
+    kept = 0;
+    while (kept < count && (*lines)[kept].votes >= threshold && (max_lines <= 0 || kept < max_lines))
+    {
+        kept++;
+    }
+
+    free(points.x);
+    free(points.y);
+    hough_space_free(&space);
+    return kept;
+}
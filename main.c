@@ -1,17 +1,3194 @@
 #include "pgm.h"
+#include <omp.h>
+
+/**
+ * @brief Blur src with a sampled Gaussian kernel of radius ceil(4 * sigma) by direct convolution
+ *        Edge pixels are repeated outside the image, the result is kept in floats
+ *        Slow on purpose, it is the reference filter_gaussian() is checked against
+ * 
+ * @param src 
+ * @param sigma 
+ * @return double* 
+ */
+static double *gaussian_reference(PGM *src, double sigma)
+{
+    int radius = (int)ceil(4 * sigma);
+    int width = src->width, height = src->height;
+    double *kernel = (double *)malloc((2 * radius + 1) * sizeof(double));
+    double *temp = (double *)malloc((size_t)width * height * sizeof(double));
+    double *out = (double *)malloc((size_t)width * height * sizeof(double));
+    double sum = 0;
+
+    for (int m = -radius; m <= radius; m++)
+    {
+        kernel[m + radius] = exp(-m * m / (2 * sigma * sigma));
+        sum += kernel[m + radius];
+    }
+    for (int m = 0; m <= 2 * radius; m++)
+    {
+        kernel[m] /= sum;
+    }
+
+    for (int i = 0; i < height; i++)
+    {
+        for (int j = 0; j < width; j++)
+        {
+            double value = 0;
+            for (int m = -radius; m <= radius; m++)
+            {
+                int y = i + m < 0 ? 0 : i + m >= height ? height - 1 : i + m;
+                value += kernel[m + radius] * src->data[y][j];
+            }
+            temp[i * width + j] = value;
+        }
+    }
+
+    for (int i = 0; i < height; i++)
+    {
+        for (int j = 0; j < width; j++)
+        {
+            double value = 0;
+            for (int m = -radius; m <= radius; m++)
+            {
+                int x = j + m < 0 ? 0 : j + m >= width ? width - 1 : j + m;
+                value += kernel[m + radius] * temp[i * width + x];
+            }
+            out[i * width + j] = value;
+        }
+    }
+
+    free(kernel);
+    free(temp);
+    return out;
+}
+
+/**
+ * @brief Compare filter_gaussian() with the direct convolution for a few sigmas
+ *        Prints the largest and the mean absolute difference in gray levels
+ * 
+ * @param pgm 
+ * @return int 0 if every sigma is within the documented tolerance
+ */
+static int check_gaussian(PGM *pgm)
+{
+    double sigmas[] = {1, 1.5, 2, 3.5, 8, 20};
+    int failed = 0;
+
+    for (int s = 0; s < (int)(sizeof(sigmas) / sizeof(sigmas[0])); s++)
+    {
+        if (gaussian_filter_size(sigmas[s]) > pgm->width || gaussian_filter_size(sigmas[s]) > pgm->height)
+        {
+            continue;
+        }
+
+        PGM *fast = filter_gaussian(pgm, sigmas[s], "yes");
+        double *reference = gaussian_reference(pgm, sigmas[s]);
+        double max_diff = 0, mean_diff = 0;
+
+        for (int i = 0; i < pgm->height; i++)
+        {
+            for (int j = 0; j < pgm->width; j++)
+            {
+                double diff = fabs(fast->data[i][j] - reference[i * pgm->width + j]);
+                max_diff = diff > max_diff ? diff : max_diff;
+                mean_diff += diff;
+            }
+        }
+        mean_diff /= (double)pgm->width * pgm->height;
+
+        printf("gaussian sigma %.1f: max diff %.2f, mean diff %.3f\n", sigmas[s], max_diff, mean_diff);
+        failed |= max_diff > 3 || mean_diff > 0.5;
+
+        free(reference);
+        pgm_free(fast);
+    }
+
+    return failed;
+}
+
+/**
+ * @brief Compare the FFT path of filter_convolve() with the direct path for a few random kernels
+ *        Prints the largest difference in gray levels and how many pixels differ
+ * 
+ * @param pgm 
+ * @return int 0 if every kernel is within the documented tolerance of 1 gray level
+ */
+static int check_convolve(PGM *pgm)
+{
+    int sizes[] = {3, 15, 31, 63};
+    int failed = 0;
+
+    srand(1);
+    for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++)
+    {
+        int size = sizes[s];
+        float *kernel;
+        double sum = 0;
+
+        if (size > pgm->width || size > pgm->height)
+        {
+            continue;
+        }
+
+        // Random weights with a positive sum, normalized so the output stays in range
+        kernel = (float *)malloc(size * size * sizeof(float));
+        for (int k = 0; k < size * size; k++)
+        {
+            kernel[k] = (float)rand() / RAND_MAX - 0.3f;
+            sum += kernel[k];
+        }
+        for (int k = 0; k < size * size; k++)
+        {
+            kernel[k] /= (float)sum;
+        }
+
+        PGM *direct = filter_convolve(pgm, kernel, size, size, CONVOLVE_DIRECT, "no");
+        PGM *fft = filter_convolve(pgm, kernel, size, size, CONVOLVE_FFT, "no");
+        int max_diff = 0;
+        long differ = 0;
+
+        for (int i = 0; i < direct->height; i++)
+        {
+            for (int j = 0; j < direct->width; j++)
+            {
+                int diff = abs(direct->data[i][j] - fft->data[i][j]);
+                max_diff = diff > max_diff ? diff : max_diff;
+                differ += diff != 0;
+            }
+        }
+
+        printf("convolve %dx%d: max diff %d, %ld pixels differ\n", size, size, max_diff, differ);
+        failed |= max_diff > 1;
+
+        free(kernel);
+        pgm_free(direct);
+        pgm_free(fft);
+    }
+
+    return failed;
+}
+
+/**
+ * @brief Copy the width x height pixels at the center of pgm into a new image with rows of exactly width bytes,
+ *          so a check reading past a row of the copy is reading past its allocation
+ * 
+ * @param pgm 
+ * @param width 
+ * @param height 
+ * @return PGM* 
+ */
+static PGM *crop_copy(PGM *pgm, int width, int height)
+{
+    PGM *crop = pgm_create(width, height, pgm->max_val, pgm->type);
+    int x = (pgm->width - width) / 2, y = (pgm->height - height) / 2;
+
+    for (int i = 0; i < height; i++)
+    {
+        memcpy(crop->data[i], pgm->data[y + i] + x, width);
+    }
+    return crop;
+}
+
+/**
+ * @brief Resample one output pixel of src straight from the definitions resize_view() documents
+ *        RESAMPLE_AREA integrates the input over the rectangle the output pixel covers,
+ *          RESAMPLE_BILINEAR interpolates between the 4 inputs around the aligned pixel center
+ *        Slow on purpose, it is the reference resize_view() is checked against
+ * 
+ * @param src 
+ * @param width output width
+ * @param height output height
+ * @param i 
+ * @param j 
+ * @param method 
+ * @return double 
+ */
+static double resize_reference(PGM *src, int width, int height, int i, int j, resample_method method)
+{
+    double sx = (double)src->width / width, sy = (double)src->height / height;
+
+    if (method == RESAMPLE_AREA)
+    {
+        double value = 0;
+
+        for (int y = (int)floor(i * sy); y < src->height && y < (i + 1) * sy; y++)
+        {
+            double cy = fmin(y + 1, (i + 1) * sy) - fmax(y, i * sy);
+            for (int x = (int)floor(j * sx); x < src->width && x < (j + 1) * sx; x++)
+            {
+                double cx = fmin(x + 1, (j + 1) * sx) - fmax(x, j * sx);
+                value += cx * cy * src->data[y][x];
+            }
+        }
+        return value / (sx * sy);
+    }
+
+    double py = fmin(fmax((i + 0.5) * sy - 0.5, 0), src->height - 1);
+    double px = fmin(fmax((j + 0.5) * sx - 0.5, 0), src->width - 1);
+    int y0 = (int)floor(py), x0 = (int)floor(px);
+    int y1 = y0 + 1 < src->height ? y0 + 1 : y0, x1 = x0 + 1 < src->width ? x0 + 1 : x0;
+    double fy = py - y0, fx = px - x0;
+
+    return (1 - fy) * ((1 - fx) * src->data[y0][x0] + fx * src->data[y0][x1]) +
+           fy * ((1 - fx) * src->data[y1][x0] + fx * src->data[y1][x1]);
+}
+
+/**
+ * @brief Compare pgm_resize() with the direct definitions for both methods on crops of pgm,
+ *          including 1 pixel wide and high inputs and outputs
+ *        Prints the largest difference in gray levels for each pair of sizes
+ * 
+ * @param pgm 
+ * @return int 0 if every size is within 1 gray level
+ */
+static int check_resize(PGM *pgm)
+{
+    // Input and output width and height, crops are taken from the center of pgm
+    static const int sizes[][4] = {{100, 100, 1, 1}, {100, 100, 37, 23}, {83, 71, 200, 150}, {1, 60, 1, 25},
+                                   {1, 60, 5, 90},   {60, 1, 25, 1},     {60, 1, 90, 4},     {1, 1, 7, 3},
+                                   {5, 5, 1, 1},     {2, 3, 1, 1},       {64, 48, 64, 48},   {97, 13, 13, 97}};
+    static const resample_method methods[] = {RESAMPLE_AREA, RESAMPLE_BILINEAR};
+    static const char *names[] = {"area", "bilinear"};
+    int failed = 0;
+
+    for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++)
+    {
+        PGM *crop;
+
+        if (sizes[s][0] > pgm->width || sizes[s][1] > pgm->height)
+        {
+            continue;
+        }
+        crop = crop_copy(pgm, sizes[s][0], sizes[s][1]);
+
+        for (int m = 0; m < 2; m++)
+        {
+            PGM *resized = pgm_resize(crop, sizes[s][2], sizes[s][3], methods[m]);
+            double max_diff = 0;
+
+            for (int i = 0; i < resized->height; i++)
+            {
+                for (int j = 0; j < resized->width; j++)
+                {
+                    double reference = resize_reference(crop, resized->width, resized->height, i, j, methods[m]);
+                    double diff = fabs(resized->data[i][j] - reference);
+                    max_diff = diff > max_diff ? diff : max_diff;
+                }
+            }
+
+            printf("resize %s %dx%d to %dx%d: max diff %.2f\n", names[m], sizes[s][0], sizes[s][1], sizes[s][2], sizes[s][3],
+                   max_diff);
+            failed |= max_diff > 1;
+            pgm_free(resized);
+        }
+        pgm_free(crop);
+    }
+
+    return failed;
+}
+
+/**
+ * @brief Denoise src with non-local means by comparing every pair of patches pixel by pixel
+ *        Weights are the table entries filter_nlmeans_view() looks up, exp(-t) at the middle of the
+ *          NLMEANS_TABLE steps of [0, NLMEANS_RANGE) the patch distance t falls in, 0 beyond
+ *        Pixels outside the image repeat the edge, output size follows the padding rules
+ *        Slow on purpose, it is the reference filter_nlmeans() is checked against
+ * 
+ * @param src 
+ * @param patch 
+ * @param search 
+ * @param h 
+ * @param padding 
+ * @return double* rows of the output width
+ */
+static double *nlmeans_reference(PGM *src, int patch, int search, double h, char *padding)
+{
+    int pr = patch / 2, sr = search / 2;
+    int offset = strcmp(padding, "yes") == 0 ? 0 : pr + sr;
+    int width = src->width - 2 * offset, height = src->height - 2 * offset;
+    double *out = (double *)malloc((size_t)width * height * sizeof(double));
+
+    for (int i = 0; i < height; i++)
+    {
+        for (int j = 0; j < width; j++)
+        {
+            int ci = i + offset, cj = j + offset;
+            double sum = 0, weights = 0;
+
+            for (int dy = -sr; dy <= sr; dy++)
+            {
+                for (int dx = -sr; dx <= sr; dx++)
+                {
+                    double distance = 0, t, weight = 0;
+
+                    for (int py = -pr; py <= pr; py++)
+                    {
+                        for (int px = -pr; px <= pr; px++)
+                        {
+                            int ay = ci + py, ax = cj + px, by = ay + dy, bx = ax + dx;
+                            int diff;
+
+                            ay = ay < 0 ? 0 : ay >= src->height ? src->height - 1 : ay;
+                            ax = ax < 0 ? 0 : ax >= src->width ? src->width - 1 : ax;
+                            by = by < 0 ? 0 : by >= src->height ? src->height - 1 : by;
+                            bx = bx < 0 ? 0 : bx >= src->width ? src->width - 1 : bx;
+                            diff = src->data[ay][ax] - src->data[by][bx];
+                            distance += diff * diff;
+                        }
+                    }
+
+                    t = distance / (h * h * patch * patch);
+                    if (t < NLMEANS_RANGE)
+                    {
+                        weight = exp(-(floor(t * NLMEANS_TABLE / NLMEANS_RANGE) + 0.5) * NLMEANS_RANGE / NLMEANS_TABLE);
+                    }
+
+                    int ny = ci + dy, nx = cj + dx;
+                    ny = ny < 0 ? 0 : ny >= src->height ? src->height - 1 : ny;
+                    nx = nx < 0 ? 0 : nx >= src->width ? src->width - 1 : nx;
+                    sum += weight * src->data[ny][nx];
+                    weights += weight;
+                }
+            }
+            out[(size_t)i * width + j] = sum / weights;
+        }
+    }
+
+    return out;
+}
+
+/**
+ * @brief Compare filter_nlmeans() with the patch by patch reference on a crop of pgm,
+ *          for a few patch and search sizes and both padding modes
+ *        Prints the largest difference in gray levels and how many pixels differ
+ * 
+ * @param pgm 
+ * @return int 0 if every setting is within 1 gray level
+ */
+static int check_nlmeans(PGM *pgm)
+{
+    static const struct
+    {
+        int patch;
+        int search;
+        double h;
+    } settings[] = {{3, 11, 10}, {5, 11, 15}, {7, 21, 20}, {1, 5, 5}};
+    static char *paddings[] = {"yes", "no"};
+    int size = 64, failed = 0;
+    PGM *crop;
+
+    size = size > pgm->width ? pgm->width : size;
+    size = size > pgm->height ? pgm->height : size;
+    crop = crop_copy(pgm, size, size);
+
+    for (int s = 0; s < (int)(sizeof(settings) / sizeof(settings[0])); s++)
+    {
+        for (int p = 0; p < 2; p++)
+        {
+            PGM *fast;
+            double *reference, max_diff = 0;
+            long differ = 0;
+
+            if (settings[s].patch + settings[s].search - 1 > size)
+            {
+                continue;
+            }
+
+            fast = filter_nlmeans(crop, settings[s].patch, settings[s].search, settings[s].h, paddings[p]);
+            reference = nlmeans_reference(crop, settings[s].patch, settings[s].search, settings[s].h, paddings[p]);
+
+            for (int i = 0; i < fast->height; i++)
+            {
+                for (int j = 0; j < fast->width; j++)
+                {
+                    double value = floor(reference[(size_t)i * fast->width + j] + 0.5);
+                    double diff = fabs(fast->data[i][j] - (value > 255 ? 255 : value));
+                    max_diff = diff > max_diff ? diff : max_diff;
+                    differ += diff != 0;
+                }
+            }
+
+            printf("nlmeans patch %d search %d h %.0f padding %s: max diff %.0f, %ld pixels differ\n", settings[s].patch,
+                   settings[s].search, settings[s].h, paddings[p], max_diff, differ);
+            failed |= max_diff > 1;
+
+            free(reference);
+            pgm_free(fast);
+        }
+    }
+
+    pgm_free(crop);
+    return failed;
+}
+
+/**
+ * @brief Binary test image for the component labeling, 255 on the shapes and 0 elsewhere
+ *        Side by side, each spanning the full height so it crosses every band border:
+ *          a rectangular spiral, a serpentine of U shapes joined alternately at the top and the bottom,
+ *          a checkerboard (one component with 8-connectivity, single pixels with 4) and random pixels
+ * 
+ * @param width 
+ * @param height 
+ * @return PGM* 
+ */
+static PGM *component_shapes(int width, int height)
+{
+    PGM *shapes = pgm_create(width, height, 255, "P5");
+    int spiral = width * 45 / 100, serpentine = width * 75 / 100, checker = width * 85 / 100;
+    int x0 = 0, y0 = 0, x1 = spiral - 2, y1 = height - 1;
+
+    // Rings 2 pixels apart, each ring stops 2 pixels below its top and steps in to the next one
+    while (x0 <= x1 && y0 <= y1)
+    {
+        for (int x = x0; x <= x1; x++)
+        {
+            shapes->data[y0][x] = 255;
+            shapes->data[y1][x] = 255;
+        }
+        for (int y = y0; y <= y1; y++)
+        {
+            shapes->data[y][x1] = 255;
+            shapes->data[y][x0] = y > y0 && y < y0 + 2 ? 0 : 255;
+        }
+        if (y0 + 2 < height && x0 + 1 < width)
+        {
+            shapes->data[y0 + 2][x0 + 1] = 255;
+        }
+        x0 += 2;
+        y0 += 2;
+        x1 -= 2;
+        y1 -= 2;
+    }
+
+    for (int x = spiral, k = 0; x < serpentine; x += 3, k++)
+    {
+        for (int y = 1; y < height - 1; y++)
+        {
+            shapes->data[y][x] = 255;
+        }
+        if (x + 3 < serpentine)
+        {
+            int y = k % 2 == 0 ? height - 2 : 1;
+            shapes->data[y][x + 1] = 255;
+            shapes->data[y][x + 2] = 255;
+        }
+    }
+
+    srand(1);
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = serpentine + 1; x < width; x++)
+        {
+            shapes->data[y][x] = x < checker ? ((x + y) % 2) * 255 : rand() % 2 * 255;
+        }
+    }
+
+    return shapes;
+}
+
+/**
+ * @brief Label the components of src with a serial flood fill, numbered in raster order of their first pixel
+ *        Slow on purpose, it is the reference label_components() is checked against
+ * 
+ * @param src 
+ * @param connectivity 4 or 8
+ * @param labels width * height labels, 0 for the background
+ * @param components set to a malloc'ed array of the statistics of every label
+ * @return int number of components
+ */
+static int components_reference(PGM *src, int connectivity, unsigned int *labels, PGM_component **components)
+{
+    int width = src->width, height = src->height, count = 0, capacity = 64;
+    size_t *stack = (size_t *)malloc((size_t)width * height * sizeof(size_t));
+
+    *components = (PGM_component *)malloc(capacity * sizeof(PGM_component));
+    memset(labels, 0, (size_t)width * height * sizeof(unsigned int));
+
+    for (int i = 0; i < height; i++)
+    {
+        for (int j = 0; j < width; j++)
+        {
+            size_t top = 0;
+            PGM_component *component;
+
+            if (src->data[i][j] == 0 || labels[(size_t)i * width + j] != 0)
+            {
+                continue;
+            }
+            if (count == capacity)
+            {
+                capacity *= 2;
+                *components = (PGM_component *)realloc(*components, capacity * sizeof(PGM_component));
+            }
+
+            component = &(*components)[count++];
+            *component = (PGM_component){0, j, i, j, i};
+            labels[(size_t)i * width + j] = count;
+            stack[top++] = (size_t)i * width + j;
+
+            while (top > 0)
+            {
+                size_t p = stack[--top];
+                int y = (int)(p / width), x = (int)(p % width);
+
+                component->area++;
+                component->left = x < component->left ? x : component->left;
+                component->right = x > component->right ? x : component->right;
+                component->top = y < component->top ? y : component->top;
+                component->bottom = y > component->bottom ? y : component->bottom;
+
+                for (int dy = -1; dy <= 1; dy++)
+                {
+                    for (int dx = -1; dx <= 1; dx++)
+                    {
+                        int ny = y + dy, nx = x + dx;
+
+                        if ((connectivity == 4 && dx != 0 && dy != 0) || ny < 0 || ny >= height || nx < 0 || nx >= width ||
+                            src->data[ny][nx] == 0 || labels[(size_t)ny * width + nx] != 0)
+                        {
+                            continue;
+                        }
+                        labels[(size_t)ny * width + nx] = count;
+                        stack[top++] = (size_t)ny * width + nx;
+                    }
+                }
+            }
+        }
+    }
+
+    free(stack);
+    return count;
+}
+
+/**
+ * @brief Compare label_components() with a serial flood fill, with 4- and 8-connectivity,
+ *          on synthetic shapes that cross the band borders many times and on pgm thresholded at 128
+ *        Labels, areas and bounding boxes must all be identical
+ *        Prints the number of components and of mismatching pixels and components
+ * 
+ * @param pgm 
+ * @return int 0 if everything matches
+ */
+static int check_components(PGM *pgm)
+{
+    PGM *images[2];
+    const char *names[] = {"shapes", "image"};
+    int failed = 0;
+
+    images[0] = component_shapes(640, 600);
+    images[1] = pgm_create(pgm->width, pgm->height, 255, "P5");
+    for (int i = 0; i < pgm->height; i++)
+    {
+        for (int j = 0; j < pgm->width; j++)
+        {
+            images[1]->data[i][j] = pgm->data[i][j] >= 128 ? 255 : 0;
+        }
+    }
+
+    for (int n = 0; n < 2; n++)
+    {
+        PGM *image = images[n];
+        size_t pixels = (size_t)image->width * image->height;
+        unsigned int *fast = (unsigned int *)malloc(pixels * sizeof(unsigned int));
+        unsigned int *reference = (unsigned int *)malloc(pixels * sizeof(unsigned int));
+
+        for (int connectivity = 4; connectivity <= 8; connectivity += 4)
+        {
+            PGM_view src = pgm_view_of(image);
+            PGM_view labels = pgm_view_wrap(fast, image->width, image->height, image->width * sizeof(unsigned int), PGM_DEPTH_32U);
+            PGM_component *fast_components, *reference_components;
+            int count = label_components(&src, &labels, connectivity, &fast_components);
+            int expected = components_reference(image, connectivity, reference, &reference_components);
+            long pixel_errors = 0, component_errors = 0;
+
+            for (size_t p = 0; p < pixels; p++)
+            {
+                pixel_errors += fast[p] != reference[p];
+            }
+            for (int c = 0; c < count && c < expected; c++)
+            {
+                const PGM_component *a = &fast_components[c], *b = &reference_components[c];
+                component_errors += a->area != b->area || a->left != b->left || a->top != b->top || a->right != b->right ||
+                                    a->bottom != b->bottom;
+            }
+
+            printf("components %s %d-connected: %d components, expected %d, %ld labels and %ld statistics differ\n", names[n],
+                   connectivity, count, expected, pixel_errors, component_errors);
+            failed |= count != expected || pixel_errors != 0 || component_errors != 0;
+
+            free(fast_components);
+            free(reference_components);
+        }
+
+        free(fast);
+        free(reference);
+        pgm_free(image);
+    }
+
+    return failed;
+}
+
+/**
+ * @brief Pixel of the source a geometric transform writes to pixel (x, y) of its output, by index math
+ *        Transforms are numbered as in check_transform()
+ * 
+ * @param transform 
+ * @param width source width
+ * @param height source height
+ * @param x 
+ * @param y 
+ * @param sx 
+ * @param sy 
+ */
+static void transform_source(int transform, int width, int height, int x, int y, int *sx, int *sy)
+{
+    switch (transform)
+    {
+    case 0: // transpose
+        *sx = y;
+        *sy = x;
+        break;
+    case 1: // rotate 0
+        *sx = x;
+        *sy = y;
+        break;
+    case 2: // rotate 90 clockwise
+        *sx = y;
+        *sy = height - 1 - x;
+        break;
+    case 3: // rotate 180
+        *sx = width - 1 - x;
+        *sy = height - 1 - y;
+        break;
+    case 4: // rotate 270 clockwise
+        *sx = width - 1 - y;
+        *sy = x;
+        break;
+    case 5: // flip left and right
+        *sx = width - 1 - x;
+        *sy = y;
+        break;
+    default: // flip top and bottom
+        *sx = x;
+        *sy = height - 1 - y;
+        break;
+    }
+}
+
+/**
+ * @brief Compare transpose_view(), rotate_view() and flip_view() with index math, for every depth,
+ *          on odd sizes that leave edges next to the register blocks and the tiles, and 1 pixel wide or high ones
+ *        Sources have a padded stride and random pixels, every output pixel must match exactly
+ *        Prints the number of wrong pixels per transform and depth
+ * 
+ * @return int 0 if every output matches
+ */
+static int check_transform(void)
+{
+    static const int sizes[][2] = {{83, 71}, {1, 57}, {57, 1}, {1, 1}, {16, 16}, {64, 64}, {130, 67}, {200, 3}, {17, 129}};
+    static const PGM_depth depths[] = {PGM_DEPTH_8U, PGM_DEPTH_16U, PGM_DEPTH_32F};
+    static const int pixel_sizes[] = {1, 2, 4};
+    static const char *names[] = {"transpose", "rotate 0", "rotate 90", "rotate 180", "rotate 270", "flip horizontal",
+                                  "flip vertical"};
+    int failed = 0;
+
+    srand(1);
+    for (int t = 0; t < 7; t++)
+    {
+        for (int d = 0; d < 3; d++)
+        {
+            int size = pixel_sizes[d];
+            long wrong = 0;
+
+            for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++)
+            {
+                int width = sizes[s][0], height = sizes[s][1];
+                int swap = t == 0 || t == 2 || t == 4;
+                int out_width = swap ? height : width, out_height = swap ? width : height;
+                ptrdiff_t stride = (ptrdiff_t)(width + 3) * size;
+                unsigned char *in = (unsigned char *)malloc((size_t)stride * height);
+                unsigned char *out = (unsigned char *)malloc((size_t)out_width * out_height * size);
+                PGM_view src = pgm_view_wrap(in, width, height, stride, depths[d]);
+                PGM_view dst = pgm_view_wrap(out, out_width, out_height, (ptrdiff_t)out_width * size, depths[d]);
+
+                for (size_t b = 0; b < (size_t)stride * height; b++)
+                {
+                    in[b] = (unsigned char)rand();
+                }
+
+                if (t == 0)
+                {
+                    transpose_view(&src, &dst);
+                }
+                else if (t <= 4)
+                {
+                    rotate_view(&src, &dst, 90 * (t - 1));
+                }
+                else
+                {
+                    flip_view(&src, &dst, t == 5);
+                }
+
+                for (int y = 0; y < out_height; y++)
+                {
+                    for (int x = 0; x < out_width; x++)
+                    {
+                        int sx, sy;
+
+                        transform_source(t, width, height, x, y, &sx, &sy);
+                        wrong += memcmp(PGM_VIEW_ROW(&dst, unsigned char, y) + (ptrdiff_t)x * size,
+                                        PGM_VIEW_ROW(&src, unsigned char, sy) + (ptrdiff_t)sx * size, size) != 0;
+                    }
+                }
+
+                free(in);
+                free(out);
+            }
+
+            printf("%s %d-bit: %ld pixels wrong\n", names[t], 8 * size, wrong);
+            failed |= wrong != 0;
+        }
+    }
+
+    return failed;
+}
+
+/**
+ * @brief Minimum or maximum of every filter_width x filter_height window inside a width x height image
+ *        Slow on purpose, it is the reference filter_morphology() is checked against
+ * 
+ * @param in rows of width pixels
+ * @param width 
+ * @param height 
+ * @param filter_width 
+ * @param filter_height 
+ * @param dilate non zero for the maximum
+ * @return unsigned char* (width - filter_width + 1) x (height - filter_height + 1) pixels
+ */
+static unsigned char *morphology_reference(const unsigned char *in, int width, int height, int filter_width,
+                                           int filter_height, int dilate)
+{
+    int out_width = width - filter_width + 1, out_height = height - filter_height + 1;
+    unsigned char *out = (unsigned char *)malloc((size_t)out_width * out_height);
+
+    for (int i = 0; i < out_height; i++)
+    {
+        for (int j = 0; j < out_width; j++)
+        {
+            unsigned char value = dilate ? 0 : 255;
+
+            for (int m = 0; m < filter_height; m++)
+            {
+                for (int n = 0; n < filter_width; n++)
+                {
+                    unsigned char pixel = in[(size_t)(i + m) * width + j + n];
+                    value = dilate ? (pixel > value ? pixel : value) : (pixel < value ? pixel : value);
+                }
+            }
+            out[(size_t)i * out_width + j] = value;
+        }
+    }
+
+    return out;
+}
+
+/**
+ * @brief Compare every operation of filter_morphology() with min and max taken window by window,
+ *          for square, flat and tall rectangles on two crops of pgm, the second narrower than a strip
+ *        Prints the number of wrong pixels per operation and rectangle, results must be identical
+ * 
+ * @param pgm 
+ * @return int 0 if every output matches
+ */
+static int check_morphology(PGM *pgm)
+{
+    static const int crops[][2] = {{300, 280}, {77, 301}};
+    static const int rectangles[][2] = {{1, 1}, {3, 3}, {5, 3}, {3, 9}, {15, 15}, {7, 1}, {1, 7}, {31, 5}};
+    static const char *names[] = {"erode", "dilate", "open", "close", "top-hat", "black-hat"};
+    int failed = 0;
+
+    for (int c = 0; c < 2; c++)
+    {
+        PGM *crop;
+
+        if (crops[c][0] > pgm->width || crops[c][1] > pgm->height)
+        {
+            continue;
+        }
+        crop = crop_copy(pgm, crops[c][0], crops[c][1]);
+
+        for (int r = 0; r < (int)(sizeof(rectangles) / sizeof(rectangles[0])); r++)
+        {
+            int fw = rectangles[r][0], fh = rectangles[r][1];
+            int width = crop->width - fw + 1, height = crop->height - fh + 1;
+            unsigned char *eroded = morphology_reference(crop->data[0], crop->width, crop->height, fw, fh, 0);
+            unsigned char *dilated = morphology_reference(crop->data[0], crop->width, crop->height, fw, fh, 1);
+            unsigned char *opened = morphology_reference(eroded, width, height, fw, fh, 1);
+            unsigned char *closed = morphology_reference(dilated, width, height, fw, fh, 0);
+
+            for (int op = MORPH_ERODE; op <= MORPH_BLACKHAT; op++)
+            {
+                int span = op == MORPH_ERODE || op == MORPH_DILATE ? 1 : 2;
+                PGM *fast = filter_morphology(crop, (morph_op)op, fw, fh, "no");
+                const unsigned char *reference[] = {eroded, dilated, opened, closed, opened, closed};
+                int stride = crop->width - span * (fw - 1);
+                long wrong = 0;
+
+                for (int i = 0; i < fast->height; i++)
+                {
+                    for (int j = 0; j < fast->width; j++)
+                    {
+                        int value = reference[op][(size_t)i * stride + j];
+                        int center = crop->data[i + fh - 1][j + fw - 1];
+
+                        value = op == MORPH_TOPHAT ? center - value : op == MORPH_BLACKHAT ? value - center : value;
+                        wrong += fast->data[i][j] != value;
+                    }
+                }
+
+                printf("morphology %s %dx%d on %dx%d: %ld pixels wrong\n", names[op], fw, fh, crop->width, crop->height, wrong);
+                failed |= wrong != 0;
+                pgm_free(fast);
+            }
+
+            free(eroded);
+            free(dilated);
+            free(opened);
+            free(closed);
+        }
+        pgm_free(crop);
+    }
+
+    return failed;
+}
+
+/**
+ * @brief Local threshold of one pixel from the mean and standard deviation of its window, summed pixel by pixel
+ *        With padding "yes" the window is clipped to the image
+ *        Slow on purpose, it is the reference filter_threshold() is checked against
+ * 
+ * @param src 
+ * @param y 
+ * @param x 
+ * @param method 
+ * @param window 
+ * @param k 
+ * @return double 
+ */
+static double threshold_reference(PGM *src, int y, int x, threshold_method method, int window, double k)
+{
+    int radius = window / 2;
+    int top = y - radius < 0 ? 0 : y - radius, bottom = y + radius >= src->height ? src->height - 1 : y + radius;
+    int left = x - radius < 0 ? 0 : x - radius, right = x + radius >= src->width ? src->width - 1 : x + radius;
+    long long sum = 0, squares = 0;
+    double count = (double)(right - left + 1) * (bottom - top + 1), mean, variance, deviation;
+
+    for (int i = top; i <= bottom; i++)
+    {
+        for (int j = left; j <= right; j++)
+        {
+            sum += src->data[i][j];
+            squares += src->data[i][j] * src->data[i][j];
+        }
+    }
+
+    mean = sum / count;
+    variance = squares / count - mean * mean;
+    deviation = variance > 0 ? sqrt(variance) : 0;
+    return method == THRESHOLD_NIBLACK ? mean + k * deviation : mean * (1 + k * (deviation / 128.0 - 1));
+}
+
+/**
+ * @brief Compare filter_threshold() with thresholds from windows summed pixel by pixel,
+ *          for Niblack and Sauvola, several windows and both padding modes
+ *        A pixel within 1e-6 of its threshold may land on either side, every other pixel must match
+ *        Prints the number of wrong pixels for each setting
+ * 
+ * @param pgm 
+ * @return int 0 if every output matches
+ */
+static int check_threshold(PGM *pgm)
+{
+    static const struct
+    {
+        threshold_method method;
+        const char *name;
+        double k;
+    } methods[] = {{THRESHOLD_NIBLACK, "niblack", -0.2}, {THRESHOLD_SAUVOLA, "sauvola", 0.3}};
+    static const int windows[] = {3, 15, 41};
+    static char *paddings[] = {"yes", "no"};
+    int failed = 0;
+
+    for (int m = 0; m < 2; m++)
+    {
+        for (int w = 0; w < (int)(sizeof(windows) / sizeof(windows[0])); w++)
+        {
+            for (int p = 0; p < 2; p++)
+            {
+                int window = windows[w], offset = p == 0 ? 0 : window / 2;
+                PGM *fast;
+                long wrong = 0;
+
+                if (window > pgm->width || window > pgm->height)
+                {
+                    continue;
+                }
+
+                fast = filter_threshold(pgm, methods[m].method, window, methods[m].k, paddings[p]);
+                for (int i = 0; i < fast->height; i++)
+                {
+                    for (int j = 0; j < fast->width; j++)
+                    {
+                        int pixel = pgm->data[i + offset][j + offset];
+                        double threshold = threshold_reference(pgm, i + offset, j + offset, methods[m].method, window, methods[m].k);
+
+                        wrong += fast->data[i][j] != (pixel > threshold ? 255 : 0) && fabs(pixel - threshold) > 1e-6;
+                    }
+                }
+
+                printf("threshold %s window %d padding %s: %ld pixels wrong\n", methods[m].name, window, paddings[p], wrong);
+                failed |= wrong != 0;
+                pgm_free(fast);
+            }
+        }
+    }
+
+    return failed;
+}
+
+/**
+ * @brief Contrast limited adaptive histogram equalization with a plain histogram per tile
+ *          and the 4 surrounding tables blended with exact weights in double
+ *        Tiles, clipping and tables follow filter_clahe_view()
+ *        Slow on purpose, it is the reference filter_clahe() is checked against
+ * 
+ * @param src 
+ * @param tiles_x 
+ * @param tiles_y 
+ * @param clip_limit 
+ * @return double* width * height values
+ */
+static double *clahe_reference(PGM *src, int tiles_x, int tiles_y, double clip_limit)
+{
+    int width = src->width, height = src->height;
+    double tile_width = (double)width / tiles_x, tile_height = (double)height / tiles_y;
+    double *luts = (double *)malloc((size_t)tiles_x * tiles_y * 256 * sizeof(double));
+    double *out = (double *)malloc((size_t)width * height * sizeof(double));
+
+    for (int ty = 0; ty < tiles_y; ty++)
+    {
+        for (int tx = 0; tx < tiles_x; tx++)
+        {
+            int x0 = (int)(tx * tile_width), x1 = tx == tiles_x - 1 ? width : (int)((tx + 1) * tile_width);
+            int y0 = (int)(ty * tile_height), y1 = ty == tiles_y - 1 ? height : (int)((ty + 1) * tile_height);
+            unsigned int pixels = (unsigned int)(x1 - x0) * (y1 - y0), histogram[256] = {0}, cumulative = 0;
+            double *lut = luts + ((size_t)ty * tiles_x + tx) * 256;
+
+            for (int i = y0; i < y1; i++)
+            {
+                for (int j = x0; j < x1; j++)
+                {
+                    histogram[src->data[i][j]]++;
+                }
+            }
+
+            if (clip_limit > 0)
+            {
+                unsigned int limit = (unsigned int)(clip_limit * pixels / 256), excess = 0;
+
+                limit = limit < 1 ? 1 : limit;
+                for (int v = 0; v < 256; v++)
+                {
+                    excess += histogram[v] > limit ? histogram[v] - limit : 0;
+                    histogram[v] = histogram[v] > limit ? limit : histogram[v];
+                }
+                // The excess is spread evenly, the remainder one count at a time every 256 / remainder bins
+                for (int v = 0; v < 256; v++)
+                {
+                    histogram[v] += excess / 256;
+                }
+                for (unsigned int r = 0; r < excess % 256; r++)
+                {
+                    histogram[r * (256 / (excess % 256))]++;
+                }
+            }
+
+            for (int v = 0; v < 256; v++)
+            {
+                cumulative += histogram[v];
+                lut[v] = floor(cumulative * 255.0 / pixels + 0.5);
+            }
+        }
+    }
+
+    for (int i = 0; i < height; i++)
+    {
+        // Clamped to the last tile, where the weight of the next one is 0
+        double py = fmin(fmax((i + 0.5) / tile_height - 0.5, 0), tiles_y - 1);
+        int top = (int)py, bottom = top + 1 < tiles_y ? top + 1 : top;
+
+        for (int j = 0; j < width; j++)
+        {
+            double px = fmin(fmax((j + 0.5) / tile_width - 0.5, 0), tiles_x - 1);
+            int left = (int)px, right = left + 1 < tiles_x ? left + 1 : left;
+            int v = src->data[i][j];
+            double upper = (left + 1 - px) * luts[((size_t)top * tiles_x + left) * 256 + v] +
+                           (px - left) * luts[((size_t)top * tiles_x + right) * 256 + v];
+            double lower = (left + 1 - px) * luts[((size_t)bottom * tiles_x + left) * 256 + v] +
+                           (px - left) * luts[((size_t)bottom * tiles_x + right) * 256 + v];
+
+            out[(size_t)i * width + j] = (top + 1 - py) * upper + (py - top) * lower;
+        }
+    }
+
+    free(luts);
+    return out;
+}
+
+/**
+ * @brief Compare filter_clahe() with the per tile histogram reference for a few tile grids and clip limits
+ *        The filter blends tables with weights in 1/256, so results may differ by 1 gray level
+ *        Prints the largest difference and how many pixels differ
+ * 
+ * @param pgm 
+ * @return int 0 if every setting is within 1 gray level
+ */
+static int check_clahe(PGM *pgm)
+{
+    static const struct
+    {
+        int tiles_x;
+        int tiles_y;
+        double clip_limit;
+    } settings[] = {{8, 8, 2}, {8, 8, 0}, {3, 5, 4}, {1, 1, 2}, {16, 12, 3}, {7, 9, 1}};
+    int failed = 0;
+
+    for (int s = 0; s < (int)(sizeof(settings) / sizeof(settings[0])); s++)
+    {
+        PGM *fast;
+        double *reference, max_diff = 0;
+        long differ = 0;
+
+        if (settings[s].tiles_x > pgm->width || settings[s].tiles_y > pgm->height)
+        {
+            continue;
+        }
+
+        fast = filter_clahe(pgm, settings[s].tiles_x, settings[s].tiles_y, settings[s].clip_limit);
+        reference = clahe_reference(pgm, settings[s].tiles_x, settings[s].tiles_y, settings[s].clip_limit);
+        for (int i = 0; i < pgm->height; i++)
+        {
+            for (int j = 0; j < pgm->width; j++)
+            {
+                double diff = fabs(fast->data[i][j] - floor(reference[(size_t)i * pgm->width + j] + 0.5));
+                max_diff = diff > max_diff ? diff : max_diff;
+                differ += diff != 0;
+            }
+        }
+
+        printf("clahe %dx%d tiles clip %.1f: max diff %.0f, %ld pixels differ\n", settings[s].tiles_x, settings[s].tiles_y,
+               settings[s].clip_limit, max_diff, differ);
+        failed |= max_diff > 1;
+
+        free(reference);
+        pgm_free(fast);
+    }
+
+    return failed;
+}
+
+/**
+ * @brief Order corners by decreasing score, then in raster order, like detect_corners()
+ * 
+ * @param a 
+ * @param b 
+ * @return int 
+ */
+static int corners_compare(const void *a, const void *b)
+{
+    const PGM_corner *p = (const PGM_corner *)a, *q = (const PGM_corner *)b;
+
+    if (p->score != q->score)
+    {
+        return p->score > q->score ? -1 : 1;
+    }
+    if (p->y != q->y)
+    {
+        return p->y < q->y ? -1 : 1;
+    }
+    return p->x < q->x ? -1 : p->x > q->x;
+}
+
+/**
+ * @brief Structure tensor response of every pixel from its window summed pixel by pixel in double
+ *        CORNER_BOX averages the products of the window clipped to the image, CORNER_GAUSSIAN weights
+ *          them with a sampled Gaussian of sigma (window - 1) / 6 out to 6 sigma, repeating the edge products
+ *        Slow on purpose, it is the reference corner_response_view() is checked against
+ * 
+ * @param src 
+ * @param method 
+ * @param shape 
+ * @param window 
+ * @param k 
+ * @return double* width * height values
+ */
+static double *corners_reference(PGM *src, corner_method method, corner_window shape, int window, double k)
+{
+    int width = src->width, height = src->height;
+    int radius = shape == CORNER_BOX ? window / 2 : window - 1;
+    double sigma = (window - 1) / 6.0, weights[2 * 64 + 1], total = 0;
+    double *products = (double *)calloc((size_t)3 * width * height, sizeof(double));
+    double *out = (double *)malloc((size_t)width * height * sizeof(double));
+
+    for (int d = -radius; d <= radius && shape == CORNER_GAUSSIAN; d++)
+    {
+        weights[d + radius] = exp(-d * d / (2 * sigma * sigma));
+        total += weights[d + radius];
+    }
+
+    for (int i = 1; i < height - 1; i++)
+    {
+        for (int j = 1; j < width - 1; j++)
+        {
+            unsigned char **p = src->data;
+            int gx = p[i - 1][j + 1] - p[i - 1][j - 1] + 2 * (p[i][j + 1] - p[i][j - 1]) + p[i + 1][j + 1] - p[i + 1][j - 1];
+            int gy = p[i + 1][j - 1] + 2 * p[i + 1][j] + p[i + 1][j + 1] - p[i - 1][j - 1] - 2 * p[i - 1][j] - p[i - 1][j + 1];
+            size_t at = 3 * ((size_t)i * width + j);
+
+            products[at] = gx * gx;
+            products[at + 1] = gy * gy;
+            products[at + 2] = gx * gy;
+        }
+    }
+
+    for (int i = 0; i < height; i++)
+    {
+        for (int j = 0; j < width; j++)
+        {
+            double a = 0, c = 0, b = 0, area = 0;
+
+            for (int di = -radius; di <= radius; di++)
+            {
+                for (int dj = -radius; dj <= radius; dj++)
+                {
+                    int y = i + di, x = j + dj;
+                    double weight;
+
+                    if (shape == CORNER_BOX)
+                    {
+                        if (y < 0 || y >= height || x < 0 || x >= width)
+                        {
+                            continue;
+                        }
+                        weight = 1;
+                    }
+                    else
+                    {
+                        y = y < 0 ? 0 : y >= height ? height - 1 : y;
+                        x = x < 0 ? 0 : x >= width ? width - 1 : x;
+                        weight = weights[di + radius] * weights[dj + radius] / (total * total);
+                    }
+                    a += weight * products[3 * ((size_t)y * width + x)];
+                    c += weight * products[3 * ((size_t)y * width + x) + 1];
+                    b += weight * products[3 * ((size_t)y * width + x) + 2];
+                    area += weight;
+                }
+            }
+
+            a /= area;
+            b /= area;
+            c /= area;
+            out[(size_t)i * width + j] = method == CORNER_HARRIS ? a * c - b * b - k * (a + c) * (a + c)
+                                                                  : (a + c) / 2 - sqrt((a - c) * (a - c) / 4 + b * b);
+        }
+    }
+
+    free(products);
+    return out;
+}
+
+/**
+ * @brief Compare corner_response_view() with the direct structure tensor for Harris and Shi-Tomasi,
+ *          box and Gaussian windows, on a crop spanning several bands
+ *        The box must agree to float rounding, the recursive Gaussian within 5% of the strongest response:
+ *          its products are within about 1% of the sampled kernel at sigma 1, and the determinant and the
+ *          eigenvalue difference cancel most of them on strong edges
+ *        detect_corners() must return the pixels that are the largest within radius of the response in
+ *          raster order of ties, with the order and the cut of corner_compare(); for the Gaussian, whose bands
+ *          start their halo elsewhere, scores are only compared with the reference
+ *        Prints the largest difference relative to the strongest response and the number of corners
+ * 
+ * @param pgm 
+ * @return int 0 if every setting matches
+ */
+static int check_corners(PGM *pgm)
+{
+    static const struct
+    {
+        corner_window shape;
+        const char *name;
+        int window;
+    } windows[] = {{CORNER_BOX, "box", 3}, {CORNER_BOX, "box", 9}, {CORNER_GAUSSIAN, "gaussian", 7}, {CORNER_GAUSSIAN, "gaussian", 13}};
+    static const struct
+    {
+        corner_method method;
+        const char *name;
+        double k;
+    } methods[] = {{CORNER_HARRIS, "harris", 0.05}, {CORNER_SHI_TOMASI, "shi-tomasi", 0}};
+    const int radius = 4;
+    const double quality = 0.001;
+    PGM *crop = crop_copy(pgm, pgm->width < 300 ? pgm->width : 300, pgm->height < 200 ? pgm->height : 200);
+    int width = crop->width, height = crop->height, failed = 0;
+    float *response = (float *)malloc((size_t)width * height * sizeof(float));
+    PGM_view src = pgm_view_of(crop);
+    PGM_view dst = pgm_view_wrap(response, width, height, width * sizeof(float), PGM_DEPTH_32F);
+
+    for (int w = 0; w < (int)(sizeof(windows) / sizeof(windows[0])); w++)
+    {
+        for (int m = 0; m < 2; m++)
+        {
+            double *reference = corners_reference(crop, methods[m].method, windows[w].shape, windows[w].window, methods[m].k);
+            double peak = 0, max_diff = 0, score_diff = 0, tolerance;
+            PGM_corner *corners, *expected = NULL;
+            int count, expected_count = 0, wrong = 0;
+
+            corner_response_view(&src, &dst, methods[m].method, windows[w].shape, windows[w].window, methods[m].k);
+            for (size_t p = 0; p < (size_t)width * height; p++)
+            {
+                peak = fabs(reference[p]) > peak ? fabs(reference[p]) : peak;
+            }
+            for (size_t p = 0; p < (size_t)width * height; p++)
+            {
+                double diff = fabs(response[p] - reference[p]) / peak;
+                max_diff = diff > max_diff ? diff : max_diff;
+            }
+            tolerance = windows[w].shape == CORNER_BOX ? 1e-5 : 0.05;
+
+            count = detect_corners(&src, methods[m].method, windows[w].shape, windows[w].window, methods[m].k, radius, quality,
+                                   0, &corners);
+            for (int c = 0; c < count; c++)
+            {
+                double diff = fabs(corners[c].score - reference[(size_t)corners[c].y * width + corners[c].x]) / peak;
+                score_diff = diff > score_diff ? diff : score_diff;
+            }
+
+            if (windows[w].shape == CORNER_BOX)
+            {
+                // Peaks of the response, pixel by pixel, then sorted and cut as detect_corners() does
+                expected = (PGM_corner *)malloc((size_t)width * height * sizeof(PGM_corner));
+                for (int i = 0; i < height; i++)
+                {
+                    for (int j = 0; j < width; j++)
+                    {
+                        float value = response[(size_t)i * width + j];
+                        int is_peak = value > 0;
+
+                        for (int y = i - radius; is_peak && y <= i + radius; y++)
+                        {
+                            for (int x = j - radius; is_peak && x <= j + radius; x++)
+                            {
+                                float near;
+
+                                if (y < 0 || y >= height || x < 0 || x >= width || (y == i && x == j))
+                                {
+                                    continue;
+                                }
+                                near = response[(size_t)y * width + x];
+                                is_peak = near < value || (near == value && (y > i || (y == i && x > j)));
+                            }
+                        }
+                        if (is_peak)
+                        {
+                            expected[expected_count].x = j;
+                            expected[expected_count].y = i;
+                            expected[expected_count].score = value;
+                            expected_count++;
+                        }
+                    }
+                }
+                qsort(expected, expected_count, sizeof(PGM_corner), corners_compare);
+                for (int kept = 0; kept < expected_count; kept++)
+                {
+                    if (expected[kept].score < (float)(quality * expected[0].score))
+                    {
+                        expected_count = kept;
+                        break;
+                    }
+                }
+
+                wrong = count != expected_count;
+                for (int c = 0; c < count && !wrong; c++)
+                {
+                    wrong = corners[c].x != expected[c].x || corners[c].y != expected[c].y || corners[c].score != expected[c].score;
+                }
+                free(expected);
+            }
+
+            printf("corners %s %s window %d: max diff %.2e, %d corners, score diff %.2e%s\n", methods[m].name, windows[w].name,
+                   windows[w].window, max_diff, count, score_diff, wrong ? ", corner list differs" : "");
+            failed |= max_diff > tolerance || score_diff > tolerance || count == 0 || wrong;
+
+            free(corners);
+            free(reference);
+        }
+    }
+
+    free(response);
+    pgm_free(crop);
+    return failed;
+}
+
+/**
+ * @brief Order lines by decreasing votes, then by angle and rho, like detect_lines()
+ * 
+ * @param a 
+ * @param b 
+ * @return int 
+ */
+static int lines_compare(const void *a, const void *b)
+{
+    const PGM_line *p = (const PGM_line *)a, *q = (const PGM_line *)b;
+
+    if (p->votes != q->votes)
+    {
+        return p->votes > q->votes ? -1 : 1;
+    }
+    if (p->theta != q->theta)
+    {
+        return p->theta < q->theta ? -1 : 1;
+    }
+    return p->rho < q->rho ? -1 : p->rho > q->rho;
+}
+
+/**
+ * @brief Draw the line x cos(theta) + y sin(theta) = rho one pixel per row or column, whichever it crosses more of
+ * 
+ * @param img 
+ * @param theta 
+ * @param rho 
+ */
+static void hough_draw(PGM *img, double theta, double rho)
+{
+    double c = cos(theta), s = sin(theta);
+
+    if (fabs(s) >= fabs(c))
+    {
+        for (int x = 0; x < img->width; x++)
+        {
+            int y = (int)floor((rho - x * c) / s + 0.5);
+            if (y >= 0 && y < img->height)
+            {
+                img->data[y][x] = 255;
+            }
+        }
+    }
+    else
+    {
+        for (int y = 0; y < img->height; y++)
+        {
+            int x = (int)floor((rho - y * s) / c + 0.5);
+            if (x >= 0 && x < img->width)
+            {
+                img->data[y][x] = 255;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Hough lines of src straight from the definition: every edge pixel adds one vote per angle,
+ *          then a cell is a line if no cell within radius angles and rho has more votes, or as many earlier in memory,
+ *          with angles past the ends taken from the other end at the opposite rho
+ *        Cells use the float expression of detect_lines() so a rho halfway between two cells rounds the same way
+ *        Slow on purpose, it is the reference detect_lines() is checked against
+ * 
+ * @param src 
+ * @param theta_steps 
+ * @param threshold 
+ * @param radius 
+ * @param votes set to the theta_steps x (2 * rho_max + 1) accumulator, freed by the caller
+ * @param lines set to the lines sorted like detect_lines(), freed by the caller
+ * @return int number of lines
+ */
+static int hough_reference(PGM *src, int theta_steps, int threshold, int radius, unsigned int **votes, PGM_line **lines)
+{
+    int rho_max = (int)ceil(sqrt((double)src->width * src->width + (double)src->height * src->height));
+    int bins = 2 * rho_max + 1, count = 0;
+    unsigned int *acc = (unsigned int *)calloc((size_t)theta_steps * bins, sizeof(unsigned int));
+    PGM_line *found = (PGM_line *)malloc(((size_t)theta_steps * bins + 1) * sizeof(PGM_line));
+
+    for (int y = 0; y < src->height; y++)
+    {
+        for (int x = 0; x < src->width; x++)
+        {
+            for (int t = 0; src->data[y][x] != 0 && t < theta_steps; t++)
+            {
+                float c = (float)cos(M_PI * t / theta_steps), s = (float)sin(M_PI * t / theta_steps);
+                acc[(size_t)t * bins + (int)(x * c + y * s + (rho_max + 0.5f))]++;
+            }
+        }
+    }
+
+    for (int t = 0; t < theta_steps; t++)
+    {
+        for (int r = 0; r < bins; r++)
+        {
+            unsigned int value = acc[(size_t)t * bins + r];
+            int peak = value >= (unsigned int)threshold;
+
+            for (int dt = -radius; peak && dt <= radius; dt++)
+            {
+                for (int dr = -radius; peak && dr <= radius; dr++)
+                {
+                    // The line at angle t + dt, rho r + dr, as a cell of the accumulator
+                    int nt = t + dt, rho = r + dr - rho_max;
+                    size_t other;
+
+                    if (nt < 0 || nt >= theta_steps)
+                    {
+                        nt += nt < 0 ? theta_steps : -theta_steps;
+                        rho = -rho;
+                    }
+                    if (nt < 0 || nt >= theta_steps || rho < -rho_max || rho > rho_max || (dt == 0 && dr == 0))
+                    {
+                        continue;
+                    }
+                    other = (size_t)nt * bins + rho + rho_max;
+                    peak = acc[other] < value || (acc[other] == value && other > (size_t)t * bins + r);
+                }
+            }
+
+            if (peak)
+            {
+                found[count].rho = (float)(r - rho_max);
+                found[count].theta = (float)(M_PI * t / theta_steps);
+                found[count].votes = (int)value;
+                count++;
+            }
+        }
+    }
+
+    qsort(found, count, sizeof(PGM_line), lines_compare);
+    *votes = acc;
+    *lines = found;
+    return count;
+}
+
+/**
+ * @brief Check detect_lines() on synthetic lines at known angles and rho, with noise pixels
+ *        Two of the lines are vertical or one step from it, at theta = 0 and 179 degrees; one step away,
+ *          across the ends of the accumulator, they leave spread out votes that only the mirrored suppression removes
+ *        At a threshold of 50, which those votes pass, HOUGH_STANDARD with 1, 3 and 8 threads, so the per thread
+ *          accumulators are summed, must return the lines of hough_reference() exactly
+ *        At a threshold of 200, both methods must find every planted line once within one angle step and 1 pixel
+ *          of rho, and nothing else
+ *        The votes of every probabilistic line must be the exact ones of the reference accumulator
+ *        Prints the number of lines and how many are wrong, and the lines of the runs at 200
+ * 
+ * @param pgm not used, the lines are drawn on an image of their own
+ * @return int 0 if every run matches
+ */
+static int check_hough(PGM *pgm)
+{
+    static const struct
+    {
+        double degrees;
+        double rho;
+    } planted[] = {{30, 120}, {90, 200}, {0, 80}, {179, -380}, {135, -40}, {62, 250}};
+    static const struct
+    {
+        hough_method method;
+        int threads;
+        int threshold;
+    } runs[] = {{HOUGH_STANDARD, 1, 50}, {HOUGH_STANDARD, 3, 50},      {HOUGH_STANDARD, 8, 50},
+                {HOUGH_STANDARD, 0, 200}, {HOUGH_PROBABILISTIC, 3, 50}, {HOUGH_PROBABILISTIC, 0, 200}};
+    const int theta_steps = 180, radius = 4, lines_planted = sizeof(planted) / sizeof(planted[0]);
+    PGM *edges = pgm_create(480, 480, 255, "P5");
+    PGM_view src = pgm_view_of(edges);
+    unsigned int *votes, seed = 1;
+    PGM_line *expected;
+    int expected_count, rho_max = (int)ceil(sqrt(2 * 480.0 * 480)), failed = 0, team = omp_get_max_threads();
+
+    (void)pgm;
+    for (int l = 0; l < lines_planted; l++)
+    {
+        hough_draw(edges, planted[l].degrees * M_PI / 180, planted[l].rho);
+    }
+    for (int n = 0; n < 2000; n++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        edges->data[(seed >> 8) % 480][(seed >> 20) % 480] = 255;
+    }
+    expected_count = hough_reference(edges, theta_steps, 50, radius, &votes, &expected);
+
+    for (int run = 0; run < (int)(sizeof(runs) / sizeof(runs[0])); run++)
+    {
+        int threads = runs[run].threads > 0 ? runs[run].threads : team, count, wrong = 0;
+        PGM_line *lines;
+
+        omp_set_num_threads(threads);
+        count = detect_lines(&src, runs[run].method, theta_steps, 0.3, runs[run].threshold, radius, 0, &lines);
+        omp_set_num_threads(team);
+
+        if (runs[run].threshold == 200)
+        {
+            // Every planted line once, as (theta, rho) or across the ends as (theta - pi, -rho)
+            for (int l = 0; l < lines_planted; l++)
+            {
+                int matches = 0;
+
+                for (int c = 0; c < count; c++)
+                {
+                    double dt = lines[c].theta * 180 / M_PI - planted[l].degrees, rho = lines[c].rho;
+
+                    if (dt < -90)
+                    {
+                        dt += 180;
+                        rho = -rho;
+                    }
+                    matches += fabs(dt) <= 180.0 / theta_steps && fabs(rho - planted[l].rho) <= 1;
+                }
+                wrong += matches != 1;
+            }
+            wrong += count != lines_planted;
+        }
+        else if (runs[run].method == HOUGH_STANDARD)
+        {
+            wrong += count != expected_count;
+            for (int c = 0; c < count && c < expected_count; c++)
+            {
+                wrong += lines[c].theta != expected[c].theta || lines[c].rho != expected[c].rho || lines[c].votes != expected[c].votes;
+            }
+        }
+        if (runs[run].method == HOUGH_PROBABILISTIC)
+        {
+            for (int c = 0; c < count; c++)
+            {
+                int t = (int)lrint(lines[c].theta * theta_steps / M_PI), r = (int)lrint(lines[c].rho) + rho_max;
+                wrong += (unsigned int)lines[c].votes != votes[(size_t)t * (2 * rho_max + 1) + r];
+            }
+        }
+
+        printf("hough %s %d threads threshold %d: %d lines, %d wrong", runs[run].method == HOUGH_STANDARD ? "standard" : "probabilistic 0.3",
+               threads, runs[run].threshold, count, wrong);
+        for (int c = 0; c < count && runs[run].threshold == 200; c++)
+        {
+            printf("%s (%.0f, %.0f) %d", c == 0 ? ":" : "", lines[c].theta * 180 / M_PI, lines[c].rho, lines[c].votes);
+        }
+        printf("\n");
+        failed |= wrong != 0;
+        free(lines);
+    }
+
+    free(votes);
+    free(expected);
+    pgm_free(edges);
+    return failed;
+}
+
+/**
+ * @brief Normalized cross-correlation of tmpl with the window of src at (x, y), summed pixel by pixel in double
+ *        Windows whose variance is below 0.25 gray levels squared score 0, like in match_template_view()
+ *        Slow on purpose, it is the reference match_template_view() is checked against
+ * 
+ * @param src 
+ * @param tmpl 
+ * @param x 
+ * @param y 
+ * @return double 
+ */
+static double match_reference(PGM *src, PGM *tmpl, int x, int y)
+{
+    int area = tmpl->width * tmpl->height;
+    double mean_window = 0, mean_template = 0, cross = 0, window_energy = 0, template_energy = 0;
+
+    for (int a = 0; a < tmpl->height; a++)
+    {
+        for (int b = 0; b < tmpl->width; b++)
+        {
+            mean_window += src->data[y + a][x + b];
+            mean_template += tmpl->data[a][b];
+        }
+    }
+    mean_window /= area;
+    mean_template /= area;
+
+    for (int a = 0; a < tmpl->height; a++)
+    {
+        for (int b = 0; b < tmpl->width; b++)
+        {
+            double w = src->data[y + a][x + b] - mean_window, t = tmpl->data[a][b] - mean_template;
+
+            cross += w * t;
+            window_energy += w * w;
+            template_energy += t * t;
+        }
+    }
+    return window_energy < area * 0.25 ? 0 : cross / sqrt(window_energy * template_energy);
+}
+
+/**
+ * @brief Plant a noise template at a known offset of a crop and compare match_template_view() with the
+ *          direct correlation at every position, for the direct and the FFT cross term
+ *        Scores must agree within 1e-4, and match_template() must return the planted offset first with a score of 1
+ *        Prints the largest score difference and the best match
+ * 
+ * @param pgm 
+ * @return int 0 if every method matches
+ */
+static int check_match(PGM *pgm)
+{
+    static const struct
+    {
+        convolve_method method;
+        const char *name;
+    } methods[] = {{CONVOLVE_DIRECT, "direct"}, {CONVOLVE_FFT, "fft"}};
+    const int planted_x = 150, planted_y = 90;
+    PGM *crop = crop_copy(pgm, pgm->width < 320 ? pgm->width : 320, pgm->height < 240 ? pgm->height : 240);
+    PGM *tmpl = pgm_create(31, 23, 255, "P5");
+    int width, height, failed = 0;
+    float *scores;
+    PGM_view src, pattern, dst;
+
+    if (crop->width < planted_x + tmpl->width || crop->height < planted_y + tmpl->height)
+    {
+        fprintf(stderr, "Error: match-check needs an image of at least %dx%d\n", planted_x + tmpl->width, planted_y + tmpl->height);
+        exit(EXIT_FAILURE);
+    }
+
+    srand(3);
+    for (int a = 0; a < tmpl->height; a++)
+    {
+        for (int b = 0; b < tmpl->width; b++)
+        {
+            tmpl->data[a][b] = (unsigned char)(rand() % 256);
+            crop->data[planted_y + a][planted_x + b] = tmpl->data[a][b];
+        }
+    }
+
+    width = crop->width - tmpl->width + 1;
+    height = crop->height - tmpl->height + 1;
+    scores = (float *)malloc((size_t)width * height * sizeof(float));
+    src = pgm_view_of(crop);
+    pattern = pgm_view_of(tmpl);
+    dst = pgm_view_wrap(scores, width, height, width * sizeof(float), PGM_DEPTH_32F);
+
+    for (int m = 0; m < 2; m++)
+    {
+        PGM_match *matches;
+        double max_diff = 0;
+        int count;
+
+        match_template_view(&src, &pattern, &dst, methods[m].method);
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                double diff = fabs(scores[(size_t)y * width + x] - match_reference(crop, tmpl, x, y));
+                max_diff = diff > max_diff ? diff : max_diff;
+            }
+        }
+
+        count = match_template(&src, &pattern, methods[m].method, 0.5, tmpl->width, 1, &matches);
+        printf("match %s: max diff %.2e, best match ", methods[m].name, max_diff);
+        if (count > 0)
+        {
+            printf("(%d, %d) score %.5f\n", matches[0].x, matches[0].y, matches[0].score);
+        }
+        else
+        {
+            printf("none\n");
+        }
+        failed |= max_diff > 1e-4 || count != 1 || matches[0].x != planted_x || matches[0].y != planted_y ||
+                  matches[0].score < 0.9999;
+        free(matches);
+    }
+
+    free(scores);
+    pgm_free(tmpl);
+    pgm_free(crop);
+    return failed;
+}
+
+/**
+ * @brief Bilateral filter of pixel (i, j) of src summed over its window in double, Gaussian in space and in gray level
+ *        The window is gaussian_filter_size(sigma_spatial) pixels wide and is cut at the image border
+ *        Slow on purpose, it is the reference filter_bilateral_view() is checked against
+ * 
+ * @param src 
+ * @param sigma_spatial 
+ * @param sigma_range 
+ * @param i 
+ * @param j 
+ * @return double 
+ */
+static double bilateral_reference(PGM *src, double sigma_spatial, double sigma_range, int i, int j)
+{
+    int radius = gaussian_filter_size(sigma_spatial) / 2;
+    double sum = 0, weight = 0;
+
+    for (int y = i - radius; y <= i + radius; y++)
+    {
+        for (int x = j - radius; x <= j + radius; x++)
+        {
+            double distance, difference, w;
+            if (y < 0 || y >= src->height || x < 0 || x >= src->width)
+            {
+                continue;
+            }
+
+            distance = (double)(y - i) * (y - i) + (double)(x - j) * (x - j);
+            difference = (double)src->data[y][x] - src->data[i][j];
+            w = exp(-distance / (2 * sigma_spatial * sigma_spatial) - difference * difference / (2 * sigma_range * sigma_range));
+            sum += w * src->data[y][x];
+            weight += w;
+        }
+    }
+    return sum / weight;
+}
+
+/**
+ * @brief Compare the bilateral grid with a brute-force bilateral filter, for a few pairs of sigmas, on a crop and
+ *          on flat blocks of noisy gray
+ *        The grid samples the filter one sigma per cell, so it is held to a mean difference of 1.25 gray levels, every
+ *          block pixel within 8 and 99% of the crop; running it with 1, 3 and 8 threads must give the same image
+ *        Also times the grid on a 4096x4096 image tiled from pgm
+ * 
+ * @param pgm 
+ * @return int 0 if every pair of sigmas is within tolerance
+ */
+static int check_bilateral(PGM *pgm)
+{
+    static const double sigmas[][2] = {{2, 20}, {3, 30}, {5, 15}};
+    PGM *images[2];
+    int failed = 0, team = omp_get_max_threads();
+
+    // A crop of pgm, and flat blocks of random gray with noise, whose edges the filter must keep
+    images[0] = crop_copy(pgm, pgm->width < 200 ? pgm->width : 200, pgm->height < 150 ? pgm->height : 150);
+    images[1] = pgm_create(200, 150, 255, "P5");
+    srand(5);
+    for (int i = 0; i < 150; i += 25)
+    {
+        for (int j = 0; j < 200; j += 25)
+        {
+            int level = 20 + rand() % 216;
+
+            for (int y = i; y < i + 25; y++)
+            {
+                for (int x = j; x < j + 25; x++)
+                {
+                    images[1]->data[y][x] = (unsigned char)(level + rand() % 21 - 10);
+                }
+            }
+        }
+    }
+
+    for (int n = 0; n < 2; n++)
+    {
+        PGM *crop = images[n];
+        PGM_view src = pgm_view_of(crop);
+
+        for (int s = 0; s < (int)(sizeof(sigmas) / sizeof(sigmas[0])); s++)
+        {
+            PGM *filtered = filter_create_output(crop, 1, 1, "yes");
+            PGM *again = filter_create_output(crop, 1, 1, "yes");
+            PGM_view dst = pgm_view_of(filtered), other = pgm_view_of(again);
+            double mean_diff = 0, max_diff = 0;
+            size_t far = 0;
+            int banded = 0;
+
+            omp_set_num_threads(1);
+            filter_bilateral_view(&src, &dst, sigmas[s][0], sigmas[s][1], "yes");
+            for (int threads = 3; threads <= 8; threads += 5)
+            {
+                omp_set_num_threads(threads);
+                filter_bilateral_view(&src, &other, sigmas[s][0], sigmas[s][1], "yes");
+                for (int i = 0; i < crop->height; i++)
+                {
+                    banded |= memcmp(filtered->data[i], again->data[i], crop->width) != 0;
+                }
+            }
+            omp_set_num_threads(team);
+
+            for (int i = 0; i < crop->height; i++)
+            {
+                for (int j = 0; j < crop->width; j++)
+                {
+                    double diff = fabs(filtered->data[i][j] - bilateral_reference(crop, sigmas[s][0], sigmas[s][1], i, j));
+
+                    mean_diff += diff;
+                    max_diff = diff > max_diff ? diff : max_diff;
+                    far += diff > 8;
+                }
+            }
+            mean_diff /= (double)crop->width * crop->height;
+
+            printf("bilateral %s sigmas %.0f/%.0f: mean diff %.2f, max diff %.1f, %zu pixels off by more than 8%s\n",
+                   n == 0 ? "crop" : "blocks", sigmas[s][0], sigmas[s][1], mean_diff, max_diff, far, banded ? ", threads disagree" : "");
+            failed |= mean_diff > 1.25 || far > (n == 0 ? (size_t)crop->width * crop->height / 100 : 0) || banded;
+
+            pgm_free(filtered);
+            pgm_free(again);
+        }
+    }
+
+    PGM *large = pgm_create(4096, 4096, 255, "P5");
+    PGM *filtered = filter_create_output(large, 1, 1, "yes");
+    PGM_view big = pgm_view_of(large), dst = pgm_view_of(filtered);
+    double start;
+
+    for (int i = 0; i < large->height; i++)
+    {
+        for (int j = 0; j < large->width; j++)
+        {
+            large->data[i][j] = pgm->data[i % pgm->height][j % pgm->width];
+        }
+    }
+    start = omp_get_wtime();
+    filter_bilateral_view(&big, &dst, 2, 20, "yes");
+    printf("bilateral sigmas 2/20 on 4096x4096: %.0f ms with %d threads\n", (omp_get_wtime() - start) * 1e3, team);
+
+    pgm_free(large);
+    pgm_free(filtered);
+    pgm_free(images[0]);
+    pgm_free(images[1]);
+    return failed;
+}
+
+/**
+ * @brief Canny edges of pgm computed serially, as 0 and 255 in an array of the size of pgm with a zero border
+ *        Same Gaussian and Sobel as filter_canny_view(), non-maximum suppression pixel by pixel with the same
+ *          fixed point direction sectors, and hysteresis as one breadth-first search from every strong pixel
+ *        Slow on purpose, it is the reference filter_canny_view() is checked against
+ * 
+ * @param pgm 
+ * @param sigma 
+ * @param low 
+ * @param high 
+ * @return unsigned char* freed by the caller
+ */
+static unsigned char *canny_reference(PGM *pgm, double sigma, int low, int high)
+{
+    int width = pgm->width, height = pgm->height;
+    PGM *smoothed = sigma > 0 ? filter_gaussian(pgm, sigma, "yes") : pgm;
+    long *magnitude = (long *)calloc((size_t)width * height, sizeof(long));
+    int *gx = (int *)calloc((size_t)width * height, sizeof(int)), *gy = (int *)calloc((size_t)width * height, sizeof(int));
+    unsigned char *edges = (unsigned char *)calloc((size_t)width * height, 1);
+    size_t *queue = (size_t *)malloc((size_t)width * height * sizeof(size_t)), head = 0, tail = 0;
+
+    for (int i = 1; i < height - 1; i++)
+    {
+        for (int j = 1; j < width - 1; j++)
+        {
+            unsigned char **d = smoothed->data;
+            int dx = d[i - 1][j + 1] - d[i - 1][j - 1] + 2 * (d[i][j + 1] - d[i][j - 1]) + d[i + 1][j + 1] - d[i + 1][j - 1];
+            int dy = d[i + 1][j - 1] + 2 * d[i + 1][j] + d[i + 1][j + 1] - d[i - 1][j - 1] - 2 * d[i - 1][j] - d[i - 1][j + 1];
+            size_t p = (size_t)i * width + j;
+
+            gx[p] = dx;
+            gy[p] = dy;
+            magnitude[p] = (long)dx * dx + (long)dy * dy;
+        }
+    }
+
+    // 1 weak, 2 strong, 255 edge
+    for (int i = 1; i < height - 1; i++)
+    {
+        for (int j = 1; j < width - 1; j++)
+        {
+            size_t p = (size_t)i * width + j;
+            long m = magnitude[p], ax = labs(gx[p]), ay = labs(gy[p]) * 32768L;
+            size_t before, after;
+
+            if (m <= (long)low * low)
+            {
+                continue;
+            }
+            if (ay < ax * 13573)
+            {
+                before = p - 1, after = p + 1;
+            }
+            else if (ay > ax * 79109)
+            {
+                before = p - width, after = p + width;
+            }
+            else
+            {
+                int s = (gx[p] < 0) != (gy[p] < 0) ? -1 : 1;
+                before = p - width - s, after = p + width + s;
+            }
+            if (m > magnitude[before] && m >= magnitude[after])
+            {
+                edges[p] = m > (long)high * high ? 2 : 1;
+            }
+        }
+    }
+
+    for (size_t p = 0; p < (size_t)width * height; p++)
+    {
+        if (edges[p] == 2)
+        {
+            edges[p] = 255;
+            queue[tail++] = p;
+        }
+    }
+    while (head < tail)
+    {
+        size_t p = queue[head++];
+        int i = (int)(p / width), j = (int)(p % width);
+
+        for (int y = i - 1; y <= i + 1; y++)
+        {
+            for (int x = j - 1; x <= j + 1; x++)
+            {
+                size_t q = (size_t)y * width + x;
+                if (y >= 0 && y < height && x >= 0 && x < width && edges[q] == 1)
+                {
+                    edges[q] = 255;
+                    queue[tail++] = q;
+                }
+            }
+        }
+    }
+    for (size_t p = 0; p < (size_t)width * height; p++)
+    {
+        edges[p] = edges[p] == 255 ? 255 : 0;
+    }
+
+    if (smoothed != pgm)
+    {
+        pgm_free(smoothed);
+    }
+    free(magnitude);
+    free(gx);
+    free(gy);
+    free(queue);
+    return edges;
+}
+
+/**
+ * @brief Compare filter_canny_view() with canny_reference() with 1, 3 and 8 threads, both padding modes, with and
+ *          without the Gaussian
+ *        On a crop of pgm, and on a faint snake that winds down and up across many bands of rows with a bright
+ *          block at one end only, so the hysteresis has to carry the edge over band borders round after round
+ *        Edges must be identical, also times the filter and its Gaussian alone on a 4096x4096 image tiled from pgm
+ * 
+ * @param pgm 
+ * @return int 0 if every run is identical to the reference
+ */
+static int check_canny(PGM *pgm)
+{
+    static const struct
+    {
+        double sigma;
+        int low;
+        int high;
+    } settings[] = {{0, 40, 120}, {1.4, 20, 60}, {2, 10, 40}};
+    PGM *images[2];
+    int failed = 0, team = omp_get_max_threads();
+
+    // The snake is 90 on 70, weak for every setting, its last column fades from 160 at the top, strong, to 90 where it
+    // joins the rest at the bottom, so its edge runs on unbroken
+    images[0] = crop_copy(pgm, pgm->width < 300 ? pgm->width : 300, pgm->height < 280 ? pgm->height : 280);
+    images[1] = pgm_create(260, 300, 255, "P5");
+    for (int i = 0; i < images[1]->height; i++)
+    {
+        memset(images[1]->data[i], 70, images[1]->width);
+    }
+    for (int c = 0; c < 12; c++)
+    {
+        int x = 10 + 20 * c;
+
+        for (int i = 10; i < 290; i++)
+        {
+            memset(images[1]->data[i] + x, 90, 8);
+        }
+        // Joins to the next column, at the bottom after going down and at the top after going up
+        for (int i = c % 2 == 0 ? 282 : 10; i < (c % 2 == 0 ? 290 : 18) && c < 11; i++)
+        {
+            memset(images[1]->data[i] + x, 90, 28);
+        }
+    }
+    for (int i = 10; i < 290; i++)
+    {
+        memset(images[1]->data[i] + 230, 160 - 70 * (i - 10) / 280, 8);
+    }
+
+    for (int n = 0; n < 2; n++)
+    {
+        PGM *image = images[n];
+        PGM_view src = pgm_view_of(image);
+
+        for (int s = 0; s < (int)(sizeof(settings) / sizeof(settings[0])); s++)
+        {
+            unsigned char *expected = canny_reference(image, settings[s].sigma, settings[s].low, settings[s].high);
+            size_t edge_pixels = 0;
+            int differ = 0;
+
+            for (size_t p = 0; p < (size_t)image->width * image->height; p++)
+            {
+                edge_pixels += expected[p] != 0;
+            }
+
+            for (int threads = 1; threads <= 8; threads += threads == 1 ? 2 : 5)
+            {
+                omp_set_num_threads(threads);
+                for (int padded = 0; padded < 2; padded++)
+                {
+                    char *padding = padded ? "yes" : "no";
+                    int k = padded ? 0 : 1;
+                    PGM *edges = filter_create_output(image, 3, 3, padding);
+                    PGM_view dst = pgm_view_of(edges);
+
+                    filter_canny_view(&src, &dst, settings[s].sigma, settings[s].low, settings[s].high, padding);
+                    for (int i = 0; i < edges->height; i++)
+                    {
+                        for (int j = 0; j < edges->width; j++)
+                        {
+                            differ += edges->data[i][j] != expected[(size_t)(i + k) * image->width + j + k];
+                        }
+                    }
+                    pgm_free(edges);
+                }
+            }
+            omp_set_num_threads(team);
+
+            printf("canny %s sigma %.1f thresholds %d/%d: %zu edge pixels, %d differ\n", n == 0 ? "crop" : "snake",
+                   settings[s].sigma, settings[s].low, settings[s].high, edge_pixels, differ);
+            failed |= differ != 0;
+            free(expected);
+        }
+    }
+
+    PGM *large = pgm_create(4096, 4096, 255, "P5");
+    PGM *edges = filter_create_output(large, 3, 3, "yes");
+    PGM *blurred = filter_create_output(large, 1, 1, "yes");
+    PGM_view big = pgm_view_of(large), dst = pgm_view_of(edges), smooth = pgm_view_of(blurred);
+    double start, gaussian;
+
+    for (int i = 0; i < large->height; i++)
+    {
+        for (int j = 0; j < large->width; j++)
+        {
+            large->data[i][j] = pgm->data[i % pgm->height][j % pgm->width];
+        }
+    }
+    start = omp_get_wtime();
+    filter_gaussian_view(&big, &smooth, 1.4, "yes");
+    gaussian = omp_get_wtime() - start;
+    start = omp_get_wtime();
+    filter_canny_view(&big, &dst, 1.4, 20, 60, "yes");
+    printf("canny sigma 1.4 on 4096x4096: %.0f ms with %d threads, the Gaussian alone %.0f ms\n", (omp_get_wtime() - start) * 1e3,
+           team, gaussian * 1e3);
+
+    pgm_free(large);
+    pgm_free(edges);
+    pgm_free(blurred);
+    pgm_free(images[0]);
+    pgm_free(images[1]);
+    return failed;
+}
+
+/**
+ * @brief Decode a copy of bytes held in a buffer of exactly size bytes, so reading past it shows up under ASan
+ * 
+ * @param bytes 
+ * @param size 
+ * @return int 1 if pgm_decode() refused the buffer
+ */
+static int decode_rejects(const char *bytes, size_t size)
+{
+    unsigned char *copy = (unsigned char *)malloc(size > 0 ? size : 1);
+    PGM *decoded;
+
+    memcpy(copy, bytes, size);
+    decoded = pgm_decode(copy, size);
+    if (decoded != NULL)
+    {
+        pgm_free(decoded);
+    }
+    free(copy);
+    return decoded == NULL;
+}
+
+/**
+ * @brief Count the pixels of a decoded image that differ from the image it was encoded from
+ *        A decoded image of another size or max_val counts as entirely different
+ * 
+ * @param decoded 
+ * @param expected 
+ * @return size_t 
+ */
+static size_t decode_differ(PGM *decoded, PGM *expected)
+{
+    size_t differ = 0;
+
+    if (decoded == NULL || decoded->width != expected->width || decoded->height != expected->height ||
+        decoded->max_val != expected->max_val)
+    {
+        return (size_t)expected->width * expected->height + 1;
+    }
+    for (int i = 0; i < expected->height; i++)
+    {
+        differ += memcmp(decoded->data[i], expected->data[i], expected->width) != 0;
+    }
+    return differ;
+}
+
+/**
+ * @brief Check pgm_encode() and pgm_decode() round trips in P2 and P5, the buffers they must refuse,
+ *          the in place P5 decode and pgm_view_sub() on views with padded and negative strides
+ *        The refused buffers print their errors to stderr, that is expected
+ * 
+ * @param pgm 
+ * @return int 0 if every round trip is exact, every bad buffer is refused and every sub-view addresses the right pixels
+ */
+static int check_pgm(PGM *pgm)
+{
+    static const char *const bad[] = {
+        "",
+        "P3\n1 1\n255\n0 0 0\n",
+        "P5\n99999999999 1\n255\n\x01",
+        "P2\n2147483648 1\n255\n0\n",
+        "P2\n1 1\n255\n4294967296\n",
+        "P2\n2 1\n100\n50 101\n",
+        "P5\n1 1\n256\n\x01\x01",
+        "P2\n1000000 1000000\n255\n0\n",
+        "P5\n2 1\n255",
+    };
+    static const char commented[] = "# leading\nP2 # type\n3 2 # width height\n# max_val\n255\n0 7 255\n# row two\n10 100 1\n";
+    static const char raw[] = "P5 # raw\n2 2\n# max_val on its own\n255\n\x00\xff\x0a\x64";
+    static const unsigned char commented_pixels[] = {0, 7, 255, 10, 100, 1};
+    PGM *images[2];
+    int failed = 0;
+
+    images[0] = crop_copy(pgm, pgm->width < 97 ? pgm->width : 97, pgm->height < 61 ? pgm->height : 61);
+    images[1] = pgm_create(16, 16, 255, "P5");
+    for (int p = 0; p < 256; p++)
+    {
+        images[1]->data[p / 16][p % 16] = (unsigned char)p;
+    }
+
+    // Round trips, the sizing call has to agree with the real one and a buffer one byte short is left untouched
+    for (int n = 0; n < 2; n++)
+    {
+        for (int t = 0; t < 2; t++)
+        {
+            PGM *image = images[n];
+            size_t size, written, differ;
+            unsigned char *buffer;
+            int untouched = 1;
+
+            strcpy(image->type, t == 0 ? "P2" : "P5");
+            size = pgm_encode(image, NULL, 0);
+            buffer = (unsigned char *)malloc(size);
+            memset(buffer, 0xA5, size);
+            written = pgm_encode(image, buffer, size - 1);
+            for (size_t p = 0; p < size; p++)
+            {
+                untouched &= buffer[p] == 0xA5;
+            }
+            written = written == size ? pgm_encode(image, buffer, size) : 0;
+
+            PGM *decoded = pgm_decode(buffer, size);
+            differ = decode_differ(decoded, image);
+            printf("pgm %s %dx%d: %zu bytes, %zu rows differ after the round trip%s\n", image->type, image->width,
+                   image->height, size, differ, untouched ? "" : ", the short buffer was written to");
+            failed |= written != size || differ != 0 || !untouched;
+            if (decoded != NULL)
+            {
+                pgm_free(decoded);
+            }
+            free(buffer);
+        }
+    }
+
+    // In place P5 decode, the rows point into the buffer and writing to the image writes to the buffer
+    {
+        size_t size, header;
+        unsigned char *buffer;
+        int in_place = 1;
+
+        strcpy(images[0]->type, "P5");
+        size = pgm_encode(images[0], NULL, 0);
+        header = size - (size_t)images[0]->width * images[0]->height;
+        buffer = (unsigned char *)malloc(size);
+
+        pgm_encode(images[0], buffer, size);
+        PGM *decoded = pgm_decode(buffer, size);
+        for (int i = 0; decoded != NULL && i < decoded->height; i++)
+        {
+            in_place &= decoded->data[i] == buffer + header + (size_t)i * decoded->width;
+        }
+        if (decoded != NULL)
+        {
+            decoded->data[decoded->height - 1][decoded->width - 1] ^= 0xFF;
+            in_place &= !decoded->owns_data && buffer[size - 1] == (images[0]->data[images[0]->height - 1][images[0]->width - 1] ^ 0xFF);
+            pgm_free(decoded);
+        }
+        printf("pgm P5 decode in place: %s\n", decoded != NULL && in_place ? "yes" : "no");
+        failed |= decoded == NULL || !in_place;
+        free(buffer);
+    }
+
+    // Comments anywhere in the header and between P2 pixels
+    {
+        PGM *text = pgm_create(3, 2, 255, "P2"), *binary = pgm_create(2, 2, 255, "P5");
+        unsigned char *copy = (unsigned char *)malloc(sizeof(raw) - 1);
+        size_t differ;
+
+        for (int p = 0; p < 6; p++)
+        {
+            text->data[p / 3][p % 3] = commented_pixels[p];
+        }
+        binary->data[0][0] = 0x00;
+        binary->data[0][1] = 0xff;
+        binary->data[1][0] = 0x0a;
+        binary->data[1][1] = 0x64;
+
+        memcpy(copy, raw, sizeof(raw) - 1);
+        PGM *decoded = pgm_decode((unsigned char *)commented, sizeof(commented) - 1);
+        differ = decode_differ(decoded, text);
+        if (decoded != NULL)
+        {
+            pgm_free(decoded);
+        }
+        decoded = pgm_decode(copy, sizeof(raw) - 1);
+        differ += decode_differ(decoded, binary);
+        if (decoded != NULL)
+        {
+            pgm_free(decoded);
+        }
+        printf("pgm headers with comments: %zu rows differ\n", differ);
+        failed |= differ != 0;
+        pgm_free(text);
+        pgm_free(binary);
+        free(copy);
+    }
+
+    // Truncated buffers, every P5 prefix is refused and so is every P2 prefix that ends before the last pixel starts,
+    // a P2 cut inside its last number still reads as a shorter number
+    {
+        PGM *small = crop_copy(pgm, 4, 3);
+        int accepted = 0, prefixes = 0;
+
+        for (int t = 0; t < 2; t++)
+        {
+            strcpy(small->type, t == 0 ? "P2" : "P5");
+            size_t size = pgm_encode(small, NULL, 0), last;
+            char *buffer = (char *)malloc(size);
+
+            pgm_encode(small, (unsigned char *)buffer, size);
+            last = size;
+            if (t == 0)
+            {
+                // Back over "\n", " " and the digits of the last pixel
+                last = size - 2;
+                while (last > 0 && buffer[last - 1] != ' ' && buffer[last - 1] != '\n')
+                {
+                    last--;
+                }
+            }
+            for (size_t cut = 0; cut < last; cut++)
+            {
+                accepted += !decode_rejects(buffer, cut);
+                prefixes++;
+            }
+            free(buffer);
+        }
+        printf("pgm truncated buffers: %d of %d prefixes accepted\n", accepted, prefixes);
+        failed |= accepted != 0;
+        pgm_free(small);
+    }
+
+    // Header numbers past INT_MAX, pixels past max_val, more than 8 bits, unknown formats and missing rasters
+    {
+        int accepted = 0;
+
+        for (int b = 0; b < (int)(sizeof(bad) / sizeof(bad[0])); b++)
+        {
+            accepted += !decode_rejects(bad[b], strlen(bad[b]));
+        }
+        printf("pgm bad headers: %d of %d accepted\n", accepted, (int)(sizeof(bad) / sizeof(bad[0])));
+        failed |= accepted != 0;
+    }
+
+    // Sub-views of a padded and of a bottom up view, pixel (x, y) of the image holds x * 7 + y * 13, the padding 0xEE
+    {
+        int width = 45, height = 31, pad = 13, bad_pixels = 0, bad_sobel = 0;
+        ptrdiff_t stride = width + pad;
+        unsigned char *bytes = (unsigned char *)malloc((size_t)stride * height);
+        float *floats = (float *)malloc((size_t)(width + 3) * height * sizeof(float));
+
+        memset(bytes, 0xEE, (size_t)stride * height);
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                bytes[y * stride + x] = (unsigned char)(x * 7 + y * 13);
+                floats[y * (width + 3) + x] = x * 7 + y * 13 + 0.5f;
+            }
+        }
+
+        for (int flip = 0; flip < 2; flip++)
+        {
+            PGM_view view = flip ? pgm_view_wrap(bytes + (height - 1) * stride, width, height, -stride, PGM_DEPTH_8U)
+                                 : pgm_view_wrap(bytes, width, height, stride, PGM_DEPTH_8U);
+            PGM_view sub = pgm_view_sub(&view, 5, 3, 30, 20);
+            PGM_view inner = pgm_view_sub(&sub, 2, 4, 17, 11);
+            PGM_view real = flip ? pgm_view_wrap(floats + (height - 1) * (width + 3), width, height, -(ptrdiff_t)((width + 3) * sizeof(float)), PGM_DEPTH_32F)
+                                 : pgm_view_wrap(floats, width, height, (width + 3) * sizeof(float), PGM_DEPTH_32F);
+            PGM_view real_inner = pgm_view_sub(&real, 7, 7, 17, 11);
+
+            for (int i = 0; i < inner.height; i++)
+            {
+                int y = flip ? height - 1 - (7 + i) : 7 + i;
+
+                for (int j = 0; j < inner.width; j++)
+                {
+                    bad_pixels += PGM_VIEW_ROW(&inner, unsigned char, i)[j] != (unsigned char)((7 + j) * 7 + y * 13);
+                    bad_pixels += PGM_VIEW_ROW(&real_inner, float, i)[j] != (7 + j) * 7 + y * 13 + 0.5f;
+                }
+            }
+
+            // A filter reading through the strided sub-view sees the same pixels as a packed copy of them
+            PGM *packed = pgm_create(sub.width, sub.height, 255, "P5");
+            PGM *expected = pgm_create(sub.width, sub.height, 255, "P5");
+            PGM *strided = pgm_create(sub.width, sub.height, 255, "P5");
+            PGM_view packed_view = pgm_view_of(packed), expected_view = pgm_view_of(expected), strided_view = pgm_view_of(strided);
+
+            for (int i = 0; i < sub.height; i++)
+            {
+                memcpy(packed->data[i], PGM_VIEW_ROW(&sub, unsigned char, i), sub.width);
+            }
+            filter_sobel_view(&packed_view, &expected_view, "yes");
+            filter_sobel_view(&sub, &strided_view, "yes");
+            for (int i = 0; i < sub.height; i++)
+            {
+                bad_sobel += memcmp(expected->data[i], strided->data[i], sub.width) != 0;
+            }
+            pgm_free(packed);
+            pgm_free(expected);
+            pgm_free(strided);
+        }
+        printf("pgm sub-views with padded and negative strides: %d pixels wrong, %d sobel rows differ\n", bad_pixels, bad_sobel);
+        failed |= bad_pixels != 0 || bad_sobel != 0;
+        free(bytes);
+        free(floats);
+    }
+
+    pgm_free(images[0]);
+    pgm_free(images[1]);
+    return failed;
+}
+
+/**
+ * @brief Squared distance from every pixel of src to the nearest non zero pixel, trying every feature pixel
+ *        Slow on purpose, it is the reference distance_transform() is checked against
+ * 
+ * @param src 
+ * @return long long* -1 where src has no feature pixel
+ */
+static long long *distance_reference(PGM *src)
+{
+    size_t pixels = (size_t)src->width * src->height, features = 0;
+    long long *out = (long long *)malloc(pixels * sizeof(long long));
+    int *xs = (int *)malloc(pixels * sizeof(int));
+    int *ys = (int *)malloc(pixels * sizeof(int));
+
+    for (int i = 0; i < src->height; i++)
+    {
+        for (int j = 0; j < src->width; j++)
+        {
+            if (src->data[i][j])
+            {
+                xs[features] = j;
+                ys[features++] = i;
+            }
+        }
+    }
+
+    for (int i = 0; i < src->height; i++)
+    {
+        for (int j = 0; j < src->width; j++)
+        {
+            long long best = -1;
+            for (size_t f = 0; f < features; f++)
+            {
+                long long d = (long long)(xs[f] - j) * (xs[f] - j) + (long long)(ys[f] - i) * (ys[f] - i);
+                best = best < 0 || d < best ? d : best;
+            }
+            out[(size_t)i * src->width + j] = best;
+        }
+    }
+
+    free(xs);
+    free(ys);
+    return out;
+}
+
+/**
+ * @brief Compare distance_transform() with the distance to every feature pixel, for 32F, 16U and 8U outputs
+ *        Images are a thresholded crop, sparse points 1, 7, 255, 256, 257 and 300 pixels wide around the
+ *          column band, images without features and a 70000 pixel line whose distances pass both clamps
+ *        32F must be exact, 16U and 8U the rounded distance clamped to 65535 and 255, with 1, 3 and 8 threads
+ * 
+ * @param pgm 
+ * @return int 0 if every output pixel is the expected one
+ */
+static int check_distance(PGM *pgm)
+{
+    static const int widths[] = {1, 7, 255, 256, 257, 300};
+    enum { SPARSE = 6, COUNT = SPARSE + 4 };
+    PGM *images[COUNT];
+    int failed = 0, team = omp_get_max_threads();
+
+    srand(7);
+    for (int n = 0; n < SPARSE; n++)
+    {
+        images[n] = pgm_create(widths[n], 41, 255, "P5");
+        for (int i = 0; i < images[n]->height; i++)
+        {
+            for (int j = 0; j < images[n]->width; j++)
+            {
+                images[n]->data[i][j] = rand() % 40 == 0 ? 255 : 0;
+            }
+        }
+    }
+    images[SPARSE] = crop_copy(pgm, pgm->width < 150 ? pgm->width : 150, pgm->height < 100 ? pgm->height : 100);
+    for (int i = 0; i < images[SPARSE]->height; i++)
+    {
+        for (int j = 0; j < images[SPARSE]->width; j++)
+        {
+            images[SPARSE]->data[i][j] = images[SPARSE]->data[i][j] > 200 ? 255 : 0;
+        }
+    }
+    // Without features, small enough that width + height is below 255 and wide enough for two bands
+    images[SPARSE + 1] = pgm_create(50, 40, 255, "P5");
+    images[SPARSE + 2] = pgm_create(300, 2, 255, "P5");
+    for (int n = SPARSE + 1; n <= SPARSE + 2; n++)
+    {
+        for (int i = 0; i < images[n]->height; i++)
+        {
+            memset(images[n]->data[i], 0, images[n]->width);
+        }
+    }
+    images[SPARSE + 3] = pgm_create(70000, 1, 255, "P5");
+    memset(images[SPARSE + 3]->data[0], 0, 70000);
+    images[SPARSE + 3]->data[0][3] = 255;
+
+    for (int n = 0; n < COUNT; n++)
+    {
+        PGM *image = images[n];
+        size_t pixels = (size_t)image->width * image->height;
+        long long *expected = distance_reference(image);
+        float *distances = (float *)malloc(pixels * sizeof(float));
+        unsigned short *wide = (unsigned short *)malloc(pixels * sizeof(unsigned short));
+        unsigned char *narrow = (unsigned char *)malloc(pixels);
+        PGM_view src = pgm_view_of(image);
+        PGM_view dst_float = pgm_view_wrap(distances, image->width, image->height, image->width * sizeof(float), PGM_DEPTH_32F);
+        PGM_view dst_wide = pgm_view_wrap(wide, image->width, image->height, image->width * sizeof(unsigned short), PGM_DEPTH_16U);
+        PGM_view dst_narrow = pgm_view_wrap(narrow, image->width, image->height, image->width, PGM_DEPTH_8U);
+        size_t differ[3] = {0, 0, 0};
+
+        for (int threads = 1; threads <= 8; threads += threads == 1 ? 2 : 5)
+        {
+            omp_set_num_threads(threads);
+            distance_transform(&src, &dst_float);
+            distance_transform(&src, &dst_wide);
+            distance_transform(&src, &dst_narrow);
+
+            for (size_t p = 0; p < pixels; p++)
+            {
+                double rounded = expected[p] < 0 ? INFINITY : sqrt((double)expected[p]) + 0.5;
+                float exact = expected[p] < 0 ? INFINITY : sqrtf((float)expected[p]);
+
+                differ[0] += distances[p] != exact;
+                differ[1] += wide[p] != (rounded >= 65535 ? 65535 : (unsigned short)rounded);
+                differ[2] += narrow[p] != (rounded >= 255 ? 255 : (unsigned char)rounded);
+            }
+        }
+        omp_set_num_threads(team);
+
+        printf("distance %dx%d: %zu float, %zu 16-bit and %zu 8-bit pixels differ\n", image->width, image->height, differ[0],
+               differ[1], differ[2]);
+        failed |= differ[0] != 0 || differ[1] != 0 || differ[2] != 0;
+
+        free(expected);
+        free(distances);
+        free(wide);
+        free(narrow);
+        pgm_free(image);
+    }
+
+    return failed;
+}
+
+/**
+ * @brief One pixel of src halved straight from the definitions downsample_view() documents
+ *        RESAMPLE_BOX is the rounded mean of the 2x2 block, RESAMPLE_BINOMIAL the rounded [1 4 6 4 1] / 16
+ *          filter in both directions around pixel (2 * j, 2 * i), edge pixels repeat outside of src
+ *        Slow on purpose, it is the reference downsample_view() is checked against
+ * 
+ * @param src 
+ * @param i 
+ * @param j 
+ * @param method 
+ * @return int 
+ */
+static int downsample_reference(PGM *src, int i, int j, resample_method method)
+{
+    static const int binomial[] = {1, 4, 6, 4, 1};
+    int sum = 0;
+
+    for (int a = 0; a < 5; a++)
+    {
+        for (int b = 0; b < 5; b++)
+        {
+            int y = 2 * i + a - 2, x = 2 * j + b - 2;
+            int weight = method == RESAMPLE_BOX ? (a == 2 || a == 3) && (b == 2 || b == 3) : binomial[a] * binomial[b];
+            y = y < 0 ? 0 : y >= src->height ? src->height - 1 : y;
+            x = x < 0 ? 0 : x >= src->width ? src->width - 1 : x;
+            sum += weight * src->data[y][x];
+        }
+    }
+    return method == RESAMPLE_BOX ? (sum + 2) >> 2 : (sum + 128) >> 8;
+}
+
+/**
+ * @brief One pixel of coarse expanded to twice its size, the rounded sum of the coarse pixels around it
+ *        weighted [1 6 1] / 8 on even and [4 4] / 8 on odd rows and columns, edge pixels repeat
+ * 
+ * @param coarse 
+ * @param y 
+ * @param x 
+ * @return int 
+ */
+static int expand_reference(PGM *coarse, int y, int x)
+{
+    static const int even[] = {1, 6, 1}, odd[] = {0, 4, 4};
+    int sum = 0;
+
+    for (int a = -1; a <= 1; a++)
+    {
+        for (int b = -1; b <= 1; b++)
+        {
+            int i = y / 2 + a, j = x / 2 + b;
+            int weight = (y % 2 ? odd : even)[a + 1] * (x % 2 ? odd : even)[b + 1];
+            i = i < 0 ? 0 : i >= coarse->height ? coarse->height - 1 : i;
+            j = j < 0 ? 0 : j >= coarse->width ? coarse->width - 1 : j;
+            sum += weight * coarse->data[i][j];
+        }
+    }
+    return (sum + 32) >> 6;
+}
+
+/**
+ * @brief Compare box and binomial downsampling and the binomial expansion with their definitions, then build
+ *          Laplacian pyramids of both kinds down to 1x1 and collapse them back
+ *        Sizes are odd, even, 1 pixel wide and 1 pixel high, on a crop and on noise that reaches the band limits
+ *        Runs with 1, 3 and 8 threads, everything must be exact and collapsing must give the image back
+ * 
+ * @param pgm 
+ * @return int 0 if every pixel is the expected one
+ */
+static int check_pyramid(PGM *pgm)
+{
+    static const int sizes[][2] = {{97, 61}, {64, 48}, {1, 37}, {37, 1}, {2, 3}, {1, 1}};
+    static const resample_method methods[] = {RESAMPLE_BOX, RESAMPLE_BINOMIAL};
+    int failed = 0, team = omp_get_max_threads();
+
+    srand(11);
+    for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++)
+    {
+        for (int noise = 0; noise < 2; noise++)
+        {
+            PGM *image = crop_copy(pgm, sizes[s][0], sizes[s][1]);
+            PGM *coarse = pgm_create((image->width + 1) / 2, (image->height + 1) / 2, 255, "P5");
+            PGM *expanded = pgm_create(image->width, image->height, 255, "P5");
+            PGM_view fine = pgm_view_of(image), half = pgm_view_of(coarse), twice = pgm_view_of(expanded);
+            int differ[2] = {0, 0}, expand_differ = 0, collapse_differ[2] = {0, 0};
+
+            for (int i = 0; noise && i < image->height; i++)
+            {
+                for (int j = 0; j < image->width; j++)
+                {
+                    image->data[i][j] = rand() % 3 == 0 ? 255 * (rand() % 2) : (unsigned char)rand();
+                }
+            }
+
+            for (int threads = 1; threads <= 8; threads += threads == 1 ? 2 : 5)
+            {
+                omp_set_num_threads(threads);
+                for (int m = 0; m < 2; m++)
+                {
+                    downsample_view(&fine, &half, methods[m]);
+                    for (int i = 0; i < coarse->height; i++)
+                    {
+                        for (int j = 0; j < coarse->width; j++)
+                        {
+                            differ[m] += coarse->data[i][j] != downsample_reference(image, i, j, methods[m]);
+                        }
+                    }
+
+                    upsample_view(&half, &twice);
+                    for (int i = 0; i < image->height; i++)
+                    {
+                        for (int j = 0; j < image->width; j++)
+                        {
+                            expand_differ += expanded->data[i][j] != expand_reference(coarse, i, j);
+                        }
+                    }
+
+                    // Laplacian pyramid down to 1x1 and back, every level is rebuilt from the one below it
+                    int levels = 64;
+                    PGM **pyramid = pyramid_gaussian(image, &levels, methods[m]);
+                    short **bands = (short **)malloc(levels * sizeof(short *));
+                    PGM_view *views = (PGM_view *)malloc(levels * sizeof(PGM_view));
+
+                    for (int l = 0; l < levels; l++)
+                    {
+                        views[l] = pgm_view_of(pyramid[l]);
+                    }
+                    for (int l = 0; l + 1 < levels; l++)
+                    {
+                        PGM_view band;
+
+                        bands[l] = (short *)malloc((size_t)pyramid[l]->width * pyramid[l]->height * sizeof(short));
+                        band = pgm_view_wrap(bands[l], pyramid[l]->width, pyramid[l]->height, pyramid[l]->width * sizeof(short), PGM_DEPTH_16S);
+                        pyramid_laplacian(&views[l], &views[l + 1], &band);
+                    }
+                    for (int l = levels - 2; l >= 0; l--)
+                    {
+                        PGM *rebuilt = pgm_create(pyramid[l]->width, pyramid[l]->height, 255, "P5");
+                        PGM_view out = pgm_view_of(rebuilt);
+                        PGM_view band = pgm_view_wrap(bands[l], pyramid[l]->width, pyramid[l]->height, pyramid[l]->width * sizeof(short), PGM_DEPTH_16S);
+
+                        pyramid_collapse(&views[l + 1], &band, &out);
+                        for (int i = 0; i < rebuilt->height; i++)
+                        {
+                            collapse_differ[m] += memcmp(rebuilt->data[i], pyramid[l]->data[i], rebuilt->width) != 0;
+                        }
+                        // The next level up is rebuilt from this rebuilt one, so errors would add up to the top
+                        if (l > 0)
+                        {
+                            pgm_free(pyramid[l]);
+                            pyramid[l] = rebuilt;
+                            views[l] = out;
+                        }
+                        else
+                        {
+                            pgm_free(rebuilt);
+                        }
+                        free(bands[l]);
+                    }
+                    pyramid_free(pyramid, levels);
+                    free(bands);
+                    free(views);
+                }
+            }
+            omp_set_num_threads(team);
+
+            printf("pyramid %s %dx%d: box %d, binomial %d, expand %d pixels differ, collapse box %d, binomial %d rows differ\n",
+                   noise ? "noise" : "crop", image->width, image->height, differ[0], differ[1], expand_differ,
+                   collapse_differ[0], collapse_differ[1]);
+            failed |= differ[0] != 0 || differ[1] != 0 || expand_differ != 0 || collapse_differ[0] != 0 || collapse_differ[1] != 0;
+
+            pgm_free(image);
+            pgm_free(coarse);
+            pgm_free(expanded);
+        }
+    }
+
+    return failed;
+}
+
+/**
+ * @brief Write bitmaps and color images of many widths as P1, P4, P3 and P6, read them back and compare,
+ *          and compare packing, unpacking, the RGB shuffles and rgb_to_gray() with their scalar definitions
+ *        Widths straddle multiples of 8, 16 and 32 so both the SIMD loops and their tails are used
+ *        Files are written to the current directory and removed afterwards
+ * 
+ * @return int 0 if every round trip and every pixel is exact
+ */
+static int check_netpbm(void)
+{
+    static const int widths[] = {1, 7, 8, 9, 15, 16, 17, 31, 32, 33, 47, 63, 65, 100};
+    static char *bitmap_types[] = {"P1", "P4"}, *color_types[] = {"P3", "P6"};
+    int failed = 0;
+
+    srand(13);
+    for (int w = 0; w < (int)(sizeof(widths) / sizeof(widths[0])); w++)
+    {
+        int width = widths[w], height = 3 + w % 3;
+        int pack_differ = 0, unpack_differ = 0, bitmap_differ[2] = {0, 0}, color_differ[2] = {0, 0};
+        int shuffle_differ = 0, gray_differ = 0, read_differ = 0;
+        PGM *image = pgm_create(width, height, 255, "P5"), *unpacked = pgm_create(width, height, 255, "P5");
+        PGM_color *color = color_create(width, height, 255, "P6");
+        PGM_view src = pgm_view_of(image), dst = pgm_view_of(unpacked);
+        PGM_bitmap *bitmap = bitmap_create(width, height, "P4");
+        unsigned char *rgb = (unsigned char *)malloc((size_t)3 * width), *planes = (unsigned char *)malloc((size_t)4 * width);
+
+        // Values next to the 128 threshold and the extremes, as well as random ones
+        for (int i = 0; i < height; i++)
+        {
+            for (int j = 0; j < width; j++)
+            {
+                static const unsigned char edges[] = {0, 127, 128, 255};
+                image->data[i][j] = rand() % 2 ? edges[rand() % 4] : (unsigned char)rand();
+                for (int c = 0; c < 3; c++)
+                {
+                    color->channel[c]->data[i][j] = rand() % 4 == 0 ? 255 : (unsigned char)rand();
+                }
+            }
+        }
+
+        // Packing, bit j % 8 from the top of byte j / 8 is pixel j, the bits past the width are 0
+        // The bitmap starts all black, as a reused one would, so every bit has to be written
+        memset(bitmap->bits, 0xff, (size_t)bitmap->stride * height);
+        bitmap_pack(&src, bitmap);
+        for (int i = 0; i < height; i++)
+        {
+            const unsigned char *bits = bitmap->bits + (ptrdiff_t)i * bitmap->stride;
+            for (int j = 0; j < bitmap->stride * 8; j++)
+            {
+                int expected = j < width && image->data[i][j] < 128;
+                pack_differ += ((bits[j / 8] >> (7 - j % 8)) & 1) != expected;
+            }
+        }
+        bitmap_unpack(bitmap, &dst);
+        for (int i = 0; i < height; i++)
+        {
+            for (int j = 0; j < width; j++)
+            {
+                unpack_differ += unpacked->data[i][j] != (image->data[i][j] < 128 ? 0 : 255);
+            }
+        }
+
+        // Bitmaps through P1 and P4 files, pgm_read() of the P4 file is the unpacked image
+        for (int t = 0; t < 2; t++)
+        {
+            strcpy(bitmap->type, bitmap_types[t]);
+            bitmap_write(bitmap, "netpbm-check.pbm");
+            PGM_bitmap *read = bitmap_read("netpbm-check.pbm");
+            bitmap_differ[t] = read->width != width || read->height != height ||
+                               memcmp(read->bits, bitmap->bits, (size_t)bitmap->stride * height) != 0;
+            bitmap_free(read);
+            if (t == 1)
+            {
+                PGM *gray = pgm_read("netpbm-check.pbm");
+                for (int i = 0; i < height; i++)
+                {
+                    read_differ += memcmp(gray->data[i], unpacked->data[i], width) != 0;
+                }
+                pgm_free(gray);
+            }
+        }
+
+        // Color images through P3 and P6 files, pgm_read() of the P6 file is the gray formula
+        for (int t = 0; t < 2; t++)
+        {
+            strcpy(color->type, color_types[t]);
+            color_write(color, "netpbm-check.ppm");
+            PGM_color *read = color_read("netpbm-check.ppm");
+            for (int c = 0; c < 3; c++)
+            {
+                for (int i = 0; i < height; i++)
+                {
+                    color_differ[t] += read->width != width || read->height != height ||
+                                       memcmp(read->channel[c]->data[i], color->channel[c]->data[i], width) != 0;
+                }
+            }
+            color_free(read);
+            if (t == 1)
+            {
+                PGM *gray = pgm_read("netpbm-check.ppm");
+                for (int i = 0; i < height; i++)
+                {
+                    for (int j = 0; j < width; j++)
+                    {
+                        int expected = (77 * color->channel[0]->data[i][j] + 150 * color->channel[1]->data[i][j] +
+                                        29 * color->channel[2]->data[i][j] + 128) >> 8;
+                        read_differ += gray->data[i][j] != expected;
+                    }
+                }
+                pgm_free(gray);
+            }
+        }
+
+        // The shuffles and the gray conversion straight, against one pixel at a time
+        for (int i = 0; i < height; i++)
+        {
+            const unsigned char *r = color->channel[0]->data[i], *g = color->channel[1]->data[i], *b = color->channel[2]->data[i];
+
+            rgb_interleave(r, g, b, rgb, width);
+            for (int j = 0; j < width; j++)
+            {
+                shuffle_differ += rgb[3 * j] != r[j] || rgb[3 * j + 1] != g[j] || rgb[3 * j + 2] != b[j];
+            }
+            rgb_deinterleave(rgb, planes, planes + width, planes + 2 * width, width);
+            shuffle_differ += memcmp(planes, r, width) != 0 || memcmp(planes + width, g, width) != 0 ||
+                              memcmp(planes + 2 * width, b, width) != 0;
+            rgb_to_gray(r, g, b, planes + 3 * width, width);
+            for (int j = 0; j < width; j++)
+            {
+                gray_differ += planes[3 * width + j] != ((77 * r[j] + 150 * g[j] + 29 * b[j] + 128) >> 8);
+            }
+        }
+
+        printf("netpbm width %d: pack %d, unpack %d, shuffle %d, gray %d pixels differ, P1 %s, P4 %s, P3 %d, P6 %d rows "
+               "differ, read as gray %d\n",
+               width, pack_differ, unpack_differ, shuffle_differ, gray_differ, bitmap_differ[0] ? "differs" : "same",
+               bitmap_differ[1] ? "differs" : "same", color_differ[0], color_differ[1], read_differ);
+        failed |= pack_differ || unpack_differ || shuffle_differ || gray_differ || bitmap_differ[0] || bitmap_differ[1] ||
+                  color_differ[0] || color_differ[1] || read_differ;
+
+        pgm_free(image);
+        pgm_free(unpacked);
+        color_free(color);
+        bitmap_free(bitmap);
+        free(rgb);
+        free(planes);
+    }
+
+    remove("netpbm-check.pbm");
+    remove("netpbm-check.ppm");
+    return failed;
+}
+
+/**
+ * @brief Print the metrics of compare_images() on one line
+ * 
+ * @param name 
+ * @param quality 
+ */
+static void print_quality(const char *name, PGM_quality quality)
+{
+    printf("%s: mse %.4f, psnr %.2f dB, max diff %d, %zu pixels differ, ssim %.5f\n", name, quality.mse, quality.psnr,
+           quality.max_diff, quality.differing, quality.ssim);
+}
+
+/**
+ * @brief Run one variant of a filter on pgm and return the filtered image
+ * 
+ * @param pgm 
+ * @param filter 
+ * @param filter_size 
+ * @param variant 
+ * @return PGM* 
+ */
+static PGM *run_variant(PGM *pgm, tune_filter filter, int filter_size, int variant)
+{
+    PGM *filtered = filter_create_output(pgm, filter_size, filter_size, "yes");
+    PGM_view src = pgm_view_of(pgm);
+    PGM_view dst = pgm_view_of(filtered);
+    tune_choice choice = {variant, 0, 0};
+
+    if (filter == TUNE_MEDIAN)
+    {
+        filter_median_variant(&src, &dst, filter_size, "yes", choice);
+    }
+    else if (filter == TUNE_AVERAGE)
+    {
+        filter_average_variant(&src, &dst, filter_size, "yes", choice);
+    }
+    else
+    {
+        filter_sobel_variant(&src, &dst, "yes", choice);
+    }
+    return filtered;
+}
+
+/**
+ * @brief Compare every optimized variant of median, average and Sobel with the first, plain one
+ *        Prints the metrics of compare_images() for each, variants must match their reference exactly
+ * 
+ * @param pgm 
+ * @return int 0 if every variant is identical to its reference
+ */
+static int check_variants(PGM *pgm)
+{
+    static const struct
+    {
+        tune_filter filter;
+        const char *name;
+        int size;
+        int variants;
+    } checks[] = {{TUNE_MEDIAN, "median", 3, MEDIAN_VARIANTS},   {TUNE_MEDIAN, "median", 5, MEDIAN_VARIANTS},
+                  {TUNE_MEDIAN, "median", 9, MEDIAN_VARIANTS},   {TUNE_MEDIAN, "median", 15, MEDIAN_VARIANTS},
+                  {TUNE_AVERAGE, "average", 3, AVERAGE_VARIANTS}, {TUNE_AVERAGE, "average", 15, AVERAGE_VARIANTS},
+                  {TUNE_SOBEL, "sobel", 3, SOBEL_VARIANTS}};
+    int failed = 0;
+
+    for (int c = 0; c < (int)(sizeof(checks) / sizeof(checks[0])); c++)
+    {
+        PGM *reference;
+
+        if (checks[c].size > pgm->width || checks[c].size > pgm->height)
+        {
+            continue;
+        }
+
+        reference = run_variant(pgm, checks[c].filter, checks[c].size, 0);
+        for (int v = 1; v < checks[c].variants; v++)
+        {
+            PGM *fast;
+            PGM_view a, b;
+            PGM_quality quality;
+            char name[64];
+
+            if (checks[c].filter == TUNE_MEDIAN && v == MEDIAN_NETWORK && checks[c].size > MEDIAN_NETWORK_MAX_SIZE)
+            {
+                continue;
+            }
+
+            fast = run_variant(pgm, checks[c].filter, checks[c].size, v);
+            a = pgm_view_of(reference);
+            b = pgm_view_of(fast);
+            quality = compare_images(&a, &b, 7);
+            snprintf(name, sizeof(name), "%s %dx%d variant %d", checks[c].name, checks[c].size, checks[c].size, v);
+            print_quality(name, quality);
+            failed |= quality.max_diff != 0;
+            pgm_free(fast);
+        }
+        pgm_free(reference);
+    }
+
+    return failed;
+}
+
+/**
+ * @brief Compare two image files, see compare_images()
+ * 
+ * @param first 
+ * @param second 
+ * @param window SSIM window
+ * @return int 0 if the images are identical, 1 if they differ
+ */
+static int compare_files(const char *first, const char *second, int window)
+{
+    PGM *a = pgm_read((char *)first);
+    PGM *b = pgm_read((char *)second);
+    PGM_view va = pgm_view_of(a);
+    PGM_view vb = pgm_view_of(b);
+    PGM_quality quality = compare_images(&va, &vb, window);
+
+    print_quality(second, quality);
+    pgm_free(a);
+    pgm_free(b);
+    return quality.max_diff != 0;
+}
+
+/**
+ * @brief Run the default pipeline with every stage measured, see profile_open()
+ *        Prints wall time, IPC or CPU time and bytes per pixel of reading, each filter and writing
+ * 
+ * @param filename 
+ * @return int 0
+ */
+static int run_profile(char *filename)
+{
+    PGM_profile profile;
+    size_t pixels;
+
+    // Before the first parallel region, so the counters follow the OpenMP threads,
+    // placement_init() pins them in a parallel region of its own and comes after
+    profile_open(&profile);
+    placement_init();
+
+    profile_begin(&profile, "read");
+    PGM *pgm = pgm_read(filename);
+    pixels = (size_t)pgm->width * pgm->height;
+    profile_end(&profile, pixels);
+
+    profile_begin(&profile, "median 9x9");
+    PGM *median = filter_median(pgm, 9, "yes");
+    profile_end(&profile, pixels);
+
+    profile_begin(&profile, "average 9x9");
+    PGM *average = filter_average(pgm, 9, "yes");
+    profile_end(&profile, pixels);
+
+    profile_begin(&profile, "sobel");
+    PGM *sobel = filter_sobel(pgm, "yes");
+    profile_end(&profile, pixels);
+
+    profile_begin(&profile, "write");
+    pgm_write(sobel, "test.pgm");
+    profile_end(&profile, pixels);
+
+    profile_report(&profile, stdout);
+    profile_close(&profile);
+
+    pgm_free(median);
+    pgm_free(average);
+    pgm_free(sobel);
+    pgm_free(pgm);
+    return 0;
+}
 
 int main(int argc, char *argv[])
 {
 
-    char filename[30] = "lenaN.pgm";
+    char *filename = "lenaN.pgm";
+    char *mode = "sobel";
 
     if (argc > 1)
     {
-        strcpy(filename, argv[1]);
+        filename = argv[1];
+    }
+    if (argc > 2)
+    {
+        mode = argv[2];
+    }
+
+    // The tune mode measures every variant and rewrites the profile, it does not need the old one
+    if (strcmp(mode, "tune") != 0)
+    {
+        tune_load(TUNE_PROFILE);
+    }
+    if (strcmp(mode, "profile") == 0)
+    {
+        return run_profile(filename);
+    }
+    placement_init();
+    if (strcmp(mode, "tune") == 0)
+    {
+        return tune_run(TUNE_PROFILE);
+    }
+    if (strcmp(mode, "compare") == 0)
+    {
+        if (argc < 4)
+        {
+            fprintf(stderr, "Error: compare needs a second image\n");
+            return EXIT_FAILURE;
+        }
+        return compare_files(filename, argv[3], argc > 4 ? atoi(argv[4]) : 7);
     }
 
     PGM *pgm = pgm_read(filename);
 
+    if (strcmp(mode, "gaussian-check") == 0)
+    {
+        int failed = check_gaussian(pgm);
+        pgm_free(pgm);
+        return failed;
+    }
+    if (strcmp(mode, "convolve-check") == 0)
+    {
+        int failed = check_convolve(pgm);
+        pgm_free(pgm);
+        return failed;
+    }
+    if (strcmp(mode, "resize-check") == 0)
+    {
+        int failed = check_resize(pgm);
+        pgm_free(pgm);
+        return failed;
+    }
+    if (strcmp(mode, "nlmeans-check") == 0)
+    {
+        int failed = check_nlmeans(pgm);
+        pgm_free(pgm);
+        return failed;
+    }
+    if (strcmp(mode, "components-check") == 0)
+    {
+        int failed = check_components(pgm);
+        pgm_free(pgm);
+        return failed;
+    }
+    if (strcmp(mode, "transform-check") == 0)
+    {
+        int failed = check_transform();
+        pgm_free(pgm);
+        return failed;
+    }
+    if (strcmp(mode, "morphology-check") == 0)
+    {
+        int failed = check_morphology(pgm);
+        pgm_free(pgm);
+        return failed;
+    }
+    if (strcmp(mode, "threshold-check") == 0)
+    {
+        int failed = check_threshold(pgm);
+        pgm_free(pgm);
+        return failed;
+    }
+    if (strcmp(mode, "corners-check") == 0)
+    {
+        int failed = check_corners(pgm);
+        pgm_free(pgm);
+        return failed;
+    }
+    if (strcmp(mode, "hough-check") == 0)
+    {
+        int failed = check_hough(pgm);
+        pgm_free(pgm);
+        return failed;
+    }
+    if (strcmp(mode, "match-check") == 0)
+    {
+        int failed = check_match(pgm);
+        pgm_free(pgm);
+        return failed;
+    }
+    if (strcmp(mode, "bilateral-check") == 0)
+    {
+        int failed = check_bilateral(pgm);
+        pgm_free(pgm);
+        return failed;
+    }
+    if (strcmp(mode, "canny-check") == 0)
+    {
+        int failed = check_canny(pgm);
+        pgm_free(pgm);
+        return failed;
+    }
+    if (strcmp(mode, "pgm-check") == 0)
+    {
+        int failed = check_pgm(pgm);
+        pgm_free(pgm);
+        return failed;
+    }
+    if (strcmp(mode, "distance-check") == 0)
+    {
+        int failed = check_distance(pgm);
+        pgm_free(pgm);
+        return failed;
+    }
+    if (strcmp(mode, "pyramid-check") == 0)
+    {
+        int failed = check_pyramid(pgm);
+        pgm_free(pgm);
+        return failed;
+    }
+    if (strcmp(mode, "netpbm-check") == 0)
+    {
+        int failed = check_netpbm();
+        pgm_free(pgm);
+        return failed;
+    }
+    if (strcmp(mode, "clahe-check") == 0)
+    {
+        int failed = check_clahe(pgm);
+        pgm_free(pgm);
+        return failed;
+    }
+    if (strcmp(mode, "placement") == 0)
+    {
+        placement_report(pgm, stdout);
+        pgm_free(pgm);
+        return 0;
+    }
+    if (strcmp(mode, "variants-check") == 0)
+    {
+        int failed = check_variants(pgm);
+        pgm_free(pgm);
+        return failed;
+    }
+
     PGM *median = filter_median(pgm, 9, "yes");
     PGM *sobel = filter_sobel(pgm, "yes");
 
@@ -23,4 +3200,4 @@ int main(int argc, char *argv[])
 
 
     return 0;
-}
\ No newline at end of file
+}
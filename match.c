@@ -0,0 +1,422 @@
+#include "pgm.h"
+#include <omp.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Windows whose pixels vary less than this, in gray levels squared, score 0, their correlation is mostly rounding error
+#define MATCH_MIN_VARIANCE 0.25
+
+/**
+ * @brief Check src and tmpl for match_template_view() and match_template()
+ * 
+ * @param src 
+ * @param tmpl 
+ * @param caller 
+ */
+static void match_check(const PGM_view *src, const PGM_view *tmpl, const char *caller)
+{
+    if (src->depth != PGM_DEPTH_8U || tmpl->depth != PGM_DEPTH_8U)
+    {
+        fprintf(stderr, "Error: %s() works on 8-bit views only\n", caller);
+        exit(EXIT_FAILURE);
+    }
+    if (tmpl->width < 1 || tmpl->height < 1 || tmpl->width > src->width || tmpl->height > src->height)
+    {
+        fprintf(stderr, "Error: %s() template must fit in the image\n", caller);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Turn the cross terms of the rows first .. last - 1 into scores, see match_template_view()
+ *        Window sums slide down the rows: the column sums over th rows get the entering row added and the leaving
+ *          row subtracted, then one running sum along the row gives every window. The sums are kept modulo 2^64
+ *          (squares) and 2^32 (pixels) and come out exact, a window sum is at most 255 * area
+ *        The variance of each window needs doubles, the score c / sqrt(variance * energy) is finished in float,
+ *          4 at a time with SSE2
+ * 
+ * @param src 
+ * @param tw template width
+ * @param th template height
+ * @param energy sum of the squared, zero mean template
+ * @param cross cross term of every window
+ * @param dst 
+ * @param first 
+ * @param last 
+ * @param columns scratch of src->width
+ * @param squares scratch of src->width
+ * @param denominator scratch of src->width
+ */
+static void match_scores(const PGM_view *src, int tw, int th, double energy, const float *cross, const PGM_view *dst, int first,
+                         int last, unsigned int *columns, unsigned long long *squares, float *denominator)
+{
+    const int width = src->width - tw + 1, area = tw * th;
+    const double inverse = 1.0 / area;
+
+    memset(columns, 0, src->width * sizeof(unsigned int));
+    memset(squares, 0, src->width * sizeof(unsigned long long));
+    for (int a = 0; a < th - 1; a++)
+    {
+        const unsigned char *row = PGM_VIEW_ROW(src, unsigned char, first + a);
+
+#pragma omp simd
+        for (int j = 0; j < src->width; j++)
+        {
+            columns[j] += row[j];
+            squares[j] += (unsigned int)row[j] * row[j];
+        }
+    }
+
+    for (int i = first; i < last; i++)
+    {
+        const unsigned char *enter = PGM_VIEW_ROW(src, unsigned char, i + th - 1), *leave = PGM_VIEW_ROW(src, unsigned char, i);
+        const float *c = cross + (size_t)i * width;
+        float *row = PGM_VIEW_ROW(dst, float, i);
+        unsigned int s = 0;
+        unsigned long long q = 0;
+        int j = 0;
+
+#pragma omp simd
+        for (int x = 0; x < src->width; x++)
+        {
+            columns[x] += enter[x];
+            squares[x] += (unsigned int)enter[x] * enter[x];
+        }
+
+        for (int x = 0; x < tw; x++)
+        {
+            s += columns[x];
+            q += squares[x];
+        }
+        for (int x = 0; x < width; x++)
+        {
+            double variance = (double)q - (double)s * s * inverse;
+
+            denominator[x] = variance >= area * MATCH_MIN_VARIANCE ? (float)(variance * energy) : 0;
+            if (x + 1 < width)
+            {
+                s += columns[x + tw] - columns[x];
+                q += squares[x + tw] - squares[x];
+            }
+        }
+
+#ifdef __SSE2__
+        for (; j + 4 <= width; j += 4)
+        {
+            __m128 d = _mm_loadu_ps(denominator + j);
+            __m128 score = _mm_div_ps(_mm_loadu_ps(c + j), _mm_sqrt_ps(d));
+
+            score = _mm_and_ps(score, _mm_cmpgt_ps(d, _mm_setzero_ps()));
+            score = _mm_max_ps(_mm_min_ps(score, _mm_set1_ps(1)), _mm_set1_ps(-1));
+            _mm_storeu_ps(row + j, score);
+        }
+#endif
+        for (; j < width; j++)
+        {
+            float score = denominator[j] > 0 ? c[j] / sqrtf(denominator[j]) : 0;
+
+            row[j] = score > 1 ? 1 : score < -1 ? -1 : score;
+        }
+
+        // The top row leaves the window
+#pragma omp simd
+        for (int x = 0; x < src->width; x++)
+        {
+            columns[x] -= leave[x];
+            squares[x] -= (unsigned int)leave[x] * leave[x];
+        }
+    }
+}
+
+/**
+ * @brief Write the normalized cross-correlation of tmpl with every window of src to dst
+ *        score(x, y) = sum (I - mean I)(T - mean T) / sqrt(sum (I - mean I)^2 * sum (T - mean T)^2)
+ *          over the window of src with its top left corner at (x, y), -1 .. 1
+ *        The cross term is a convolution of src with the flipped, zero mean template, direct or FFT,
+ *          see filter_convolve_view() for method, a zero mean template needs no window mean
+ *        Window means and energies slide down each thread's band of rows, see match_scores()
+ *        A 64x64 template costs the FFT convolution and a few operations per pixel, not 4096 multiply-adds
+ *        Windows of (nearly) constant gray score 0, the template must not be constant
+ * 
+ * @param src 8-bit view
+ * @param tmpl 8-bit view, no larger than src
+ * @param dst 32F view of (src->width - tmpl->width + 1) x (src->height - tmpl->height + 1)
+ * @param method 
+ */
+void match_template_view(const PGM_view *src, const PGM_view *tmpl, const PGM_view *dst, convolve_method method)
+{
+    const int tw = tmpl->width, th = tmpl->height, area = tw * th;
+    const int width = src->width - tw + 1, height = src->height - th + 1;
+    float *kernel, *cross;
+    double mean = 0, energy = 0;
+
+    match_check(src, tmpl, "match_template");
+    if (dst->depth != PGM_DEPTH_32F || dst->width != width || dst->height != height)
+    {
+        fprintf(stderr, "Error: match_template() needs a 32F output of the size of the valid positions\n");
+        exit(EXIT_FAILURE);
+    }
+
+    kernel = (float *)malloc((size_t)area * sizeof(float));
+    // A contiguous dst takes the cross term and is turned into scores in place
+    cross = dst->stride == (ptrdiff_t)(width * sizeof(float)) ? (float *)dst->data : (float *)malloc((size_t)width * height * sizeof(float));
+    if (kernel == NULL || cross == NULL)
+    {
+        fprintf(stderr, "Error: match_template() failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int a = 0; a < th; a++)
+    {
+        const unsigned char *row = PGM_VIEW_ROW(tmpl, unsigned char, a);
+
+        for (int b = 0; b < tw; b++)
+        {
+            mean += row[b];
+        }
+    }
+    mean /= area;
+
+    // Flipped so the convolution is a correlation
+    for (int a = 0; a < th; a++)
+    {
+        const unsigned char *row = PGM_VIEW_ROW(tmpl, unsigned char, a);
+
+        for (int b = 0; b < tw; b++)
+        {
+            double centered = row[b] - mean;
+
+            kernel[(size_t)(th - 1 - a) * tw + tw - 1 - b] = (float)centered;
+            energy += centered * centered;
+        }
+    }
+    if (energy < area * MATCH_MIN_VARIANCE)
+    {
+        fprintf(stderr, "Error: match_template() template is constant\n");
+        exit(EXIT_FAILURE);
+    }
+
+    convolve_valid(src, cross, kernel, tw, th, method);
+
+#pragma omp parallel
+    {
+        // One band of rows per thread, every band pays th rows to start its column sums
+        int t = omp_get_thread_num(), teams = omp_get_num_threads();
+        unsigned int *columns = (unsigned int *)malloc(src->width * sizeof(unsigned int));
+        unsigned long long *squares = (unsigned long long *)malloc(src->width * sizeof(unsigned long long));
+        float *denominator = (float *)malloc(src->width * sizeof(float));
+        if (columns == NULL || squares == NULL || denominator == NULL)
+        {
+            fprintf(stderr, "Error: match_template() failed to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+
+        match_scores(src, tw, th, energy, cross, dst, (int)((long long)height * t / teams), (int)((long long)height * (t + 1) / teams),
+                     columns, squares, denominator);
+        free(columns);
+        free(squares);
+        free(denominator);
+    }
+
+    if (cross != (float *)dst->data)
+    {
+        free(cross);
+    }
+    free(kernel);
+}
+
+/**
+ * @brief Compare matches by score, best first, then by y and x for a stable order
+ * 
+ * @param a 
+ * @param b 
+ * @return int 
+ */
+static int match_compare(const void *a, const void *b)
+{
+    const PGM_match *p = (const PGM_match *)a, *q = (const PGM_match *)b;
+
+    if (p->score != q->score)
+    {
+        return p->score > q->score ? -1 : 1;
+    }
+    if (p->y != q->y)
+    {
+        return p->y < q->y ? -1 : 1;
+    }
+    return p->x < q->x ? -1 : p->x > q->x;
+}
+
+/**
+ * @brief Find the best positions of tmpl in src
+ *        The score map of match_template_view() is searched for local maxima of their 3x3 neighbourhood with at
+ *          least min_score, in parallel by rows, then the maxima are taken best first and each one is kept
+ *          unless a kept match is within radius pixels in x and y
+ *        Kept matches are looked up in a grid of radius + 1 pixel cells, so keeping is linear in the maxima
+ * 
+ * @param src 
+ * @param tmpl 
+ * @param method see filter_convolve_view()
+ * @param min_score -1 .. 1, 0.8 keeps clear matches only
+ * @param radius smallest distance between two matches, the template size is a common choice
+ * @param max_matches 0 for all of them
+ * @param matches set to an array the caller frees, best first
+ * @return int number of matches
+ */
+int match_template(const PGM_view *src, const PGM_view *tmpl, convolve_method method, double min_score, int radius,
+                   int max_matches, PGM_match **matches)
+{
+    int width, height, count = 0, kept = 0, cell, grid_width, grid_height;
+    float *scores;
+    PGM_view map;
+    PGM_match *found = NULL;
+    int *grid, *next;
+
+    match_check(src, tmpl, "match_template");
+    width = src->width - tmpl->width + 1;
+    height = src->height - tmpl->height + 1;
+    radius = radius < 0 ? 0 : radius;
+
+    scores = (float *)malloc((size_t)width * height * sizeof(float));
+    if (scores == NULL)
+    {
+        fprintf(stderr, "Error: match_template() failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    map = pgm_view_wrap(scores, width, height, width * sizeof(float), PGM_DEPTH_32F);
+    match_template_view(src, tmpl, &map, method);
+
+#pragma omp parallel
+    {
+        PGM_match *local = NULL;
+        int local_count = 0, local_capacity = 0;
+
+#pragma omp for schedule(static)
+        for (int y = 0; y < height; y++)
+        {
+            const float *row = scores + (size_t)y * width;
+
+            for (int x = 0; x < width; x++)
+            {
+                float value = row[x];
+                int peak = value >= min_score;
+
+                // Earlier neighbours in raster order must be smaller, later ones no larger
+                for (int ny = y - 1; peak && ny <= y + 1; ny++)
+                {
+                    const float *near = scores + (size_t)ny * width;
+
+                    if (ny < 0 || ny >= height)
+                    {
+                        continue;
+                    }
+                    for (int nx = x - 1; nx <= x + 1; nx++)
+                    {
+                        if (nx < 0 || nx >= width || (ny == y && nx == x))
+                        {
+                            continue;
+                        }
+                        if (near[nx] > value || (near[nx] == value && (ny < y || (ny == y && nx < x))))
+                        {
+                            peak = 0;
+                            break;
+                        }
+                    }
+                }
+
+                if (peak)
+                {
+                    if (local_count == local_capacity)
+                    {
+                        local_capacity = local_capacity ? 2 * local_capacity : 256;
+                        local = (PGM_match *)realloc(local, local_capacity * sizeof(PGM_match));
+                        if (local == NULL)
+                        {
+                            fprintf(stderr, "Error: match_template() failed to allocate memory\n");
+                            exit(EXIT_FAILURE);
+                        }
+                    }
+                    local[local_count].x = x;
+                    local[local_count].y = y;
+                    local[local_count].score = value;
+                    local_count++;
+                }
+            }
+        }
+
+#pragma omp critical
+        {
+            found = (PGM_match *)realloc(found, (count + local_count + 1) * sizeof(PGM_match));
+            if (found == NULL)
+            {
+                fprintf(stderr, "Error: match_template() failed to allocate memory\n");
+                exit(EXIT_FAILURE);
+            }
+            if (local_count > 0)
+            {
+                memcpy(found + count, local, local_count * sizeof(PGM_match));
+            }
+            count += local_count;
+        }
+
+        free(local);
+    }
+    free(scores);
+
+    qsort(found, count, sizeof(PGM_match), match_compare);
+
+    // Kept matches are linked per grid cell, a match only looks at the 3x3 cells around its own
+    cell = radius + 1;
+    grid_width = (width + cell - 1) / cell;
+    grid_height = (height + cell - 1) / cell;
+    grid = (int *)malloc((size_t)grid_width * grid_height * sizeof(int));
+    next = (int *)malloc((count + 1) * sizeof(int));
+    if (grid == NULL || next == NULL)
+    {
+        fprintf(stderr, "Error: match_template() failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t g = 0; g < (size_t)grid_width * grid_height; g++)
+    {
+        grid[g] = -1;
+    }
+
+    for (int m = 0; m < count && (max_matches <= 0 || kept < max_matches); m++)
+    {
+        int gx = found[m].x / cell, gy = found[m].y / cell, free_spot = 1;
+
+        for (int cy = gy - 1; free_spot && cy <= gy + 1; cy++)
+        {
+            for (int cx = gx - 1; free_spot && cx <= gx + 1; cx++)
+            {
+                if (cx < 0 || cy < 0 || cx >= grid_width || cy >= grid_height)
+                {
+                    continue;
+                }
+                for (int k = grid[(size_t)cy * grid_width + cx]; k >= 0; k = next[k])
+                {
+                    if (abs(found[k].x - found[m].x) <= radius && abs(found[k].y - found[m].y) <= radius)
+                    {
+                        free_spot = 0;
+                        break;
+                    }
+                }
+            }
+        }
+
+        if (free_spot)
+        {
+            found[kept] = found[m];
+            next[kept] = grid[(size_t)gy * grid_width + gx];
+            grid[(size_t)gy * grid_width + gx] = kept;
+            kept++;
+        }
+    }
+
+    free(grid);
+    free(next);
+    *matches = found;
+    return kept;
+}
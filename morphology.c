@@ -0,0 +1,304 @@
+#include "pgm.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Rows of a strip that are transposed together in the horizontal pass, one SIMD lane each
+#define MORPH_STRIP 64
+// Columns handled by one thread in the vertical pass
+#define MORPH_BAND 256
+
+/**
+ * @brief out = min(a, b) for erosion or max(a, b) for dilation, n bytes at a time
+ *        16 bytes per instruction with SSE2, plain loop for the tail
+ * 
+ * @param a 
+ * @param b 
+ * @param out 
+ * @param n 
+ * @param dilate 
+ */
+static void morph_combine(const unsigned char *a, const unsigned char *b, unsigned char *out, int n, int dilate)
+{
+    int x = 0;
+
+#ifdef __SSE2__
+    if (dilate)
+    {
+        for (; x + 16 <= n; x += 16)
+        {
+            __m128i va = _mm_loadu_si128((const __m128i *)(a + x));
+            __m128i vb = _mm_loadu_si128((const __m128i *)(b + x));
+            _mm_storeu_si128((__m128i *)(out + x), _mm_max_epu8(va, vb));
+        }
+    }
+    else
+    {
+        for (; x + 16 <= n; x += 16)
+        {
+            __m128i va = _mm_loadu_si128((const __m128i *)(a + x));
+            __m128i vb = _mm_loadu_si128((const __m128i *)(b + x));
+            _mm_storeu_si128((__m128i *)(out + x), _mm_min_epu8(va, vb));
+        }
+    }
+#endif
+
+    for (; x < n; x++)
+    {
+        if (dilate)
+        {
+            out[x] = a[x] > b[x] ? a[x] : b[x];
+        }
+        else
+        {
+            out[x] = a[x] < b[x] ? a[x] : b[x];
+        }
+    }
+}
+
+/**
+ * @brief van Herk/Gil-Werman running min or max of window k down the rows of a block
+ *        The block is lanes bytes wide and length rows long, every byte column is filtered independently
+ *          so one call handles a whole band of image columns with SIMD
+ *        Rows are split in segments of k, g holds the running value from the start of each segment
+ *          and h the running value to its end, then a window starting at row r covers the tail of one
+ *          segment and the head of the next: out[r] = op(h[r], g[r + k - 1])
+ *        That is 3 comparisons per pixel whatever k is
+ *        Output has length - k + 1 rows, g and h are scratch of length * lanes bytes
+ * 
+ * @param src 
+ * @param src_stride 
+ * @param dst 
+ * @param dst_stride 
+ * @param lanes 
+ * @param length 
+ * @param k 
+ * @param dilate 
+ * @param g 
+ * @param h 
+ */
+static void morph_running(const unsigned char *src, ptrdiff_t src_stride, unsigned char *dst, ptrdiff_t dst_stride,
+                          int lanes, int length, int k, int dilate, unsigned char *g, unsigned char *h)
+{
+    int r;
+
+    if (k == 1)
+    {
+        for (r = 0; r < length; r++)
+        {
+            memcpy(dst + r * dst_stride, src + r * src_stride, lanes);
+        }
+        return;
+    }
+
+    for (int start = 0; start < length; start += k)
+    {
+        int end = start + k < length ? start + k : length;
+
+        memcpy(g + (ptrdiff_t)start * lanes, src + start * src_stride, lanes);
+        for (r = start + 1; r < end; r++)
+        {
+            morph_combine(g + (ptrdiff_t)(r - 1) * lanes, src + r * src_stride, g + (ptrdiff_t)r * lanes, lanes, dilate);
+        }
+
+        memcpy(h + (ptrdiff_t)(end - 1) * lanes, src + (end - 1) * src_stride, lanes);
+        for (r = end - 2; r >= start; r--)
+        {
+            morph_combine(h + (ptrdiff_t)(r + 1) * lanes, src + r * src_stride, h + (ptrdiff_t)r * lanes, lanes, dilate);
+        }
+    }
+
+    for (r = 0; r + k <= length; r++)
+    {
+        morph_combine(h + (ptrdiff_t)r * lanes, g + (ptrdiff_t)(r + k - 1) * lanes, dst + r * dst_stride, lanes, dilate);
+    }
+}
+
+/**
+ * @brief Allocate scratch memory or exit
+ * 
+ * @param size 
+ * @return unsigned char* 
+ */
+static unsigned char *morph_alloc(size_t size)
+{
+    unsigned char *buffer = (unsigned char *)malloc(size > 0 ? size : 1);
+    if (buffer == NULL)
+    {
+        fprintf(stderr, "Error: filter_morphology() failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return buffer;
+}
+
+/**
+ * @brief Erode or dilate src with a filter_width x filter_height rectangle into dst
+ *        dst must be (src width - filter_width + 1, src height - filter_height + 1), no padding
+ *        Horizontal pass: strips of MORPH_STRIP rows are transposed with transpose_tile() so the rows
+ *          become byte lanes, filtered with morph_running() and transposed back into a temporary image
+ *        Vertical pass: bands of MORPH_BAND columns of the temporary image go through morph_running() directly
+ *        Strips and bands are independent and are spread over the threads
+ * 
+ * @param src 
+ * @param dst 
+ * @param filter_width 
+ * @param filter_height 
+ * @param dilate 
+ */
+static void morph_separable(const PGM_view *src, const PGM_view *dst, int filter_width, int filter_height, int dilate)
+{
+    int width = dst->width;
+    int height = src->height;
+    unsigned char *temp = morph_alloc((size_t)width * height);
+    int strips = (height + MORPH_STRIP - 1) / MORPH_STRIP;
+    int bands = (width + MORPH_BAND - 1) / MORPH_BAND;
+
+#pragma omp parallel
+    {
+        unsigned char *in = morph_alloc((size_t)src->width * MORPH_STRIP);
+        unsigned char *out = morph_alloc((size_t)src->width * MORPH_STRIP);
+        unsigned char *g = morph_alloc((size_t)src->width * MORPH_STRIP);
+        unsigned char *h = morph_alloc((size_t)src->width * MORPH_STRIP);
+
+#pragma omp for schedule(static)
+        for (int s = 0; s < strips; s++)
+        {
+            int y0 = s * MORPH_STRIP;
+            int lanes = height - y0 < MORPH_STRIP ? height - y0 : MORPH_STRIP;
+
+            PGM_view rows = pgm_view_sub(src, 0, y0, src->width, lanes);
+            PGM_view strip = pgm_view_wrap(in, lanes, src->width, lanes, PGM_DEPTH_8U);
+            PGM_view filtered = pgm_view_wrap(out, lanes, width, lanes, PGM_DEPTH_8U);
+            PGM_view result = pgm_view_wrap(temp + (ptrdiff_t)y0 * width, width, lanes, width, PGM_DEPTH_8U);
+
+            transpose_tile(&rows, &strip);
+            morph_running(in, lanes, out, lanes, lanes, src->width, filter_width, dilate, g, h);
+            transpose_tile(&filtered, &result);
+        }
+
+        free(in);
+        free(out);
+        free(g);
+        free(h);
+    }
+
+#pragma omp parallel
+    {
+        unsigned char *g = morph_alloc((size_t)height * MORPH_BAND);
+        unsigned char *h = morph_alloc((size_t)height * MORPH_BAND);
+
+#pragma omp for schedule(static)
+        for (int b = 0; b < bands; b++)
+        {
+            int x0 = b * MORPH_BAND;
+            int lanes = width - x0 < MORPH_BAND ? width - x0 : MORPH_BAND;
+
+            morph_running(temp + x0, width, PGM_VIEW_ROW(dst, unsigned char, 0) + x0, dst->stride,
+                          lanes, height, filter_height, dilate, g, h);
+        }
+
+        free(g);
+        free(h);
+    }
+
+    free(temp);
+}
+
+/**
+ * @brief Apply a morphological operation with a rectangular structuring element and return the filtered image
+ *        See filter_morphology_view()
+ * 
+ * @param img 
+ * @param op 
+ * @param filter_width 
+ * @param filter_height 
+ * @param padding 
+ * @return PGM* 
+ */
+PGM *filter_morphology(PGM *img, morph_op op, int filter_width, int filter_height, char *padding)
+{
+    int span = op == MORPH_ERODE || op == MORPH_DILATE ? 1 : 2;
+    PGM *filtered = filter_create_output(img, span * filter_width - span + 1, span * filter_height - span + 1, padding);
+    PGM_view src = pgm_view_of(img);
+    PGM_view dst = pgm_view_of(filtered);
+
+    filter_morphology_view(&src, &dst, op, filter_width, filter_height, padding);
+    return filtered;
+}
+
+/**
+ * @brief Apply a morphological operation with a filter_width x filter_height rectangle to src and write it to dst
+ *        Erosion is the minimum and dilation the maximum under the rectangle, both cost about
+ *          3 comparisons per pixel and pass whatever the rectangle size is
+ *        Opening is dilation of the erosion, closing is erosion of the dilation,
+ *          top-hat is src - opening and black-hat is closing - src
+ *        Filter sizes must be odd
+ *        Output size follows the padding rules of filter_prepare_output_rect(), the compound operations
+ *          read 2 * filter_size - 1 pixels around each output pixel so their border is twice as wide
+ * 
+ * @param src 
+ * @param dst 
+ * @param op 
+ * @param filter_width 
+ * @param filter_height 
+ * @param padding 
+ */
+void filter_morphology_view(const PGM_view *src, const PGM_view *dst, morph_op op, int filter_width, int filter_height, char *padding)
+{
+    int span_x = filter_width, span_y = filter_height;
+    int kx, ky;
+    PGM_view out, temp;
+    unsigned char *buffer = NULL;
+
+    if (filter_width % 2 == 0 || filter_height % 2 == 0 || filter_width < 1 || filter_height < 1)
+    {
+        fprintf(stderr, "Error: filter_morphology() filter_size must be odd\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (op != MORPH_ERODE && op != MORPH_DILATE)
+    {
+        span_x = 2 * filter_width - 1;
+        span_y = 2 * filter_height - 1;
+    }
+
+    filter_prepare_output_rect(src, dst, span_x, span_y, padding, "filter_morphology", &kx, &ky);
+    out = pgm_view_sub(dst, kx, ky, src->width - span_x + 1, src->height - span_y + 1);
+
+    if (op == MORPH_ERODE || op == MORPH_DILATE)
+    {
+        morph_separable(src, &out, filter_width, filter_height, op == MORPH_DILATE);
+        return;
+    }
+
+    buffer = morph_alloc((size_t)(src->width - filter_width + 1) * (src->height - filter_height + 1));
+    temp = pgm_view_wrap(buffer, src->width - filter_width + 1, src->height - filter_height + 1,
+                         src->width - filter_width + 1, PGM_DEPTH_8U);
+
+    if (op == MORPH_OPEN || op == MORPH_TOPHAT)
+    {
+        morph_separable(src, &temp, filter_width, filter_height, 0);
+        morph_separable(&temp, &out, filter_width, filter_height, 1);
+    }
+    else
+    {
+        morph_separable(src, &temp, filter_width, filter_height, 1);
+        morph_separable(&temp, &out, filter_width, filter_height, 0);
+    }
+    free(buffer);
+
+    if (op == MORPH_TOPHAT || op == MORPH_BLACKHAT)
+    {
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < out.height; i++)
+        {
+            const unsigned char *center = PGM_VIEW_ROW(src, unsigned char, i + span_y / 2) + span_x / 2;
+            unsigned char *row = PGM_VIEW_ROW(&out, unsigned char, i);
+            for (int j = 0; j < out.width; j++)
+            {
+                row[j] = op == MORPH_TOPHAT ? center[j] - row[j] : row[j] - center[j];
+            }
+        }
+    }
+}
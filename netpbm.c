@@ -0,0 +1,646 @@
+#include "pgm.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Fixed-point BT.601 luma weights, they add up to 256
+#define GRAY_RED 77
+#define GRAY_GREEN 150
+#define GRAY_BLUE 29
+
+#ifdef __SSE2__
+/**
+ * @brief One round of the byte shuffle that turns 96 interleaved RGB bytes into planes
+ *        Every round interleaves the first three registers with the last three,
+ *          after five rounds each register holds 16 samples of one channel
+ * 
+ * @param v 6 registers, in and out
+ */
+static inline void deinterleave_round(__m128i *v)
+{
+    __m128i t[6];
+
+    t[0] = _mm_unpacklo_epi8(v[0], v[3]);
+    t[1] = _mm_unpackhi_epi8(v[0], v[3]);
+    t[2] = _mm_unpacklo_epi8(v[1], v[4]);
+    t[3] = _mm_unpackhi_epi8(v[1], v[4]);
+    t[4] = _mm_unpacklo_epi8(v[2], v[5]);
+    t[5] = _mm_unpackhi_epi8(v[2], v[5]);
+    memcpy(v, t, sizeof(t));
+}
+
+/**
+ * @brief Inverse of deinterleave_round(), even bytes of each pair of registers go to the first three,
+ *          odd bytes to the last three
+ * 
+ * @param v 6 registers, in and out
+ */
+static inline void interleave_round(__m128i *v)
+{
+    const __m128i low = _mm_set1_epi16(0x00ff);
+    __m128i t[6];
+
+    for (int n = 0; n < 3; n++)
+    {
+        t[n] = _mm_packus_epi16(_mm_and_si128(v[2 * n], low), _mm_and_si128(v[2 * n + 1], low));
+        t[n + 3] = _mm_packus_epi16(_mm_srli_epi16(v[2 * n], 8), _mm_srli_epi16(v[2 * n + 1], 8));
+    }
+    memcpy(v, t, sizeof(t));
+}
+#endif
+
+/**
+ * @brief Split count interleaved RGB pixels into three planes
+ *        32 pixels at a time with SSE2, see deinterleave_round()
+ * 
+ * @param rgb 3 * count bytes
+ * @param red 
+ * @param green 
+ * @param blue 
+ * @param count 
+ */
+void rgb_deinterleave(const unsigned char *rgb, unsigned char *red, unsigned char *green, unsigned char *blue, int count)
+{
+    int x = 0;
+
+#ifdef __SSE2__
+    for (; x + 32 <= count; x += 32)
+    {
+        __m128i v[6];
+
+        for (int n = 0; n < 6; n++)
+        {
+            v[n] = _mm_loadu_si128((const __m128i *)(rgb + 3 * x + 16 * n));
+        }
+        for (int round = 0; round < 5; round++)
+        {
+            deinterleave_round(v);
+        }
+        _mm_storeu_si128((__m128i *)(red + x), v[0]);
+        _mm_storeu_si128((__m128i *)(red + x + 16), v[1]);
+        _mm_storeu_si128((__m128i *)(green + x), v[2]);
+        _mm_storeu_si128((__m128i *)(green + x + 16), v[3]);
+        _mm_storeu_si128((__m128i *)(blue + x), v[4]);
+        _mm_storeu_si128((__m128i *)(blue + x + 16), v[5]);
+    }
+#endif
+    for (; x < count; x++)
+    {
+        red[x] = rgb[3 * x];
+        green[x] = rgb[3 * x + 1];
+        blue[x] = rgb[3 * x + 2];
+    }
+}
+
+/**
+ * @brief Merge three planes into count interleaved RGB pixels, the reverse of rgb_deinterleave()
+ * 
+ * @param red 
+ * @param green 
+ * @param blue 
+ * @param rgb 3 * count bytes
+ * @param count 
+ */
+void rgb_interleave(const unsigned char *red, const unsigned char *green, const unsigned char *blue, unsigned char *rgb, int count)
+{
+    int x = 0;
+
+#ifdef __SSE2__
+    for (; x + 32 <= count; x += 32)
+    {
+        __m128i v[6];
+
+        v[0] = _mm_loadu_si128((const __m128i *)(red + x));
+        v[1] = _mm_loadu_si128((const __m128i *)(red + x + 16));
+        v[2] = _mm_loadu_si128((const __m128i *)(green + x));
+        v[3] = _mm_loadu_si128((const __m128i *)(green + x + 16));
+        v[4] = _mm_loadu_si128((const __m128i *)(blue + x));
+        v[5] = _mm_loadu_si128((const __m128i *)(blue + x + 16));
+        for (int round = 0; round < 5; round++)
+        {
+            interleave_round(v);
+        }
+        for (int n = 0; n < 6; n++)
+        {
+            _mm_storeu_si128((__m128i *)(rgb + 3 * x + 16 * n), v[n]);
+        }
+    }
+#endif
+    for (; x < count; x++)
+    {
+        rgb[3 * x] = red[x];
+        rgb[3 * x + 1] = green[x];
+        rgb[3 * x + 2] = blue[x];
+    }
+}
+
+/**
+ * @brief Convert count pixels from RGB planes to gray, (77 R + 150 G + 29 B + 128) / 256
+ *        16 pixels at a time in 16-bit fixed point with SSE2, the sum cannot overflow
+ * 
+ * @param red 
+ * @param green 
+ * @param blue 
+ * @param gray 
+ * @param count 
+ */
+void rgb_to_gray(const unsigned char *red, const unsigned char *green, const unsigned char *blue, unsigned char *gray, int count)
+{
+    int x = 0;
+
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i weight_red = _mm_set1_epi16(GRAY_RED);
+    const __m128i weight_green = _mm_set1_epi16(GRAY_GREEN);
+    const __m128i weight_blue = _mm_set1_epi16(GRAY_BLUE);
+    const __m128i half = _mm_set1_epi16(128);
+
+    for (; x + 16 <= count; x += 16)
+    {
+        __m128i r = _mm_loadu_si128((const __m128i *)(red + x));
+        __m128i g = _mm_loadu_si128((const __m128i *)(green + x));
+        __m128i b = _mm_loadu_si128((const __m128i *)(blue + x));
+        __m128i low = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(r, zero), weight_red),
+                                                  _mm_mullo_epi16(_mm_unpacklo_epi8(g, zero), weight_green)),
+                                    _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), weight_blue), half));
+        __m128i high = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(r, zero), weight_red),
+                                                   _mm_mullo_epi16(_mm_unpackhi_epi8(g, zero), weight_green)),
+                                     _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), weight_blue), half));
+
+        _mm_storeu_si128((__m128i *)(gray + x), _mm_packus_epi16(_mm_srli_epi16(low, 8), _mm_srli_epi16(high, 8)));
+    }
+#endif
+    for (; x < count; x++)
+    {
+        gray[x] = (unsigned char)((GRAY_RED * red[x] + GRAY_GREEN * green[x] + GRAY_BLUE * blue[x] + 128) >> 8);
+    }
+}
+
+/**
+ * @brief Read the header of a netpbm file: type, size and, except for bitmaps, max_val
+ *        Exactly one whitespace after the last number is consumed, so a binary raster starts right after
+ * 
+ * @param fp 
+ * @param type 
+ * @param width 
+ * @param height 
+ * @param max_val 1 for bitmaps
+ * @param filename for error messages
+ */
+static void netpbm_read_header(FILE *fp, char *type, int *width, int *height, int *max_val, const char *filename)
+{
+    skip_comments(fp);
+    if (fscanf(fp, "%2s", type) != 1 || type[0] != 'P' || type[1] < '1' || type[1] > '6')
+    {
+        fprintf(stderr, "Error: %s is not a netpbm file\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    skip_comments(fp);
+    if (fscanf(fp, "%d", width) != 1)
+    {
+        fprintf(stderr, "Error: %s has a broken header\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    skip_comments(fp);
+    if (fscanf(fp, "%d", height) != 1)
+    {
+        fprintf(stderr, "Error: %s has a broken header\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    *max_val = 1;
+    if (type[1] != '1' && type[1] != '4')
+    {
+        skip_comments(fp);
+        if (fscanf(fp, "%d", max_val) != 1)
+        {
+            fprintf(stderr, "Error: %s has a broken header\n", filename);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (*width < 1 || *height < 1 || *max_val < 1 || *max_val > 255)
+    {
+        fprintf(stderr, "Error: %s is not an 8-bit image of a valid size\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    fgetc(fp);
+}
+
+/**
+ * @brief Create an RGB image with three zeroed channels
+ * 
+ * @param width 
+ * @param height 
+ * @param max_val 
+ * @param type P3 or P6
+ * @return PGM_color* 
+ */
+PGM_color *color_create(int width, int height, int max_val, char *type)
+{
+    PGM_color *color = (PGM_color *)malloc(sizeof(PGM_color));
+
+    if (color == NULL)
+    {
+        fprintf(stderr, "Error: color_create() failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    color->width = width;
+    color->height = height;
+    color->max_val = max_val;
+    strcpy(color->type, type);
+    for (int c = 0; c < 3; c++)
+    {
+        color->channel[c] = pgm_create(width, height, max_val, "P5");
+    }
+    return color;
+}
+
+/**
+ * @brief Free an RGB image and its channels
+ * 
+ * @param color 
+ */
+void color_free(PGM_color *color)
+{
+    for (int c = 0; c < 3; c++)
+    {
+        pgm_free(color->channel[c]);
+    }
+    free(color);
+}
+
+/**
+ * @brief Read a P3 or P6 image into three planes
+ *        P6 rows are read whole and split with rgb_deinterleave(), so every filter then runs on
+ *          a contiguous channel
+ * 
+ * @param filename 
+ * @return PGM_color* 
+ */
+PGM_color *color_read(char *filename)
+{
+    char type[3];
+    int width, height, max_val;
+    FILE *fp = fopen(filename, "rb");
+    PGM_color *color;
+
+    if (fp == NULL)
+    {
+        fprintf(stderr, "Error: color_read() failed to open file %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    netpbm_read_header(fp, type, &width, &height, &max_val, filename);
+    if (type[1] != '3' && type[1] != '6')
+    {
+        fprintf(stderr, "Error: color_read() %s is not a P3 or P6 image\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    color = color_create(width, height, max_val, type);
+    if (type[1] == '6')
+    {
+        unsigned char *row = (unsigned char *)malloc((size_t)3 * width);
+        if (row == NULL)
+        {
+            fprintf(stderr, "Error: color_read() failed to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < height; i++)
+        {
+            if (fread(row, 3, width, fp) != (size_t)width)
+            {
+                fprintf(stderr, "Error: color_read() failed to read from file %s\n", filename);
+                exit(EXIT_FAILURE);
+            }
+            rgb_deinterleave(row, color->channel[0]->data[i], color->channel[1]->data[i], color->channel[2]->data[i], width);
+        }
+        free(row);
+    }
+    else
+    {
+        for (int i = 0; i < height; i++)
+        {
+            for (int j = 0; j < width; j++)
+            {
+                for (int c = 0; c < 3; c++)
+                {
+                    if (fscanf(fp, "%hhu", &color->channel[c]->data[i][j]) != 1)
+                    {
+                        fprintf(stderr, "Error: color_read() failed to read from file %s\n", filename);
+                        exit(EXIT_FAILURE);
+                    }
+                }
+            }
+        }
+    }
+
+    fclose(fp);
+    return color;
+}
+
+/**
+ * @brief Write an RGB image as P3 or P6, following color->type
+ *        P6 rows are merged with rgb_interleave() and written whole
+ * 
+ * @param color 
+ * @param filename 
+ */
+void color_write(PGM_color *color, char *filename)
+{
+    FILE *fp;
+
+    if (strcmp(color->type, "P3") != 0 && strcmp(color->type, "P6") != 0)
+    {
+        fprintf(stderr, "Error: Unknown format\n");
+        exit(EXIT_FAILURE);
+    }
+    fp = fopen(filename, color->type[1] == '6' ? "wb" : "w");
+    if (fp == NULL)
+    {
+        fprintf(stderr, "Error: color_write() failed to open file %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(fp, "%s\n%d %d\n%d\n", color->type, color->width, color->height, color->max_val);
+    if (color->type[1] == '6')
+    {
+        unsigned char *row = (unsigned char *)malloc((size_t)3 * color->width);
+        if (row == NULL)
+        {
+            fprintf(stderr, "Error: color_write() failed to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < color->height; i++)
+        {
+            rgb_interleave(color->channel[0]->data[i], color->channel[1]->data[i], color->channel[2]->data[i], row, color->width);
+            fwrite(row, 3, color->width, fp);
+            if (ferror(fp))
+            {
+                fprintf(stderr, "Error: color_write() failed to write to file %s\n", filename);
+                exit(EXIT_FAILURE);
+            }
+        }
+        free(row);
+    }
+    else
+    {
+        for (int i = 0; i < color->height; i++)
+        {
+            for (int j = 0; j < color->width; j++)
+            {
+                fprintf(fp, "%hhu %hhu %hhu ", color->channel[0]->data[i][j], color->channel[1]->data[i][j],
+                        color->channel[2]->data[i][j]);
+            }
+            fprintf(fp, "\n");
+        }
+    }
+
+    fclose(fp);
+}
+
+/**
+ * @brief Convert an RGB image to gray, see rgb_to_gray()
+ * 
+ * @param color 
+ * @return PGM* P5 image, or P2 for a P3 image
+ */
+PGM *color_to_gray(PGM_color *color)
+{
+    PGM *gray = pgm_create(color->width, color->height, color->max_val, color->type[1] == '3' ? "P2" : "P5");
+
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < color->height; i++)
+    {
+        rgb_to_gray(color->channel[0]->data[i], color->channel[1]->data[i], color->channel[2]->data[i], gray->data[i],
+                    color->width);
+    }
+    return gray;
+}
+
+/**
+ * @brief Create a zeroed, all white bitmap
+ * 
+ * @param width 
+ * @param height 
+ * @param type P1 or P4
+ * @return PGM_bitmap* 
+ */
+PGM_bitmap *bitmap_create(int width, int height, char *type)
+{
+    PGM_bitmap *bitmap = (PGM_bitmap *)malloc(sizeof(PGM_bitmap));
+
+    if (bitmap == NULL)
+    {
+        fprintf(stderr, "Error: bitmap_create() failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    bitmap->width = width;
+    bitmap->height = height;
+    bitmap->stride = (width + 7) / 8;
+    strcpy(bitmap->type, type);
+    bitmap->bits = (unsigned char *)calloc((size_t)bitmap->stride * height + 1, 1);
+    if (bitmap->bits == NULL)
+    {
+        fprintf(stderr, "Error: bitmap_create() failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return bitmap;
+}
+
+/**
+ * @brief Free a bitmap
+ * 
+ * @param bitmap 
+ */
+void bitmap_free(PGM_bitmap *bitmap)
+{
+    free(bitmap->bits);
+    free(bitmap);
+}
+
+/**
+ * @brief Read a P1 or P4 bitmap, packed
+ *        A P4 raster has the layout of PGM_bitmap and is read in one go without expanding it
+ *        P1 digits may or may not be separated by whitespace
+ * 
+ * @param filename 
+ * @return PGM_bitmap* 
+ */
+PGM_bitmap *bitmap_read(char *filename)
+{
+    char type[3];
+    int width, height, max_val;
+    FILE *fp = fopen(filename, "rb");
+    PGM_bitmap *bitmap;
+
+    if (fp == NULL)
+    {
+        fprintf(stderr, "Error: bitmap_read() failed to open file %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    netpbm_read_header(fp, type, &width, &height, &max_val, filename);
+    if (type[1] != '1' && type[1] != '4')
+    {
+        fprintf(stderr, "Error: bitmap_read() %s is not a P1 or P4 image\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    bitmap = bitmap_create(width, height, type);
+    if (type[1] == '4')
+    {
+        if (fread(bitmap->bits, bitmap->stride, height, fp) != (size_t)height)
+        {
+            fprintf(stderr, "Error: bitmap_read() failed to read from file %s\n", filename);
+            exit(EXIT_FAILURE);
+        }
+    }
+    else
+    {
+        for (int i = 0; i < height; i++)
+        {
+            unsigned char *row = bitmap->bits + (ptrdiff_t)i * bitmap->stride;
+            for (int j = 0; j < width; j++)
+            {
+                int ch;
+
+                skip_comments(fp);
+                ch = fgetc(fp);
+                if (ch != '0' && ch != '1')
+                {
+                    fprintf(stderr, "Error: bitmap_read() failed to read from file %s\n", filename);
+                    exit(EXIT_FAILURE);
+                }
+                row[j / 8] |= (unsigned char)((ch - '0') << (7 - j % 8));
+            }
+        }
+    }
+
+    fclose(fp);
+    return bitmap;
+}
+
+/**
+ * @brief Write a bitmap as P1 or P4, following bitmap->type
+ *        P4 writes the packed rows as they are, P1 lines are at most 70 characters as netpbm asks
+ * 
+ * @param bitmap 
+ * @param filename 
+ */
+void bitmap_write(PGM_bitmap *bitmap, char *filename)
+{
+    FILE *fp;
+
+    if (strcmp(bitmap->type, "P1") != 0 && strcmp(bitmap->type, "P4") != 0)
+    {
+        fprintf(stderr, "Error: Unknown format\n");
+        exit(EXIT_FAILURE);
+    }
+    fp = fopen(filename, bitmap->type[1] == '4' ? "wb" : "w");
+    if (fp == NULL)
+    {
+        fprintf(stderr, "Error: bitmap_write() failed to open file %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(fp, "%s\n%d %d\n", bitmap->type, bitmap->width, bitmap->height);
+    if (bitmap->type[1] == '4')
+    {
+        fwrite(bitmap->bits, bitmap->stride, bitmap->height, fp);
+    }
+    else
+    {
+        for (int i = 0; i < bitmap->height; i++)
+        {
+            const unsigned char *row = bitmap->bits + (ptrdiff_t)i * bitmap->stride;
+            for (int j = 0; j < bitmap->width; j++)
+            {
+                fputc('0' + ((row[j / 8] >> (7 - j % 8)) & 1), fp);
+                if (j % 70 == 69 || j == bitmap->width - 1)
+                {
+                    fputc('\n', fp);
+                }
+            }
+        }
+    }
+    if (ferror(fp))
+    {
+        fprintf(stderr, "Error: bitmap_write() failed to write to file %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    fclose(fp);
+}
+
+/**
+ * @brief Pack an 8-bit view into a bitmap of the same size, pixels below 128 become black (1)
+ *        With SSE2 the top bits of 16 pixels are gathered with one movemask, which sees the
+ *          0 / 255 output of filter_threshold() and filter_canny() exactly
+ * 
+ * @param src 
+ * @param dst 
+ */
+void bitmap_pack(const PGM_view *src, PGM_bitmap *dst)
+{
+    if (src->depth != PGM_DEPTH_8U || src->width != dst->width || src->height != dst->height)
+    {
+        fprintf(stderr, "Error: bitmap_pack() needs an 8-bit view of the size of the bitmap\n");
+        exit(EXIT_FAILURE);
+    }
+
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < src->height; i++)
+    {
+        const unsigned char *row = PGM_VIEW_ROW(src, unsigned char, i);
+        unsigned char *bits = dst->bits + (ptrdiff_t)i * dst->stride;
+        int j = 0;
+
+#ifdef __SSE2__
+        for (; j + 16 <= src->width; j += 16)
+        {
+            unsigned int white = (unsigned int)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(row + j)));
+            unsigned int black = ~white & 0xffff;
+
+            // movemask puts the first pixel in the lowest bit, netpbm wants it in the highest
+            for (int n = 0; n < 2; n++)
+            {
+                unsigned int byte = (black >> (8 * n)) & 0xff;
+                byte = ((byte * 0x0802u & 0x22110u) | (byte * 0x8020u & 0x88440u)) * 0x10101u >> 16;
+                bits[j / 8 + n] = (unsigned char)byte;
+            }
+        }
+#endif
+        memset(bits + j / 8, 0, dst->stride - j / 8);
+        for (; j < src->width; j++)
+        {
+            bits[j / 8] |= (unsigned char)((row[j] < 128) << (7 - j % 8));
+        }
+    }
+}
+
+/**
+ * @brief Expand a bitmap into an 8-bit view of the same size, black is 0 and white 255
+ * 
+ * @param src 
+ * @param dst 
+ */
+void bitmap_unpack(const PGM_bitmap *src, const PGM_view *dst)
+{
+    if (dst->depth != PGM_DEPTH_8U || src->width != dst->width || src->height != dst->height)
+    {
+        fprintf(stderr, "Error: bitmap_unpack() needs an 8-bit view of the size of the bitmap\n");
+        exit(EXIT_FAILURE);
+    }
+
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < dst->height; i++)
+    {
+        const unsigned char *bits = src->bits + (ptrdiff_t)i * src->stride;
+        unsigned char *row = PGM_VIEW_ROW(dst, unsigned char, i);
+
+#pragma omp simd
+        for (int j = 0; j < dst->width; j++)
+        {
+            row[j] = (bits[j >> 3] >> (7 - (j & 7))) & 1 ? 0 : 255;
+        }
+    }
+}
@@ -0,0 +1,237 @@
+#include "pgm.h"
+
+// Output rows per band, a band keeps its accumulators and the integral image of one offset in cache
+#define NLMEANS_BAND 16
+// Largest patch, patch distances stay below 2^31 as ints
+#define NLMEANS_MAX_PATCH 63
+
+/**
+ * @brief Accumulate the weighted neighbours of one offset for the rows of a band
+ *        d(y, x) = (in(y, x) - in(y + dy, x + dx))^2 goes into an integral image row by row,
+ *          every patch distance is then 4 lookups, whatever the size of the patch
+ *        Integral sums wrap around in 32 bits, a patch sum is below 2^31 and comes out exact
+ * 
+ * @param in input rows, output pixel (i, j) is centered on in(i + margin, j + margin)
+ * @param y0 first output row of the band
+ * @param rows output rows of the band
+ * @param width output width
+ * @param patch 
+ * @param search 
+ * @param dy 
+ * @param dx 
+ * @param table weights by scaled patch distance, NLMEANS_TABLE + 1 entries, the last one 0
+ * @param scale table index per unit of patch distance
+ * @param integral (rows + patch) x (width + patch) scratch
+ * @param line width + patch scratch
+ * @param sum weighted sum of the band
+ * @param weight sum of the weights of the band
+ */
+static void nlmeans_offset(const PGM_view *in, int y0, int rows, int width, int patch, int search, int dy, int dx,
+                           const float *table, float scale, unsigned int *integral, unsigned int *line, float *sum,
+                           float *weight)
+{
+    const int sr = search / 2, columns = width + patch - 1, stride = columns + 1;
+
+    // Row 0 and column 0 of the integral image are 0
+    memset(integral, 0, stride * sizeof(unsigned int));
+    for (int k = 0; k < rows + patch - 1; k++)
+    {
+        const unsigned char *a = PGM_VIEW_ROW(in, unsigned char, y0 + sr + k) + sr;
+        const unsigned char *b = PGM_VIEW_ROW(in, unsigned char, y0 + sr + k + dy) + sr + dx;
+        const unsigned int *above = integral + (size_t)k * stride;
+        unsigned int *row = integral + (size_t)(k + 1) * stride, running = 0;
+
+#pragma omp simd
+        for (int c = 0; c < columns; c++)
+        {
+            int diff = a[c] - b[c];
+            line[c] = (unsigned int)(diff * diff);
+        }
+
+        row[0] = 0;
+        for (int c = 0; c < columns; c++)
+        {
+            running += line[c];
+            row[c + 1] = running;
+        }
+
+#pragma omp simd
+        for (int c = 1; c <= columns; c++)
+        {
+            row[c] += above[c];
+        }
+    }
+
+    for (int k = 0; k < rows; k++)
+    {
+        const unsigned int *top = integral + (size_t)k * stride, *bottom = integral + (size_t)(k + patch) * stride;
+        const unsigned char *neighbour = PGM_VIEW_ROW(in, unsigned char, y0 + k + search / 2 + patch / 2 + dy) + sr + patch / 2 + dx;
+        float *s = sum + (size_t)k * width, *w = weight + (size_t)k * width;
+
+#pragma omp simd
+        for (int j = 0; j < width; j++)
+        {
+            int distance = (int)(bottom[j + patch] - bottom[j] - top[j + patch] + top[j]);
+            float index = distance * scale;
+            float value = table[index < NLMEANS_TABLE ? (int)index : NLMEANS_TABLE];
+
+            w[j] += value;
+            s[j] += value * neighbour[j];
+        }
+    }
+}
+
+/**
+ * @brief Apply non-local means to the image and return the filtered image
+ *        See filter_nlmeans_view()
+ * 
+ * @param img 
+ * @param patch 
+ * @param search 
+ * @param h 
+ * @param padding 
+ * @return PGM* 
+ */
+PGM *filter_nlmeans(PGM *img, int patch, int search, double h, char *padding)
+{
+    PGM *filtered = filter_create_output(img, patch + search - 1, patch + search - 1, padding);
+    PGM_view src = pgm_view_of(img);
+    PGM_view dst = pgm_view_of(filtered);
+
+    filter_nlmeans_view(&src, &dst, patch, search, h, padding);
+    return filtered;
+}
+
+/**
+ * @brief Denoise src with non-local means and write the result to dst
+ *        Every pixel becomes the mean of the pixels in a search x search window around it, weighted by
+ *          exp(-d / h^2) where d is the mean squared difference of the patch x patch patches around the two pixels
+ *        Offsets are taken one at a time (Darbon et al. 2008): the squared differences between the image
+ *          and the image shifted by the offset go into an integral image, so a patch distance costs
+ *          4 lookups and the filter costs search^2 times a constant per pixel, not search^2 * patch^2
+ *        Bands of rows run in parallel, each goes through all offsets with its accumulators in cache,
+ *          and the per pixel loops of an offset run on SIMD lanes, weights come from a table
+ *        Output size follows the rules of filter_bilateral_view() for a patch + search - 1 filter,
+ *          with padding "yes" the border is filtered too, pixels outside the image repeat the edge
+ * 
+ * @param src 
+ * @param dst 
+ * @param patch odd, 3 .. 7 is common, at most NLMEANS_MAX_PATCH
+ * @param search odd, 11 .. 21 is common
+ * @param h in gray levels, about the noise standard deviation
+ * @param padding 
+ */
+void filter_nlmeans_view(const PGM_view *src, const PGM_view *dst, int patch, int search, double h, char *padding)
+{
+    const int size = patch + search - 1, margin = size / 2;
+    const int offset = strcmp(padding, "yes") == 0 ? 0 : margin;
+    float table[NLMEANS_TABLE + 1];
+    float scale;
+    unsigned char *padded = NULL;
+    PGM_view in;
+    int width, height, bands;
+
+    if (patch < 1 || patch % 2 == 0 || patch > NLMEANS_MAX_PATCH || search < 1 || search % 2 == 0)
+    {
+        fprintf(stderr, "Error: filter_nlmeans() patch and search must be odd, patch at most %d\n", NLMEANS_MAX_PATCH);
+        exit(EXIT_FAILURE);
+    }
+    if (!(h > 0))
+    {
+        fprintf(stderr, "Error: filter_nlmeans() h must be positive\n");
+        exit(EXIT_FAILURE);
+    }
+
+    filter_prepare_output(src, dst, size, padding, "filter_nlmeans");
+    width = src->width - 2 * offset;
+    height = src->height - 2 * offset;
+
+    // Input with the edge repeated margin pixels beyond it, or src itself when only inner pixels are filtered
+    if (offset == 0)
+    {
+        int padded_width = src->width + 2 * margin, padded_height = src->height + 2 * margin;
+
+        padded = (unsigned char *)malloc((size_t)padded_width * padded_height);
+        if (padded == NULL)
+        {
+            fprintf(stderr, "Error: filter_nlmeans() failed to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+
+#pragma omp parallel for schedule(static)
+        for (int y = 0; y < padded_height; y++)
+        {
+            int i = y - margin < 0 ? 0 : y - margin >= src->height ? src->height - 1 : y - margin;
+            const unsigned char *row = PGM_VIEW_ROW(src, unsigned char, i);
+            unsigned char *out = padded + (size_t)y * padded_width;
+
+            memset(out, row[0], margin);
+            memcpy(out + margin, row, src->width);
+            memset(out + margin + src->width, row[src->width - 1], margin);
+        }
+        in = pgm_view_wrap(padded, padded_width, padded_height, padded_width, PGM_DEPTH_8U);
+    }
+    else
+    {
+        in = *src;
+    }
+
+    // Table entry n is exp(-t) at t = n * NLMEANS_RANGE / NLMEANS_TABLE, t = d / h^2 with d the mean over the patch
+    for (int n = 0; n < NLMEANS_TABLE; n++)
+    {
+        table[n] = (float)exp(-(n + 0.5) * NLMEANS_RANGE / NLMEANS_TABLE);
+    }
+    table[NLMEANS_TABLE] = 0;
+    scale = (float)(NLMEANS_TABLE / (NLMEANS_RANGE * h * h * patch * patch));
+    bands = (height + NLMEANS_BAND - 1) / NLMEANS_BAND;
+
+#pragma omp parallel
+    {
+        unsigned int *integral = (unsigned int *)malloc((size_t)(NLMEANS_BAND + patch) * (width + patch) * sizeof(unsigned int));
+        unsigned int *line = (unsigned int *)malloc((width + patch) * sizeof(unsigned int));
+        float *sum = (float *)malloc((size_t)NLMEANS_BAND * width * sizeof(float));
+        float *weight = (float *)malloc((size_t)NLMEANS_BAND * width * sizeof(float));
+
+        if (integral == NULL || line == NULL || sum == NULL || weight == NULL)
+        {
+            fprintf(stderr, "Error: filter_nlmeans() failed to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+
+#pragma omp for schedule(static)
+        for (int b = 0; b < bands; b++)
+        {
+            int y0 = b * NLMEANS_BAND, rows = y0 + NLMEANS_BAND < height ? NLMEANS_BAND : height - y0;
+
+            memset(sum, 0, (size_t)rows * width * sizeof(float));
+            memset(weight, 0, (size_t)rows * width * sizeof(float));
+            for (int dy = -(search / 2); dy <= search / 2; dy++)
+            {
+                for (int dx = -(search / 2); dx <= search / 2; dx++)
+                {
+                    nlmeans_offset(&in, y0, rows, width, patch, search, dy, dx, table, scale, integral, line, sum, weight);
+                }
+            }
+
+            // The offset 0 always has weight table[0], so weight is never 0
+            for (int k = 0; k < rows; k++)
+            {
+                const float *s = sum + (size_t)k * width, *w = weight + (size_t)k * width;
+                unsigned char *out = PGM_VIEW_ROW(dst, unsigned char, y0 + k);
+
+                for (int j = 0; j < width; j++)
+                {
+                    float value = s[j] / w[j] + 0.5f;
+                    out[j] = value >= 255 ? 255 : (unsigned char)value;
+                }
+            }
+        }
+
+        free(integral);
+        free(line);
+        free(sum);
+        free(weight);
+    }
+
+    free(padded);
+}
@@ -1,7 +1,8 @@
 #include "pgm.h"
 
 /**
- * @brief Check if pgm format is P2 or P5 and return the reading mode
+ * @brief Check the netpbm type of a file and return the reading mode
+ *        P1, P2 and P3 are text, P4, P5 and P6 binary, anything else returns NULL
  * 
  * @param filename 
  * @return char* 
@@ -17,12 +18,12 @@ char *check_pgm_type(char *filename)
     }
     fscanf(fp, "%2s", type);
     fclose(fp);
-    if (strcmp(type, "P2") == 0)
+    if (strcmp(type, "P1") == 0 || strcmp(type, "P2") == 0 || strcmp(type, "P3") == 0)
     {
         return "r\0";
     }
 
-    else if (strcmp(type, "P5") == 0)
+    else if (strcmp(type, "P4") == 0 || strcmp(type, "P5") == 0 || strcmp(type, "P6") == 0)
     {
         return "rb";
     }
@@ -34,6 +35,8 @@ char *check_pgm_type(char *filename)
  * @brief Create a new pgm struct to hold the image data and return pointer to it
  *        Struct is allocated on the heap
  *        Calloc is used to allocate memory because Calloc initializes the memory to 0 for padding if needed
+ *        Pixels are one contiguous block and data[i] points to the start of row i, so the image
+ *          can also be handed out as a PGM_view without copying
  * 
  * @param width 
  * @param height 
@@ -48,23 +51,59 @@ PGM *pgm_create(int width, int height, int max_val, char *type)
     pgm->height = height;
     pgm->max_val = max_val;
     strcpy(pgm->type, type);
-    pgm->data = (unsigned char **)calloc(height, sizeof(unsigned char *));
+    pgm->stride = width;
+    pgm->owns_data = 1;
+    pgm->data = (unsigned char **)calloc(height > 0 ? height : 1, sizeof(unsigned char *));
+    unsigned char *pixels = (unsigned char *)calloc((size_t)width * height + 1, sizeof(unsigned char));
 
-    if (pgm->data == NULL)
+    if (pgm->data == NULL || pixels == NULL)
     {
+        free(pixels);
+        free(pgm->data);
         free(pgm);
         fprintf(stderr, "Error: pgm_create() failed to allocate memory for pgm->data\n");
         exit(EXIT_FAILURE);
     }
 
-    for (int i = 0; i < height; i++)
+    placement_touch(pixels, width, height);
+    pgm->data[0] = pixels;
+    for (int i = 1; i < height; i++)
     {
-        pgm->data[i] = (unsigned char *)calloc(width, sizeof(unsigned char));
+        pgm->data[i] = pixels + (ptrdiff_t)i * width;
     }
     fprintf(stdout, "pgm_create() created a PGM image with width %d, height %d, max_val %d, type %s\n", width, height, max_val, type);
     return pgm;
 }
 
+/**
+ * @brief Read a bitmap or color netpbm file as a gray image, see pgm_read()
+ * 
+ * @param filename 
+ * @param type 
+ * @return PGM* 
+ */
+static PGM *pgm_read_netpbm(char *filename, const char *type)
+{
+    PGM *pgm;
+
+    if (type[1] == '1' || type[1] == '4')
+    {
+        PGM_bitmap *bitmap = bitmap_read(filename);
+        PGM_view view;
+
+        pgm = pgm_create(bitmap->width, bitmap->height, 255, bitmap->type);
+        view = pgm_view_of(pgm);
+        bitmap_unpack(bitmap, &view);
+        bitmap_free(bitmap);
+        return pgm;
+    }
+
+    PGM_color *color = color_read(filename);
+    pgm = color_to_gray(color);
+    color_free(color);
+    return pgm;
+}
+
 /**
  * @brief Read a pgm image from a file and return a pointer to the image struct
  *        Check for PGM type is P2, reading mode is r and if PGM type is P5, reading mode is rb
@@ -72,6 +111,8 @@ PGM *pgm_create(int width, int height, int max_val, char *type)
  *          so fscanf reads data|whitespace and then data to fill the image struct
  *        if PGM type is P5, we can read the data with fread line by line 
  *        Single pixel data type is unsigned char (max value is 255)
+ *        Bitmaps (P1, P4) are expanded to 0 for black and 255 for white and keep their type,
+ *          color images (P3, P6) are converted with color_to_gray() and become P2 and P5
  * 
  * @param filename 
  * @return PGM* 
@@ -82,8 +123,15 @@ PGM *pgm_read(char *filename)
     int max_val;
     int width, height, i;
     char reading_format[3];
+    char *mode = check_pgm_type(filename);
 
-    memcpy(reading_format, check_pgm_type(filename), 2);
+    if (mode == NULL)
+    {
+        fprintf(stderr, "Error: pgm_read() %s is not a netpbm image\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    memcpy(reading_format, mode, 2);
+    reading_format[2] = '\0';
 
     FILE *ptr = fopen(filename, reading_format);
     if (ptr == NULL)
@@ -94,6 +142,11 @@ PGM *pgm_read(char *filename)
 
     skip_comments(ptr);
     fscanf(ptr, "%s\n", type);
+    if (type[1] == '1' || type[1] == '3' || type[1] == '4' || type[1] == '6')
+    {
+        fclose(ptr);
+        return pgm_read_netpbm(filename, type);
+    }
     skip_comments(ptr);
     fscanf(ptr, "%d %d\n", &width, &height);
     skip_comments(ptr);
@@ -166,6 +219,7 @@ void skip_comments(FILE *ptr)
  *        so fprintf writes data|whitespace and then data to the file
  *        if PGM type is P5, we can write the data with fwrite line by line
  *        Single pixel data type is unsigned char (max value is 255)
+ *        if PGM type is P1 or P4, pixels below 128 are written as black bits, see bitmap_pack()
  * 
  * @param pgm 
  * @param filename 
@@ -181,6 +235,16 @@ void pgm_write(PGM *pgm, char *filename)
     {
         strcpy(reading_format, "wb");
     }
+    else if (strcmp(pgm->type, "P1") == 0 || strcmp(pgm->type, "P4") == 0)
+    {
+        PGM_bitmap *bitmap = bitmap_create(pgm->width, pgm->height, pgm->type);
+        PGM_view view = pgm_view_of(pgm);
+
+        bitmap_pack(&view, bitmap);
+        bitmap_write(bitmap, filename);
+        bitmap_free(bitmap);
+        return;
+    }
     else
     {
         fprintf(stderr, "Error: Unknown format\n");
@@ -230,14 +294,15 @@ void pgm_write(PGM *pgm, char *filename)
 
 /**
  * @brief Free the memory allocated for the image struct
+ *        Pixels of a wrapped or decoded image belong to the caller and are left alone
  * 
  * @param pgm 
  */
 void pgm_free(PGM *pgm)
 {
-    for (int i = 0; i < pgm->height; i++)
+    if (pgm->owns_data)
     {
-        free(pgm->data[i]);
+        free(pgm->data[0]);
     }
 
     free(pgm->data);
@@ -245,10 +310,494 @@ void pgm_free(PGM *pgm)
     fprintf(stdout, "pgm_free() freed the PGM image\n");
 }
 
+/**
+ * @brief Wrap caller owned memory in a view
+ *        Nothing is allocated or copied, the memory must outlive every use of the view
+ *        Stride is the distance between row starts in bytes and can be larger than the row
+ *          so a view can sit on top of another library's frame buffer
+ * 
+ * @param data 
+ * @param width 
+ * @param height 
+ * @param stride 
+ * @param depth 
+ * @return PGM_view 
+ */
+PGM_view pgm_view_wrap(void *data, int width, int height, ptrdiff_t stride, PGM_depth depth)
+{
+    PGM_view view;
+    view.width = width;
+    view.height = height;
+    view.stride = stride;
+    view.depth = depth;
+    view.data = data;
+    return view;
+}
+
+/**
+ * @brief Return a view over the pixels of a pgm image
+ *        The view stays valid until the image is freed
+ * 
+ * @param pgm 
+ * @return PGM_view 
+ */
+PGM_view pgm_view_of(PGM *pgm)
+{
+    return pgm_view_wrap(pgm->height > 0 ? pgm->data[0] : NULL, pgm->width, pgm->height, pgm->stride, PGM_DEPTH_8U);
+}
+
+/**
+ * @brief Return a view over a rectangle inside another view
+ *        The sub view shares the stride of its parent so no pixels are copied
+ * 
+ * @param view 
+ * @param x 
+ * @param y 
+ * @param width 
+ * @param height 
+ * @return PGM_view 
+ */
+PGM_view pgm_view_sub(const PGM_view *view, int x, int y, int width, int height)
+{
+    static const int pixel_size[] = {1, 2, 4, 4, 2};
+
+    if (x < 0 || y < 0 || width < 0 || height < 0 || x + width > view->width || y + height > view->height)
+    {
+        fprintf(stderr, "Error: pgm_view_sub() rectangle is outside of the view\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return pgm_view_wrap(PGM_VIEW_ROW(view, unsigned char, y) + (ptrdiff_t)x * pixel_size[view->depth],
+                         width, height, view->stride, view->depth);
+}
+
+/**
+ * @brief Create a pgm struct on top of the pixels of a view
+ *        Only the struct and the row pointers are allocated, data[i] points into the view
+ *        pgm_free() releases the struct but leaves the pixels to their owner
+ * 
+ * @param view 
+ * @param max_val 
+ * @param type 
+ * @return PGM* 
+ */
+PGM *pgm_wrap(const PGM_view *view, int max_val, char *type)
+{
+    if (view->depth != PGM_DEPTH_8U)
+    {
+        fprintf(stderr, "Error: pgm_wrap() only 8-bit views can be wrapped\n");
+        exit(EXIT_FAILURE);
+    }
+
+    PGM *pgm = (PGM *)malloc(sizeof(PGM));
+    pgm->width = view->width;
+    pgm->height = view->height;
+    pgm->max_val = max_val;
+    strcpy(pgm->type, type);
+    pgm->stride = view->stride;
+    pgm->owns_data = 0;
+    pgm->data = (unsigned char **)malloc((view->height > 0 ? view->height : 1) * sizeof(unsigned char *));
+
+    if (pgm->data == NULL)
+    {
+        free(pgm);
+        fprintf(stderr, "Error: pgm_wrap() failed to allocate memory for pgm->data\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < view->height; i++)
+    {
+        pgm->data[i] = PGM_VIEW_ROW(view, unsigned char, i);
+    }
+    return pgm;
+}
+
+/**
+ * @brief Skip whitespace and comments in a pgm header held in memory
+ *        Same rules as skip_comments(), a comment runs from # to the end of the line
+ * 
+ * @param buffer 
+ * @param size 
+ * @param pos 
+ * @return size_t position of the next token
+ */
+static size_t buffer_skip_comments(const unsigned char *buffer, size_t size, size_t pos)
+{
+    while (pos < size)
+    {
+        if (buffer[pos] == '#')
+        {
+            while (pos < size && buffer[pos] != '\n')
+            {
+                pos++;
+            }
+        }
+        else if (isspace(buffer[pos]))
+        {
+            pos++;
+        }
+        else
+        {
+            break;
+        }
+    }
+    return pos;
+}
+
+/**
+ * @brief Read a non negative decimal number from a buffer and advance pos past it
+ * 
+ * @param buffer 
+ * @param size 
+ * @param pos 
+ * @param value 
+ * @return int 1 on success, 0 if there is no number at pos or it does not fit an int
+ */
+static int buffer_read_int(const unsigned char *buffer, size_t size, size_t *pos, int *value)
+{
+    long number = 0;
+    size_t start;
+
+    *pos = buffer_skip_comments(buffer, size, *pos);
+    start = *pos;
+    // All digits are consumed, a number past INT_MAX stays above it instead of being cut into two fields
+    while (*pos < size && isdigit(buffer[*pos]))
+    {
+        if (number <= INT_MAX)
+        {
+            number = number * 10 + (buffer[*pos] - '0');
+        }
+        (*pos)++;
+    }
+
+    if (*pos == start || number > INT_MAX)
+    {
+        return 0;
+    }
+    *value = (int)number;
+    return 1;
+}
+
+/**
+ * @brief Decode a pgm image held in memory and return a pointer to the image struct
+ *        if PGM type is P5, the raster is used in place: data[i] points into buffer and nothing is copied,
+ *          so buffer must outlive the image and writing to the image writes to buffer
+ *        if PGM type is P2, the text has to be parsed so the pixels are stored in a new image
+ *        Returns NULL if the buffer does not hold an 8-bit P2 or P5 image, ends early, has a header number
+ *          that does not fit an int or a P2 pixel above max_val
+ * 
+ * @param buffer 
+ * @param size 
+ * @return PGM* 
+ */
+PGM *pgm_decode(unsigned char *buffer, size_t size)
+{
+    char type[3];
+    int width, height, max_val, value;
+    size_t pos = buffer_skip_comments(buffer, size, 0);
+    PGM *pgm;
+    PGM_view view;
+
+    if (size - pos < 2 || buffer[pos] != 'P' || (buffer[pos + 1] != '2' && buffer[pos + 1] != '5'))
+    {
+        fprintf(stderr, "Error: pgm_decode() unknown format\n");
+        return NULL;
+    }
+    type[0] = 'P';
+    type[1] = buffer[pos + 1];
+    type[2] = '\0';
+    pos += 2;
+
+    if (!buffer_read_int(buffer, size, &pos, &width) || !buffer_read_int(buffer, size, &pos, &height) ||
+        !buffer_read_int(buffer, size, &pos, &max_val))
+    {
+        fprintf(stderr, "Error: pgm_decode() broken header\n");
+        return NULL;
+    }
+    if (max_val > 255)
+    {
+        fprintf(stderr, "Error: pgm_decode() only 8-bit images are supported\n");
+        return NULL;
+    }
+
+    switch (type[1])
+    {
+    case '2':
+        // Every pixel takes at least one digit, a header asking for more is refused before anything is allocated
+        if (size - pos < (size_t)width * height)
+        {
+            fprintf(stderr, "Error: pgm_decode() buffer ends before the last pixel\n");
+            return NULL;
+        }
+        pgm = pgm_create(width, height, max_val, type);
+        for (int i = 0; i < height; i++)
+        {
+            for (int j = 0; j < width; j++)
+            {
+                if (!buffer_read_int(buffer, size, &pos, &value))
+                {
+                    fprintf(stderr, "Error: pgm_decode() buffer ends before the last pixel\n");
+                    pgm_free(pgm);
+                    return NULL;
+                }
+                if (value > max_val)
+                {
+                    fprintf(stderr, "Error: pgm_decode() pixel above max_val\n");
+                    pgm_free(pgm);
+                    return NULL;
+                }
+                pgm->data[i][j] = (unsigned char)value;
+            }
+        }
+        break;
+
+    default:
+        // Exactly one whitespace separates max_val from the raster
+        pos++;
+        if (pos > size || size - pos < (size_t)width * height)
+        {
+            fprintf(stderr, "Error: pgm_decode() buffer ends before the last pixel\n");
+            return NULL;
+        }
+        view = pgm_view_wrap(buffer + pos, width, height, width, PGM_DEPTH_8U);
+        pgm = pgm_wrap(&view, max_val, type);
+        break;
+    }
+
+    return pgm;
+}
+
+/**
+ * @brief Encode a pgm image into a caller provided buffer, same layout as pgm_write()
+ *        Returns the number of bytes the encoded image needs
+ *        If buffer is NULL or capacity is smaller than that, nothing is written,
+ *          so the first call can be used to size the buffer
+ * 
+ * @param pgm 
+ * @param buffer 
+ * @param capacity 
+ * @return size_t 
+ */
+size_t pgm_encode(PGM *pgm, unsigned char *buffer, size_t capacity)
+{
+    char header[64];
+    int header_size = snprintf(header, sizeof(header), "%s\n%d %d\n%d\n", pgm->type, pgm->width, pgm->height, pgm->max_val);
+    size_t size = header_size;
+    size_t pos;
+
+    if (strcmp(pgm->type, "P2") == 0)
+    {
+        for (int i = 0; i < pgm->height; i++)
+        {
+            for (int j = 0; j < pgm->width; j++)
+            {
+                size += (pgm->data[i][j] >= 100) + (pgm->data[i][j] >= 10) + 2;
+            }
+            size++;
+        }
+    }
+    else if (strcmp(pgm->type, "P5") == 0)
+    {
+        size += (size_t)pgm->width * pgm->height;
+    }
+    else
+    {
+        fprintf(stderr, "Error: Unknown format\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (buffer == NULL || capacity < size)
+    {
+        return size;
+    }
+
+    memcpy(buffer, header, header_size);
+    pos = header_size;
+    for (int i = 0; i < pgm->height; i++)
+    {
+        if (pgm->type[1] == '5')
+        {
+            memcpy(buffer + pos, pgm->data[i], pgm->width);
+            pos += pgm->width;
+            continue;
+        }
+
+        for (int j = 0; j < pgm->width; j++)
+        {
+            unsigned char value = pgm->data[i][j];
+            if (value >= 100)
+            {
+                buffer[pos++] = '0' + value / 100;
+            }
+            if (value >= 10)
+            {
+                buffer[pos++] = '0' + value / 10 % 10;
+            }
+            buffer[pos++] = '0' + value % 10;
+            buffer[pos++] = ' ';
+        }
+        buffer[pos++] = '\n';
+    }
+
+    return size;
+}
+
+/**
+ * @brief Check that dst can hold the result of a filter_size x filter_size filter on src
+ *        and return the offset of the first filtered pixel in dst
+ *        See filter_prepare_output_rect()
+ * 
+ * @param src 
+ * @param dst 
+ * @param filter_size 
+ * @param padding 
+ * @param caller name of the filter for error messages
+ * @return int 
+ */
+int filter_prepare_output(const PGM_view *src, const PGM_view *dst, int filter_size, char *padding, const char *caller)
+{
+    int kx, ky;
+
+    filter_prepare_output_rect(src, dst, filter_size, filter_size, padding, caller, &kx, &ky);
+    return kx;
+}
+
+/**
+ * @brief Check that dst can hold the result of a filter_width x filter_height filter on src
+ *        and store the offset of the first filtered pixel in dst to kx, ky
+ *        If padding is "yes", dst has the size of src and its border of filter_size / 2 pixels is set to 0,
+ *          the same border pgm_create() gives the PGM versions of the filters
+ *        else dst must be (width - filter_width + 1, height - filter_height + 1) and the offset is 0
+ *        dst must not overlap src
+ * 
+ * @param src 
+ * @param dst 
+ * @param filter_width 
+ * @param filter_height 
+ * @param padding 
+ * @param caller name of the filter for error messages
+ * @param kx 
+ * @param ky 
+ */
+void filter_prepare_output_rect(const PGM_view *src, const PGM_view *dst, int filter_width, int filter_height,
+                                char *padding, const char *caller, int *kx, int *ky)
+{
+    int size_x = filter_width - 1;
+    int size_y = filter_height - 1;
+    int width = src->width - size_x;
+    int height = src->height - size_y;
+
+    *kx = 0;
+    *ky = 0;
+
+    if (src->depth != PGM_DEPTH_8U || dst->depth != PGM_DEPTH_8U)
+    {
+        fprintf(stderr, "Error: %s() works on 8-bit views only\n", caller);
+        exit(EXIT_FAILURE);
+    }
+
+    if (width < 1 || height < 1)
+    {
+        fprintf(stderr, "Error: %s() image is smaller than the filter\n", caller);
+        exit(EXIT_FAILURE);
+    }
+
+    if (strcmp(padding, "yes") == 0)
+    {
+        width = src->width;
+        height = src->height;
+        *kx = size_x / 2;
+        *ky = size_y / 2;
+    }
+
+    if (dst->width != width || dst->height != height)
+    {
+        fprintf(stderr, "Error: %s() output is %dx%d, expected %dx%d\n", caller, dst->width, dst->height, width, height);
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < dst->height; i++)
+    {
+        unsigned char *row = PGM_VIEW_ROW(dst, unsigned char, i);
+        if (i < *ky || i >= dst->height - (size_y - *ky))
+        {
+            memset(row, 0, dst->width);
+        }
+        else if (*kx > 0)
+        {
+            memset(row, 0, *kx);
+            memset(row + dst->width - (size_x - *kx), 0, size_x - *kx);
+        }
+    }
+}
+
+/**
+ * @brief Create the output image of a filter_width x filter_height filter
+ *        Same size as img if padding is "yes", smaller by filter_size - 1 otherwise
+ * 
+ * @param img 
+ * @param filter_width 
+ * @param filter_height 
+ * @param padding 
+ * @return PGM* 
+ */
+PGM *filter_create_output(PGM *img, int filter_width, int filter_height, char *padding)
+{
+    if (strcmp(padding, "yes") == 0)
+    {
+        return pgm_create(img->width, img->height, img->max_val, img->type);
+    }
+    return pgm_create(img->width - filter_width + 1, img->height - filter_height + 1, img->max_val, img->type);
+}
+
+/**
+ * @brief Apply sobel filter to the image and return the filtered image
+ *        See filter_sobel_view()
+ * 
+ * @param img 
+ * @param padding 
+ * @return PGM* 
+ */
 PGM *filter_sobel(PGM *img, char *padding)
 {
-    PGM *filtered, *sobel_x, *sobel_y;
+    PGM *filtered = filter_create_output(img, 3, 3, padding);
+    PGM_view src = pgm_view_of(img);
+    PGM_view dst = pgm_view_of(filtered);
+
+    filter_sobel_view(&src, &dst, padding);
+    return filtered;
+}
+
+/**
+ * @brief Apply sobel filter to src and write the gradient magnitude to dst
+ *        X and Y gradients are min-max normalized to 0..255 separately and then combined
+ *        Output size follows the padding rules of filter_prepare_output()
+ *        The implementation is the one the tune profile picked for the image size, see tune_lookup()
+ * 
+ * @param src 
+ * @param dst 
+ * @param padding 
+ */
+void filter_sobel_view(const PGM_view *src, const PGM_view *dst, char *padding)
+{
+    filter_sobel_variant(src, dst, padding, tune_lookup(TUNE_SOBEL, 3, src->width, src->height));
+}
+
+/**
+ * @brief Apply sobel filter to src with the implementation and thread count in choice
+ *        SOBEL_DIRECT is the plain serial loop, SOBEL_BANDS see sobel_bands()
+ *        Every variant writes exactly the same output
+ * 
+ * @param src 
+ * @param dst 
+ * @param padding 
+ * @param choice 
+ */
+void filter_sobel_variant(const PGM_view *src, const PGM_view *dst, char *padding, tune_choice choice)
+{
     int k, i, j;
+    int width = src->width - 2;
+    int height = src->height - 2;
 
     double x_max = DBL_MIN;
     double x_min = DBL_MAX;
@@ -258,46 +807,39 @@ PGM *filter_sobel(PGM *img, char *padding)
     short x_sobel[3][3] = {{-1, 0, 1}, {-2, 0, 2}, {-1, 0, 1}};
     short y_sobel[3][3] = {{-1, -2, -1}, {0, 0, 0}, {1, 2, 1}};
 
-    double **temp_x = (double **)malloc(sizeof(double *) * img->height - 2);
-    double **temp_y = (double **)malloc(sizeof(double *) * img->height - 2);
+    k = filter_prepare_output(src, dst, 3, padding, "filter_sobel");
 
-    for (i = 0; i < img->height - 1; i++)
+    if (choice.variant == SOBEL_BANDS)
     {
-        temp_x[i] = (double *)malloc(sizeof(double) * img->width - 2);
-        temp_y[i] = (double *)malloc(sizeof(double) * img->width - 2);
+        sobel_bands(src, dst, k, choice);
+        return;
     }
 
-    if (strcmp(padding, "yes") == 0)
+    double *temp_x = (double *)malloc(sizeof(double) * width * height);
+    double *temp_y = (double *)malloc(sizeof(double) * width * height);
+    if (temp_x == NULL || temp_y == NULL)
     {
-        filtered = pgm_create(img->width, img->height, img->max_val, img->type);
-        sobel_x = pgm_create(img->width, img->height, img->max_val, img->type);
-        sobel_y = pgm_create(img->width, img->height, img->max_val, img->type);
-        k = 1;
-    }
-    else
-    {
-        filtered = pgm_create(img->width - 2, img->height - 2, img->max_val, img->type);
-        sobel_x = pgm_create(img->width - 2, img->height - 2, img->max_val, img->type);
-        sobel_y = pgm_create(img->width - 2, img->height - 2, img->max_val, img->type);
-        k = 0;
+        fprintf(stderr, "Error: filter_sobel() failed to allocate memory for gradients\n");
+        exit(EXIT_FAILURE);
     }
 
-    for (i = 0; i < img->height - 2; i++)
+    for (i = 0; i < height; i++)
     {
-        for (j = 0; j < img->width - 2; j++)
+        for (j = 0; j < width; j++)
         {
             double x_sum = 0;
             double y_sum = 0;
             for (int m = 0; m < 3; m++)
             {
+                const unsigned char *row = PGM_VIEW_ROW(src, unsigned char, i + m);
                 for (int n = 0; n < 3; n++)
                 {
-                    x_sum += (double)img->data[i + m][j + n] * x_sobel[m][n];
-                    y_sum += (double)img->data[i + m][j + n] * y_sobel[m][n];
+                    x_sum += (double)row[j + n] * x_sobel[m][n];
+                    y_sum += (double)row[j + n] * y_sobel[m][n];
                 }
             }
-            temp_x[i][j] = x_sum;
-            temp_y[i][j] = y_sum;
+            temp_x[i * width + j] = x_sum;
+            temp_y[i * width + j] = y_sum;
             if (x_sum > x_max)
             {
                 x_max = x_sum;
@@ -318,34 +860,19 @@ PGM *filter_sobel(PGM *img, char *padding)
         }
     }
 
-    for (i = 0; i < img->height - 2; i++)
+    for (i = 0; i < height; i++)
     {
-        for (j = 0; j < img->width - 2; j++)
+        unsigned char *out = PGM_VIEW_ROW(dst, unsigned char, i + k);
+        for (j = 0; j < width; j++)
         {
-            sobel_x->data[i + k][j + k] = (unsigned char)(temp_x[i][j] - x_min) * 255 / (x_max - x_min);
-            sobel_y->data[i + k][j + k] = (unsigned char)(temp_y[i][j] - y_min) * 255 / (y_max - y_min);
+            unsigned char sobel_x = (unsigned char)(temp_x[i * width + j] - x_min) * 255 / (x_max - x_min);
+            unsigned char sobel_y = (unsigned char)(temp_y[i * width + j] - y_min) * 255 / (y_max - y_min);
+            out[j + k] = (unsigned char)(sqrt(pow(sobel_x, 2) + pow(sobel_y, 2)));
         }
     }
 
-    for (i = 0; i < img->height - 2; i++)
-    {
-        for (j = 0; j < img->width - 2; j++)
-        {
-            filtered->data[i + k][j + k] = (unsigned char)(sqrt(pow(sobel_x->data[i + k][j + k], 2) + pow(sobel_y->data[i + k][j + k], 2)));
-        }
-    }
-
-    for (i = 0; i < img->height - 1; i++)
-    {
-        free(temp_x[i]);
-        free(temp_y[i]);
-    }
     free(temp_x);
     free(temp_y);
-    pgm_free(sobel_x);
-    pgm_free(sobel_y);
-
-    return filtered;
 }
 
 /**
@@ -362,8 +889,44 @@ PGM *filter_sobel(PGM *img, char *padding)
  */
 PGM *filter_median(PGM *img, int filter_size, char *padding)
 {
-    PGM *filtered;
-    int i, j, k;
+    PGM *filtered = filter_create_output(img, filter_size, filter_size, padding);
+    PGM_view src = pgm_view_of(img);
+    PGM_view dst = pgm_view_of(filtered);
+
+    filter_median_view(&src, &dst, filter_size, padding);
+    return filtered;
+}
+
+/**
+ * @brief Apply median filter to src and write the result to dst
+ *        Output size follows the padding rules of filter_prepare_output()
+ *        The implementation is the one the tune profile picked for the kernel and image size, see tune_lookup()
+ * 
+ * @param src 
+ * @param dst 
+ * @param filter_size 
+ * @param padding 
+ */
+void filter_median_view(const PGM_view *src, const PGM_view *dst, int filter_size, char *padding)
+{
+    filter_median_variant(src, dst, filter_size, padding, tune_lookup(TUNE_MEDIAN, filter_size, src->width, src->height));
+}
+
+/**
+ * @brief Apply median filter to src with the implementation and thread count in choice
+ *        MEDIAN_MERGESORT sorts every window with find_median(), MEDIAN_NETWORK see median_network(),
+ *          MEDIAN_HISTOGRAM see median_histogram()
+ *        Kernels larger than MEDIAN_NETWORK_MAX_SIZE use MEDIAN_HISTOGRAM instead of MEDIAN_NETWORK
+ * 
+ * @param src 
+ * @param dst 
+ * @param filter_size 
+ * @param padding 
+ * @param choice 
+ */
+void filter_median_variant(const PGM_view *src, const PGM_view *dst, int filter_size, char *padding, tune_choice choice)
+{
+    int k;
     int size = filter_size - 1;
 
     if (filter_size % 2 == 0 && filter_size > 1)
@@ -372,25 +935,28 @@ PGM *filter_median(PGM *img, int filter_size, char *padding)
         exit(EXIT_FAILURE);
     }
 
-    if (strcmp(padding, "yes") == 0)
+    k = filter_prepare_output(src, dst, filter_size, padding, "filter_median");
+
+    if (choice.variant == MEDIAN_NETWORK && filter_size <= MEDIAN_NETWORK_MAX_SIZE)
     {
-        filtered = pgm_create(img->width, img->height, img->max_val, img->type);
-        k = size / 2;
+        median_network(src, dst, filter_size, k, choice);
+        return;
     }
-    else
+    if (choice.variant == MEDIAN_NETWORK || choice.variant == MEDIAN_HISTOGRAM)
     {
-        filtered = pgm_create(img->width - size, img->height - size, img->max_val, img->type);
-        k = 0;
+        median_histogram(src, dst, filter_size, k, choice);
+        return;
     }
 
-    for (i = 0; i < img->height - size; i++)
+#pragma omp parallel for num_threads(tune_threads(choice)) schedule(dynamic, 4)
+    for (int i = 0; i < src->height - size; i++)
     {
-        for (j = 0; j < img->width - size; j++)
+        unsigned char *out = PGM_VIEW_ROW(dst, unsigned char, i + k);
+        for (int j = 0; j < src->width - size; j++)
         {
-            filtered->data[i + k][j + k] = find_median(img->data, i, j, filter_size);
+            out[j + k] = find_median(src, i, j, filter_size);
         }
     }
-    return filtered;
 }
 
 /**
@@ -401,22 +967,23 @@ PGM *filter_median(PGM *img, int filter_size, char *padding)
  *        Return the median of the array
  *        Free the array
  * 
- * @param array 
+ * @param src 
  * @param i 
  * @param j 
  * @param size 
  * @return unsigned char 
  */
-unsigned char find_median(unsigned char **array, int i, int j, int size)
+unsigned char find_median(const PGM_view *src, int i, int j, int size)
 {
     unsigned char *arr = (unsigned char *)malloc(size * size * sizeof(unsigned char));
     unsigned median;
 
     for (int k = 0; k < size; k++)
     {
+        const unsigned char *row = PGM_VIEW_ROW(src, unsigned char, i + k);
         for (int m = 0; m < size; m++)
         {
-            arr[k * size + m] = array[i + k][j + m];
+            arr[k * size + m] = row[j + m];
         }
     }
 
@@ -529,8 +1096,43 @@ void merge(unsigned char *arr, int left, int middle, int right)
  */
 PGM *filter_average(PGM *img, int filter_size, char *padding)
 {
-    PGM *filtered;
-    int i, j, k;
+    PGM *filtered = filter_create_output(img, filter_size, filter_size, padding);
+    PGM_view src = pgm_view_of(img);
+    PGM_view dst = pgm_view_of(filtered);
+
+    filter_average_view(&src, &dst, filter_size, padding);
+    return filtered;
+}
+
+/**
+ * @brief Apply average filter to src and write the result to dst
+ *        Output size follows the padding rules of filter_prepare_output()
+ *        The implementation is the one the tune profile picked for the kernel and image size, see tune_lookup()
+ * 
+ * @param src 
+ * @param dst 
+ * @param filter_size 
+ * @param padding 
+ */
+void filter_average_view(const PGM_view *src, const PGM_view *dst, int filter_size, char *padding)
+{
+    filter_average_variant(src, dst, filter_size, padding, tune_lookup(TUNE_AVERAGE, filter_size, src->width, src->height));
+}
+
+/**
+ * @brief Apply average filter to src with the implementation and thread count in choice
+ *        AVERAGE_DIRECT adds up every window, AVERAGE_RUNNING see average_running()
+ *        Both truncate the mean the same way and write exactly the same output
+ * 
+ * @param src 
+ * @param dst 
+ * @param filter_size 
+ * @param padding 
+ * @param choice 
+ */
+void filter_average_variant(const PGM_view *src, const PGM_view *dst, int filter_size, char *padding, tune_choice choice)
+{
+    int k;
     int size = filter_size - 1;
 
     if (filter_size % 2 == 0 && filter_size > 1)
@@ -539,32 +1141,30 @@ PGM *filter_average(PGM *img, int filter_size, char *padding)
         exit(EXIT_FAILURE);
     }
 
-    if (strcmp(padding, "yes") == 0)
-    {
-        filtered = pgm_create(img->width, img->height, img->max_val, img->type);
-        k = size / 2;
-    }
-    else
+    k = filter_prepare_output(src, dst, filter_size, padding, "filter_average");
+
+    if (choice.variant == AVERAGE_RUNNING)
     {
-        filtered = pgm_create(img->width - size, img->height - size, img->max_val, img->type);
-        k = 0;
+        average_running(src, dst, filter_size, k, choice);
+        return;
     }
 
-    for (i = 0; i < img->height - size; i++)
+#pragma omp parallel for num_threads(tune_threads(choice)) schedule(static)
+    for (int i = 0; i < src->height - size; i++)
     {
-        for (j = 0; j < img->width - size; j++)
+        unsigned char *out = PGM_VIEW_ROW(dst, unsigned char, i + k);
+        for (int j = 0; j < src->width - size; j++)
         {
             double sum = 0;
             for (int m = 0; m < filter_size; m++)
             {
+                const unsigned char *row = PGM_VIEW_ROW(src, unsigned char, i + m);
                 for (int n = 0; n < filter_size; n++)
                 {
-                    sum += img->data[i + m][j + n];
+                    sum += row[j + n];
                 }
             }
-            filtered->data[i + k][j + k] = (unsigned char)(sum / (filter_size * filter_size));
+            out[j + k] = (unsigned char)(sum / (filter_size * filter_size));
         }
     }
-
-    return filtered;
 }
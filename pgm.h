@@ -3,6 +3,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
 #include <ctype.h>
 #include <math.h>
@@ -10,6 +11,7 @@
 #include <float.h>
 
 // PGM data structure
+// Rows of data point into one contiguous block, stride bytes apart
 
 typedef struct
 {
@@ -18,8 +20,248 @@ typedef struct
     int max_val;
     char type[3];
     unsigned char **data;
+    ptrdiff_t stride;
+    int owns_data;
 } PGM;
 
+// RGB image as three planes, each channel is an 8-bit PGM so every filter runs on it as is
+
+typedef struct
+{
+    int width;
+    int height;
+    int max_val;
+    char type[3];
+    PGM *channel[3];
+} PGM_color;
+
+// Bitmap packed 8 pixels per byte, most significant bit first, 1 is black, rows are stride bytes apart
+
+typedef struct
+{
+    int width;
+    int height;
+    char type[3];
+    ptrdiff_t stride;
+    unsigned char *bits;
+} PGM_bitmap;
+
+// Image view data structure
+// Wraps memory owned by someone else, nothing is copied or freed through a view
+
+typedef enum
+{
+    PGM_DEPTH_8U,
+    PGM_DEPTH_16U,
+    PGM_DEPTH_32U,
+    PGM_DEPTH_32F,
+    PGM_DEPTH_16S
+} PGM_depth;
+
+typedef struct
+{
+    int width;
+    int height;
+    ptrdiff_t stride;
+    PGM_depth depth;
+    void *data;
+} PGM_view;
+
+#define PGM_VIEW_ROW(view, T, i) ((T *)((unsigned char *)(view)->data + (ptrdiff_t)(i) * (view)->stride))
+
+// Morphological operations
+
+typedef enum
+{
+    MORPH_ERODE,
+    MORPH_DILATE,
+    MORPH_OPEN,
+    MORPH_CLOSE,
+    MORPH_TOPHAT,
+    MORPH_BLACKHAT
+} morph_op;
+
+// Local threshold methods
+
+typedef enum
+{
+    THRESHOLD_NIBLACK,
+    THRESHOLD_SAUVOLA
+} threshold_method;
+
+// Convolution methods, CONVOLVE_AUTO picks the cheaper one for the kernel size
+
+typedef enum
+{
+    CONVOLVE_AUTO,
+    CONVOLVE_DIRECT,
+    CONVOLVE_FFT
+} convolve_method;
+
+// Corner response, Harris score or smallest eigenvalue of the structure tensor
+
+typedef enum
+{
+    CORNER_HARRIS,
+    CORNER_SHI_TOMASI
+} corner_method;
+
+// Corner window, a box of window x window pixels or a Gaussian of sigma (window - 1) / 6
+
+typedef enum
+{
+    CORNER_BOX,
+    CORNER_GAUSSIAN
+} corner_window;
+
+typedef struct
+{
+    int x;
+    int y;
+    float score;
+} PGM_corner;
+
+// Hough line methods, HOUGH_PROBABILISTIC votes with a fraction of the edge pixels
+
+typedef enum
+{
+    HOUGH_STANDARD,
+    HOUGH_PROBABILISTIC
+} hough_method;
+
+// Line x cos(theta) + y sin(theta) = rho, theta in [0, pi), votes are the edge pixels on it
+
+typedef struct
+{
+    float rho;
+    float theta;
+    int votes;
+} PGM_line;
+
+// Template match, position of the top left corner of the template and its normalized cross-correlation
+
+typedef struct
+{
+    int x;
+    int y;
+    float score;
+} PGM_match;
+
+// Differences between two images, psnr is INFINITY for identical images, ssim is the mean over all windows
+
+typedef struct
+{
+    double mse;
+    double psnr;
+    int max_diff;
+    size_t differing;
+    double ssim;
+} PGM_quality;
+
+// Connected component statistics, bounding box corners are inclusive
+
+typedef struct
+{
+    size_t area;
+    int left;
+    int top;
+    int right;
+    int bottom;
+} PGM_component;
+
+// Resampling methods, box and binomial halve the image, area and bilinear resize to any size
+
+typedef enum
+{
+    RESAMPLE_BOX,
+    RESAMPLE_BINOMIAL,
+    RESAMPLE_AREA,
+    RESAMPLE_BILINEAR
+} resample_method;
+
+// Implementations the tune profile picks from for every filter, kernel size and image size class
+
+typedef enum
+{
+    TUNE_MEDIAN,
+    TUNE_AVERAGE,
+    TUNE_SOBEL,
+    TUNE_FILTERS
+} tune_filter;
+
+typedef enum
+{
+    MEDIAN_MERGESORT,
+    MEDIAN_NETWORK,
+    MEDIAN_HISTOGRAM,
+    MEDIAN_VARIANTS
+} median_variant;
+
+typedef enum
+{
+    AVERAGE_DIRECT,
+    AVERAGE_RUNNING,
+    AVERAGE_VARIANTS
+} average_variant;
+
+typedef enum
+{
+    SOBEL_DIRECT,
+    SOBEL_BANDS,
+    SOBEL_VARIANTS
+} sobel_variant;
+
+// Variant, threads (0 for all of them) and rows per band (0 for the variant default) of one filter call
+
+typedef struct
+{
+    int variant;
+    int threads;
+    int tile;
+} tune_choice;
+
+// Largest kernel the median sorting network is built for
+#define MEDIAN_NETWORK_MAX_SIZE 11
+// Profile main.c loads at startup and the tune mode writes
+#define TUNE_PROFILE "tune.profile"
+// Non-local means weights exp(-t) come from a table of NLMEANS_TABLE entries over t in [0, NLMEANS_RANGE),
+// farther patches get weight 0
+#define NLMEANS_RANGE 8.0
+#define NLMEANS_TABLE 8192
+
+// Profiling, wall time and counters of the stages of a program, see profile.c
+
+#define PROFILE_STAGES 32
+#define PROFILE_COUNTERS 4
+
+typedef enum
+{
+    PROFILE_HARDWARE,
+    PROFILE_SOFTWARE,
+    PROFILE_RUSAGE
+} profile_source;
+
+// counts are cycles, instructions, LLC misses, branch misses with PROFILE_HARDWARE,
+// CPU time in ns, page faults, major page faults, context switches otherwise, -1 if not available
+
+typedef struct
+{
+    const char *name;
+    double seconds;
+    long long counts[PROFILE_COUNTERS];
+    size_t pixels;
+} PGM_stage;
+
+typedef struct
+{
+    profile_source source;
+    int fds[PROFILE_COUNTERS];
+    int stages;
+    PGM_stage stage[PROFILE_STAGES];
+    double start;
+    long long start_counts[PROFILE_COUNTERS];
+} PGM_profile;
+
 // PGM file format read and write
 char *check_pgm_type(char *filename);
 PGM *pgm_read(char *filename);
@@ -28,11 +270,124 @@ PGM *pgm_create(int width, int height, int max_val, char *type);
 void pgm_write(PGM *pgm, char *filename);
 void pgm_free(PGM *pgm);
 
+// Color and bitmap netpbm images
+PGM_color *color_create(int width, int height, int max_val, char *type);
+PGM_color *color_read(char *filename);
+void color_write(PGM_color *color, char *filename);
+void color_free(PGM_color *color);
+PGM *color_to_gray(PGM_color *color);
+PGM_bitmap *bitmap_create(int width, int height, char *type);
+PGM_bitmap *bitmap_read(char *filename);
+void bitmap_write(PGM_bitmap *bitmap, char *filename);
+void bitmap_free(PGM_bitmap *bitmap);
+void bitmap_pack(const PGM_view *src, PGM_bitmap *dst);
+void bitmap_unpack(const PGM_bitmap *src, const PGM_view *dst);
+void rgb_deinterleave(const unsigned char *rgb, unsigned char *red, unsigned char *green, unsigned char *blue, int count);
+void rgb_interleave(const unsigned char *red, const unsigned char *green, const unsigned char *blue, unsigned char *rgb, int count);
+void rgb_to_gray(const unsigned char *red, const unsigned char *green, const unsigned char *blue, unsigned char *gray, int count);
+
+// In-memory buffers and views
+PGM_view pgm_view_wrap(void *data, int width, int height, ptrdiff_t stride, PGM_depth depth);
+PGM_view pgm_view_of(PGM *pgm);
+PGM_view pgm_view_sub(const PGM_view *view, int x, int y, int width, int height);
+PGM *pgm_wrap(const PGM_view *view, int max_val, char *type);
+PGM *pgm_decode(unsigned char *buffer, size_t size);
+size_t pgm_encode(PGM *pgm, unsigned char *buffer, size_t capacity);
+int filter_prepare_output(const PGM_view *src, const PGM_view *dst, int filter_size, char *padding, const char *caller);
+void filter_prepare_output_rect(const PGM_view *src, const PGM_view *dst, int filter_width, int filter_height,
+                                char *padding, const char *caller, int *kx, int *ky);
+PGM *filter_create_output(PGM *img, int filter_width, int filter_height, char *padding);
+
 // Filter functions
 PGM *filter_median(PGM *img, int filter_size, char *padding);
 PGM *filter_average(PGM *img, int filter_size, char *padding);
 PGM *filter_sobel(PGM *img,char *padding);
-unsigned char find_median(unsigned char **array, int i, int j, int size);
+void filter_median_view(const PGM_view *src, const PGM_view *dst, int filter_size, char *padding);
+void filter_average_view(const PGM_view *src, const PGM_view *dst, int filter_size, char *padding);
+void filter_sobel_view(const PGM_view *src, const PGM_view *dst, char *padding);
+void filter_median_variant(const PGM_view *src, const PGM_view *dst, int filter_size, char *padding, tune_choice choice);
+void filter_average_variant(const PGM_view *src, const PGM_view *dst, int filter_size, char *padding, tune_choice choice);
+void filter_sobel_variant(const PGM_view *src, const PGM_view *dst, char *padding, tune_choice choice);
+PGM *filter_morphology(PGM *img, morph_op op, int filter_width, int filter_height, char *padding);
+void filter_morphology_view(const PGM_view *src, const PGM_view *dst, morph_op op, int filter_width, int filter_height, char *padding);
+PGM *filter_gaussian(PGM *img, double sigma, char *padding);
+void filter_gaussian_view(const PGM_view *src, const PGM_view *dst, double sigma, char *padding);
+int gaussian_filter_size(double sigma);
+void gaussian_blur_planes(float *data, int width, int height, int planes, double sigma);
+PGM *filter_bilateral(PGM *img, double sigma_spatial, double sigma_range, char *padding);
+void filter_bilateral_view(const PGM_view *src, const PGM_view *dst, double sigma_spatial, double sigma_range, char *padding);
+PGM *filter_nlmeans(PGM *img, int patch, int search, double h, char *padding);
+void filter_nlmeans_view(const PGM_view *src, const PGM_view *dst, int patch, int search, double h, char *padding);
+PGM *filter_canny(PGM *img, double sigma, int low, int high, char *padding);
+void filter_canny_view(const PGM_view *src, const PGM_view *dst, double sigma, int low, int high, char *padding);
+PGM *filter_threshold(PGM *img, threshold_method method, int window, double k, char *padding);
+void filter_threshold_view(const PGM_view *src, const PGM_view *dst, threshold_method method, int window, double k, char *padding);
+PGM *filter_equalize(PGM *img);
+void filter_equalize_view(const PGM_view *src, const PGM_view *dst);
+PGM *filter_clahe(PGM *img, int tiles_x, int tiles_y, double clip_limit);
+void filter_clahe_view(const PGM_view *src, const PGM_view *dst, int tiles_x, int tiles_y, double clip_limit);
+PGM *filter_convolve(PGM *img, const float *kernel, int kernel_width, int kernel_height, convolve_method method, char *padding);
+void filter_convolve_view(const PGM_view *src, const PGM_view *dst, const float *kernel, int kernel_width, int kernel_height,
+                          convolve_method method, char *padding);
+void convolve_valid(const PGM_view *src, float *out, const float *kernel, int kernel_width, int kernel_height, convolve_method method);
+int label_components(const PGM_view *src, const PGM_view *labels, int connectivity, PGM_component **components);
+void distance_transform(const PGM_view *src, const PGM_view *dst);
+void corner_response_view(const PGM_view *src, const PGM_view *dst, corner_method method, corner_window shape, int window,
+                          double k);
+int detect_corners(const PGM_view *src, corner_method method, corner_window shape, int window, double k, int radius,
+                   double quality, int max_corners, PGM_corner **corners);
+int detect_lines(const PGM_view *src, hough_method method, int theta_steps, double fraction, int threshold, int radius,
+                 int max_lines, PGM_line **lines);
+void match_template_view(const PGM_view *src, const PGM_view *tmpl, const PGM_view *dst, convolve_method method);
+int match_template(const PGM_view *src, const PGM_view *tmpl, convolve_method method, double min_score, int radius,
+                   int max_matches, PGM_match **matches);
+
+// Resampling and pyramids
+PGM *pgm_resize(PGM *img, int width, int height, resample_method method);
+void resize_view(const PGM_view *src, const PGM_view *dst, resample_method method);
+PGM *pgm_downsample(PGM *img, resample_method method);
+void downsample_view(const PGM_view *src, const PGM_view *dst, resample_method method);
+void upsample_view(const PGM_view *src, const PGM_view *dst);
+PGM **pyramid_gaussian(PGM *img, int *levels, resample_method method);
+void pyramid_free(PGM **pyramid, int levels);
+void pyramid_laplacian(const PGM_view *fine, const PGM_view *coarse, const PGM_view *band);
+void pyramid_collapse(const PGM_view *coarse, const PGM_view *band, const PGM_view *fine);
+
+// Geometric transforms
+PGM *pgm_transpose(PGM *img);
+PGM *pgm_rotate(PGM *img, int degrees);
+PGM *pgm_flip(PGM *img, int horizontal);
+void transpose_view(const PGM_view *src, const PGM_view *dst);
+void transpose_tile(const PGM_view *src, const PGM_view *dst);
+void rotate_view(const PGM_view *src, const PGM_view *dst, int degrees);
+void flip_view(const PGM_view *src, const PGM_view *dst, int horizontal);
+
+// Filter variants and the tune profile
+void median_network(const PGM_view *src, const PGM_view *dst, int filter_size, int offset, tune_choice choice);
+void median_histogram(const PGM_view *src, const PGM_view *dst, int filter_size, int offset, tune_choice choice);
+void average_running(const PGM_view *src, const PGM_view *dst, int filter_size, int offset, tune_choice choice);
+void sobel_bands(const PGM_view *src, const PGM_view *dst, int offset, tune_choice choice);
+tune_choice tune_lookup(tune_filter filter, int filter_size, int width, int height);
+int tune_threads(tune_choice choice);
+int tune_load(const char *filename);
+int tune_run(const char *filename);
+
+// Profiling
+void profile_open(PGM_profile *profile);
+void profile_begin(PGM_profile *profile, const char *name);
+void profile_end(PGM_profile *profile, size_t pixels);
+void profile_report(const PGM_profile *profile, FILE *out);
+void profile_close(PGM_profile *profile);
+
+// Quality metrics
+PGM_quality compare_images(const PGM_view *a, const PGM_view *b, int window);
+
+// NUMA placement
+int placement_init(void);
+void placement_touch(unsigned char *pixels, size_t row_bytes, int rows);
+void placement_report(const PGM *img, FILE *out);
+
+unsigned char find_median(const PGM_view *src, int i, int j, int size);
 void mergeSort(unsigned char *arr, int left, int right);
 void merge(unsigned char *arr, int left, int middle, int right);
 
@@ -0,0 +1,276 @@
+#define _GNU_SOURCE
+#include "pgm.h"
+#include <omp.h>
+#include <unistd.h>
+#include <sched.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+// Where NUMA nodes and their CPUs are listed
+#define PLACEMENT_SYSFS "/sys/devices/system/node"
+// Set to a number of nodes to split the CPUs of this machine into, for testing on a single node
+#define PLACEMENT_ENV "PGM_NUMA_NODES"
+#define PLACEMENT_MAX_NODES 64
+
+// Placement policy, set once by placement_init(), inactive until then and on single node machines
+static struct
+{
+    int active;
+    int emulated;
+    int nodes;
+    int threads;
+    int pinned;
+} placement = {0, 0, 1, 1, 0};
+
+/**
+ * @brief Parse a kernel CPU list like "0-3,8-11" and add its CPUs to cpus
+ * 
+ * @param text 
+ * @param cpus 
+ * @param count 
+ * @param capacity 
+ */
+static void placement_parse_cpus(const char *text, int *cpus, int *count, int capacity)
+{
+    const char *p = text;
+
+    while (*p != '\0' && *p != '\n')
+    {
+        char *end;
+        long first = strtol(p, &end, 10), last = first;
+
+        if (end == p)
+        {
+            break;
+        }
+        p = end;
+        if (*p == '-')
+        {
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for (long cpu = first; cpu <= last && *count < capacity; cpu++)
+        {
+            cpus[(*count)++] = (int)cpu;
+        }
+        if (*p == ',')
+        {
+            p++;
+        }
+    }
+}
+
+/**
+ * @brief Read the CPUs of every NUMA node from sysfs, nodes without CPUs are skipped
+ * 
+ * @param cpus set to node_count[n] CPUs per node, one after the other
+ * @param node_count 
+ * @param capacity 
+ * @return int number of nodes with CPUs, 0 if sysfs has no node list
+ */
+static int placement_read_nodes(int *cpus, int *node_count, int capacity)
+{
+    int nodes = 0, total = 0;
+
+    for (int n = 0; n < PLACEMENT_MAX_NODES; n++)
+    {
+        char path[128], text[4096];
+        FILE *file;
+        int count = 0;
+
+        snprintf(path, sizeof(path), PLACEMENT_SYSFS "/node%d/cpulist", n);
+        file = fopen(path, "r");
+        if (file == NULL)
+        {
+            continue;
+        }
+        if (fgets(text, sizeof(text), file) != NULL)
+        {
+            placement_parse_cpus(text, cpus + total, &count, capacity - total);
+        }
+        fclose(file);
+
+        if (count > 0)
+        {
+            node_count[nodes++] = count;
+            total += count;
+        }
+    }
+    return nodes;
+}
+
+/**
+ * @brief Set up NUMA placement for the OpenMP threads of the program
+ *        On a machine with several nodes, thread t of the full team is pinned to a CPU of node t * nodes / threads,
+ *          so consecutive threads share a node, and pgm_create() from then on first-touches the rows of every
+ *          image with the same threads and the same schedule(static) split the filters use, so each band of
+ *          rows lives on the node of the thread that filters it, stage after stage
+ *        PGM_NUMA_NODES=n splits the CPUs this process may use into n equal groups and treats them as nodes,
+ *          which runs the whole policy on a single node machine (pages then all stay on node 0)
+ *        A no-op on single node machines, with one thread, or when the node list cannot be read
+ *        Call it before the first parallel region, OpenMP keeps its threads and their pinning afterwards
+ *        Pinning runs a parallel region that starts those threads, so when profiling, call profile_open()
+ *          first or its counters do not follow them
+ * 
+ * @return int number of nodes in use, 1 when placement is off
+ */
+int placement_init(void)
+{
+    int cpus[CPU_SETSIZE], node_count[PLACEMENT_MAX_NODES], node_first[PLACEMENT_MAX_NODES];
+    int nodes, threads = omp_get_max_threads(), pinned = 0;
+    const char *emulate = getenv(PLACEMENT_ENV);
+
+    placement.active = 0;
+    placement.emulated = 0;
+    placement.nodes = 1;
+    placement.threads = threads;
+    placement.pinned = 0;
+
+    if (emulate != NULL)
+    {
+        cpu_set_t allowed;
+        int total = 0;
+
+        nodes = atoi(emulate);
+        if (nodes < 1 || nodes > PLACEMENT_MAX_NODES)
+        {
+            fprintf(stderr, "Error: placement_init() %s must be 1 .. %d\n", PLACEMENT_ENV, PLACEMENT_MAX_NODES);
+            exit(EXIT_FAILURE);
+        }
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        {
+            return 1;
+        }
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, &allowed))
+            {
+                cpus[total++] = cpu;
+            }
+        }
+        // Fewer CPUs than nodes, nodes share CPUs
+        for (int n = 0; n < nodes; n++)
+        {
+            node_count[n] = total / nodes > 0 ? total / nodes : 1;
+        }
+        for (int n = 0; n < nodes; n++)
+        {
+            node_first[n] = total / nodes > 0 ? n * (total / nodes) : n % total;
+        }
+        placement.emulated = 1;
+    }
+    else
+    {
+        nodes = placement_read_nodes(cpus, node_count, CPU_SETSIZE);
+        for (int n = 0, first = 0; n < nodes; n++)
+        {
+            node_first[n] = first;
+            first += node_count[n];
+        }
+    }
+
+    if (nodes <= 1 || threads <= 1)
+    {
+        return 1;
+    }
+
+    omp_set_dynamic(0);
+#pragma omp parallel num_threads(threads) reduction(+ : pinned)
+    {
+        int t = omp_get_thread_num();
+        int node = (int)((long)t * nodes / threads);
+        int first_thread = (int)(((long)node * threads + nodes - 1) / nodes);
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(cpus[node_first[node] + (t - first_thread) % node_count[node]], &set);
+        pinned += sched_setaffinity(0, sizeof(set), &set) == 0;
+    }
+
+    placement.active = 1;
+    placement.nodes = nodes;
+    placement.pinned = pinned;
+    return nodes;
+}
+
+/**
+ * @brief First-touch rows of fresh memory from the threads that will process them
+ *        Called by pgm_create() on its zeroed pixels, the pages are still unmapped and land on the node of the
+ *          thread that writes them first, the content stays 0
+ * 
+ * @param pixels 
+ * @param row_bytes 
+ * @param rows 
+ */
+void placement_touch(unsigned char *pixels, size_t row_bytes, int rows)
+{
+    if (!placement.active)
+    {
+        return;
+    }
+
+#pragma omp parallel for num_threads(placement.threads) schedule(static)
+    for (int i = 0; i < rows; i++)
+    {
+        memset(pixels + i * row_bytes, 0, row_bytes);
+    }
+}
+
+/**
+ * @brief Node the page at address is on
+ * 
+ * @param address 
+ * @return int -1 if the kernel does not say
+ */
+static int placement_node_of(const void *address)
+{
+#if defined(__linux__) && defined(SYS_get_mempolicy)
+    int node = -1;
+
+    if (syscall(SYS_get_mempolicy, &node, NULL, 0, address, MPOL_F_NODE | MPOL_F_ADDR) == 0)
+    {
+        return node;
+    }
+#else
+    (void)address;
+#endif
+    return -1;
+}
+
+/**
+ * @brief Print the placement policy and, for every thread's band of rows of img, the node it should be on
+ *          and the node its first page is on
+ *        With emulated nodes the pages are all on the one real node, the bands show the split the
+ *          threads would use on a real machine
+ * 
+ * @param img 
+ * @param out 
+ */
+void placement_report(const PGM *img, FILE *out)
+{
+    int threads = placement.threads, rows = img->height;
+    int base = rows / threads, extra = rows % threads;
+
+    if (!placement.active)
+    {
+        fprintf(out, "placement: off, nodes %d, threads %d\n", placement.nodes, threads);
+        return;
+    }
+
+    fprintf(out, "placement: %d %snodes, %d of %d threads pinned\n", placement.nodes, placement.emulated ? "emulated " : "",
+            placement.pinned, threads);
+    // The split of schedule(static): the first rows % threads threads get one more row
+    for (int t = 0, first = 0; t < threads; t++)
+    {
+        int count = base + (t < extra), node = (int)((long)t * placement.nodes / threads);
+
+        if (count > 0)
+        {
+            fprintf(out, "thread %3d rows %6d .. %6d node %d, pages on node %d\n", t, first, first + count - 1, node,
+                    placement_node_of(img->data[first]));
+        }
+        first += count;
+    }
+}
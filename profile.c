@@ -0,0 +1,278 @@
+#include "pgm.h"
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+// Bytes behind one counted event, a cache line for LLC misses and a page for page faults
+#define PROFILE_LINE_BYTES 64
+#define PROFILE_PAGE_BYTES 4096
+
+/**
+ * @brief Open one counter of the calling process and of the threads it starts later
+ *        User space only, which perf_event_paranoid up to 2 allows without privileges
+ * 
+ * @param type PERF_TYPE_HARDWARE or PERF_TYPE_SOFTWARE
+ * @param config 
+ * @return int file descriptor, -1 if the counter is not available
+ */
+static int profile_counter_open(unsigned int type, unsigned long long config)
+{
+#ifdef __linux__
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    (void)type;
+    (void)config;
+    return -1;
+#endif
+}
+
+/**
+ * @brief Wall clock time in seconds
+ * 
+ * @return double 
+ */
+static double profile_clock(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief Read all counters of profile into counts, -1 for the ones that are not open
+ *        Without perf counters, getrusage() gives the software values
+ * 
+ * @param profile 
+ * @param counts 
+ */
+static void profile_read(const PGM_profile *profile, long long *counts)
+{
+    if (profile->source == PROFILE_RUSAGE)
+    {
+        struct rusage usage;
+
+        getrusage(RUSAGE_SELF, &usage);
+        counts[0] = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000LL +
+                    (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000LL;
+        counts[1] = usage.ru_minflt + usage.ru_majflt;
+        counts[2] = usage.ru_majflt;
+        counts[3] = usage.ru_nvcsw + usage.ru_nivcsw;
+        return;
+    }
+
+    for (int c = 0; c < PROFILE_COUNTERS; c++)
+    {
+        unsigned long long value;
+
+        counts[c] = -1;
+        if (profile->fds[c] >= 0 && read(profile->fds[c], &value, sizeof(value)) == sizeof(value))
+        {
+            counts[c] = (long long)value;
+        }
+    }
+}
+
+/**
+ * @brief Open the counters of a profile
+ *        PROFILE_HARDWARE counts cycles, instructions, last level cache misses and branch misses,
+ *          when the CPU or the virtual machine has no PMU, PROFILE_SOFTWARE uses the kernel's CPU time,
+ *          page fault and context switch counters, and PROFILE_RUSAGE reads the same from getrusage()
+ *          where perf_event_open() is not allowed at all
+ *        Counters follow threads started after this call, so open the profile before the first
+ *          parallel region, OpenMP keeps its threads for the rest of the program
+ *        placement_init() starts them in its pinning region, call it after this
+ * 
+ * @param profile 
+ */
+void profile_open(PGM_profile *profile)
+{
+#ifdef __linux__
+    static const unsigned long long hardware[PROFILE_COUNTERS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                                  PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+    static const unsigned long long software[PROFILE_COUNTERS] = {PERF_COUNT_SW_TASK_CLOCK, PERF_COUNT_SW_PAGE_FAULTS,
+                                                                  PERF_COUNT_SW_PAGE_FAULTS_MAJ, PERF_COUNT_SW_CONTEXT_SWITCHES};
+#endif
+
+    memset(profile, 0, sizeof(*profile));
+    for (int c = 0; c < PROFILE_COUNTERS; c++)
+    {
+        profile->fds[c] = -1;
+    }
+
+#ifdef __linux__
+    profile->source = PROFILE_HARDWARE;
+    profile->fds[0] = profile_counter_open(PERF_TYPE_HARDWARE, hardware[0]);
+    if (profile->fds[0] < 0)
+    {
+        profile->source = PROFILE_SOFTWARE;
+        profile->fds[0] = profile_counter_open(PERF_TYPE_SOFTWARE, software[0]);
+    }
+    if (profile->fds[0] >= 0)
+    {
+        for (int c = 1; c < PROFILE_COUNTERS; c++)
+        {
+            profile->fds[c] = profile_counter_open(profile->source == PROFILE_HARDWARE ? PERF_TYPE_HARDWARE : PERF_TYPE_SOFTWARE,
+                                                   profile->source == PROFILE_HARDWARE ? hardware[c] : software[c]);
+        }
+        return;
+    }
+#endif
+    profile->source = PROFILE_RUSAGE;
+}
+
+/**
+ * @brief Start measuring a stage, stages are not nested
+ * 
+ * @param profile 
+ * @param name kept as is, usually a literal
+ */
+void profile_begin(PGM_profile *profile, const char *name)
+{
+    if (profile->stages == PROFILE_STAGES)
+    {
+        fprintf(stderr, "Error: profile_begin() more than %d stages\n", PROFILE_STAGES);
+        exit(EXIT_FAILURE);
+    }
+
+    profile->stage[profile->stages].name = name;
+    profile_read(profile, profile->start_counts);
+    profile->start = profile_clock();
+}
+
+/**
+ * @brief Stop measuring the stage started last and store its time and counter deltas
+ * 
+ * @param profile 
+ * @param pixels pixels the stage produced, for the per pixel column of the report
+ */
+void profile_end(PGM_profile *profile, size_t pixels)
+{
+    PGM_stage *stage = &profile->stage[profile->stages];
+    long long counts[PROFILE_COUNTERS];
+
+    stage->seconds = profile_clock() - profile->start;
+    profile_read(profile, counts);
+    for (int c = 0; c < PROFILE_COUNTERS; c++)
+    {
+        stage->counts[c] = counts[c] < 0 || profile->start_counts[c] < 0 ? -1 : counts[c] - profile->start_counts[c];
+    }
+    stage->pixels = pixels;
+    profile->stages++;
+}
+
+/**
+ * @brief Format value with 2 decimals, or - if it is not valid
+ * 
+ * @param text at least 24 characters
+ * @param valid 
+ * @param value 
+ */
+static void profile_format(char *text, int valid, double value)
+{
+    if (valid)
+    {
+        snprintf(text, 24, "%.2f", value);
+    }
+    else
+    {
+        strcpy(text, "-");
+    }
+}
+
+/**
+ * @brief Print one line per stage with wall time and the counters
+ *        Hardware counters give IPC and the bytes per pixel brought in from memory, LLC misses times a cache line
+ *        Software counters give the CPU time over wall time, how many threads were busy on average,
+ *          and the bytes per pixel of fresh pages, page faults times a page
+ *        Counters that could not be opened print as -
+ * 
+ * @param profile 
+ * @param out 
+ */
+void profile_report(const PGM_profile *profile, FILE *out)
+{
+    static const char *sources[] = {"hardware", "perf software", "getrusage"};
+
+    fprintf(out, "counters: %s\n", sources[profile->source]);
+    if (profile->source == PROFILE_HARDWARE)
+    {
+        fprintf(out, "%-12s %10s %14s %14s %6s %12s %12s %8s\n", "stage", "wall ms", "cycles", "instructions", "IPC",
+                "LLC misses", "br misses", "B/px");
+    }
+    else
+    {
+        fprintf(out, "%-12s %10s %10s %6s %12s %8s %8s %8s\n", "stage", "wall ms", "cpu ms", "cpu/wl", "faults", "major",
+                "ctx sw", "B/px");
+    }
+
+    for (int s = 0; s < profile->stages; s++)
+    {
+        const PGM_stage *stage = &profile->stage[s];
+        const long long *n = stage->counts;
+        char columns[PROFILE_COUNTERS][24], ratio[24], per_pixel[24];
+
+        for (int c = 0; c < PROFILE_COUNTERS; c++)
+        {
+            if (n[c] < 0)
+            {
+                strcpy(columns[c], "-");
+            }
+            else if (c == 0 && profile->source != PROFILE_HARDWARE)
+            {
+                profile_format(columns[c], 1, n[c] * 1e-6);
+            }
+            else
+            {
+                snprintf(columns[c], sizeof(columns[c]), "%lld", n[c]);
+            }
+        }
+
+        if (profile->source == PROFILE_HARDWARE)
+        {
+            profile_format(ratio, n[0] > 0 && n[1] >= 0, n[0] > 0 ? (double)n[1] / n[0] : 0);
+            profile_format(per_pixel, stage->pixels > 0 && n[2] >= 0,
+                           stage->pixels > 0 ? (double)n[2] * PROFILE_LINE_BYTES / stage->pixels : 0);
+            fprintf(out, "%-12s %10.2f %14s %14s %6s %12s %12s %8s\n", stage->name, stage->seconds * 1000, columns[0],
+                    columns[1], ratio, columns[2], columns[3], per_pixel);
+        }
+        else
+        {
+            profile_format(ratio, n[0] >= 0 && stage->seconds > 0, stage->seconds > 0 ? n[0] * 1e-9 / stage->seconds : 0);
+            profile_format(per_pixel, stage->pixels > 0 && n[1] >= 0,
+                           stage->pixels > 0 ? (double)n[1] * PROFILE_PAGE_BYTES / stage->pixels : 0);
+            fprintf(out, "%-12s %10.2f %10s %6s %12s %8s %8s %8s\n", stage->name, stage->seconds * 1000, columns[0], ratio,
+                    columns[1], columns[2], columns[3], per_pixel);
+        }
+    }
+}
+
+/**
+ * @brief Close the counters of a profile
+ * 
+ * @param profile 
+ */
+void profile_close(PGM_profile *profile)
+{
+    for (int c = 0; c < PROFILE_COUNTERS; c++)
+    {
+        if (profile->fds[c] >= 0)
+        {
+            close(profile->fds[c]);
+            profile->fds[c] = -1;
+        }
+    }
+}
@@ -0,0 +1,266 @@
+#include "pgm.h"
+
+// Rows per band, a band enters window - 1 rows of the next band again for its last windows
+#define QUALITY_BAND 64
+// Pixels per block of the squared error sum, 255^2 * 4096 fits an unsigned int
+#define QUALITY_BLOCK 4096
+// Window sums of squares and products are kept in 32 bits, 255^2 * 255^2 still fits
+#define QUALITY_MAX_WINDOW 255
+// SSIM stabilizers (0.01 * 255)^2 and (0.03 * 255)^2
+#define QUALITY_C1 6.5025
+#define QUALITY_C2 58.5225
+
+// Column sums of one thread over the rows of the current windows, and their prefix sums along the row
+typedef struct
+{
+    unsigned int *column[5];
+    unsigned int *prefix[5];
+} quality_sums;
+
+// Pixel statistics of the rows a thread owns
+typedef struct
+{
+    unsigned long long squared;
+    unsigned long long differing;
+    unsigned int max_diff;
+} quality_errors;
+
+/**
+ * @brief Add rows ra and rb to the column sums of a, b, a^2, b^2 and a * b
+ *        With errors set, the same loop adds the squared differences, the differing pixels and the
+ *          largest difference of the row, so every pixel is loaded once for both metrics
+ * 
+ * @param sums 
+ * @param ra 
+ * @param rb 
+ * @param width 
+ * @param errors NULL for rows another band owns
+ */
+static void quality_enter_row(quality_sums *sums, const unsigned char *ra, const unsigned char *rb, int width,
+                              quality_errors *errors)
+{
+    unsigned int *sa = sums->column[0], *sb = sums->column[1], *saa = sums->column[2], *sbb = sums->column[3];
+    unsigned int *sab = sums->column[4];
+
+    if (errors == NULL)
+    {
+#pragma omp simd
+        for (int j = 0; j < width; j++)
+        {
+            unsigned int x = ra[j], y = rb[j];
+
+            sa[j] += x;
+            sb[j] += y;
+            saa[j] += x * x;
+            sbb[j] += y * y;
+            sab[j] += x * y;
+        }
+        return;
+    }
+
+    for (int j0 = 0; j0 < width; j0 += QUALITY_BLOCK)
+    {
+        int j1 = j0 + QUALITY_BLOCK < width ? j0 + QUALITY_BLOCK : width;
+        unsigned int squared = 0, differing = 0, peak = errors->max_diff;
+
+#pragma omp simd reduction(+ : squared, differing) reduction(max : peak)
+        for (int j = j0; j < j1; j++)
+        {
+            unsigned int x = ra[j], y = rb[j];
+            unsigned int diff = x > y ? x - y : y - x;
+
+            sa[j] += x;
+            sb[j] += y;
+            saa[j] += x * x;
+            sbb[j] += y * y;
+            sab[j] += x * y;
+            squared += diff * diff;
+            differing += diff != 0;
+            peak = diff > peak ? diff : peak;
+        }
+
+        errors->squared += squared;
+        errors->differing += differing;
+        errors->max_diff = peak;
+    }
+}
+
+/**
+ * @brief Remove rows ra and rb from the column sums
+ * 
+ * @param sums 
+ * @param ra 
+ * @param rb 
+ * @param width 
+ */
+static void quality_leave_row(quality_sums *sums, const unsigned char *ra, const unsigned char *rb, int width)
+{
+    unsigned int *sa = sums->column[0], *sb = sums->column[1], *saa = sums->column[2], *sbb = sums->column[3];
+    unsigned int *sab = sums->column[4];
+
+#pragma omp simd
+    for (int j = 0; j < width; j++)
+    {
+        unsigned int x = ra[j], y = rb[j];
+
+        sa[j] -= x;
+        sb[j] -= y;
+        saa[j] -= x * x;
+        sbb[j] -= y * y;
+        sab[j] -= x * y;
+    }
+}
+
+/**
+ * @brief Sum of the SSIM of the windows along one row, the column sums hold exactly the window rows
+ *        Prefix sums wrap around in 32 bits, a window sum is the difference of two of them and comes out exact
+ * 
+ * @param sums 
+ * @param width 
+ * @param window 
+ * @return double 
+ */
+static double quality_ssim_row(quality_sums *sums, int width, int window)
+{
+    const unsigned int *pa = sums->prefix[0], *pb = sums->prefix[1], *paa = sums->prefix[2], *pbb = sums->prefix[3];
+    const unsigned int *pab = sums->prefix[4];
+    const double scale = 1.0 / ((double)window * window);
+    double total = 0;
+
+    for (int s = 0; s < 5; s++)
+    {
+        const unsigned int *column = sums->column[s];
+        unsigned int *prefix = sums->prefix[s], running = 0;
+
+        prefix[0] = 0;
+        for (int j = 0; j < width; j++)
+        {
+            running += column[j];
+            prefix[j + 1] = running;
+        }
+    }
+
+#pragma omp simd reduction(+ : total)
+    for (int j = 0; j <= width - window; j++)
+    {
+        double mean_a = (pa[j + window] - pa[j]) * scale, mean_b = (pb[j + window] - pb[j]) * scale;
+        double var_a = (paa[j + window] - paa[j]) * scale - mean_a * mean_a;
+        double var_b = (pbb[j + window] - pbb[j]) * scale - mean_b * mean_b;
+        double covariance = (pab[j + window] - pab[j]) * scale - mean_a * mean_b;
+
+        total += (2 * mean_a * mean_b + QUALITY_C1) * (2 * covariance + QUALITY_C2) /
+                 ((mean_a * mean_a + mean_b * mean_b + QUALITY_C1) * (var_a + var_b + QUALITY_C2));
+    }
+    return total;
+}
+
+/**
+ * @brief Compare two images of the same size, typically an optimized filter against its reference
+ *        MSE, PSNR against a peak of 255, the largest absolute difference and the number of pixels that differ,
+ *          and the mean SSIM of all window x window windows inside the image (Wang et al. 2004 with a box
+ *          window and the population variance, C1 = (0.01 * 255)^2, C2 = (0.03 * 255)^2)
+ *        All of it comes out of one pass over the rows: every row is added to running column sums of a, b,
+ *          a^2, b^2 and a * b in the same vector loop that measures its differences, bands of rows run in parallel
+ * 
+ * @param a 8-bit view
+ * @param b 8-bit view of the same size
+ * @param window SSIM window, 7 is common, at most 255 and clipped to the image
+ * @return PGM_quality 
+ */
+PGM_quality compare_images(const PGM_view *a, const PGM_view *b, int window)
+{
+    const int width = a->width, height = a->height;
+    int bands, tops;
+    unsigned long long squared = 0, differing = 0;
+    unsigned int max_diff = 0;
+    double ssim = 0;
+    PGM_quality quality;
+
+    if (a->depth != PGM_DEPTH_8U || b->depth != PGM_DEPTH_8U)
+    {
+        fprintf(stderr, "Error: compare_images() works on 8-bit views only\n");
+        exit(EXIT_FAILURE);
+    }
+    if (a->width != b->width || a->height != b->height)
+    {
+        fprintf(stderr, "Error: compare_images() images are %dx%d and %dx%d\n", a->width, a->height, b->width, b->height);
+        exit(EXIT_FAILURE);
+    }
+    if (window < 1 || window > QUALITY_MAX_WINDOW)
+    {
+        fprintf(stderr, "Error: compare_images() window must be 1 .. %d\n", QUALITY_MAX_WINDOW);
+        exit(EXIT_FAILURE);
+    }
+    window = window > width ? width : window;
+    window = window > height ? height : window;
+    bands = (height + QUALITY_BAND - 1) / QUALITY_BAND;
+    tops = height - window + 1;
+
+#pragma omp parallel reduction(+ : squared, differing, ssim) reduction(max : max_diff)
+    {
+        quality_sums sums;
+        quality_errors errors = {0, 0, 0};
+
+        for (int s = 0; s < 5; s++)
+        {
+            sums.column[s] = (unsigned int *)malloc(width * sizeof(unsigned int));
+            sums.prefix[s] = (unsigned int *)malloc((width + 1) * sizeof(unsigned int));
+            if (sums.column[s] == NULL || sums.prefix[s] == NULL)
+            {
+                fprintf(stderr, "Error: compare_images() failed to allocate memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+#pragma omp for schedule(static)
+        for (int band = 0; band < bands; band++)
+        {
+            int y0 = band * QUALITY_BAND, y1 = y0 + QUALITY_BAND < height ? y0 + QUALITY_BAND : height;
+            int last_top = y1 < tops ? y1 : tops, next = y0;
+
+            for (int s = 0; s < 5; s++)
+            {
+                memset(sums.column[s], 0, width * sizeof(unsigned int));
+            }
+
+            for (int top = y0; top < last_top; top++)
+            {
+                for (; next < top + window; next++)
+                {
+                    quality_enter_row(&sums, PGM_VIEW_ROW(a, unsigned char, next), PGM_VIEW_ROW(b, unsigned char, next), width,
+                                      next < y1 ? &errors : NULL);
+                }
+                if (top > y0)
+                {
+                    quality_leave_row(&sums, PGM_VIEW_ROW(a, unsigned char, top - 1), PGM_VIEW_ROW(b, unsigned char, top - 1),
+                                      width);
+                }
+                ssim += quality_ssim_row(&sums, width, window);
+            }
+
+            // Rows below the last window top still count for the pixel statistics
+            for (; next < y1; next++)
+            {
+                quality_enter_row(&sums, PGM_VIEW_ROW(a, unsigned char, next), PGM_VIEW_ROW(b, unsigned char, next), width,
+                                  &errors);
+            }
+        }
+
+        squared += errors.squared;
+        differing += errors.differing;
+        max_diff = errors.max_diff;
+
+        for (int s = 0; s < 5; s++)
+        {
+            free(sums.column[s]);
+            free(sums.prefix[s]);
+        }
+    }
+
+    quality.mse = (double)squared / ((double)width * height);
+    quality.psnr = squared == 0 ? INFINITY : 10 * log10(255.0 * 255.0 / quality.mse);
+    quality.max_diff = (int)max_diff;
+    quality.differing = (size_t)differing;
+    quality.ssim = ssim / ((double)tops * (width - window + 1));
+    return quality;
+}
@@ -0,0 +1,556 @@
+#include "pgm.h"
+
+// Coefficient table of a separable resampling pass, every output pixel reads taps inputs from start
+// Weights are stored by tap, the weights of tap k for all outputs follow each other, so a pass can run
+// over the outputs with vector code one tap at a time
+
+typedef struct
+{
+    int taps;
+    int *start;
+    float *weights;
+} resample_table;
+
+/**
+ * @brief Clamp an index to 0 .. size - 1
+ * 
+ * @param i 
+ * @param size 
+ * @return int 
+ */
+static int clamp_index(int i, int size)
+{
+    return i < 0 ? 0 : i >= size ? size - 1 : i;
+}
+
+/**
+ * @brief Allocate memory or exit
+ * 
+ * @param size 
+ * @return void* 
+ */
+static void *resample_alloc(size_t size)
+{
+    void *buffer = malloc(size > 0 ? size : 1);
+    if (buffer == NULL)
+    {
+        fprintf(stderr, "Error: resample failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return buffer;
+}
+
+/**
+ * @brief Build the coefficient table that maps src_size samples to dst_size samples
+ *        RESAMPLE_BILINEAR: pixel centers are aligned, 2 taps, edge samples repeat
+ *        RESAMPLE_AREA: every output sample is the mean of the input interval it covers,
+ *          partly covered inputs count for the covered fraction
+ *        Taps that fall outside of the input get weight 0 and are moved inside so they can always be read,
+ *          there are never more taps than inputs, so start + taps <= src_size holds for every entry
+ *        Weight k of output i is weights[k * dst_size + i]
+ * 
+ * @param src_size 
+ * @param dst_size 
+ * @param method 
+ * @return resample_table 
+ */
+static resample_table resample_coefficients(int src_size, int dst_size, resample_method method)
+{
+    resample_table table;
+    double scale = (double)src_size / dst_size;
+    float *w;
+
+    table.taps = method == RESAMPLE_AREA ? (int)ceil(scale) + 1 : 2;
+    // An output sample never covers more than all the inputs, a 1 pixel wide input has a single tap
+    table.taps = table.taps > src_size ? src_size : table.taps;
+    table.start = (int *)resample_alloc(dst_size * sizeof(int));
+    table.weights = (float *)resample_alloc((size_t)dst_size * table.taps * sizeof(float));
+    w = (float *)resample_alloc(table.taps * sizeof(float));
+
+    for (int i = 0; i < dst_size; i++)
+    {
+        memset(w, 0, table.taps * sizeof(float));
+
+        if (method == RESAMPLE_AREA)
+        {
+            double from = i * scale, to = (i + 1) * scale;
+            int first = (int)floor(from);
+            for (int k = 0; k < table.taps; k++)
+            {
+                double low = first + k > from ? first + k : from;
+                double high = first + k + 1 < to ? first + k + 1 : to;
+                w[k] = high > low && first + k < src_size ? (float)((high - low) / scale) : 0;
+            }
+            table.start[i] = first;
+        }
+        else
+        {
+            double position = (i + 0.5) * scale - 0.5;
+            int first = (int)floor(position);
+            float fraction = (float)(position - first);
+            if (first < 0)
+            {
+                first = 0;
+                fraction = 0;
+            }
+            if (first >= src_size - 1)
+            {
+                first = src_size - 1;
+                fraction = 0;
+            }
+            w[0] = 1 - fraction;
+            if (table.taps > 1)
+            {
+                w[1] = fraction;
+            }
+            table.start[i] = first;
+        }
+
+        // Keep every tap readable, the ones past the end have weight 0, taps <= src_size so shift <= start
+        if (table.start[i] + table.taps > src_size)
+        {
+            int shift = table.start[i] + table.taps - src_size;
+            memmove(w + shift, w, (table.taps - shift) * sizeof(float));
+            memset(w, 0, shift * sizeof(float));
+            table.start[i] -= shift;
+        }
+
+        for (int k = 0; k < table.taps; k++)
+        {
+            table.weights[(ptrdiff_t)k * dst_size + i] = w[k];
+        }
+    }
+
+    free(w);
+    return table;
+}
+
+/**
+ * @brief Free a coefficient table
+ * 
+ * @param table 
+ */
+static void resample_table_free(resample_table *table)
+{
+    free(table->start);
+    free(table->weights);
+}
+
+/**
+ * @brief Resize the image to width x height and return the resized image
+ *        See resize_view()
+ * 
+ * @param img 
+ * @param width 
+ * @param height 
+ * @param method 
+ * @return PGM* 
+ */
+PGM *pgm_resize(PGM *img, int width, int height, resample_method method)
+{
+    PGM *resized = pgm_create(width, height, img->max_val, img->type);
+    PGM_view src = pgm_view_of(img);
+    PGM_view dst = pgm_view_of(resized);
+
+    resize_view(&src, &dst, method);
+    return resized;
+}
+
+/**
+ * @brief Resize src to the size of dst with RESAMPLE_AREA or RESAMPLE_BILINEAR
+ *        Coefficients are computed once per column and per row, then every output row is made in one pass:
+ *          the rows it needs are combined into a float row with vector code across the width,
+ *          and that row is combined horizontally through the column table, one tap at a time with vector
+ *          code across the output columns, each lane reading its own input
+ *        Output rows are spread over the threads
+ * 
+ * @param src 
+ * @param dst 
+ * @param method 
+ */
+void resize_view(const PGM_view *src, const PGM_view *dst, resample_method method)
+{
+    resample_table columns, rows;
+
+    if (method != RESAMPLE_AREA && method != RESAMPLE_BILINEAR)
+    {
+        fprintf(stderr, "Error: resize_view() method must be RESAMPLE_AREA or RESAMPLE_BILINEAR\n");
+        exit(EXIT_FAILURE);
+    }
+    if (src->depth != PGM_DEPTH_8U || dst->depth != PGM_DEPTH_8U || dst->width < 1 || dst->height < 1)
+    {
+        fprintf(stderr, "Error: resize_view() works on non empty 8-bit views only\n");
+        exit(EXIT_FAILURE);
+    }
+
+    columns = resample_coefficients(src->width, dst->width, method);
+    rows = resample_coefficients(src->height, dst->height, method);
+
+#pragma omp parallel
+    {
+        float *line = (float *)resample_alloc(src->width * sizeof(float));
+        float *sum = (float *)resample_alloc(dst->width * sizeof(float));
+
+#pragma omp for schedule(static)
+        for (int i = 0; i < dst->height; i++)
+        {
+            unsigned char *out = PGM_VIEW_ROW(dst, unsigned char, i);
+
+            memset(line, 0, src->width * sizeof(float));
+            for (int k = 0; k < rows.taps; k++)
+            {
+                const unsigned char *row = PGM_VIEW_ROW(src, unsigned char, rows.start[i] + k);
+                const float w = rows.weights[(ptrdiff_t)k * dst->height + i];
+                if (w == 0)
+                {
+                    continue;
+                }
+#pragma omp simd
+                for (int x = 0; x < src->width; x++)
+                {
+                    line[x] += w * row[x];
+                }
+            }
+
+            // Same sums in the same order as tap by tap per pixel, so the result does not depend on the layout
+            for (int j = 0; j < dst->width; j++)
+            {
+                sum[j] = 0.5f;
+            }
+            for (int k = 0; k < columns.taps; k++)
+            {
+                const float *wx = columns.weights + (ptrdiff_t)k * dst->width;
+                const float *in = line + k;
+                const int *start = columns.start;
+#pragma omp simd
+                for (int j = 0; j < dst->width; j++)
+                {
+                    sum[j] += wx[j] * in[start[j]];
+                }
+            }
+#pragma omp simd
+            for (int j = 0; j < dst->width; j++)
+            {
+                out[j] = sum[j] >= 255 ? 255 : (unsigned char)sum[j];
+            }
+        }
+
+        free(line);
+        free(sum);
+    }
+
+    resample_table_free(&columns);
+    resample_table_free(&rows);
+}
+
+/**
+ * @brief Halve the image and return the smaller image
+ *        See downsample_view()
+ * 
+ * @param img 
+ * @param method 
+ * @return PGM* 
+ */
+PGM *pgm_downsample(PGM *img, resample_method method)
+{
+    PGM *half = pgm_create((img->width + 1) / 2, (img->height + 1) / 2, img->max_val, img->type);
+    PGM_view src = pgm_view_of(img);
+    PGM_view dst = pgm_view_of(half);
+
+    downsample_view(&src, &dst, method);
+    return half;
+}
+
+/**
+ * @brief Halve src into dst, which must be ((width + 1) / 2, (height + 1) / 2)
+ *        RESAMPLE_BOX: mean of each 2x2 block
+ *        RESAMPLE_BINOMIAL: [1 4 6 4 1] / 16 in both directions at every second pixel,
+ *          one level of a Gaussian pyramid (Burt and Adelson 1983)
+ *        Edge pixels repeat outside of the image
+ *        Each output row is one pass: the input rows it needs are summed into an integer row with
+ *          vector code, then every second column of that row is filtered horizontally
+ * 
+ * @param src 
+ * @param dst 
+ * @param method 
+ */
+void downsample_view(const PGM_view *src, const PGM_view *dst, resample_method method)
+{
+    int width = src->width, height = src->height;
+
+    if (method != RESAMPLE_BOX && method != RESAMPLE_BINOMIAL)
+    {
+        fprintf(stderr, "Error: downsample_view() method must be RESAMPLE_BOX or RESAMPLE_BINOMIAL\n");
+        exit(EXIT_FAILURE);
+    }
+    if (src->depth != PGM_DEPTH_8U || dst->depth != PGM_DEPTH_8U ||
+        dst->width != (width + 1) / 2 || dst->height != (height + 1) / 2)
+    {
+        fprintf(stderr, "Error: downsample_view() output must be an 8-bit view of %dx%d\n", (width + 1) / 2, (height + 1) / 2);
+        exit(EXIT_FAILURE);
+    }
+
+#pragma omp parallel
+    {
+        // Two extra samples on each side hold the repeated edge pixels
+        int *line = (int *)resample_alloc((width + 4) * sizeof(int)) + 2;
+
+#pragma omp for schedule(static)
+        for (int i = 0; i < dst->height; i++)
+        {
+            unsigned char *out = PGM_VIEW_ROW(dst, unsigned char, i);
+
+            if (method == RESAMPLE_BOX)
+            {
+                const unsigned char *r0 = PGM_VIEW_ROW(src, unsigned char, 2 * i);
+                const unsigned char *r1 = PGM_VIEW_ROW(src, unsigned char, clamp_index(2 * i + 1, height));
+#pragma omp simd
+                for (int x = 0; x < width; x++)
+                {
+                    line[x] = r0[x] + r1[x];
+                }
+                line[width] = line[width - 1];
+                for (int j = 0; j < dst->width; j++)
+                {
+                    out[j] = (unsigned char)((line[2 * j] + line[2 * j + 1] + 2) >> 2);
+                }
+                continue;
+            }
+
+            const unsigned char *r0 = PGM_VIEW_ROW(src, unsigned char, clamp_index(2 * i - 2, height));
+            const unsigned char *r1 = PGM_VIEW_ROW(src, unsigned char, clamp_index(2 * i - 1, height));
+            const unsigned char *r2 = PGM_VIEW_ROW(src, unsigned char, 2 * i);
+            const unsigned char *r3 = PGM_VIEW_ROW(src, unsigned char, clamp_index(2 * i + 1, height));
+            const unsigned char *r4 = PGM_VIEW_ROW(src, unsigned char, clamp_index(2 * i + 2, height));
+#pragma omp simd
+            for (int x = 0; x < width; x++)
+            {
+                line[x] = r0[x] + 4 * r1[x] + 6 * r2[x] + 4 * r3[x] + r4[x];
+            }
+            line[-2] = line[-1] = line[0];
+            line[width] = line[width + 1] = line[width - 1];
+            for (int j = 0; j < dst->width; j++)
+            {
+                const int *c = line + 2 * j;
+                out[j] = (unsigned char)((c[-2] + 4 * c[-1] + 6 * c[0] + 4 * c[1] + c[2] + 128) >> 8);
+            }
+        }
+
+        free(line - 2);
+    }
+}
+
+/**
+ * @brief One row of the binomial expansion of coarse to twice its size, times 64
+ *        Even output samples take [1 6 1] / 8 of the coarse samples around them, odd ones [4 4] / 8,
+ *          the reverse of RESAMPLE_BINOMIAL downsampling
+ * 
+ * @param coarse 
+ * @param y output row
+ * @param width output width
+ * @param line scratch of coarse width + 2 ints
+ * @param out width ints
+ */
+static void expand_row(const PGM_view *coarse, int y, int width, int *line, int *out)
+{
+    int cw = coarse->width, ch = coarse->height;
+    int i = y / 2;
+
+    if (y % 2 == 0)
+    {
+        const unsigned char *r0 = PGM_VIEW_ROW(coarse, unsigned char, clamp_index(i - 1, ch));
+        const unsigned char *r1 = PGM_VIEW_ROW(coarse, unsigned char, clamp_index(i, ch));
+        const unsigned char *r2 = PGM_VIEW_ROW(coarse, unsigned char, clamp_index(i + 1, ch));
+#pragma omp simd
+        for (int x = 0; x < cw; x++)
+        {
+            line[x + 1] = r0[x] + 6 * r1[x] + r2[x];
+        }
+    }
+    else
+    {
+        const unsigned char *r0 = PGM_VIEW_ROW(coarse, unsigned char, clamp_index(i, ch));
+        const unsigned char *r1 = PGM_VIEW_ROW(coarse, unsigned char, clamp_index(i + 1, ch));
+#pragma omp simd
+        for (int x = 0; x < cw; x++)
+        {
+            line[x + 1] = 4 * (r0[x] + r1[x]);
+        }
+    }
+    line[0] = line[1];
+    line[cw + 1] = line[cw];
+
+    for (int x = 0; x < width; x++)
+    {
+        const int *c = line + 1 + x / 2;
+        out[x] = x % 2 == 0 ? c[-1] + 6 * c[0] + c[1] : 4 * (c[0] + c[1]);
+    }
+}
+
+/**
+ * @brief Check that fine is twice the size of coarse, rounded down or up
+ * 
+ * @param fine 
+ * @param coarse 
+ * @param caller 
+ */
+static void expand_check(const PGM_view *fine, const PGM_view *coarse, const char *caller)
+{
+    if (coarse->depth != PGM_DEPTH_8U || (fine->width + 1) / 2 != coarse->width || (fine->height + 1) / 2 != coarse->height)
+    {
+        fprintf(stderr, "Error: %s() coarse level must be an 8-bit view of (width + 1) / 2 x (height + 1) / 2\n", caller);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Double src into dst with the binomial expansion, dst must be (2 * width or 2 * width - 1, same for height)
+ * 
+ * @param src 
+ * @param dst 
+ */
+void upsample_view(const PGM_view *src, const PGM_view *dst)
+{
+    expand_check(dst, src, "upsample_view");
+
+#pragma omp parallel
+    {
+        int *line = (int *)resample_alloc((src->width + 2) * sizeof(int));
+        int *expanded = (int *)resample_alloc(dst->width * sizeof(int));
+
+#pragma omp for schedule(static)
+        for (int i = 0; i < dst->height; i++)
+        {
+            unsigned char *out = PGM_VIEW_ROW(dst, unsigned char, i);
+            expand_row(src, i, dst->width, line, expanded);
+            for (int j = 0; j < dst->width; j++)
+            {
+                out[j] = (unsigned char)((expanded[j] + 32) >> 6);
+            }
+        }
+
+        free(line);
+        free(expanded);
+    }
+}
+
+/**
+ * @brief Laplacian pyramid level, band = fine - expand(coarse) as signed 16-bit values
+ *        coarse is the next Gaussian level of fine, band has the size of fine and depth PGM_DEPTH_16S
+ * 
+ * @param fine 
+ * @param coarse 
+ * @param band 
+ */
+void pyramid_laplacian(const PGM_view *fine, const PGM_view *coarse, const PGM_view *band)
+{
+    expand_check(fine, coarse, "pyramid_laplacian");
+    if (band->depth != PGM_DEPTH_16S || band->width != fine->width || band->height != fine->height)
+    {
+        fprintf(stderr, "Error: pyramid_laplacian() band must be a 16-bit signed view of the fine level size\n");
+        exit(EXIT_FAILURE);
+    }
+
+#pragma omp parallel
+    {
+        int *line = (int *)resample_alloc((coarse->width + 2) * sizeof(int));
+        int *expanded = (int *)resample_alloc(fine->width * sizeof(int));
+
+#pragma omp for schedule(static)
+        for (int i = 0; i < fine->height; i++)
+        {
+            const unsigned char *row = PGM_VIEW_ROW(fine, unsigned char, i);
+            short *out = PGM_VIEW_ROW(band, short, i);
+            expand_row(coarse, i, fine->width, line, expanded);
+#pragma omp simd
+            for (int j = 0; j < fine->width; j++)
+            {
+                out[j] = (short)(row[j] - ((expanded[j] + 32) >> 6));
+            }
+        }
+
+        free(line);
+        free(expanded);
+    }
+}
+
+/**
+ * @brief Rebuild a pyramid level from the next coarser level and its Laplacian band, the inverse of pyramid_laplacian()
+ * 
+ * @param coarse 
+ * @param band 
+ * @param fine 
+ */
+void pyramid_collapse(const PGM_view *coarse, const PGM_view *band, const PGM_view *fine)
+{
+    expand_check(fine, coarse, "pyramid_collapse");
+    if (band->depth != PGM_DEPTH_16S || band->width != fine->width || band->height != fine->height)
+    {
+        fprintf(stderr, "Error: pyramid_collapse() band must be a 16-bit signed view of the fine level size\n");
+        exit(EXIT_FAILURE);
+    }
+
+#pragma omp parallel
+    {
+        int *line = (int *)resample_alloc((coarse->width + 2) * sizeof(int));
+        int *expanded = (int *)resample_alloc(fine->width * sizeof(int));
+
+#pragma omp for schedule(static)
+        for (int i = 0; i < fine->height; i++)
+        {
+            const short *row = PGM_VIEW_ROW(band, short, i);
+            unsigned char *out = PGM_VIEW_ROW(fine, unsigned char, i);
+            expand_row(coarse, i, fine->width, line, expanded);
+            for (int j = 0; j < fine->width; j++)
+            {
+                int value = row[j] + ((expanded[j] + 32) >> 6);
+                out[j] = value < 0 ? 0 : value > 255 ? 255 : (unsigned char)value;
+            }
+        }
+
+        free(line);
+        free(expanded);
+    }
+}
+
+/**
+ * @brief Build a Gaussian pyramid of levels images, each half the size of the one before
+ *        Element 0 is img itself, the others are new images made with downsample_view() and method
+ *        Levels are plain PGM images so every filter runs on them
+ *        Stops early if a level would be smaller than 1x1, levels is updated to the number built
+ * 
+ * @param img 
+ * @param levels 
+ * @param method 
+ * @return PGM** 
+ */
+PGM **pyramid_gaussian(PGM *img, int *levels, resample_method method)
+{
+    PGM **pyramid = (PGM **)resample_alloc((*levels > 0 ? *levels : 1) * sizeof(PGM *));
+    int count = 1;
+
+    pyramid[0] = img;
+    while (count < *levels && (pyramid[count - 1]->width > 1 || pyramid[count - 1]->height > 1))
+    {
+        pyramid[count] = pgm_downsample(pyramid[count - 1], method);
+        count++;
+    }
+
+    *levels = count;
+    return pyramid;
+}
+
+/**
+ * @brief Free the levels a pyramid_gaussian() call made, element 0 belongs to the caller
+ * 
+ * @param pyramid 
+ * @param levels 
+ */
+void pyramid_free(PGM **pyramid, int levels)
+{
+    for (int i = 1; i < levels; i++)
+    {
+        pgm_free(pyramid[i]);
+    }
+    free(pyramid);
+}
@@ -0,0 +1,178 @@
+#include "pgm.h"
+
+// Smallest number of output rows per band, bands grow with the window so the rows read twice stay few
+#define THRESHOLD_BAND 256
+// Dynamic range of the standard deviation in Sauvola's formula
+#define SAUVOLA_RANGE 128.0
+
+/**
+ * @brief Add or remove one image row from the column sums of values and squares
+ * 
+ * @param row 
+ * @param width 
+ * @param sum 
+ * @param squares 
+ * @param sign 1 to add, -1 to remove
+ */
+static void threshold_column_sums(const unsigned char *row, int width, unsigned long long *sum, unsigned long long *squares, int sign)
+{
+    if (sign > 0)
+    {
+#pragma omp simd
+        for (int x = 0; x < width; x++)
+        {
+            sum[x] += row[x];
+            squares[x] += (unsigned int)row[x] * row[x];
+        }
+    }
+    else
+    {
+#pragma omp simd
+        for (int x = 0; x < width; x++)
+        {
+            sum[x] -= row[x];
+            squares[x] -= (unsigned int)row[x] * row[x];
+        }
+    }
+}
+
+/**
+ * @brief Binarize the image with a local threshold and return the binary image
+ *        See filter_threshold_view()
+ * 
+ * @param img 
+ * @param method 
+ * @param window 
+ * @param k 
+ * @param padding 
+ * @return PGM* 
+ */
+PGM *filter_threshold(PGM *img, threshold_method method, int window, double k, char *padding)
+{
+    PGM *binary = filter_create_output(img, window, window, padding);
+    PGM_view src = pgm_view_of(img);
+    PGM_view dst = pgm_view_of(binary);
+
+    filter_threshold_view(&src, &dst, method, window, k, padding);
+    return binary;
+}
+
+/**
+ * @brief Binarize src with a threshold computed from the window x window neighbourhood of every pixel
+ *        THRESHOLD_NIBLACK: T = mean + k * deviation, k around -0.2
+ *        THRESHOLD_SAUVOLA: T = mean * (1 + k * (deviation / 128 - 1)), k around 0.2 .. 0.5
+ *        Pixels above T become 255, the others 0
+ *        Mean and standard deviation come from integral images of the values and of their squares, 64-bit
+ *          so they cannot overflow, and the cost per pixel does not depend on the window size
+ *        The integral images are never stored whole: a window only needs the difference of two integral rows,
+ *          which is the running sum of the window rows in every column, and its prefix sums along the row
+ *        Bands of output rows are spread over the threads, each band sums its first window once and then
+ *          adds the row entering the window and removes the row leaving it
+ *        Output size follows the rules of filter_gaussian_view(), with padding "yes" the border is
+ *          thresholded too, with the part of the window that is inside the image
+ * 
+ * @param src 
+ * @param dst 
+ * @param method 
+ * @param window odd, at least 3
+ * @param k 
+ * @param padding 
+ */
+void filter_threshold_view(const PGM_view *src, const PGM_view *dst, threshold_method method, int window, double k, char *padding)
+{
+    int width = src->width, height = src->height;
+    int radius = window / 2;
+    int offset = strcmp(padding, "yes") == 0 ? 0 : radius;
+    int band = 8 * window > THRESHOLD_BAND ? 8 * window : THRESHOLD_BAND;
+    int bands;
+
+    if (window < 3 || window % 2 == 0)
+    {
+        fprintf(stderr, "Error: filter_threshold() window must be odd and at least 3\n");
+        exit(EXIT_FAILURE);
+    }
+    if (method != THRESHOLD_NIBLACK && method != THRESHOLD_SAUVOLA)
+    {
+        fprintf(stderr, "Error: filter_threshold() unknown method\n");
+        exit(EXIT_FAILURE);
+    }
+
+    filter_prepare_output(src, dst, window, padding, "filter_threshold");
+    bands = (dst->height + band - 1) / band;
+
+#pragma omp parallel
+    {
+        unsigned long long *sum = (unsigned long long *)malloc(width * sizeof(unsigned long long));
+        unsigned long long *squares = (unsigned long long *)malloc(width * sizeof(unsigned long long));
+        unsigned long long *integral = (unsigned long long *)malloc((width + 1) * sizeof(unsigned long long));
+        unsigned long long *integral_squares = (unsigned long long *)malloc((width + 1) * sizeof(unsigned long long));
+        if (sum == NULL || squares == NULL || integral == NULL || integral_squares == NULL)
+        {
+            fprintf(stderr, "Error: filter_threshold() failed to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+
+#pragma omp for schedule(static)
+        for (int b = 0; b < bands; b++)
+        {
+            int i0 = b * band;
+            int i1 = i0 + band < dst->height ? i0 + band : dst->height;
+            int top = i0 + offset - radius < 0 ? 0 : i0 + offset - radius;
+            int bottom = i0 + offset + radius + 1 > height ? height : i0 + offset + radius + 1;
+
+            memset(sum, 0, width * sizeof(unsigned long long));
+            memset(squares, 0, width * sizeof(unsigned long long));
+            for (int y = top; y < bottom; y++)
+            {
+                threshold_column_sums(PGM_VIEW_ROW(src, unsigned char, y), width, sum, squares, 1);
+            }
+
+            for (int i = i0; i < i1; i++)
+            {
+                int y = i + offset;
+                const unsigned char *row = PGM_VIEW_ROW(src, unsigned char, y);
+                unsigned char *out = PGM_VIEW_ROW(dst, unsigned char, i);
+                int rows;
+
+                if (i > i0 && y + radius < height)
+                {
+                    threshold_column_sums(PGM_VIEW_ROW(src, unsigned char, y + radius), width, sum, squares, 1);
+                    bottom++;
+                }
+                if (i > i0 && y - radius - 1 >= 0)
+                {
+                    threshold_column_sums(PGM_VIEW_ROW(src, unsigned char, y - radius - 1), width, sum, squares, -1);
+                    top++;
+                }
+                rows = bottom - top;
+
+                integral[0] = integral_squares[0] = 0;
+                for (int x = 0; x < width; x++)
+                {
+                    integral[x + 1] = integral[x] + sum[x];
+                    integral_squares[x + 1] = integral_squares[x] + squares[x];
+                }
+
+                for (int j = 0; j < dst->width; j++)
+                {
+                    int x = j + offset;
+                    int left = x - radius < 0 ? 0 : x - radius;
+                    int right = x + radius + 1 > width ? width : x + radius + 1;
+                    double count = (double)(right - left) * rows;
+                    double mean = (long long)(integral[right] - integral[left]) / count;
+                    double variance = (long long)(integral_squares[right] - integral_squares[left]) / count - mean * mean;
+                    double deviation = variance > 0 ? sqrt(variance) : 0;
+                    double threshold = method == THRESHOLD_NIBLACK ? mean + k * deviation
+                                                                   : mean * (1 + k * (deviation / SAUVOLA_RANGE - 1));
+
+                    out[j] = row[x] > threshold ? 255 : 0;
+                }
+            }
+        }
+
+        free(sum);
+        free(squares);
+        free(integral);
+        free(integral_squares);
+    }
+}
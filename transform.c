@@ -0,0 +1,442 @@
+#include "pgm.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Side of the square tiles handed to the threads, in pixels
+#define TRANSFORM_TILE 64
+
+/**
+ * @brief Size of one pixel of the given depth in bytes
+ * 
+ * @param depth 
+ * @return int 
+ */
+static int transform_pixel_size(PGM_depth depth)
+{
+    static const int pixel_size[] = {1, 2, 4, 4, 2};
+    return pixel_size[depth];
+}
+
+#ifdef __SSE2__
+/**
+ * @brief Transpose a 16x16 block of bytes in registers
+ *        Four rounds of interleaving row i with row i + 8 turn rows into columns
+ * 
+ * @param src 
+ * @param src_stride 
+ * @param dst 
+ * @param dst_stride 
+ */
+static void transpose_block_8(const unsigned char *src, ptrdiff_t src_stride, unsigned char *dst, ptrdiff_t dst_stride)
+{
+    __m128i r[16], t[16];
+
+    for (int i = 0; i < 16; i++)
+    {
+        r[i] = _mm_loadu_si128((const __m128i *)(src + i * src_stride));
+    }
+    for (int round = 0; round < 4; round++)
+    {
+        for (int i = 0; i < 8; i++)
+        {
+            t[2 * i] = _mm_unpacklo_epi8(r[i], r[i + 8]);
+            t[2 * i + 1] = _mm_unpackhi_epi8(r[i], r[i + 8]);
+        }
+        memcpy(r, t, sizeof(r));
+    }
+    for (int i = 0; i < 16; i++)
+    {
+        _mm_storeu_si128((__m128i *)(dst + i * dst_stride), r[i]);
+    }
+}
+
+/**
+ * @brief Transpose an 8x8 block of 16-bit pixels in registers, see transpose_block_8()
+ * 
+ * @param src 
+ * @param src_stride 
+ * @param dst 
+ * @param dst_stride 
+ */
+static void transpose_block_16(const unsigned char *src, ptrdiff_t src_stride, unsigned char *dst, ptrdiff_t dst_stride)
+{
+    __m128i r[8], t[8];
+
+    for (int i = 0; i < 8; i++)
+    {
+        r[i] = _mm_loadu_si128((const __m128i *)(src + i * src_stride));
+    }
+    for (int round = 0; round < 3; round++)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            t[2 * i] = _mm_unpacklo_epi16(r[i], r[i + 4]);
+            t[2 * i + 1] = _mm_unpackhi_epi16(r[i], r[i + 4]);
+        }
+        memcpy(r, t, sizeof(r));
+    }
+    for (int i = 0; i < 8; i++)
+    {
+        _mm_storeu_si128((__m128i *)(dst + i * dst_stride), r[i]);
+    }
+}
+
+/**
+ * @brief Transpose a 4x4 block of 32-bit pixels in registers, see transpose_block_8()
+ * 
+ * @param src 
+ * @param src_stride 
+ * @param dst 
+ * @param dst_stride 
+ */
+static void transpose_block_32(const unsigned char *src, ptrdiff_t src_stride, unsigned char *dst, ptrdiff_t dst_stride)
+{
+    __m128i r[4], t[4];
+
+    for (int i = 0; i < 4; i++)
+    {
+        r[i] = _mm_loadu_si128((const __m128i *)(src + i * src_stride));
+    }
+    for (int round = 0; round < 2; round++)
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            t[2 * i] = _mm_unpacklo_epi32(r[i], r[i + 2]);
+            t[2 * i + 1] = _mm_unpackhi_epi32(r[i], r[i + 2]);
+        }
+        memcpy(r, t, sizeof(r));
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        _mm_storeu_si128((__m128i *)(dst + i * dst_stride), r[i]);
+    }
+}
+
+/**
+ * @brief Reverse the 16 bytes of a register
+ * 
+ * @param v 
+ * @return __m128i 
+ */
+static __m128i reverse_bytes(__m128i v)
+{
+    v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+#endif
+
+/**
+ * @brief Transpose part of a view pixel by pixel, for the edges the register kernels do not cover
+ * 
+ * @param src 
+ * @param dst 
+ * @param x0 first column of src
+ * @param y0 first row of src
+ * @param width 
+ * @param height 
+ */
+static void transpose_pixels(const PGM_view *src, const PGM_view *dst, int x0, int y0, int width, int height)
+{
+    int size = transform_pixel_size(src->depth);
+
+    for (int i = y0; i < y0 + height; i++)
+    {
+        const unsigned char *row = PGM_VIEW_ROW(src, unsigned char, i);
+        for (int j = x0; j < x0 + width; j++)
+        {
+            unsigned char *out = PGM_VIEW_ROW(dst, unsigned char, j) + (ptrdiff_t)i * size;
+            switch (size)
+            {
+            case 1:
+                *out = row[j];
+                break;
+            case 2:
+                *(unsigned short *)out = ((const unsigned short *)row)[j];
+                break;
+            default:
+                *(unsigned int *)out = ((const unsigned int *)row)[j];
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Check that dst has the depth of src and the given size
+ * 
+ * @param src 
+ * @param dst 
+ * @param width 
+ * @param height 
+ * @param caller 
+ */
+static void transform_check(const PGM_view *src, const PGM_view *dst, int width, int height, const char *caller)
+{
+    if (src->depth != dst->depth || dst->width != width || dst->height != height)
+    {
+        fprintf(stderr, "Error: %s() output must have the depth of the input and size %dx%d\n", caller, width, height);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Transpose src into dst on the calling thread
+ *        Blocks of one SSE2 register per row (16x16 bytes, 8x8 16-bit or 4x4 32-bit pixels) are transposed
+ *          in registers, the rest pixel by pixel
+ *        Meant for strips that fit in the cache, such as the ones separable filters turn into lanes
+ *          from inside their own parallel loops, use transpose_view() for whole images
+ *        Any stride works, negative ones too, so the views may be flipped
+ * 
+ * @param src 
+ * @param dst view of src height x src width with the same depth
+ */
+void transpose_tile(const PGM_view *src, const PGM_view *dst)
+{
+    int width = src->width, height = src->height;
+    int block = 16 / transform_pixel_size(src->depth);
+    int full_width = 0, full_height = 0;
+
+    transform_check(src, dst, height, width, "transpose_tile");
+
+#ifdef __SSE2__
+    full_width = width - width % block;
+    full_height = height - height % block;
+    for (int i = 0; i < full_height; i += block)
+    {
+        for (int j = 0; j < full_width; j += block)
+        {
+            const unsigned char *in = PGM_VIEW_ROW(src, unsigned char, i) + (ptrdiff_t)j * (16 / block);
+            unsigned char *out = PGM_VIEW_ROW(dst, unsigned char, j) + (ptrdiff_t)i * (16 / block);
+            switch (block)
+            {
+            case 16:
+                transpose_block_8(in, src->stride, out, dst->stride);
+                break;
+            case 8:
+                transpose_block_16(in, src->stride, out, dst->stride);
+                break;
+            default:
+                transpose_block_32(in, src->stride, out, dst->stride);
+                break;
+            }
+        }
+    }
+#endif
+
+    transpose_pixels(src, dst, full_width, 0, width - full_width, height);
+    transpose_pixels(src, dst, 0, full_height, full_width, height - full_height);
+}
+
+/**
+ * @brief Transpose src into dst, pixel (x, y) goes to (y, x)
+ *        The image is cut in TRANSFORM_TILE x TRANSFORM_TILE tiles so the rows read and the rows written
+ *          both stay in the cache, tiles go through transpose_tile() and are spread over the threads
+ *        Works on every depth
+ * 
+ * @param src 
+ * @param dst view of src height x src width with the same depth
+ */
+void transpose_view(const PGM_view *src, const PGM_view *dst)
+{
+    int tiles_x = (src->width + TRANSFORM_TILE - 1) / TRANSFORM_TILE;
+    int tiles_y = (src->height + TRANSFORM_TILE - 1) / TRANSFORM_TILE;
+
+    transform_check(src, dst, src->height, src->width, "transpose_view");
+
+#pragma omp parallel for collapse(2) schedule(static)
+    for (int ty = 0; ty < tiles_y; ty++)
+    {
+        for (int tx = 0; tx < tiles_x; tx++)
+        {
+            int x = tx * TRANSFORM_TILE, y = ty * TRANSFORM_TILE;
+            int w = src->width - x < TRANSFORM_TILE ? src->width - x : TRANSFORM_TILE;
+            int h = src->height - y < TRANSFORM_TILE ? src->height - y : TRANSFORM_TILE;
+            PGM_view in = pgm_view_sub(src, x, y, w, h);
+            PGM_view out = pgm_view_sub(dst, y, x, h, w);
+            transpose_tile(&in, &out);
+        }
+    }
+}
+
+/**
+ * @brief View of the same pixels with the rows in reverse order, nothing is copied
+ * 
+ * @param view 
+ * @return PGM_view 
+ */
+static PGM_view flip_rows(const PGM_view *view)
+{
+    if (view->height == 0)
+    {
+        return *view;
+    }
+    return pgm_view_wrap(PGM_VIEW_ROW(view, unsigned char, view->height - 1), view->width, view->height, -view->stride, view->depth);
+}
+
+/**
+ * @brief Mirror src into dst
+ *        Vertical flips copy whole rows in reverse order, horizontal flips reverse every row,
+ *          16 bytes per instruction for 8-bit views with SSE2
+ *        Rows are spread over the threads
+ * 
+ * @param src 
+ * @param dst view of the same size and depth
+ * @param horizontal non zero to swap left and right, zero to swap top and bottom
+ */
+void flip_view(const PGM_view *src, const PGM_view *dst, int horizontal)
+{
+    int width = src->width;
+    int size = transform_pixel_size(src->depth);
+
+    transform_check(src, dst, src->width, src->height, "flip_view");
+
+    if (!horizontal)
+    {
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < src->height; i++)
+        {
+            memcpy(PGM_VIEW_ROW(dst, unsigned char, src->height - 1 - i), PGM_VIEW_ROW(src, unsigned char, i), (size_t)width * size);
+        }
+        return;
+    }
+
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < src->height; i++)
+    {
+        const unsigned char *row = PGM_VIEW_ROW(src, unsigned char, i);
+        unsigned char *out = PGM_VIEW_ROW(dst, unsigned char, i);
+        int j = 0;
+
+        switch (size)
+        {
+        case 1:
+#ifdef __SSE2__
+            for (; j + 16 <= width; j += 16)
+            {
+                __m128i v = _mm_loadu_si128((const __m128i *)(row + width - 16 - j));
+                _mm_storeu_si128((__m128i *)(out + j), reverse_bytes(v));
+            }
+#endif
+            for (; j < width; j++)
+            {
+                out[j] = row[width - 1 - j];
+            }
+            break;
+        case 2:
+            for (; j < width; j++)
+            {
+                ((unsigned short *)out)[j] = ((const unsigned short *)row)[width - 1 - j];
+            }
+            break;
+        default:
+            for (; j < width; j++)
+            {
+                ((unsigned int *)out)[j] = ((const unsigned int *)row)[width - 1 - j];
+            }
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Rotate src clockwise by 0, 90, 180 or 270 degrees into dst
+ *        0 copies the rows, 90 is the transpose of src read bottom row first, 270 the transpose written bottom row first,
+ *          both only change the sign of a stride so they run at the speed of transpose_view()
+ *        180 flips the rows horizontally into dst read bottom row first
+ * 
+ * @param src 
+ * @param dst view of src height x src width for 90 and 270, of the size of src for 0 and 180, same depth
+ * @param degrees 
+ */
+void rotate_view(const PGM_view *src, const PGM_view *dst, int degrees)
+{
+    PGM_view flipped;
+
+    switch (degrees)
+    {
+    case 0:
+        transform_check(src, dst, src->width, src->height, "rotate_view");
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < src->height; i++)
+        {
+            memcpy(PGM_VIEW_ROW(dst, unsigned char, i), PGM_VIEW_ROW(src, unsigned char, i),
+                   (size_t)src->width * transform_pixel_size(src->depth));
+        }
+        break;
+    case 90:
+        flipped = flip_rows(src);
+        transpose_view(&flipped, dst);
+        break;
+    case 180:
+        transform_check(src, dst, src->width, src->height, "rotate_view");
+        flipped = flip_rows(dst);
+        flip_view(src, &flipped, 1);
+        break;
+    case 270:
+        transform_check(src, dst, src->height, src->width, "rotate_view");
+        flipped = flip_rows(dst);
+        transpose_view(src, &flipped);
+        break;
+    default:
+        fprintf(stderr, "Error: rotate_view() angle must be 0, 90, 180 or 270 degrees\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Rotate the image clockwise by 0, 90, 180 or 270 degrees and return the rotated image
+ *        See rotate_view()
+ * 
+ * @param img 
+ * @param degrees 
+ * @return PGM* 
+ */
+PGM *pgm_rotate(PGM *img, int degrees)
+{
+    int swap = degrees == 90 || degrees == 270;
+    PGM *rotated = pgm_create(swap ? img->height : img->width, swap ? img->width : img->height, img->max_val, img->type);
+    PGM_view src = pgm_view_of(img);
+    PGM_view dst = pgm_view_of(rotated);
+
+    rotate_view(&src, &dst, degrees);
+    return rotated;
+}
+
+/**
+ * @brief Transpose the image and return the transposed image
+ *        See transpose_view()
+ * 
+ * @param img 
+ * @return PGM* 
+ */
+PGM *pgm_transpose(PGM *img)
+{
+    PGM *transposed = pgm_create(img->height, img->width, img->max_val, img->type);
+    PGM_view src = pgm_view_of(img);
+    PGM_view dst = pgm_view_of(transposed);
+
+    transpose_view(&src, &dst);
+    return transposed;
+}
+
+/**
+ * @brief Mirror the image and return the mirrored image
+ *        See flip_view()
+ * 
+ * @param img 
+ * @param horizontal 
+ * @return PGM* 
+ */
+PGM *pgm_flip(PGM *img, int horizontal)
+{
+    PGM *flipped = pgm_create(img->width, img->height, img->max_val, img->type);
+    PGM_view src = pgm_view_of(img);
+    PGM_view dst = pgm_view_of(flipped);
+
+    flip_view(&src, &dst, horizontal);
+    return flipped;
+}
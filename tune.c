@@ -0,0 +1,378 @@
+#include "pgm.h"
+#ifdef _OPENMP
+#include <omp.h>
+#else
+#include <time.h>
+#endif
+
+// Kernel sizes the tuner measures, other sizes use the largest measured size below them
+#define TUNE_KERNELS 8
+// Image size classes, images of at least TUNE_LARGE_PIXELS pixels are large
+#define TUNE_CLASSES 2
+#define TUNE_LARGE_PIXELS (1 << 20)
+// A variant whose time on the previous kernel is this many times the best time is not measured
+#define TUNE_DROP 4.0
+// Candidates are repeated while they take less than this many seconds, the fastest run counts
+#define TUNE_REPEAT_TIME 0.05
+
+static const int tune_sizes[TUNE_KERNELS] = {3, 5, 7, 9, 11, 15, 21, 31};
+static const int tune_tiles[] = {16, 64, 256};
+static const char *tune_filter_names[TUNE_FILTERS] = {"median", "average", "sobel"};
+static const char *tune_class_names[TUNE_CLASSES] = {"small", "large"};
+static const char *tune_variant_names[TUNE_FILTERS][MEDIAN_VARIANTS] = {
+    {"mergesort", "network", "histogram"},
+    {"direct", "running", NULL},
+    {"direct", "bands", NULL}};
+static const int tune_variant_count[TUNE_FILTERS] = {MEDIAN_VARIANTS, AVERAGE_VARIANTS, SOBEL_VARIANTS};
+// Benchmark image of each class
+static const int tune_class_width[TUNE_CLASSES] = {512, 2048};
+static const int tune_class_height[TUNE_CLASSES] = {512, 1024};
+
+static tune_choice tune_table[TUNE_FILTERS][TUNE_KERNELS][TUNE_CLASSES];
+static int tune_loaded = 0;
+
+/**
+ * @brief Index of the largest measured kernel size not above filter_size, 0 for smaller kernels
+ * 
+ * @param filter_size 
+ * @return int 
+ */
+static int tune_kernel_index(int filter_size)
+{
+    int index = 0;
+
+    while (index + 1 < TUNE_KERNELS && tune_sizes[index + 1] <= filter_size)
+    {
+        index++;
+    }
+    return index;
+}
+
+/**
+ * @brief Choice used when no profile is loaded, fine on most machines
+ * 
+ * @param filter 
+ * @param filter_size 
+ * @return tune_choice 
+ */
+static tune_choice tune_default(tune_filter filter, int filter_size)
+{
+    tune_choice choice = {0, 0, 0};
+
+    if (filter == TUNE_MEDIAN)
+    {
+        choice.variant = filter_size <= 5 ? MEDIAN_NETWORK : MEDIAN_HISTOGRAM;
+    }
+    else if (filter == TUNE_AVERAGE)
+    {
+        choice.variant = AVERAGE_RUNNING;
+    }
+    else
+    {
+        choice.variant = SOBEL_BANDS;
+    }
+    return choice;
+}
+
+/**
+ * @brief Return the implementation to use for a filter_size filter on a width x height image
+ *        One table read once a profile is loaded, tune_default() before
+ * 
+ * @param filter 
+ * @param filter_size 
+ * @param width 
+ * @param height 
+ * @return tune_choice 
+ */
+tune_choice tune_lookup(tune_filter filter, int filter_size, int width, int height)
+{
+    if (!tune_loaded)
+    {
+        return tune_default(filter, filter_size);
+    }
+    return tune_table[filter][tune_kernel_index(filter_size)][(size_t)width * height >= TUNE_LARGE_PIXELS];
+}
+
+/**
+ * @brief Number of threads a choice runs on, all of them if choice.threads is 0
+ * 
+ * @param choice 
+ * @return int 
+ */
+int tune_threads(tune_choice choice)
+{
+    if (choice.threads > 0)
+    {
+        return choice.threads;
+    }
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+/**
+ * @brief Wall clock time in seconds
+ * 
+ * @return double 
+ */
+static double tune_clock(void)
+{
+#ifdef _OPENMP
+    return omp_get_wtime();
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/**
+ * @brief Find name in a table of count names
+ * 
+ * @param names 
+ * @param count 
+ * @param name 
+ * @return int index, -1 if it is not there
+ */
+static int tune_find_name(const char **names, int count, const char *name)
+{
+    for (int n = 0; n < count; n++)
+    {
+        if (names[n] != NULL && strcmp(names[n], name) == 0)
+        {
+            return n;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Load a profile written by tune_run(), filters dispatch through it from then on
+ *        One line per filter, kernel size and size class: "median 5 large histogram 8 0" is
+ *          filter, kernel size, size class, variant, threads and tile rows
+ *        Lines starting with # are comments, entries missing from the file keep tune_default()
+ *        A malformed line, e.g. of a truncated file, is reported on stderr and the whole profile is ignored,
+ *          every filter keeps tune_default() so the program and the tune mode that rewrites the file still run
+ * 
+ * @param filename 
+ * @return int 1 if the profile was loaded, 0 if the file does not exist or is malformed
+ */
+int tune_load(const char *filename)
+{
+    FILE *file = fopen(filename, "r");
+    char line[256];
+    int number = 0;
+
+    if (file == NULL)
+    {
+        return 0;
+    }
+
+    for (int f = 0; f < TUNE_FILTERS; f++)
+    {
+        for (int k = 0; k < TUNE_KERNELS; k++)
+        {
+            for (int c = 0; c < TUNE_CLASSES; c++)
+            {
+                tune_table[f][k][c] = tune_default((tune_filter)f, tune_sizes[k]);
+            }
+        }
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        char filter_name[32], class_name[32], variant_name[32];
+        int filter, size, size_class, variant, threads, tile;
+
+        number++;
+        if (line[0] == '#' || line[0] == '\n')
+        {
+            continue;
+        }
+        if (sscanf(line, "%31s %d %31s %31s %d %d", filter_name, &size, class_name, variant_name, &threads, &tile) != 6 ||
+            (filter = tune_find_name(tune_filter_names, TUNE_FILTERS, filter_name)) < 0 ||
+            (size_class = tune_find_name(tune_class_names, TUNE_CLASSES, class_name)) < 0 ||
+            (variant = tune_find_name(tune_variant_names[filter], tune_variant_count[filter], variant_name)) < 0 ||
+            tune_sizes[tune_kernel_index(size)] != size || threads < 0 || tile < 0)
+        {
+            fprintf(stderr, "Warning: tune_load() bad entry on line %d of %s, using the default choices\n", number, filename);
+            fclose(file);
+            tune_loaded = 0;
+            return 0;
+        }
+
+        tune_table[filter][tune_kernel_index(size)][size_class] = (tune_choice){variant, threads, tile};
+    }
+
+    fclose(file);
+    tune_loaded = 1;
+    return 1;
+}
+
+/**
+ * @brief Run one variant of a filter on src into dst and return the time it took
+ *        Short runs are repeated, the fastest one counts
+ * 
+ * @param filter 
+ * @param src 
+ * @param dst 
+ * @param filter_size 
+ * @param choice 
+ * @return double seconds 
+ */
+static double tune_measure(tune_filter filter, const PGM_view *src, const PGM_view *dst, int filter_size, tune_choice choice)
+{
+    double best = DBL_MAX, spent = 0;
+
+    for (int run = 0; run < 5 && spent < TUNE_REPEAT_TIME; run++)
+    {
+        double start = tune_clock(), time;
+
+        if (filter == TUNE_MEDIAN)
+        {
+            filter_median_variant(src, dst, filter_size, "yes", choice);
+        }
+        else if (filter == TUNE_AVERAGE)
+        {
+            filter_average_variant(src, dst, filter_size, "yes", choice);
+        }
+        else
+        {
+            filter_sobel_variant(src, dst, "yes", choice);
+        }
+
+        time = tune_clock() - start;
+        best = time < best ? time : best;
+        spent += time;
+    }
+    return best;
+}
+
+/**
+ * @brief Benchmark the variants of every filter on this machine, keep the fastest and write them to filename
+ *        For each size class a synthetic image of that class is filtered with every measured kernel size,
+ *          every variant, thread counts 1, 2, 4 .. up to all threads and, for the banded variants,
+ *          every tile size in tune_tiles
+ *        Kernels grow from small to large and no variant gets faster on a larger kernel, so a variant
+ *          whose time on the previous kernel is TUNE_DROP times the best one already found is skipped,
+ *          which keeps the slow sorts from dominating the run
+ *        The profile is used by the filters right away, main() loads it at startup next time
+ *        Prints one line per entry
+ * 
+ * @param filename 
+ * @return int 0, or 1 if the profile could not be written
+ */
+int tune_run(const char *filename)
+{
+    int max_threads = tune_threads((tune_choice){0, 0, 0});
+    PGM *images[TUNE_CLASSES], *outputs[TUNE_CLASSES];
+    FILE *file;
+
+    srand(1);
+    for (int c = 0; c < TUNE_CLASSES; c++)
+    {
+        images[c] = pgm_create(tune_class_width[c], tune_class_height[c], 255, "P5");
+        outputs[c] = pgm_create(tune_class_width[c], tune_class_height[c], 255, "P5");
+        // Smooth shading with noise on top, so neither sorting nor histograms get an easy input
+        for (int i = 0; i < images[c]->height; i++)
+        {
+            for (int j = 0; j < images[c]->width; j++)
+            {
+                images[c]->data[i][j] = (unsigned char)((i / 4 + j / 8 + rand() % 64) & 255);
+            }
+        }
+    }
+
+    for (int f = 0; f < TUNE_FILTERS; f++)
+    {
+        int kernels = f == TUNE_SOBEL ? 1 : TUNE_KERNELS;
+        double previous[MEDIAN_VARIANTS][TUNE_CLASSES] = {{0}};
+
+        for (int k = 0; k < kernels; k++)
+        {
+            for (int c = 0; c < TUNE_CLASSES; c++)
+            {
+                PGM_view src = pgm_view_of(images[c]);
+                PGM_view dst = pgm_view_of(outputs[c]);
+                double best_time = DBL_MAX;
+                int measured[MEDIAN_VARIANTS] = {0};
+                tune_choice best = tune_default((tune_filter)f, tune_sizes[k]);
+
+                for (int n = 0; n < tune_variant_count[f]; n++)
+                {
+                    int v = -1, banded, tiles;
+                    double fastest = DBL_MAX;
+
+                    // Fastest variant of the previous kernel size first, so best_time soon prunes the others
+                    for (int u = 0; u < tune_variant_count[f]; u++)
+                    {
+                        v = !measured[u] && (v < 0 || previous[u][c] < previous[v][c]) ? u : v;
+                    }
+                    measured[v] = 1;
+                    if ((f == TUNE_MEDIAN && v == MEDIAN_NETWORK && tune_sizes[k] > MEDIAN_NETWORK_MAX_SIZE) ||
+                        previous[v][c] > TUNE_DROP * best_time)
+                    {
+                        continue;
+                    }
+
+                    banded = (f == TUNE_AVERAGE && v == AVERAGE_RUNNING) || (f == TUNE_SOBEL && v == SOBEL_BANDS);
+                    tiles = banded ? (int)(sizeof(tune_tiles) / sizeof(tune_tiles[0])) : 1;
+                    for (int threads = 1;; threads = threads * 2 < max_threads ? threads * 2 : max_threads)
+                    {
+                        for (int t = 0; t < tiles; t++)
+                        {
+                            tune_choice choice = {v, threads, banded ? tune_tiles[t] : 0};
+                            double time = tune_measure((tune_filter)f, &src, &dst, tune_sizes[k], choice);
+
+                            fastest = time < fastest ? time : fastest;
+                            if (time < best_time)
+                            {
+                                best_time = time;
+                                best = choice;
+                            }
+                        }
+                        if (threads == max_threads)
+                        {
+                            break;
+                        }
+                    }
+                    previous[v][c] = fastest;
+                }
+
+                tune_table[f][k][c] = best;
+                printf("%s %dx%d %s: %s, %d threads, tile %d, %.2f ms\n", tune_filter_names[f], tune_sizes[k], tune_sizes[k],
+                       tune_class_names[c], tune_variant_names[f][best.variant], best.threads, best.tile, best_time * 1000);
+            }
+        }
+
+    }
+    tune_loaded = 1;
+
+    for (int c = 0; c < TUNE_CLASSES; c++)
+    {
+        pgm_free(images[c]);
+        pgm_free(outputs[c]);
+    }
+
+    file = fopen(filename, "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Error: tune_run() cannot write %s\n", filename);
+        return 1;
+    }
+    fprintf(file, "# filter, kernel size, size class, variant, threads, tile rows (%d threads available)\n", max_threads);
+    for (int f = 0; f < TUNE_FILTERS; f++)
+    {
+        for (int k = 0; k < (f == TUNE_SOBEL ? 1 : TUNE_KERNELS); k++)
+        {
+            for (int c = 0; c < TUNE_CLASSES; c++)
+            {
+                const tune_choice *choice = &tune_table[f][k][c];
+                fprintf(file, "%s %d %s %s %d %d\n", tune_filter_names[f], tune_sizes[k], tune_class_names[c],
+                        tune_variant_names[f][choice->variant], choice->threads, choice->tile);
+            }
+        }
+    }
+    fclose(file);
+    return 0;
+}
@@ -0,0 +1,464 @@
+#include "pgm.h"
+
+// Output pixels the median network sorts at once, one vector lane each
+#define NETWORK_LANES 16
+// Rows per band when the tune profile leaves the tile size open
+#define VARIANT_TILE 64
+
+typedef struct
+{
+    unsigned short low;
+    unsigned short high;
+} comparator;
+
+/**
+ * @brief Build the comparators that move the median of count values to position count / 2
+ *        Batcher's odd-even merge sort network on the next power of two, the extra inputs hold 255
+ *        Comparators whose high input still holds such a 255 cannot change anything and are dropped,
+ *          then walking the network backwards keeps only the comparators the median position depends on
+ * 
+ * @param count 
+ * @param inputs set to the power of two the network sorts
+ * @return comparator* list ending with low == high == 0, to be freed by the caller
+ */
+static comparator *median_network_build(int count, int *inputs)
+{
+    int n = 1, total = 0, kept = 0;
+    comparator *network;
+    unsigned char *padded, *needed;
+
+    while (n < count)
+    {
+        n <<= 1;
+    }
+
+    for (int p = 1; p < n; p <<= 1)
+    {
+        for (int k = p; k >= 1; k >>= 1)
+        {
+            for (int j = k % p; j + k < n; j += 2 * k)
+            {
+                for (int i = 0; i < k && i + j + k < n; i++)
+                {
+                    total += (i + j) / (2 * p) == (i + j + k) / (2 * p);
+                }
+            }
+        }
+    }
+
+    network = (comparator *)malloc((total + 1) * sizeof(comparator));
+    padded = (unsigned char *)malloc(n);
+    needed = (unsigned char *)malloc(n);
+    if (network == NULL || padded == NULL || needed == NULL)
+    {
+        fprintf(stderr, "Error: median_network() failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        padded[i] = i >= count;
+        needed[i] = i == count / 2;
+    }
+
+    for (int p = 1; p < n; p <<= 1)
+    {
+        for (int k = p; k >= 1; k >>= 1)
+        {
+            for (int j = k % p; j + k < n; j += 2 * k)
+            {
+                for (int i = 0; i < k && i + j + k < n; i++)
+                {
+                    int low = i + j, high = i + j + k;
+                    if ((i + j) / (2 * p) != (i + j + k) / (2 * p) || padded[high])
+                    {
+                        continue;
+                    }
+                    // A 255 in the low input is swapped up, the comparator is kept
+                    padded[high] = padded[low];
+                    padded[low] = 0;
+                    network[kept].low = (unsigned short)low;
+                    network[kept].high = (unsigned short)high;
+                    kept++;
+                }
+            }
+        }
+    }
+
+    total = kept;
+    kept = 0;
+    for (int c = total - 1; c >= 0; c--)
+    {
+        if (needed[network[c].low] || needed[network[c].high])
+        {
+            needed[network[c].low] = needed[network[c].high] = 1;
+            network[c].low |= 0x8000;
+            kept++;
+        }
+    }
+    kept = 0;
+    for (int c = 0; c < total; c++)
+    {
+        if (network[c].low & 0x8000)
+        {
+            network[kept].low = network[c].low & 0x7fff;
+            network[kept].high = network[c].high;
+            kept++;
+        }
+    }
+    network[kept].low = network[kept].high = 0;
+
+    free(padded);
+    free(needed);
+    *inputs = n;
+    return network;
+}
+
+/**
+ * @brief Median filter that runs a sorting network over NETWORK_LANES neighbouring output pixels at once
+ *        Every network input is a vector of the same window position for NETWORK_LANES pixels of a row,
+ *          so each comparator is one vector min and one vector max, without branches
+ *        The network is cut down to what the median needs, see median_network_build(),
+ *          its size grows as n log^2 n so it is for kernels up to MEDIAN_NETWORK_MAX_SIZE
+ *        Rows are spread over choice.threads threads
+ * 
+ * @param src 
+ * @param dst prepared by filter_prepare_output()
+ * @param filter_size 
+ * @param offset of the first filtered pixel in dst
+ * @param choice 
+ */
+void median_network(const PGM_view *src, const PGM_view *dst, int filter_size, int offset, tune_choice choice)
+{
+    int count = filter_size * filter_size;
+    int width = src->width - filter_size + 1, height = src->height - filter_size + 1;
+    int inputs;
+    comparator *network = median_network_build(count, &inputs);
+
+#pragma omp parallel num_threads(tune_threads(choice))
+    {
+        unsigned char (*lanes)[NETWORK_LANES] = (unsigned char (*)[NETWORK_LANES])malloc((size_t)inputs * NETWORK_LANES);
+        if (lanes == NULL)
+        {
+            fprintf(stderr, "Error: median_network() failed to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+
+#pragma omp for schedule(dynamic, 4)
+        for (int i = 0; i < height; i++)
+        {
+            unsigned char *out = PGM_VIEW_ROW(dst, unsigned char, i + offset) + offset;
+
+            for (int j = 0; j < width; j += NETWORK_LANES)
+            {
+                int used = width - j < NETWORK_LANES ? width - j : NETWORK_LANES;
+
+                for (int m = 0; m < filter_size; m++)
+                {
+                    const unsigned char *row = PGM_VIEW_ROW(src, unsigned char, i + m) + j;
+                    for (int n = 0; n < filter_size; n++)
+                    {
+                        memcpy(lanes[m * filter_size + n], row + n, used);
+                    }
+                }
+                memset(lanes[count], 255, (size_t)(inputs - count) * NETWORK_LANES);
+
+                for (const comparator *c = network; c->low != c->high; c++)
+                {
+                    unsigned char *low = lanes[c->low], *high = lanes[c->high];
+#pragma omp simd
+                    for (int l = 0; l < NETWORK_LANES; l++)
+                    {
+                        unsigned char a = low[l], b = high[l];
+                        low[l] = a < b ? a : b;
+                        high[l] = a < b ? b : a;
+                    }
+                }
+
+                memcpy(out + j, lanes[count / 2], used);
+            }
+        }
+
+        free(lanes);
+    }
+
+    free(network);
+}
+
+/**
+ * @brief Median filter with a sliding histogram (Huang, Yang and Tang, 1979)
+ *        Each row starts with the histogram of its first window, then every step right removes the
+ *          column leaving the window and adds the one entering it, 2 * filter_size updates per pixel
+ *        The median moves little between neighbours, it is found again from the previous one
+ *          with the count of values below it
+ *        Rows are spread over choice.threads threads
+ * 
+ * @param src 
+ * @param dst prepared by filter_prepare_output()
+ * @param filter_size 
+ * @param offset of the first filtered pixel in dst
+ * @param choice 
+ */
+void median_histogram(const PGM_view *src, const PGM_view *dst, int filter_size, int offset, tune_choice choice)
+{
+    int half = filter_size * filter_size / 2;
+    int width = src->width - filter_size + 1, height = src->height - filter_size + 1;
+
+#pragma omp parallel for num_threads(tune_threads(choice)) schedule(dynamic, 4)
+    for (int i = 0; i < height; i++)
+    {
+        unsigned char *out = PGM_VIEW_ROW(dst, unsigned char, i + offset) + offset;
+        unsigned int histogram[256] = {0};
+        int median = 0, below = 0;
+
+        for (int m = 0; m < filter_size; m++)
+        {
+            const unsigned char *row = PGM_VIEW_ROW(src, unsigned char, i + m);
+            for (int n = 0; n < filter_size; n++)
+            {
+                histogram[row[n]]++;
+            }
+        }
+
+        for (int j = 0; j < width; j++)
+        {
+            if (j > 0)
+            {
+                for (int m = 0; m < filter_size; m++)
+                {
+                    const unsigned char *row = PGM_VIEW_ROW(src, unsigned char, i + m);
+                    unsigned char leaving = row[j - 1], entering = row[j + filter_size - 1];
+                    histogram[leaving]--;
+                    histogram[entering]++;
+                    below += (entering < median) - (leaving < median);
+                }
+            }
+
+            // below counts the values under median, the median is the value at position half once sorted
+            while (below > half)
+            {
+                median--;
+                below -= histogram[median];
+            }
+            while (below + (int)histogram[median] <= half)
+            {
+                below += histogram[median];
+                median++;
+            }
+            out[j] = (unsigned char)median;
+        }
+    }
+}
+
+/**
+ * @brief Average filter with running sums
+ *        Bands of choice.tile output rows are spread over the threads, a band keeps the sum of the
+ *          filter_size rows of its window in every column, adding the row that enters and removing
+ *          the one that leaves, and each output row slides a horizontal sum over these column sums
+ *        The sums are exact integers, so the truncated mean is the one of filter_average_variant()
+ * 
+ * @param src 
+ * @param dst prepared by filter_prepare_output()
+ * @param filter_size 
+ * @param offset of the first filtered pixel in dst
+ * @param choice 
+ */
+void average_running(const PGM_view *src, const PGM_view *dst, int filter_size, int offset, tune_choice choice)
+{
+    int area = filter_size * filter_size;
+    int width = src->width - filter_size + 1, height = src->height - filter_size + 1;
+    int band = choice.tile > 0 ? choice.tile : VARIANT_TILE;
+    int bands = (height + band - 1) / band;
+
+#pragma omp parallel num_threads(tune_threads(choice))
+    {
+        unsigned int *column = (unsigned int *)malloc(src->width * sizeof(unsigned int));
+        if (column == NULL)
+        {
+            fprintf(stderr, "Error: filter_average() failed to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+
+#pragma omp for schedule(static)
+        for (int b = 0; b < bands; b++)
+        {
+            int i0 = b * band, i1 = i0 + band < height ? i0 + band : height;
+
+            memset(column, 0, src->width * sizeof(unsigned int));
+            for (int m = 0; m < filter_size - 1; m++)
+            {
+                const unsigned char *row = PGM_VIEW_ROW(src, unsigned char, i0 + m);
+#pragma omp simd
+                for (int x = 0; x < src->width; x++)
+                {
+                    column[x] += row[x];
+                }
+            }
+
+            for (int i = i0; i < i1; i++)
+            {
+                const unsigned char *entering = PGM_VIEW_ROW(src, unsigned char, i + filter_size - 1);
+                unsigned char *out = PGM_VIEW_ROW(dst, unsigned char, i + offset) + offset;
+                unsigned int sum = 0;
+
+#pragma omp simd
+                for (int x = 0; x < src->width; x++)
+                {
+                    column[x] += entering[x];
+                }
+
+                for (int x = 0; x < filter_size; x++)
+                {
+                    sum += column[x];
+                }
+                out[0] = (unsigned char)(sum / area);
+                for (int j = 1; j < width; j++)
+                {
+                    sum += column[j + filter_size - 1] - column[j - 1];
+                    out[j] = (unsigned char)(sum / area);
+                }
+
+                const unsigned char *leaving = PGM_VIEW_ROW(src, unsigned char, i);
+#pragma omp simd
+                for (int x = 0; x < src->width; x++)
+                {
+                    column[x] -= leaving[x];
+                }
+            }
+        }
+
+        free(column);
+    }
+}
+
+typedef struct
+{
+    int max;
+    int first_record;
+    int min;
+} sobel_range;
+
+/**
+ * @brief Follow the running maximum and minimum of one gradient the way filter_sobel_variant() does
+ *        A value above the running maximum only updates the maximum, so it never becomes the minimum
+ *          even when it is the smallest value seen so far
+ * 
+ * @param range 
+ * @param value 
+ */
+static void sobel_range_add(sobel_range *range, int value)
+{
+    if (value > range->max)
+    {
+        if (range->first_record == INT_MAX)
+        {
+            range->first_record = value;
+        }
+        range->max = value;
+    }
+    else if (value < range->min)
+    {
+        range->min = value;
+    }
+}
+
+/**
+ * @brief Sobel filter on bands of choice.tile rows spread over the threads
+ *        Gradients are exact integers, kept in 16 bits
+ *        The serial version updates the minimum only with values that do not raise the running maximum,
+ *          which depends on everything scanned before. Each band tracks its own range from 0, the start
+ *          of the serial maximum DBL_MIN for integers, and its first value above 0: once the band
+ *          ranges are merged in order, band values above 0 that did not raise the maximum of the earlier
+ *          bands are added to the minimum, and the smallest of them is that first value
+ *        The result is identical to the serial version
+ * 
+ * @param src 
+ * @param dst prepared by filter_prepare_output()
+ * @param offset of the first filtered pixel in dst
+ * @param choice 
+ */
+void sobel_bands(const PGM_view *src, const PGM_view *dst, int offset, tune_choice choice)
+{
+    int width = src->width - 2, height = src->height - 2;
+    int band = choice.tile > 0 ? choice.tile : VARIANT_TILE;
+    int bands = (height + band - 1) / band;
+    int x_max = 0, x_min = INT_MAX, y_max = 0, y_min = INT_MAX;
+    double x_high, x_low, y_high, y_low;
+    short *gradient_x = (short *)malloc((size_t)width * height * sizeof(short));
+    short *gradient_y = (short *)malloc((size_t)width * height * sizeof(short));
+    sobel_range *ranges = (sobel_range *)malloc(2 * bands * sizeof(sobel_range));
+
+    if (gradient_x == NULL || gradient_y == NULL || ranges == NULL)
+    {
+        fprintf(stderr, "Error: filter_sobel() failed to allocate memory for gradients\n");
+        exit(EXIT_FAILURE);
+    }
+
+#pragma omp parallel for num_threads(tune_threads(choice)) schedule(static)
+    for (int b = 0; b < bands; b++)
+    {
+        int i0 = b * band, i1 = i0 + band < height ? i0 + band : height;
+        sobel_range range_x = {0, INT_MAX, INT_MAX}, range_y = {0, INT_MAX, INT_MAX};
+
+        for (int i = i0; i < i1; i++)
+        {
+            const unsigned char *top = PGM_VIEW_ROW(src, unsigned char, i);
+            const unsigned char *middle = PGM_VIEW_ROW(src, unsigned char, i + 1);
+            const unsigned char *bottom = PGM_VIEW_ROW(src, unsigned char, i + 2);
+            short *row_x = gradient_x + (size_t)i * width;
+            short *row_y = gradient_y + (size_t)i * width;
+
+#pragma omp simd
+            for (int j = 0; j < width; j++)
+            {
+                row_x[j] = (short)(top[j + 2] - top[j] + 2 * (middle[j + 2] - middle[j]) + bottom[j + 2] - bottom[j]);
+                row_y[j] = (short)(bottom[j] + 2 * bottom[j + 1] + bottom[j + 2] - top[j] - 2 * top[j + 1] - top[j + 2]);
+            }
+            for (int j = 0; j < width; j++)
+            {
+                sobel_range_add(&range_x, row_x[j]);
+                sobel_range_add(&range_y, row_y[j]);
+            }
+        }
+
+        ranges[2 * b] = range_x;
+        ranges[2 * b + 1] = range_y;
+    }
+
+    for (int b = 0; b < bands; b++)
+    {
+        const sobel_range *range_x = &ranges[2 * b], *range_y = &ranges[2 * b + 1];
+
+        x_min = range_x->min < x_min ? range_x->min : x_min;
+        x_min = range_x->first_record <= x_max && range_x->first_record < x_min ? range_x->first_record : x_min;
+        x_max = range_x->max > x_max ? range_x->max : x_max;
+        y_min = range_y->min < y_min ? range_y->min : y_min;
+        y_min = range_y->first_record <= y_max && range_y->first_record < y_min ? range_y->first_record : y_min;
+        y_max = range_y->max > y_max ? range_y->max : y_max;
+    }
+
+    x_high = x_max > 0 ? x_max : DBL_MIN;
+    x_low = x_min < INT_MAX ? x_min : DBL_MAX;
+    y_high = y_max > 0 ? y_max : DBL_MIN;
+    y_low = y_min < INT_MAX ? y_min : DBL_MAX;
+
+#pragma omp parallel for num_threads(tune_threads(choice)) schedule(static)
+    for (int i = 0; i < height; i++)
+    {
+        const short *row_x = gradient_x + (size_t)i * width;
+        const short *row_y = gradient_y + (size_t)i * width;
+        unsigned char *out = PGM_VIEW_ROW(dst, unsigned char, i + offset) + offset;
+
+        // Same arithmetic as the serial version, out of range values wrap like its conversions do
+        for (int j = 0; j < width; j++)
+        {
+            unsigned char sobel_x = (unsigned char)(int)((unsigned char)(int)(row_x[j] - x_low) * 255 / (x_high - x_low));
+            unsigned char sobel_y = (unsigned char)(int)((unsigned char)(int)(row_y[j] - y_low) * 255 / (y_high - y_low));
+            out[j] = (unsigned char)(int)(sqrt(pow(sobel_x, 2) + pow(sobel_y, 2)));
+        }
+    }
+
+    free(gradient_x);
+    free(gradient_y);
+    free(ranges);
+}